@@ -0,0 +1,157 @@
+#include <cstdio>
+#include <cstring>
+
+#include "JobSystem.h"
+#include "MicroBenchmark.h"
+#include "SpatialGrid.h"
+
+/*
+ Times the job system's speedup and scheduling cost on 1 to N threads.
+*/
+static void RunJobBenchmark() {
+	std::vector<JobBenchmarkResult> results;
+
+	BenchmarkJobSystem(0, &results);
+	for (size_t i = 0; i < results.size(); i++) {
+		printf("Jobs, %u threads: %.3f ms (%.2fx), %.3f us per empty job, %llu stolen\n",
+			results[i].threads, results[i].milliseconds, results[i].speedup, results[i].overheadMicroseconds, results[i].stolen);
+	}
+}
+
+/*
+ Times spatial queries through the grid against testing every object, on a large
+ and a very large scene.
+
+ @return Whether the grid found the same objects as the linear tests on both
+*/
+static bool RunSpatialBenchmark() {
+	DWORD sizes[2] = { SPATIAL_BENCHMARK_SMALL, SPATIAL_BENCHMARK_LARGE };
+	bool matched = true;
+
+	for (int i = 0; i < 2; i++) {
+		SpatialBenchmarkResult result;
+
+		BenchmarkSpatialGrid(sizes[i], &result);
+		if (!result.matched) {
+			printf("Spatial grid with %u objects found different objects from the linear tests\n", (unsigned)result.objects);
+			matched = false;
+		}
+		printf("Spatial, %u objects in %u cells: build %.1f ms, update %.1f ms\n", (unsigned)result.objects, (unsigned)result.cells, result.build, result.update);
+		printf("Spatial, %u queries: frustum %.1f / %.1f ms, ray %.1f / %.1f ms, sphere %.1f / %.1f ms (grid / linear)\n",
+			(unsigned)SPATIAL_BENCHMARK_QUERIES, result.frustumGrid, result.frustumLinear, result.rayGrid, result.rayLinear, result.sphereGrid, result.sphereLinear);
+	}
+	return matched;
+}
+
+/*
+ Times the core library's hot paths one at a time and checks them against the
+ baseline in the working directory. When there is no baseline yet, this run is
+ saved as one and later runs are checked against it.
+
+ @param saveBaseline - Save this run as the baseline instead of checking against it
+ @return Whether the baseline was read or written, no case regressed and a
+		 Placement did not drift from a rotation
+*/
+static bool RunMicroBenchmarks(bool saveBaseline) {
+	MicroBenchmark suite;
+	CoreMicroBenchmarks core;
+	std::vector<MicroBenchmarkResult> results, baseline;
+	std::string badLine;
+	double nsPerRotation;
+	float drift;
+	unsigned regressions = 0;
+	bool ok = true;
+
+	core.addTo(&suite);
+	suite.run(&results);
+
+	switch (saveBaseline ? BASELINE_MISSING : MicroBenchmark::LoadBaseline(MICROBENCH_BASELINE, &baseline, &badLine)) {
+	case BASELINE_LOADED:
+		regressions = MicroBenchmark::CompareToBaseline(&results, baseline);
+		break;
+	case BASELINE_BAD:
+		printf("Bad micro-benchmark baseline line in %s: %s\n", MICROBENCH_BASELINE, badLine.c_str());
+		ok = false;
+		break;
+	default:
+		if (!MicroBenchmark::SaveBaseline(MICROBENCH_BASELINE, results)) {
+			printf("Could not write the micro-benchmark baseline %s\n", MICROBENCH_BASELINE);
+			ok = false;
+		}
+		else if (!saveBaseline) {
+			printf("Micro-benchmark: no baseline in %s, saved this run as the baseline; later runs are checked against it\n", MICROBENCH_BASELINE);
+		}
+		break;
+	}
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const MicroBenchmarkResult& result = results[i];
+
+		if (result.baselineNsPerOp > 0.0) {
+			printf("%s: %.1f ns/op, %.3f allocations/op, %llu iterations (baseline %.1f ns/op, %+.1f%%)%s\n",
+				result.name.c_str(), result.nsPerOp, result.allocationsPerOp, result.iterations, result.baselineNsPerOp,
+				(result.nsPerOp / result.baselineNsPerOp - 1.0) * 100.0, result.regressed ? " REGRESSED" : "");
+		}
+		else {
+			printf("%s: %.1f ns/op, %.3f allocations/op, %llu iterations\n",
+				result.name.c_str(), result.nsPerOp, result.allocationsPerOp, result.iterations);
+		}
+	}
+
+	if (!CheckRotationDrift(&nsPerRotation, &drift)) {
+		printf("Micro-benchmark: a Placement's world matrix drifted %g from a rotation over %u rotations, more than %g\n",
+			drift, (unsigned)MICROBENCH_DRIFT_ROTATIONS, MICROBENCH_MAX_DRIFT);
+		ok = false;
+	}
+	printf("Placement drift: %u random rotations, %.1f ns per rotation, orthonormality error %g\n",
+		(unsigned)MICROBENCH_DRIFT_ROTATIONS, nsPerRotation, drift);
+
+	if (regressions > 0) {
+		printf("Micro-benchmark: %u of %u cases regressed more than %.0f%% past %s\n",
+			regressions, (unsigned)results.size(), MICROBENCH_THRESHOLD * 100.0, MICROBENCH_BASELINE);
+		ok = false;
+	}
+	return ok;
+}
+
+/*
+ Whether a benchmark was asked for on the command line. Every benchmark is when
+ none is named.
+
+ @param argc - The number of arguments
+ @param argv - The arguments
+ @param name - The benchmark's name
+ @return Whether to run it
+*/
+static bool Wanted(int argc, char** argv, const char* name) {
+	if (argc < 2)
+		return true;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], name) == 0)
+			return true;
+	}
+	return false;
+}
+
+/*
+ Runs the benchmarks named on the command line, or all of them when none are.
+
+ @param argc - The number of arguments
+ @param argv - The benchmarks to run.
+			   jobs times the job system on 1 to N threads
+			   spatial times the spatial grid against linear scans on 100k and 1M objects
+			   micro times the core hot paths and checks them against microbench.baseline
+			   savebaseline with micro saves the run as the new baseline
+ @return 0 when every benchmark that ran checked out, 1 otherwise
+*/
+int main(int argc, char** argv) {
+	bool ok = true;
+
+	if (Wanted(argc, argv, "jobs"))
+		RunJobBenchmark();
+	if (Wanted(argc, argv, "spatial"))
+		ok = RunSpatialBenchmark() && ok;
+	if (Wanted(argc, argv, "micro"))
+		ok = RunMicroBenchmarks(argc > 1 && Wanted(argc, argv, "savebaseline")) && ok;
+	return ok ? 0 : 1;
+}
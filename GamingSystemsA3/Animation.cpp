@@ -0,0 +1,903 @@
+#include "Headers.h"
+#include "Animation.h"
+#include <thread>
+
+//Instances each benchmark job updates.
+#define ANIMATION_JOB_INSTANCES 16
+//Frames and mesh containers in each chunk of the hierarchy's pools.
+#define HIERARCHY_POOL_CHUNK 64
+//Bytes in each block of the arena the hierarchy's names are copied to.
+#define HIERARCHY_NAME_BLOCK 4096
+
+/*
+Builds the frames and mesh containers D3DXLoadMeshHierarchyFromX returns. Only
+the names, transforms, meshes and skin info are kept; AnimatedModel copies what
+it needs out of them and then destroys the hierarchy. Frames and containers
+come from pools and names from an arena, so the whole hierarchy's memory goes
+back in one go when the allocator does.
+*/
+class HierarchyAllocator : public ID3DXAllocateHierarchy {
+private:
+	Pool<D3DXFRAME> frames;
+	Pool<D3DXMESHCONTAINER> containers;
+	LinearArena names;
+
+	/*
+	Copies a name into the hierarchy's arena.
+
+	@param name - The name to copy, or null
+
+	@return - The copy, or null if there was no name
+	*/
+	LPSTR copyName(LPCSTR name) {
+		if (name == NULL)
+			return NULL;
+
+		size_t length = strlen(name) + 1;
+		LPSTR copy = names.allocArray<char>(length);
+		strcpy_s(copy, length, name);
+		return copy;
+	}
+
+public:
+	HierarchyAllocator() :frames(HIERARCHY_POOL_CHUNK, MEMORY_SCENE), containers(HIERARCHY_POOL_CHUNK, MEMORY_SCENE), names(HIERARCHY_NAME_BLOCK, MEMORY_SCENE) {
+	}
+
+	STDMETHOD(CreateFrame)(THIS_ LPCSTR Name, LPD3DXFRAME* ppNewFrame) {
+		LPD3DXFRAME pFrame = frames.allocate();
+
+		ZeroMemory(pFrame, sizeof(D3DXFRAME));
+		pFrame->Name = copyName(Name);
+		D3DXMatrixIdentity(&pFrame->TransformationMatrix);
+		*ppNewFrame = pFrame;
+		return S_OK;
+	}
+
+	STDMETHOD(CreateMeshContainer)(THIS_ LPCSTR Name, const D3DXMESHDATA* pMeshData, const D3DXMATERIAL* pMaterials,
+		const D3DXEFFECTINSTANCE* pEffectInstances, DWORD NumMaterials, const DWORD* pAdjacency,
+		LPD3DXSKININFO pSkinInfo, LPD3DXMESHCONTAINER* ppNewMeshContainer) {
+		LPD3DXMESHCONTAINER pContainer = containers.allocate();
+
+		ZeroMemory(pContainer, sizeof(D3DXMESHCONTAINER));
+		pContainer->Name = copyName(Name);
+
+		// Patch and progressive meshes are not skinned
+		if (pMeshData->Type == D3DXMESHTYPE_MESH) {
+			pContainer->MeshData = *pMeshData;
+			pContainer->MeshData.pMesh->AddRef();
+		}
+		if (pSkinInfo) {
+			pContainer->pSkinInfo = pSkinInfo;
+			pSkinInfo->AddRef();
+		}
+
+		*ppNewMeshContainer = pContainer;
+		return S_OK;
+	}
+
+	// Names stay in the arena until the allocator goes
+	STDMETHOD(DestroyFrame)(THIS_ LPD3DXFRAME pFrameToFree) {
+		frames.free(pFrameToFree);
+		return S_OK;
+	}
+
+	STDMETHOD(DestroyMeshContainer)(THIS_ LPD3DXMESHCONTAINER pMeshContainerToFree) {
+		if (pMeshContainerToFree->MeshData.pMesh)
+			pMeshContainerToFree->MeshData.pMesh->Release();
+		if (pMeshContainerToFree->pSkinInfo)
+			pMeshContainerToFree->pSkinInfo->Release();
+		containers.free(pMeshContainerToFree);
+		return S_OK;
+	}
+};
+
+/*
+Sizes a pose for a skeleton and sets every bone, padding included, to the
+identity so that padding never produces a zero length quaternion.
+
+@param numBones - The number of bones in the skeleton
+*/
+void Pose::resize(DWORD numBones) {
+	groups = (numBones + 3) / 4;
+	channels.assign(POSE_CHANNELS * groups, _mm_setzero_ps());
+	for (DWORD g = 0; g < groups; g++) {
+		channels[POSE_RW * groups + g] = _mm_set1_ps(1.0f);
+		channels[POSE_SX * groups + g] = _mm_set1_ps(1.0f);
+		channels[POSE_SY * groups + g] = _mm_set1_ps(1.0f);
+		channels[POSE_SZ * groups + g] = _mm_set1_ps(1.0f);
+	}
+}
+
+/*
+Writes one bone's transform into a pose laid out as channels.
+
+@param pose - The first float of the pose
+@param groups - The number of __m128 in each channel
+@param bone - The bone to write
+@param scale, rotation, translation - The bone's local transform
+*/
+static void WriteBone(float* pose, DWORD groups, DWORD bone, const D3DXVECTOR3& scale, const D3DXQUATERNION& rotation, const D3DXVECTOR3& translation) {
+	DWORD stride = groups * 4;
+
+	pose[POSE_TX * stride + bone] = translation.x;
+	pose[POSE_TY * stride + bone] = translation.y;
+	pose[POSE_TZ * stride + bone] = translation.z;
+	pose[POSE_RX * stride + bone] = rotation.x;
+	pose[POSE_RY * stride + bone] = rotation.y;
+	pose[POSE_RZ * stride + bone] = rotation.z;
+	pose[POSE_RW * stride + bone] = rotation.w;
+	pose[POSE_SX * stride + bone] = scale.x;
+	pose[POSE_SY * stride + bone] = scale.y;
+	pose[POSE_SZ * stride + bone] = scale.z;
+}
+
+/*
+Adds a bone to a vertex's influences, keeping the heaviest MAX_BONE_INFLUENCES
+in order, heaviest first.
+
+@param influence - The vertex's influences
+@param bone - The palette entry of the bone
+@param weight - How much the bone moves the vertex
+*/
+static void AddInfluence(SkinInfluence* influence, WORD bone, float weight) {
+	int i = MAX_BONE_INFLUENCES - 1;
+
+	if (weight <= influence->weights[i])
+		return;
+
+	for (; i > 0 && influence->weights[i - 1] < weight; i--) {
+		influence->weights[i] = influence->weights[i - 1];
+		influence->bones[i] = influence->bones[i - 1];
+	}
+	influence->weights[i] = weight;
+	influence->bones[i] = bone;
+}
+
+AnimatedModel::AnimatedModel() :maxPartBones(0) {
+	bindPose.resize(0);
+}
+
+/*
+Adds a frame, its siblings and all of their children to the skeleton. Parents
+are always added before their children.
+
+@param pFrame - The first frame to add
+@param parent - The bone of the frames' parent, or -1 for the root
+@param frames - Receives the frame of each bone added
+*/
+void AnimatedModel::addFrame(LPD3DXFRAME pFrame, int parent, std::vector<LPD3DXFRAME>* frames) {
+	for (; pFrame; pFrame = pFrame->pFrameSibling) {
+		int bone = (int)boneNames.size();
+
+		boneNames.push_back(pFrame->Name ? pFrame->Name : "");
+		parents.push_back(parent);
+		frames->push_back(pFrame);
+
+		if (pFrame->pFrameFirstChild)
+			addFrame(pFrame->pFrameFirstChild, bone, frames);
+	}
+}
+
+/*
+Finds a bone by the name of its frame.
+
+@param name - The name to find
+
+@return - The bone, or -1 if no frame has the name
+*/
+int AnimatedModel::findBone(LPCSTR name) {
+	for (DWORD b = 0; name && b < boneNames.size(); b++) {
+		if (boneNames[b] == name)
+			return (int)b;
+	}
+	return -1;
+}
+
+/*
+Copies a mesh into a skinned part. A mesh with skin info keeps its bones'
+offsets and the four heaviest bones of each vertex. A mesh without is bound
+wholly to the frame it hangs from, with an identity offset, since its vertices
+are already in that frame's space.
+
+@param pContainer - The mesh container to copy
+@param bone - The bone of the frame the container hangs from
+@param pDevice - The device to clone the mesh on
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the mesh can not be copied or names a bone that is not in
+		  the hierarchy.
+*/
+int AnimatedModel::addMeshContainer(LPD3DXMESHCONTAINER pContainer, DWORD bone, LPDIRECT3DDEVICE9 pDevice) {
+	SkinnedPart part;
+	LPD3DXMESH pClone = 0;
+	SkinVertex* pVertices = 0;
+	LPD3DXSKININFO pSkin = pContainer->pSkinInfo;
+
+	if (!pContainer->MeshData.pMesh)
+		return S_OK;
+
+	part.name = pContainer->Name ? pContainer->Name : "";
+
+	if (FAILED(pContainer->MeshData.pMesh->CloneMeshFVF(D3DXMESH_SYSTEMMEM, SKIN_FVF, pDevice, &pClone))) {
+		SetError(TEXT("Could not copy mesh %S for skinning"), part.name.c_str());
+		return E_FAIL;
+	}
+	if (FAILED(pClone->LockVertexBuffer(D3DLOCK_READONLY, (void**)&pVertices))) {
+		SetError(TEXT("Could not lock vertex buffer"));
+		pClone->Release();
+		return E_FAIL;
+	}
+	part.vertices.assign(pVertices, pVertices + pClone->GetNumVertices());
+	pClone->UnlockVertexBuffer();
+	pClone->Release();
+
+	SkinInfluence none;
+	ZeroMemory(&none, sizeof(SkinInfluence));
+	part.influences.assign(part.vertices.size(), none);
+
+	if (pSkin && pSkin->GetNumBones() > 0) {
+		std::vector<DWORD> vertices;
+		std::vector<float> weights;
+
+		for (DWORD b = 0; b < pSkin->GetNumBones(); b++) {
+			int skeletonBone = findBone(pSkin->GetBoneName(b));
+			DWORD count = pSkin->GetNumBoneInfluences(b);
+
+			if (skeletonBone < 0) {
+				SetError(TEXT("Mesh %S is skinned to bone %S, which is not in the hierarchy"), part.name.c_str(), pSkin->GetBoneName(b));
+				return E_FAIL;
+			}
+			part.bones.push_back(skeletonBone);
+			part.offsets.push_back(*pSkin->GetBoneOffsetMatrix(b));
+
+			if (count == 0)
+				continue;
+			vertices.resize(count);
+			weights.resize(count);
+			pSkin->GetBoneInfluence(b, &vertices[0], &weights[0]);
+			for (DWORD i = 0; i < count; i++)
+				AddInfluence(&part.influences[vertices[i]], (WORD)b, weights[i]);
+		}
+
+		// Dropping influences past the fourth leaves weights that no longer sum to 1
+		for (DWORD v = 0; v < part.influences.size(); v++) {
+			SkinInfluence& influence = part.influences[v];
+			float total = 0.0f;
+
+			for (int i = 0; i < MAX_BONE_INFLUENCES; i++)
+				total += influence.weights[i];
+			if (total <= 0.0f) {
+				influence.weights[0] = 1.0f;
+				continue;
+			}
+			for (int i = 0; i < MAX_BONE_INFLUENCES; i++)
+				influence.weights[i] /= total;
+		}
+	}
+	else {
+		D3DXMATRIX identity;
+
+		D3DXMatrixIdentity(&identity);
+		part.bones.push_back(bone);
+		part.offsets.push_back(identity);
+		for (DWORD v = 0; v < part.influences.size(); v++)
+			part.influences[v].weights[0] = 1.0f;
+	}
+
+	maxPartBones = max(maxPartBones, (DWORD)part.bones.size());
+	parts.push_back(part);
+	return S_OK;
+}
+
+/*
+Resamples an animation set into a clip at ANIMATION_SAMPLE_RATE. Bones the set
+does not animate keep their bind pose.
+
+@param pSet - The animation set to resample
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+*/
+int AnimatedModel::addAnimationSet(LPD3DXANIMATIONSET pSet) {
+	AnimationClip clip;
+	UINT numAnimations = pSet->GetNumAnimations();
+	std::vector<int> targets(numAnimations);
+	DWORD poseSize = POSE_CHANNELS * bindPose.groups;
+
+	for (UINT a = 0; a < numAnimations; a++) {
+		LPCSTR name = NULL;
+
+		pSet->GetAnimationNameByIndex(a, &name);
+		targets[a] = findBone(name);
+	}
+
+	clip.name = pSet->GetName() ? pSet->GetName() : "";
+	clip.duration = pSet->GetPeriod();
+	clip.numFrames = max(2u, (DWORD)ceil(clip.duration * ANIMATION_SAMPLE_RATE) + 1);
+	clip.frames.resize(clip.numFrames * poseSize);
+
+	for (DWORD f = 0; f < clip.numFrames; f++) {
+		__m128* pFrame = &clip.frames[f * poseSize];
+		double time = clip.duration * f / (clip.numFrames - 1);
+
+		std::copy(bindPose.channels.begin(), bindPose.channels.end(), pFrame);
+		for (UINT a = 0; a < numAnimations; a++) {
+			D3DXVECTOR3 scale, translation;
+			D3DXQUATERNION rotation;
+
+			if (targets[a] < 0)
+				continue;
+			pSet->GetSRT(time, a, &scale, &rotation, &translation);
+			WriteBone((float*)pFrame, bindPose.groups, targets[a], scale, rotation, translation);
+		}
+	}
+
+	LogMessage(TEXT("Animation %S: %.2f s, %u frames"), clip.name.c_str(), clip.duration, clip.numFrames);
+	clips.push_back(clip);
+	return S_OK;
+}
+
+/*
+Loads the frame hierarchy, skinned meshes and animation sets of a .x file.
+
+@param file - The .x file to load
+@param pDevice - The device to load the file with; nothing is kept on it
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the file can not be loaded or a mesh can not be copied.
+*/
+int AnimatedModel::load(LPCWSTR file, LPDIRECT3DDEVICE9 pDevice) {
+	HierarchyAllocator allocator;
+	LPD3DXFRAME pRoot = 0;
+	LPD3DXANIMATIONCONTROLLER pController = 0;
+	std::vector<LPD3DXFRAME> frames;
+	HRESULT r = S_OK;
+
+	cleanup();
+
+	if (FAILED(D3DXLoadMeshHierarchyFromX(file, D3DXMESH_SYSTEMMEM, pDevice, &allocator, NULL, &pRoot, &pController))) {
+		TCHAR text[MAX_PATH];
+		_stprintf_s(text, MAX_PATH, TEXT("..\\%s"), file);
+		// If the file is not in current folder, try parent folder
+		if (FAILED(D3DXLoadMeshHierarchyFromX(text, D3DXMESH_SYSTEMMEM, pDevice, &allocator, NULL, &pRoot, &pController))) {
+			SetError(TEXT("Could not load the hierarchy of %s"), file);
+			return E_FAIL;
+		}
+	}
+
+	addFrame(pRoot, -1, &frames);
+
+	bindPose.resize(boneNames.size());
+	for (DWORD b = 0; b < frames.size(); b++) {
+		D3DXVECTOR3 scale, translation;
+		D3DXQUATERNION rotation;
+
+		D3DXMatrixDecompose(&scale, &rotation, &translation, &frames[b]->TransformationMatrix);
+		WriteBone(bindPose.channel(0), bindPose.groups, b, scale, rotation, translation);
+	}
+
+	// Every bone has to exist before skin info can name them
+	for (DWORD b = 0; b < frames.size() && SUCCEEDED(r); b++) {
+		for (LPD3DXMESHCONTAINER pContainer = frames[b]->pMeshContainer; pContainer && SUCCEEDED(r); pContainer = pContainer->pNextMeshContainer)
+			r = addMeshContainer(pContainer, b, pDevice);
+	}
+
+	if (pController) {
+		for (UINT s = 0; s < pController->GetNumAnimationSets() && SUCCEEDED(r); s++) {
+			LPD3DXANIMATIONSET pSet = 0;
+
+			if (SUCCEEDED(pController->GetAnimationSet(s, &pSet))) {
+				r = addAnimationSet(pSet);
+				pSet->Release();
+			}
+		}
+		pController->Release();
+	}
+
+	D3DXFrameDestroy(pRoot, &allocator);
+
+	if (FAILED(r)) {
+		cleanup();
+		return E_FAIL;
+	}
+
+	LogMessage(TEXT("%s: %u bones, %u skinned parts, %u vertices, %u animations"),
+		file, getNumBones(), getNumParts(), getNumVertices(), getNumClips());
+	return S_OK;
+}
+
+/*
+Adds two generated clips for models whose files carry no animation sets, so the
+sampling, blending and skinning paths still have work to do: "Sway" rocks the
+root about its z axis and "Bob" moves every bone up and down out of phase.
+*/
+void AnimatedModel::addProceduralClips() {
+	static const double DURATION = 2.0;
+	DWORD poseSize = POSE_CHANNELS * bindPose.groups;
+	DWORD stride = bindPose.groups * 4;
+	AnimationClip sway, bob;
+
+	sway.name = "Sway";
+	bob.name = "Bob";
+	sway.duration = bob.duration = DURATION;
+	sway.numFrames = bob.numFrames = (DWORD)(DURATION * ANIMATION_SAMPLE_RATE) + 1;
+	sway.frames.resize(sway.numFrames * poseSize);
+	bob.frames.resize(bob.numFrames * poseSize);
+
+	for (DWORD f = 0; f < sway.numFrames; f++) {
+		float phase = 2.0f * D3DX_PI * f / (sway.numFrames - 1);
+		__m128* pSway = &sway.frames[f * poseSize];
+		__m128* pBob = &bob.frames[f * poseSize];
+
+		std::copy(bindPose.channels.begin(), bindPose.channels.end(), pSway);
+		std::copy(bindPose.channels.begin(), bindPose.channels.end(), pBob);
+
+		if (getNumBones() > 0) {
+			float* root = (float*)pSway;
+			D3DXVECTOR3 axis(0.0f, 0.0f, 1.0f);
+			D3DXQUATERNION bind(root[POSE_RX * stride], root[POSE_RY * stride], root[POSE_RZ * stride], root[POSE_RW * stride]);
+			D3DXQUATERNION rock, rotation;
+
+			D3DXQuaternionRotationAxis(&rock, &axis, 0.1f * sinf(phase));
+			D3DXQuaternionMultiply(&rotation, &bind, &rock);
+			root[POSE_RX * stride] = rotation.x;
+			root[POSE_RY * stride] = rotation.y;
+			root[POSE_RZ * stride] = rotation.z;
+			root[POSE_RW * stride] = rotation.w;
+		}
+
+		float* ty = (float*)pBob + POSE_TY * stride;
+		for (DWORD b = 0; b < getNumBones(); b++)
+			ty[b] += 0.05f * sinf(phase + b * 0.5f);
+	}
+
+	clips.push_back(sway);
+	clips.push_back(bob);
+}
+
+void AnimatedModel::cleanup() {
+	boneNames.clear();
+	parents.clear();
+	clips.clear();
+	parts.clear();
+	bindPose.resize(0);
+	maxPartBones = 0;
+}
+
+DWORD AnimatedModel::getNumBones() {
+	return boneNames.size();
+}
+
+DWORD AnimatedModel::getNumClips() {
+	return clips.size();
+}
+
+const AnimationClip& AnimatedModel::getClip(DWORD index) {
+	return clips[index];
+}
+
+DWORD AnimatedModel::getNumParts() {
+	return parts.size();
+}
+
+const SkinnedPart& AnimatedModel::getPart(DWORD index) {
+	return parts[index];
+}
+
+/*
+Counts the vertices skinned for each instance.
+
+@return - The number of vertices in every part
+*/
+DWORD AnimatedModel::getNumVertices() {
+	DWORD total = 0;
+
+	for (DWORD p = 0; p < parts.size(); p++)
+		total += parts[p].vertices.size();
+	return total;
+}
+
+DWORD AnimatedModel::getMaxPartBones() {
+	return maxPartBones;
+}
+
+const Pose& AnimatedModel::getBindPose() {
+	return bindPose;
+}
+
+/*
+Samples a clip, looping, by blending the two resampled poses around the time.
+
+@param clip - The clip to sample
+@param time - The time in seconds; it wraps around the clip's duration
+@param pose - Receives the pose; it must be sized for the skeleton
+*/
+void AnimatedModel::samplePose(DWORD clip, double time, Pose* pose) {
+	const AnimationClip& c = clips[clip];
+	DWORD poseSize = POSE_CHANNELS * pose->groups;
+	double position = 0.0;
+
+	if (c.duration > 0.0) {
+		double wrapped = fmod(time, c.duration);
+		if (wrapped < 0.0)
+			wrapped += c.duration;
+		position = wrapped / c.duration * (c.numFrames - 1);
+	}
+
+	DWORD frame = min((DWORD)position, c.numFrames - 2);
+	BlendPoses(&c.frames[frame * poseSize], &c.frames[(frame + 1) * poseSize], (float)(position - frame), pose->groups, &pose->channels[0]);
+}
+
+/*
+Turns a pose into the model space matrix of every bone. Parents come before
+their children, so one pass down the bone list is enough.
+
+@param pose - The local transforms of the bones
+@param models - Receives one matrix per bone
+*/
+void AnimatedModel::computeModelMatrices(const Pose& pose, D3DXMATRIX* models) {
+	const float* tx = pose.channel(POSE_TX);
+	const float* ty = pose.channel(POSE_TY);
+	const float* tz = pose.channel(POSE_TZ);
+	const float* rx = pose.channel(POSE_RX);
+	const float* ry = pose.channel(POSE_RY);
+	const float* rz = pose.channel(POSE_RZ);
+	const float* rw = pose.channel(POSE_RW);
+	const float* sx = pose.channel(POSE_SX);
+	const float* sy = pose.channel(POSE_SY);
+	const float* sz = pose.channel(POSE_SZ);
+
+	for (DWORD b = 0; b < boneNames.size(); b++) {
+		D3DXQUATERNION rotation(rx[b], ry[b], rz[b], rw[b]);
+		D3DXMATRIX local;
+
+		// Scale, then rotate, then translate
+		D3DXMatrixRotationQuaternion(&local, &rotation);
+		local._11 *= sx[b]; local._12 *= sx[b]; local._13 *= sx[b];
+		local._21 *= sy[b]; local._22 *= sy[b]; local._23 *= sy[b];
+		local._31 *= sz[b]; local._32 *= sz[b]; local._33 *= sz[b];
+		local._41 = tx[b]; local._42 = ty[b]; local._43 = tz[b];
+
+		if (parents[b] < 0)
+			models[b] = local;
+		else
+			D3DXMatrixMultiply(&models[b], &local, &models[parents[b]]);
+	}
+}
+
+/*
+Blends two poses four bones at a time. Translations and scales are interpolated
+linearly; rotations are normalized linear interpolations that take the shorter
+way round, which is close enough to a slerp for the small steps between frames
+and between clips of one model. The output may be either input.
+
+@param a - The pose at weight 0
+@param b - The pose at weight 1
+@param weight - How far to blend from a to b
+@param groups - The number of __m128 in each channel
+@param out - Receives the blended pose
+*/
+void AnimatedModel::BlendPoses(const __m128* a, const __m128* b, float weight, DWORD groups, __m128* out) {
+	static const int linear[] = { POSE_TX, POSE_TY, POSE_TZ, POSE_SX, POSE_SY, POSE_SZ };
+	const __m128 t = _mm_set1_ps(weight);
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	for (int c = 0; c < sizeof(linear) / sizeof(linear[0]); c++) {
+		const __m128* pa = a + linear[c] * groups;
+		const __m128* pb = b + linear[c] * groups;
+		__m128* po = out + linear[c] * groups;
+
+		for (DWORD g = 0; g < groups; g++)
+			po[g] = _mm_add_ps(pa[g], _mm_mul_ps(_mm_sub_ps(pb[g], pa[g]), t));
+	}
+
+	for (DWORD g = 0; g < groups; g++) {
+		__m128 ax = a[POSE_RX * groups + g], ay = a[POSE_RY * groups + g], az = a[POSE_RZ * groups + g], aw = a[POSE_RW * groups + g];
+		__m128 bx = b[POSE_RX * groups + g], by = b[POSE_RY * groups + g], bz = b[POSE_RZ * groups + g], bw = b[POSE_RW * groups + g];
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+
+		// q and -q are the same rotation; flip b onto a's side where the dot is negative
+		__m128 flip = _mm_and_ps(dot, signBit);
+		bx = _mm_xor_ps(bx, flip);
+		by = _mm_xor_ps(by, flip);
+		bz = _mm_xor_ps(bz, flip);
+		bw = _mm_xor_ps(bw, flip);
+
+		__m128 x = _mm_add_ps(ax, _mm_mul_ps(_mm_sub_ps(bx, ax), t));
+		__m128 y = _mm_add_ps(ay, _mm_mul_ps(_mm_sub_ps(by, ay), t));
+		__m128 z = _mm_add_ps(az, _mm_mul_ps(_mm_sub_ps(bz, az), t));
+		__m128 w = _mm_add_ps(aw, _mm_mul_ps(_mm_sub_ps(bw, aw), t));
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w))));
+		__m128 scale = _mm_div_ps(one, length);
+
+		out[POSE_RX * groups + g] = _mm_mul_ps(x, scale);
+		out[POSE_RY * groups + g] = _mm_mul_ps(y, scale);
+		out[POSE_RZ * groups + g] = _mm_mul_ps(z, scale);
+		out[POSE_RW * groups + g] = _mm_mul_ps(w, scale);
+	}
+}
+
+/*
+Builds the skinning palette of a part: each entry takes a bind pose vertex into
+the bone's space and then into model space with the bone's current transform.
+
+@param part - The part to build the palette of
+@param models - The model space matrix of every bone
+@param palette - Receives four rows per palette entry
+*/
+void AnimatedModel::ComputePalette(const SkinnedPart& part, const D3DXMATRIX* models, __m128* palette) {
+	for (DWORD i = 0; i < part.bones.size(); i++) {
+		D3DXMATRIX m;
+
+		D3DXMatrixMultiply(&m, &part.offsets[i], &models[part.bones[i]]);
+		palette[i * 4] = _mm_loadu_ps(&m._11);
+		palette[i * 4 + 1] = _mm_loadu_ps(&m._21);
+		palette[i * 4 + 2] = _mm_loadu_ps(&m._31);
+		palette[i * 4 + 3] = _mm_loadu_ps(&m._41);
+	}
+}
+
+/*
+Skins a part with SSE. The palette rows of a vertex's bones are blended by
+weight, and the position and normal are transformed by the blended rows, four
+components at a time.
+
+@param part - The part to skin
+@param palette - The part's palette from ComputePalette
+@param out - Receives one skinned vertex per bind pose vertex
+*/
+void AnimatedModel::SkinVertices(const SkinnedPart& part, const __m128* palette, SkinVertex* out) {
+	DWORD numVertices = part.vertices.size();
+
+	for (DWORD v = 0; v < numVertices; v++) {
+		const SkinInfluence& influence = part.influences[v];
+		const SkinVertex& src = part.vertices[v];
+		const __m128* m = palette + influence.bones[0] * 4;
+		__m128 w = _mm_set1_ps(influence.weights[0]);
+		__m128 r0 = _mm_mul_ps(m[0], w);
+		__m128 r1 = _mm_mul_ps(m[1], w);
+		__m128 r2 = _mm_mul_ps(m[2], w);
+		__m128 r3 = _mm_mul_ps(m[3], w);
+
+		for (int i = 1; i < MAX_BONE_INFLUENCES && influence.weights[i] > 0.0f; i++) {
+			m = palette + influence.bones[i] * 4;
+			w = _mm_set1_ps(influence.weights[i]);
+			r0 = _mm_add_ps(r0, _mm_mul_ps(m[0], w));
+			r1 = _mm_add_ps(r1, _mm_mul_ps(m[1], w));
+			r2 = _mm_add_ps(r2, _mm_mul_ps(m[2], w));
+			r3 = _mm_add_ps(r3, _mm_mul_ps(m[3], w));
+		}
+
+		__m128 x = _mm_set1_ps(src.normal[0]), y = _mm_set1_ps(src.normal[1]), z = _mm_set1_ps(src.normal[2]);
+		__m128 normal = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, r0), _mm_mul_ps(y, r1)), _mm_mul_ps(z, r2));
+		x = _mm_set1_ps(src.position[0]);
+		y = _mm_set1_ps(src.position[1]);
+		z = _mm_set1_ps(src.position[2]);
+		__m128 position = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, r0), _mm_mul_ps(y, r1)), _mm_add_ps(_mm_mul_ps(z, r2), r3));
+
+		// Each store spills a fourth float into the next field, so the fields are
+		// written in order and the texture coordinate, which is not skinned, last
+		_mm_storeu_ps(out[v].position, position);
+		_mm_storeu_ps(out[v].normal, normal);
+		out[v].uv[0] = src.uv[0];
+		out[v].uv[1] = src.uv[1];
+	}
+}
+
+/*
+Skins a part one vertex at a time with the D3DX vector functions. This is the
+reference SkinVertices is checked and timed against.
+
+@param part - The part to skin
+@param palette - The part's palette from ComputePalette
+@param out - Receives one skinned vertex per bind pose vertex
+*/
+void AnimatedModel::SkinVerticesScalar(const SkinnedPart& part, const __m128* palette, SkinVertex* out) {
+	for (DWORD v = 0; v < part.vertices.size(); v++) {
+		const SkinInfluence& influence = part.influences[v];
+		const SkinVertex& src = part.vertices[v];
+		D3DXMATRIX blended;
+		D3DXVECTOR3 position, normal;
+
+		ZeroMemory(&blended, sizeof(D3DXMATRIX));
+		for (int i = 0; i < MAX_BONE_INFLUENCES && influence.weights[i] > 0.0f; i++)
+			blended += *(const D3DXMATRIX*)(palette + influence.bones[i] * 4) * influence.weights[i];
+
+		D3DXVec3TransformCoord(&position, (const D3DXVECTOR3*)src.position, &blended);
+		D3DXVec3TransformNormal(&normal, (const D3DXVECTOR3*)src.normal, &blended);
+		memcpy(out[v].position, &position, sizeof(position));
+		memcpy(out[v].normal, &normal, sizeof(normal));
+		out[v].uv[0] = src.uv[0];
+		out[v].uv[1] = src.uv[1];
+	}
+}
+
+//The buffers one benchmark thread reuses for every instance it updates.
+struct AnimationScratch
+{
+	Pose a, b, blended;
+	std::vector<D3DXMATRIX> models;
+	std::vector<__m128> palette;
+	std::vector<SkinVertex> vertices;
+};
+
+//What every benchmark job reads, and the buffers of each job system thread.
+struct AnimationBenchmark
+{
+	AnimatedModel* model;
+	JobSystem* jobs;
+	double time;
+	bool simd;
+	std::vector<AnimationScratch> scratch; // One per thread
+};
+
+/*
+Sizes a thread's buffers for a model.
+
+@param model - The model the thread will update
+@param scratch - The buffers to size
+*/
+static void InitScratch(AnimatedModel* model, AnimationScratch* scratch) {
+	DWORD maxVertices = 0;
+
+	for (DWORD p = 0; p < model->getNumParts(); p++)
+		maxVertices = max(maxVertices, (DWORD)model->getPart(p).vertices.size());
+
+	scratch->a = model->getBindPose();
+	scratch->b = model->getBindPose();
+	scratch->blended = model->getBindPose();
+	scratch->models.resize(max(1u, model->getNumBones()));
+	scratch->palette.resize(max(1u, model->getMaxPartBones()) * 4);
+	scratch->vertices.resize(max(1u, maxVertices));
+}
+
+/*
+Updates one animated instance: samples two clips at the instance's own time,
+blends them by the instance's own weight, builds the bone matrices and skins
+every part.
+
+@param model - The model the instance is of
+@param instance - The index of the instance, which sets its time offset and blend weight
+@param time - The time of the frame in seconds
+@param simd - Whether to skin with SSE or with the scalar reference
+@param scratch - The calling thread's buffers
+*/
+static void UpdateInstance(AnimatedModel* model, DWORD instance, double time, bool simd, AnimationScratch* scratch) {
+	DWORD numClips = model->getNumClips();
+	double offset = instance * 0.37;
+	float weight = (instance % 8) / 7.0f;
+
+	model->samplePose(0, time + offset, &scratch->a);
+	model->samplePose(1 % numClips, time + offset, &scratch->b);
+	AnimatedModel::BlendPoses(&scratch->a.channels[0], &scratch->b.channels[0], weight, scratch->blended.groups, &scratch->blended.channels[0]);
+	model->computeModelMatrices(scratch->blended, &scratch->models[0]);
+
+	for (DWORD p = 0; p < model->getNumParts(); p++) {
+		const SkinnedPart& part = model->getPart(p);
+
+		AnimatedModel::ComputePalette(part, &scratch->models[0], &scratch->palette[0]);
+		if (simd)
+			AnimatedModel::SkinVertices(part, &scratch->palette[0], &scratch->vertices[0]);
+		else
+			AnimatedModel::SkinVerticesScalar(part, &scratch->palette[0], &scratch->vertices[0]);
+	}
+}
+
+/*
+Updates a run of instances on one of the job system's threads.
+
+@param data - The AnimationBenchmark shared by every job
+@param begin, end - The instances to update
+*/
+static void RunAnimationJobs(void* data, unsigned begin, unsigned end) {
+	AnimationBenchmark* bench = (AnimationBenchmark*)data;
+	AnimationScratch* scratch = &bench->scratch[bench->jobs->getThreadIndex()];
+
+	for (unsigned i = begin; i < end; i++)
+		UpdateInstance(bench->model, i, bench->time, bench->simd, scratch);
+}
+
+/*
+Times ANIMATION_BENCHMARK_FRAMES frames of updating every instance.
+
+@param model - The model to animate
+@param instances - The number of instances
+@param threads - The number of threads to spread the instances over
+@param simd - Whether to skin with SSE or with the scalar reference
+
+@return - The average time of a frame in milliseconds
+*/
+static double TimeAnimation(AnimatedModel* model, DWORD instances, DWORD threads, bool simd) {
+	AnimationBenchmark bench;
+	JobSystem jobs;
+	LARGE_INTEGER start, end, frequency;
+
+	jobs.start(threads);
+	bench.model = model;
+	bench.jobs = &jobs;
+	bench.simd = simd;
+	bench.scratch.resize(jobs.getNumThreads());
+	for (DWORD t = 0; t < bench.scratch.size(); t++)
+		InitScratch(model, &bench.scratch[t]);
+
+	QueryPerformanceCounter(&start);
+	for (DWORD f = 0; f < ANIMATION_BENCHMARK_FRAMES; f++) {
+		bench.time = f / 60.0;
+		jobs.parallelFor(instances, ANIMATION_JOB_INSTANCES, RunAnimationJobs, &bench);
+	}
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+
+	return (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart / ANIMATION_BENCHMARK_FRAMES;
+}
+
+/*
+Measures the animation runtime without opening a window. The model is loaded on
+a null reference device, given generated clips if its file has fewer than two,
+and the SSE skinning is checked against the scalar reference. Then every
+instance is sampled, blended and skinned each frame: with the scalar reference
+on one thread, with SSE on one thread, and with SSE on every hardware thread.
+Frame times and skinned vertex throughput are written to the debug output.
+
+@param file - The .x file to animate
+@param instances - The number of instances updated each frame
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the device can not be created or the model loaded.
+*/
+int BenchmarkAnimation(LPCWSTR file, DWORD instances) {
+	LPDIRECT3D9 pD3D = 0;
+	LPDIRECT3DDEVICE9 pDevice = 0;
+	AnimatedModel model;
+	AnimationScratch scratch;
+	DWORD threads = max(1u, std::thread::hardware_concurrency());
+	float maxError = 0.0f;
+	HRESULT r;
+
+	if (FAILED(CreateNullDevice(&pD3D, &pDevice)))
+		return E_FAIL;
+	r = model.load(file, pDevice);
+	pDevice->Release();
+	pD3D->Release();
+	if (FAILED(r))
+		return E_FAIL;
+
+	if (model.getNumClips() < 2) {
+		LogMessage(TEXT("%s has %u animations, adding generated ones"), file, model.getNumClips());
+		model.addProceduralClips();
+	}
+
+	// SSE and scalar skinning of one blended pose must agree
+	InitScratch(&model, &scratch);
+	model.samplePose(0, 0.5, &scratch.a);
+	model.samplePose(1, 0.5, &scratch.b);
+	AnimatedModel::BlendPoses(&scratch.a.channels[0], &scratch.b.channels[0], 0.5f, scratch.blended.groups, &scratch.blended.channels[0]);
+	model.computeModelMatrices(scratch.blended, &scratch.models[0]);
+	for (DWORD p = 0; p < model.getNumParts(); p++) {
+		const SkinnedPart& part = model.getPart(p);
+		std::vector<SkinVertex> reference(part.vertices.size());
+
+		AnimatedModel::ComputePalette(part, &scratch.models[0], &scratch.palette[0]);
+		AnimatedModel::SkinVertices(part, &scratch.palette[0], &scratch.vertices[0]);
+		AnimatedModel::SkinVerticesScalar(part, &scratch.palette[0], &reference[0]);
+		for (DWORD v = 0; v < part.vertices.size(); v++) {
+			for (int i = 0; i < 3; i++) {
+				maxError = max(maxError, fabsf(scratch.vertices[v].position[i] - reference[v].position[i]));
+				maxError = max(maxError, fabsf(scratch.vertices[v].normal[i] - reference[v].normal[i]));
+			}
+		}
+	}
+	LogMessage(TEXT("SSE skinning differs from the scalar reference by at most %g"), maxError);
+
+	double vertices = (double)model.getNumVertices() * instances;
+	double scalar = TimeAnimation(&model, instances, 1, false);
+	double simd = TimeAnimation(&model, instances, 1, true);
+	double parallel = TimeAnimation(&model, instances, threads, true);
+
+	LogMessage(TEXT("%u instances, %u vertices each:"), instances, model.getNumVertices());
+	LogMessage(TEXT("  scalar, 1 thread: %.2f ms/frame, %.1f million vertices/s"), scalar, vertices / (scalar * 1000.0));
+	LogMessage(TEXT("  SSE, 1 thread: %.2f ms/frame, %.1f million vertices/s (%.2fx)"), simd, vertices / (simd * 1000.0), scalar / simd);
+	LogMessage(TEXT("  SSE, %u threads: %.2f ms/frame, %.1f million vertices/s (%.2fx)"), threads, parallel, vertices / (parallel * 1000.0), scalar / parallel);
+
+	return S_OK;
+}
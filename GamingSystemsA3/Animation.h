@@ -0,0 +1,121 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "Headers.h"
+#include <xmmintrin.h>
+#include <vector>
+#include <string>
+
+//Rate animation sets are resampled at when they are loaded, in frames per second.
+#define ANIMATION_SAMPLE_RATE 30.0
+//Most bones that move one skinned vertex.
+#define MAX_BONE_INFLUENCES 4
+//Instances the animation benchmark updates each frame.
+#define ANIMATION_BENCHMARK_INSTANCES 1000
+//Frames the animation benchmark times for each configuration.
+#define ANIMATION_BENCHMARK_FRAMES 10
+
+//The channels of a pose, each stored as its own run of floats, one per bone.
+enum PoseChannel { POSE_TX, POSE_TY, POSE_TZ, POSE_RX, POSE_RY, POSE_RZ, POSE_RW, POSE_SX, POSE_SY, POSE_SZ, POSE_CHANNELS };
+
+//Layout of skinned vertices, both the bind pose input and the skinned output.
+#define SKIN_FVF (D3DFVF_XYZ | D3DFVF_NORMAL | D3DFVF_TEX1)
+
+struct SkinVertex
+{
+	float position[3];
+	float normal[3];
+	float uv[2];
+};
+
+//The bones that move a vertex, heaviest first. Unused slots have a weight of 0.
+struct SkinInfluence
+{
+	WORD bones[MAX_BONE_INFLUENCES]; // Indices into the part's bone list
+	float weights[MAX_BONE_INFLUENCES];
+};
+
+/*
+The local transforms of every bone, structure of arrays: each channel holds one
+float per bone, padded with identity bones to a multiple of four so that whole
+poses are blended four bones at a time.
+*/
+struct Pose
+{
+	DWORD groups; // Number of __m128 in each channel
+	std::vector<__m128> channels; // POSE_CHANNELS runs of groups
+
+	void resize(DWORD numBones);
+	float* channel(int c) { return (float*)&channels[c * groups]; }
+	const float* channel(int c) const { return (const float*)&channels[c * groups]; }
+};
+
+//An animation resampled into evenly spaced poses.
+struct AnimationClip
+{
+	std::string name;
+	double duration; // Seconds
+	DWORD numFrames; // The first frame is at 0 and the last at duration
+	std::vector<__m128> frames; // numFrames poses back to back, in the Pose layout
+};
+
+//A mesh bound to the skeleton, copied out of the .x file into system memory.
+struct SkinnedPart
+{
+	std::string name;
+	std::vector<SkinVertex> vertices; // Bind pose
+	std::vector<SkinInfluence> influences; // One per vertex
+	std::vector<DWORD> bones; // Skeleton bone of each palette entry
+	std::vector<D3DXMATRIX> offsets; // Bind pose model space to bone space, per palette entry
+};
+
+/*
+An AnimatedModel is the frame hierarchy, skinned meshes and animations of a .x
+file. Frames become the bones of a skeleton, sorted so parents come before their
+children. Animation sets are resampled at ANIMATION_SAMPLE_RATE so sampling a
+clip at any time is a blend of two neighbouring poses. Meshes with skin info are
+bound to their bones; meshes without are bound rigidly to their frame.
+
+The model holds no per-instance state. Each instance samples and blends into its
+own Pose, turns it into matrices and skins into its own vertices, so any number
+of instances can be updated on different threads at once.
+*/
+class AnimatedModel {
+private:
+	std::vector<std::string> boneNames;
+	std::vector<int> parents; // -1 for the root
+	Pose bindPose;
+	std::vector<AnimationClip> clips;
+	std::vector<SkinnedPart> parts;
+	DWORD maxPartBones;
+
+	void addFrame(LPD3DXFRAME pFrame, int parent, std::vector<LPD3DXFRAME>* frames);
+	int findBone(LPCSTR name);
+	int addMeshContainer(LPD3DXMESHCONTAINER pContainer, DWORD bone, LPDIRECT3DDEVICE9 pDevice);
+	int addAnimationSet(LPD3DXANIMATIONSET pSet);
+
+public:
+	AnimatedModel();
+	int load(LPCWSTR file, LPDIRECT3DDEVICE9 pDevice);
+	void addProceduralClips();
+	void cleanup();
+	DWORD getNumBones();
+	DWORD getNumClips();
+	const AnimationClip& getClip(DWORD);
+	DWORD getNumParts();
+	const SkinnedPart& getPart(DWORD);
+	DWORD getNumVertices();
+	DWORD getMaxPartBones();
+	const Pose& getBindPose();
+	void samplePose(DWORD clip, double time, Pose* pose);
+	void computeModelMatrices(const Pose& pose, D3DXMATRIX* models);
+
+	static void BlendPoses(const __m128* a, const __m128* b, float weight, DWORD groups, __m128* out);
+	static void ComputePalette(const SkinnedPart& part, const D3DXMATRIX* models, __m128* palette);
+	static void SkinVertices(const SkinnedPart& part, const __m128* palette, SkinVertex* out);
+	static void SkinVerticesScalar(const SkinnedPart& part, const __m128* palette, SkinVertex* out);
+};
+
+int BenchmarkAnimation(LPCWSTR file, DWORD instances);
+
+#endif // !ANIMATION_H
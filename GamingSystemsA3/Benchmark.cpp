@@ -0,0 +1,476 @@
+#include "Headers.h"
+#include "Benchmark.h"
+#include <algorithm>
+#include <psapi.h>
+
+Benchmark::Benchmark() :running(false), frames(0), frame(0), lastFrame(0), lastAllocations(0), lastThreadAllocations(0), steadyAllocations(0), steadyThreadAllocations(0), peakStreamedBytes(0) {
+	QueryPerformanceFrequency(&frequency);
+	ZeroMemory(&totals, sizeof(RenderPipelineStats));
+	ZeroMemory(&streaming, sizeof(StreamingStats));
+}
+
+/*
+Builds the path flown when a scene has no .campath file: a loop around the
+models that swings in close and back out, so every detail level is drawn, and
+ends where it started.
+
+@param path - Receives the keys
+*/
+void Benchmark::BuildFlythrough(CameraPath* path) {
+	static const int KEYS = 8;
+	D3DXVECTOR3 target(0.0f, 1.0f, 0.0f), up(0.0f, 1.0f, 0.0f);
+	float duration = BENCHMARK_FRAMES * BENCHMARK_TIME_STEP;
+	Camera camera;
+
+	path->clear();
+	for (int k = 0; k <= KEYS; k++) {
+		float angle = 2.0f * D3DX_PI * k / KEYS;
+		float radius = (k % 2) ? 5.0f : 15.0f;
+		D3DXVECTOR3 eye(-sinf(angle) * radius, 2.0f + (k % 2) * 2.0f, -cosf(angle) * radius);
+
+		camera.lookAt(eye, target, up);
+		path->addKey(duration * k / KEYS, camera);
+	}
+}
+
+/*
+Loads a camera path from a text file with a key on each line, "time x y z qx qy
+qz qw". Blank lines and lines starting with # are skipped.
+
+@param file - The file to load
+@param path - Receives the keys
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the file can not be read or holds no keys.
+*/
+int Benchmark::LoadPath(LPCWSTR file, CameraPath* path) {
+	std::vector<char> data;
+	std::string line;
+
+	if (!ReadWholeFile(file, &data))
+		return E_FAIL;
+
+	std::istringstream text(std::string(data.begin(), data.end()));
+
+	path->clear();
+	while (std::getline(text, line)) {
+		std::istringstream fields(line);
+		float time;
+		D3DXVECTOR3 position;
+		D3DXQUATERNION orientation;
+
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		if (!(fields >> time >> position.x >> position.y >> position.z >> orientation.x >> orientation.y >> orientation.z >> orientation.w)) {
+			SetError(TEXT("Bad camera key in %s: %S"), file, line.c_str());
+			return E_FAIL;
+		}
+		path->addKey(time, position, orientation);
+	}
+
+	return path->getNumKeys() > 0 ? S_OK : E_FAIL;
+}
+
+/*
+Starts a run from the next frame.
+
+@param sceneName - Names the run in the report and picks the camera path file
+@param frameCount - The number of frames to run, including the warm-up
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro. Should never fail;
+		  a scene without a path file flies the built-in loop.
+*/
+int Benchmark::start(LPCWSTR sceneName, DWORD frameCount) {
+	std::wstring pathFile;
+
+	scene = sceneName;
+	pathFile = scene + L".campath";
+	if (FAILED(LoadPath(pathFile.c_str(), &path))) {
+		LogMessage(TEXT("No camera path in %s, flying around the models"), pathFile.c_str());
+		BuildFlythrough(&path);
+	}
+
+	frames = max(frameCount, (DWORD)BENCHMARK_WARMUP_FRAMES + 1);
+	frame = 0;
+	frameTimes.clear();
+	frameTimes.reserve(frames);
+	ZeroMemory(&totals, sizeof(RenderPipelineStats));
+	ZeroMemory(&streaming, sizeof(StreamingStats));
+	peakStreamedBytes = 0;
+	lastFrame = 0;
+	steadyAllocations = steadyThreadAllocations = 0;
+	running = true;
+
+	return S_OK;
+}
+
+bool Benchmark::isRunning() {
+	return running && frame < frames;
+}
+
+bool Benchmark::isFinished() {
+	return running && frame >= frames;
+}
+
+/*
+Places the camera for the next frame.
+
+@param camera - The camera to move along the path
+
+@return - The fixed time step the frame is simulated with
+*/
+float Benchmark::beginFrame(Camera* camera) {
+	path.evaluate(frame * BENCHMARK_TIME_STEP, camera);
+	return BENCHMARK_TIME_STEP;
+}
+
+/*
+Ends a frame once it has been submitted, timing it from the end of the one
+before and counting the heap allocations made during it. Called on the game
+thread.
+*/
+void Benchmark::endFrame() {
+	LARGE_INTEGER now;
+	unsigned long long allocations = GetHeapAllocations();
+	unsigned long long threadAllocations = GetThreadHeapAllocations();
+
+	QueryPerformanceCounter(&now);
+	if (lastFrame != 0 && frame >= BENCHMARK_WARMUP_FRAMES) {
+		frameTimes.push_back((now.QuadPart - lastFrame) * 1000.0 / frequency.QuadPart);
+		steadyAllocations += allocations - lastAllocations;
+		steadyThreadAllocations += threadAllocations - lastThreadAllocations;
+	}
+	lastFrame = now.QuadPart;
+	lastAllocations = allocations;
+	lastThreadAllocations = threadAllocations;
+	frame++;
+}
+
+/*
+Adds the render pipeline's statistics to the run's totals.
+
+@param stats - Statistics taken from the pipeline during the run
+*/
+void Benchmark::addStats(const RenderPipelineStats& stats) {
+	totals.frames += stats.frames;
+	totals.simulateTime += stats.simulateTime;
+	totals.renderTime += stats.renderTime;
+	totals.waitTime += stats.waitTime;
+	totals.latencyTotal += stats.latencyTotal;
+	totals.latencyMax = max(totals.latencyMax, stats.latencyMax);
+	totals.drawCalls += stats.drawCalls;
+	totals.triangles += stats.triangles;
+	totals.stateChanges += stats.stateChanges;
+}
+
+/*
+Adds the streaming manager's statistics to the run's: what it holds now
+replaces what it held before, and the work it has done is summed.
+
+@param stats - Statistics taken from the streaming manager during the run
+*/
+void Benchmark::addStreamingStats(const StreamingStats& stats) {
+	DWORD loads = streaming.loads + stats.loads, trims = streaming.trims + stats.trims;
+	DWORD evictions = streaming.evictions + stats.evictions, reloads = streaming.reloads + stats.reloads;
+	DWORD stalls = streaming.stalls + stats.stalls;
+
+	streaming = stats;
+	streaming.loads = loads;
+	streaming.trims = trims;
+	streaming.evictions = evictions;
+	streaming.reloads = reloads;
+	streaming.stalls = stalls;
+	peakStreamedBytes = max(peakStreamedBytes, stats.bytesResident);
+}
+
+/*
+Writes the run's report as JSON: the frame time distribution, what was drawn
+per frame, where the time went, how much memory the process, the device
+resources, the streamed textures and each memory subsystem use, and the heap
+allocations of the steady-state frames.
+
+@param file - The file to write
+@param residency - Bytes of the device resources the Objects keep resident
+@param headless - Whether the run used the null reference device
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the run has not finished, the file can not be written or the
+		  game thread allocated from the heap after the warm-up.
+*/
+int Benchmark::writeReport(LPCWSTR file, const ResidencyStats& residency, bool headless) {
+	PROCESS_MEMORY_COUNTERS memory;
+	std::vector<double> sorted(frameTimes);
+	std::ostringstream json;
+	char name[MAX_PATH];
+	double total = 0.0, variance = 0.0, mean;
+	double drawn = max(totals.frames, (DWORD)1);
+	size_t count = sorted.size();
+
+	if (!isFinished() || count == 0) {
+		SetError(TEXT("The benchmark has not finished"));
+		return E_FAIL;
+	}
+
+	std::sort(sorted.begin(), sorted.end());
+	for (size_t i = 0; i < count; i++)
+		total += sorted[i];
+	mean = total / count;
+	for (size_t i = 0; i < count; i++)
+		variance += (sorted[i] - mean) * (sorted[i] - mean);
+
+	auto percentile = [&](double p) { return sorted[min(count - 1, (size_t)(p * (count - 1) + 0.5))]; };
+
+	ZeroMemory(&memory, sizeof(memory));
+	GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory));
+	WideCharToMultiByte(CP_UTF8, 0, scene.c_str(), -1, name, MAX_PATH, NULL, NULL);
+
+	json.setf(std::ios::fixed);
+	json.precision(4);
+	json << "{\n";
+	json << "\t\"scene\": \"" << name << "\",\n";
+	json << "\t\"device\": \"" << (headless ? "nullref" : "hal") << "\",\n";
+	json << "\t\"frames\": " << frames << ",\n";
+	json << "\t\"warmupFrames\": " << BENCHMARK_WARMUP_FRAMES << ",\n";
+	json << "\t\"timeStep\": " << BENCHMARK_TIME_STEP << ",\n";
+	json << "\t\"frameTimeMs\": {\n";
+	json << "\t\t\"min\": " << sorted.front() << ",\n";
+	json << "\t\t\"mean\": " << mean << ",\n";
+	json << "\t\t\"median\": " << percentile(0.5) << ",\n";
+	json << "\t\t\"p90\": " << percentile(0.9) << ",\n";
+	json << "\t\t\"p95\": " << percentile(0.95) << ",\n";
+	json << "\t\t\"p99\": " << percentile(0.99) << ",\n";
+	json << "\t\t\"max\": " << sorted.back() << ",\n";
+	json << "\t\t\"stddev\": " << sqrt(variance / count) << "\n";
+	json << "\t},\n";
+	json << "\t\"averageFps\": " << 1000.0 / mean << ",\n";
+	json << "\t\"perFrame\": {\n";
+	json << "\t\t\"drawCalls\": " << totals.drawCalls / drawn << ",\n";
+	json << "\t\t\"triangles\": " << totals.triangles / drawn << ",\n";
+	json << "\t\t\"stateChanges\": " << totals.stateChanges / drawn << ",\n";
+	json << "\t\t\"simulateMs\": " << totals.simulateTime / drawn << ",\n";
+	json << "\t\t\"renderMs\": " << totals.renderTime / drawn << ",\n";
+	json << "\t\t\"waitMs\": " << totals.waitTime / drawn << ",\n";
+	json << "\t\t\"latencyMs\": " << totals.latencyTotal / drawn << ",\n";
+	json << "\t\t\"latencyMaxMs\": " << totals.latencyMax << "\n";
+	json << "\t},\n";
+	json << "\t\"memory\": {\n";
+	json << "\t\t\"workingSetBytes\": " << (unsigned long long)memory.WorkingSetSize << ",\n";
+	json << "\t\t\"peakWorkingSetBytes\": " << (unsigned long long)memory.PeakWorkingSetSize << ",\n";
+	json << "\t\t\"pagefileBytes\": " << (unsigned long long)memory.PagefileUsage << ",\n";
+	json << "\t\t\"vertexBytes\": " << residency.vertexBytes << ",\n";
+	json << "\t\t\"indexBytes\": " << residency.indexBytes << ",\n";
+	json << "\t\t\"textureBytes\": " << residency.textureBytes << ",\n";
+	json << "\t\t\"managedBytes\": " << residency.managedBytes << ",\n";
+	json << "\t\t\"defaultBytes\": " << residency.defaultBytes << ",\n";
+	json << "\t\t\"systemBytes\": " << residency.systemBytes << ",\n";
+	json << "\t\t\"streaming\": { \"textures\": " << streaming.textures << ", \"resident\": " << streaming.resident
+		<< ", \"budget\": " << streaming.budget << ", \"bytesResident\": " << streaming.bytesResident
+		<< ", \"peakBytesResident\": " << peakStreamedBytes << ", \"bytesInFlight\": " << streaming.bytesInFlight
+		<< ", \"loads\": " << streaming.loads << ", \"trims\": " << streaming.trims << ", \"evictions\": " << streaming.evictions
+		<< ", \"stalls\": " << streaming.stalls << " },\n";
+	for (int t = 0; t < MEMORY_TAG_COUNT; t++) {
+		MemoryCounters counters;
+		char tagName[32];
+
+		GetMemoryCounters((MemoryTag)t, &counters);
+		WideCharToMultiByte(CP_UTF8, 0, GetMemoryTagName((MemoryTag)t), -1, tagName, sizeof(tagName), NULL, NULL);
+		json << "\t\t\"" << tagName << "\": { \"bytes\": " << counters.bytes << ", \"peakBytes\": " << counters.peakBytes
+			<< ", \"allocations\": " << counters.allocations << ", \"frees\": " << counters.frees << " },\n";
+	}
+	json << "\t\t\"steadyStateHeapAllocations\": " << steadyThreadAllocations << ",\n";
+	json << "\t\t\"steadyStateHeapAllocationsAllThreads\": " << steadyAllocations << "\n";
+	json << "\t}\n";
+	json << "}\n";
+
+	std::string report = json.str();
+	if (!WriteWholeFile(file, report.c_str(), report.size())) {
+		SetError(TEXT("Could not write the benchmark report %s"), file);
+		return E_FAIL;
+	}
+
+	LogMessage(TEXT("Benchmark %s: %u frames, %.3f ms mean, %.3f ms p99, %.0f draw calls and %.0f triangles per frame, report in %s"),
+		scene.c_str(), frames, mean, percentile(0.99), totals.drawCalls / drawn, totals.triangles / drawn, file);
+
+	if (steadyThreadAllocations > 0) {
+		SetError(TEXT("Benchmark %s: the game thread made %llu heap allocations after the warm-up, expected none"), scene.c_str(), steadyThreadAllocations);
+		return E_FAIL;
+	}
+	return S_OK;
+}
+
+//A mesh file loaded by one micro-benchmark case.
+struct MeshFixture
+{
+	LPDIRECT3DDEVICE9 pDevice;
+	std::wstring file;
+};
+
+//A texture file decoded by one micro-benchmark case, read into memory up front so the disk is not timed.
+struct TextureFixture
+{
+	LPDIRECT3DDEVICE9 pDevice;
+	std::vector<char> data;
+};
+
+// Written by the D3DX cases so the optimizer can not drop the work being timed
+static volatile float microSink;
+
+/*
+Finds the files in the working directory that match a pattern.
+
+@param pattern - The files to find, such as *.x
+@param names - Receives the file names
+*/
+static void FindShippedFiles(LPCWSTR pattern, std::vector<std::wstring>* names) {
+	WIN32_FIND_DATA found;
+	HANDLE find = FindFirstFile(pattern, &found);
+
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+	do {
+		names->push_back(found.cFileName);
+	} while (FindNextFile(find, &found));
+	FindClose(find);
+}
+
+static void LoadMesh(void* data, unsigned long long iterations) {
+	MeshFixture* fixture = (MeshFixture*)data;
+
+	for (unsigned long long i = 0; i < iterations; i++) {
+		LPD3DXMESH pMesh = 0;
+
+		if (SUCCEEDED(D3DXLoadMeshFromX(fixture->file.c_str(), D3DXMESH_SYSTEMMEM, fixture->pDevice, NULL, NULL, NULL, NULL, &pMesh))) {
+			microSink = (float)pMesh->GetNumFaces();
+			pMesh->Release();
+		}
+	}
+}
+
+static void DecodeTexture(void* data, unsigned long long iterations) {
+	TextureFixture* fixture = (TextureFixture*)data;
+
+	// The scratch pool decodes into system memory without needing the device to support the format
+	for (unsigned long long i = 0; i < iterations; i++) {
+		LPDIRECT3DTEXTURE9 pTexture = 0;
+
+		if (SUCCEEDED(D3DXCreateTextureFromFileInMemoryEx(fixture->pDevice, &fixture->data[0], fixture->data.size(),
+			D3DX_DEFAULT, D3DX_DEFAULT, D3DX_DEFAULT, 0, D3DFMT_UNKNOWN, D3DPOOL_SCRATCH,
+			D3DX_DEFAULT, D3DX_DEFAULT, 0, NULL, NULL, &pTexture))) {
+			microSink = (float)pTexture->GetLevelCount();
+			pTexture->Release();
+		}
+	}
+}
+
+/*
+Runs the micro-benchmark suite on a null reference device without opening a
+window: the core cases, then loading every .x mesh and decoding every .dds
+texture shipped next to the executable. Writes each case's time and allocations
+per operation to the debug output and checks them against the baseline. When
+there is no baseline yet, this run is saved as one and later runs are checked
+against it.
+
+@param baselineFile - The baseline to check against, or to write
+@param saveBaseline - Save this run as the baseline instead of checking against it
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the device can not be created, the baseline can not be
+		  read or saved, a case regressed past the threshold, or a Placement
+		  drifted from a rotation.
+*/
+int RunMicroBenchmarks(const char* baselineFile, bool saveBaseline) {
+	LPDIRECT3D9 pD3D = 0;
+	LPDIRECT3DDEVICE9 pDevice = 0;
+	MicroBenchmark suite;
+	CoreMicroBenchmarks core;
+	std::vector<MicroBenchmarkResult> results, baseline;
+	std::vector<std::wstring> meshFiles, textureFiles;
+	std::vector<MeshFixture> meshes;
+	std::vector<TextureFixture> textures;
+	std::string badLine;
+	double nsPerRotation;
+	float drift;
+	HRESULT r = S_OK;
+	unsigned regressions = 0;
+
+	if (FAILED(CreateNullDevice(&pD3D, &pDevice)))
+		return E_FAIL;
+
+	core.addTo(&suite);
+
+	// The fixtures are all in place before any case points at one
+	FindShippedFiles(TEXT("*.x"), &meshFiles);
+	FindShippedFiles(TEXT("*.dds"), &textureFiles);
+	meshes.resize(meshFiles.size());
+	textures.resize(textureFiles.size());
+
+	for (size_t i = 0; i < meshFiles.size(); i++) {
+		meshes[i].pDevice = pDevice;
+		meshes[i].file = meshFiles[i];
+		suite.add(std::string("D3DXLoadMeshFromX/") + (LPCSTR)CW2A(meshFiles[i].c_str()), LoadMesh, &meshes[i]);
+	}
+
+	for (size_t i = 0; i < textureFiles.size(); i++) {
+		textures[i].pDevice = pDevice;
+		if (!ReadWholeFile(textureFiles[i].c_str(), &textures[i].data) || textures[i].data.empty()) {
+			LogMessage(TEXT("Micro-benchmark: could not read %s, skipping it"), textureFiles[i].c_str());
+			continue;
+		}
+		suite.add(std::string("D3DXCreateTextureFromFileInMemoryEx/") + (LPCSTR)CW2A(textureFiles[i].c_str()), DecodeTexture, &textures[i]);
+	}
+
+	suite.run(&results);
+
+	switch (saveBaseline ? BASELINE_MISSING : MicroBenchmark::LoadBaseline(baselineFile, &baseline, &badLine)) {
+	case BASELINE_LOADED:
+		regressions = MicroBenchmark::CompareToBaseline(&results, baseline);
+		break;
+	case BASELINE_BAD:
+		SetError(TEXT("Bad micro-benchmark baseline line in %S: %S"), baselineFile, badLine.c_str());
+		r = E_FAIL;
+		break;
+	default:
+		if (!MicroBenchmark::SaveBaseline(baselineFile, results)) {
+			SetError(TEXT("Could not write the micro-benchmark baseline %S"), baselineFile);
+			r = E_FAIL;
+		}
+		else if (!saveBaseline) {
+			LogMessage(TEXT("Micro-benchmark: no baseline in %S, saved this run as the baseline; later runs are checked against it"), baselineFile);
+		}
+		break;
+	}
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const MicroBenchmarkResult& result = results[i];
+
+		if (result.baselineNsPerOp > 0.0) {
+			LogMessage(TEXT("%S: %.1f ns/op, %.3f allocations/op, %llu iterations (baseline %.1f ns/op, %+.1f%%)%s"),
+				result.name.c_str(), result.nsPerOp, result.allocationsPerOp, result.iterations, result.baselineNsPerOp,
+				(result.nsPerOp / result.baselineNsPerOp - 1.0) * 100.0, result.regressed ? TEXT(" REGRESSED") : TEXT(""));
+		}
+		else {
+			LogMessage(TEXT("%S: %.1f ns/op, %.3f allocations/op, %llu iterations"),
+				result.name.c_str(), result.nsPerOp, result.allocationsPerOp, result.iterations);
+		}
+	}
+
+	if (!CheckRotationDrift(&nsPerRotation, &drift)) {
+		SetError(TEXT("Micro-benchmark: a Placement's world matrix drifted %g from a rotation over %u rotations, more than %g"),
+			drift, MICROBENCH_DRIFT_ROTATIONS, MICROBENCH_MAX_DRIFT);
+		r = E_FAIL;
+	}
+	LogMessage(TEXT("Placement drift: %u random rotations, %.1f ns per rotation, orthonormality error %g"),
+		MICROBENCH_DRIFT_ROTATIONS, nsPerRotation, drift);
+
+	if (regressions > 0) {
+		SetError(TEXT("Micro-benchmark: %u of %u cases regressed more than %.0f%% past %S"),
+			regressions, (DWORD)results.size(), MICROBENCH_THRESHOLD * 100.0, baselineFile);
+		r = E_FAIL;
+	}
+
+	pDevice->Release();
+	pD3D->Release();
+
+	return r;
+}
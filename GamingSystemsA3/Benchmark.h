@@ -0,0 +1,68 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "Headers.h"
+#include <string>
+#include <vector>
+
+//Frames simulated and drawn by a benchmark run.
+#define BENCHMARK_FRAMES 1800
+//Frames at the start left out of the frame time distribution, while caches and the driver settle.
+#define BENCHMARK_WARMUP_FRAMES 60
+//Simulated seconds per frame, fixed so every run shows the same frames.
+#define BENCHMARK_TIME_STEP (1.0f / 60.0f)
+//Scene name used when -benchmark is not followed by one.
+#define BENCHMARK_DEFAULT_SCENE L"default"
+
+/*
+A Benchmark flies the camera along a fixed path for a fixed number of frames,
+each with the same time step, so runs of different builds draw exactly the same
+frames and their reports can be compared. Frame times are taken on the game
+thread, from one submitted frame to the next.
+
+The models' textures are streamed, so the device memory the Objects report
+leaves them out; the report takes them from the streaming manager instead.
+
+Once warmed up a frame should not touch the heap. The game thread's heap
+allocations are counted over the steady-state frames, and a run that made any
+fails.
+
+The path is loaded from <scene>.campath, a text file with a key on each line
+("time x y z qx qy qz qw", # starts a comment); without one a loop around the
+models is flown.
+*/
+class Benchmark {
+private:
+	bool running;
+	std::wstring scene;
+	CameraPath path;
+	DWORD frames; // Frames in the run
+	DWORD frame; // Frames finished so far
+	std::vector<double> frameTimes; // Milliseconds, after the warm-up
+	LARGE_INTEGER frequency;
+	LONGLONG lastFrame;
+	unsigned long long lastAllocations, lastThreadAllocations; // Heap allocations when the last frame ended
+	unsigned long long steadyAllocations; // Made on every thread during the frames after the warm-up
+	unsigned long long steadyThreadAllocations; // Made on the game thread during them
+	RenderPipelineStats totals;
+	StreamingStats streaming; // Latest figures of the streaming manager, with its loads, trims, evictions, reloads and stalls summed over the run
+	unsigned long long peakStreamedBytes; // Most bytes of streamed textures resident when the figures were taken
+
+	static void BuildFlythrough(CameraPath*);
+
+public:
+	Benchmark();
+	int start(LPCWSTR sceneName, DWORD frameCount);
+	bool isRunning();
+	bool isFinished();
+	float beginFrame(Camera* camera);
+	void endFrame();
+	void addStats(const RenderPipelineStats&);
+	void addStreamingStats(const StreamingStats&);
+	int writeReport(LPCWSTR file, const ResidencyStats& residency, bool headless);
+	static int LoadPath(LPCWSTR file, CameraPath* path);
+};
+
+int RunMicroBenchmarks(const char* baselineFile, bool saveBaseline);
+
+#endif // !BENCHMARK_H
@@ -1,111 +1,250 @@
-#include "Headers.h"
+#include "Camera.h"
 
-Camera::Camera() {
+Camera::Camera() : _cameraType(AIRCRAFT) {
 	_pos = D3DXVECTOR3(0.0f, 0.0f, -5.0f);
-	_right = D3DXVECTOR3(1.0f, 0.0f, 0.0f);
-	_up = D3DXVECTOR3(0.0f, 1.0f, 0.0f);
-	_look = D3DXVECTOR3(0.0f, 0.0f, 1.0f);
+	D3DXQuaternionIdentity(&_orientation);
+	_axesDirty = _viewDirty = true;
 }
 
 Camera::Camera(CameraType cameraType) : _cameraType(cameraType) {
 	_pos = D3DXVECTOR3(0.0f, 0.0f, -15.0f);
-	_right = D3DXVECTOR3(1.0f, 0.0f, 0.0f);
-	_up = D3DXVECTOR3(0.0f, 1.0f, 0.0f);
-	_look = D3DXVECTOR3(0.0f, 0.0f, 1.0f);
+	D3DXQuaternionIdentity(&_orientation);
+	_axesDirty = _viewDirty = true;
 }
 
 Camera::~Camera() {}
 
+/*
+Reads the right, up and look axes out of the orientation. They are the rows of
+the quaternion's rotation matrix, computed here without building the matrix.
+*/
+void Camera::updateAxes()
+{
+	const D3DXQUATERNION& q = _orientation;
+	float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+	_right = D3DXVECTOR3(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy));
+	_up = D3DXVECTOR3(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx));
+	_look = D3DXVECTOR3(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy));
+	_axesDirty = false;
+}
+
+/*
+Gets the view matrix, rebuilding it only if the camera moved or turned since
+the last call.
+
+@param V - Receives the view matrix
+*/
 void Camera::getViewMatrix(D3DXMATRIX* V)
 {
-	// Keep camera's axes orthogonal to each other:
-	D3DXVec3Normalize(&_look, &_look);
-	D3DXVec3Cross(&_up, &_look, &_right);
-	D3DXVec3Normalize(&_up, &_up);
-	D3DXVec3Cross(&_right, &_up, &_look);
-	D3DXVec3Normalize(&_right, &_right);
-	// Build the view matrix:
-	float x = -D3DXVec3Dot(&_right, &_pos);
-	float y = -D3DXVec3Dot(&_up, &_pos);
-	float z = -D3DXVec3Dot(&_look, &_pos);
-	(*V)(0, 0) = _right.x;
-	(*V)(0, 1) = _up.x;
-	(*V)(0, 2) = _look.x;
-	(*V)(0, 3) = 0.0f;
-	(*V)(1, 0) = _right.y;
-	(*V)(1, 1) = _up.y;
-	(*V)(1, 2) = _look.y;
-	(*V)(1, 3) = 0.0f;
-	(*V)(2, 0) = _right.z;
-	(*V)(2, 1) = _up.z;
-	(*V)(2, 2) = _look.z;
-	(*V)(2, 3) = 0.0f;
-	(*V)(3, 0) = x;
-	(*V)(3, 1) = y;
-	(*V)(3, 2) = z;
-	(*V)(3, 3) = 1.0f;
+	if (_viewDirty) {
+		if (_axesDirty)
+			updateAxes();
+
+		float x = -D3DXVec3Dot(&_right, &_pos);
+		float y = -D3DXVec3Dot(&_up, &_pos);
+		float z = -D3DXVec3Dot(&_look, &_pos);
+		_view(0, 0) = _right.x;
+		_view(0, 1) = _up.x;
+		_view(0, 2) = _look.x;
+		_view(0, 3) = 0.0f;
+		_view(1, 0) = _right.y;
+		_view(1, 1) = _up.y;
+		_view(1, 2) = _look.y;
+		_view(1, 3) = 0.0f;
+		_view(2, 0) = _right.z;
+		_view(2, 1) = _up.z;
+		_view(2, 2) = _look.z;
+		_view(2, 3) = 0.0f;
+		_view(3, 0) = x;
+		_view(3, 1) = y;
+		_view(3, 2) = z;
+		_view(3, 3) = 1.0f;
+		_viewDirty = false;
+	}
+
+	*V = _view;
+}
+
+/*
+Turns the camera about an axis. A local axis is one of the camera's own axes
+and is applied before the orientation; a world axis is applied after it. The
+quaternion is renormalized so rounding can not build up.
+
+@param axis - The axis, in camera space if local and world space otherwise
+@param angle - The angle in radians
+@param local - Whether the axis is in camera space
+*/
+void Camera::turn(const D3DXVECTOR3& axis, float angle, bool local)
+{
+	D3DXQUATERNION rotation;
+
+	D3DXQuaternionRotationAxis(&rotation, &axis, angle);
+	if (local)
+		D3DXQuaternionMultiply(&_orientation, &rotation, &_orientation);
+	else
+		D3DXQuaternionMultiply(&_orientation, &_orientation, &rotation);
+	D3DXQuaternionNormalize(&_orientation, &_orientation);
+
+	_axesDirty = _viewDirty = true;
 }
 
 void Camera::pitch(float angle)
 {
-	D3DXMATRIX T;
-	D3DXMatrixRotationAxis(&T, &_right, angle);
-
 	// rotate _up and _look around _right vector
-	D3DXVec3TransformCoord(&_up, &_up, &T);
-	D3DXVec3TransformCoord(&_look, &_look, &T);
+	turn(D3DXVECTOR3(1.0f, 0.0f, 0.0f), angle, true);
 }
 
 void Camera::yaw(float angle)
 {
-	D3DXMATRIX T;
-
 	// rotate around world y (0, 1, 0) always for land object
 	if (_cameraType == LANDOBJECT)
-		D3DXMatrixRotationY(&T, angle);
+		turn(D3DXVECTOR3(0.0f, 1.0f, 0.0f), angle, false);
 
 	// rotate around own up vector for aircraft
 	if (_cameraType == AIRCRAFT)
-		D3DXMatrixRotationAxis(&T, &_up, angle);
-
-	// rotate _right and _look around _up or y-axis
-	D3DXVec3TransformCoord(&_right, &_right, &T);
-	D3DXVec3TransformCoord(&_look, &_look, &T);
+		turn(D3DXVECTOR3(0.0f, 1.0f, 0.0f), angle, true);
 }
 
 void Camera::roll(float angle)
 {
 	// only roll for aircraft type
 	if (_cameraType == AIRCRAFT)
-	{
-		D3DXMATRIX T;
-		D3DXMatrixRotationAxis(&T, &_look, angle);
-
-		// rotate _up and _right around _look vector
-		D3DXVec3TransformCoord(&_right, &_right, &T);
-		D3DXVec3TransformCoord(&_up, &_up, &T);
-	}
+		turn(D3DXVECTOR3(0.0f, 0.0f, 1.0f), angle, true);
 }
 
 void Camera::walk(float units)
 {
+	if (_axesDirty)
+		updateAxes();
+
 	// move only on xz plane for land object
 	if (_cameraType == LANDOBJECT)
 		_pos += D3DXVECTOR3(_look.x, 0.0f, _look.z) * units;
 	if (_cameraType == AIRCRAFT)
 		_pos += _look * units;
+	_viewDirty = true;
 }
 void Camera::strafe(float units)
 {
+	if (_axesDirty)
+		updateAxes();
+
 	// move only on xz plane for land object
 	if (_cameraType == LANDOBJECT)
 		_pos += D3DXVECTOR3(_right.x, 0.0f, _right.z) * units;
 	if (_cameraType == AIRCRAFT)
 		_pos += _right * units;
+	_viewDirty = true;
 }
 
 void Camera::fly(float units)
 {
-	if (_cameraType == AIRCRAFT)
+	if (_axesDirty)
+		updateAxes();
+
+	if (_cameraType == AIRCRAFT) {
 		_pos += _up * units;
-}
\ No newline at end of file
+		_viewDirty = true;
+	}
+}
+
+void Camera::setCameraType(CameraType cameraType)
+{
+	_cameraType = cameraType;
+}
+
+void Camera::getPosition(D3DXVECTOR3* pos)
+{
+	*pos = _pos;
+}
+
+void Camera::setPosition(D3DXVECTOR3* pos)
+{
+	_pos = *pos;
+	_viewDirty = true;
+}
+
+void Camera::getRight(D3DXVECTOR3* right)
+{
+	if (_axesDirty)
+		updateAxes();
+	*right = _right;
+}
+
+void Camera::getUp(D3DXVECTOR3* up)
+{
+	if (_axesDirty)
+		updateAxes();
+	*up = _up;
+}
+
+void Camera::getLook(D3DXVECTOR3* look)
+{
+	if (_axesDirty)
+		updateAxes();
+	*look = _look;
+}
+
+void Camera::getOrientation(D3DXQUATERNION* orientation)
+{
+	*orientation = _orientation;
+}
+
+void Camera::setOrientation(const D3DXQUATERNION* orientation)
+{
+	D3DXQuaternionNormalize(&_orientation, orientation);
+	_axesDirty = _viewDirty = true;
+}
+
+/*
+Places the camera at a point looking at another.
+
+@param eye - Where the camera is
+@param target - The point it looks at
+@param worldUp - The direction that should appear up; must not be parallel to the view direction
+*/
+void Camera::lookAt(const D3DXVECTOR3& eye, const D3DXVECTOR3& target, const D3DXVECTOR3& worldUp)
+{
+	D3DXMATRIX axes;
+	D3DXVECTOR3 look = target - eye, right, up;
+
+	D3DXVec3Normalize(&look, &look);
+	D3DXVec3Cross(&right, &worldUp, &look);
+	D3DXVec3Normalize(&right, &right);
+	D3DXVec3Cross(&up, &look, &right);
+
+	D3DXMatrixIdentity(&axes);
+	axes(0, 0) = right.x; axes(0, 1) = right.y; axes(0, 2) = right.z;
+	axes(1, 0) = up.x; axes(1, 1) = up.y; axes(1, 2) = up.z;
+	axes(2, 0) = look.x; axes(2, 1) = look.y; axes(2, 2) = look.z;
+	D3DXQuaternionRotationMatrix(&_orientation, &axes);
+	D3DXQuaternionNormalize(&_orientation, &_orientation);
+
+	_pos = eye;
+	_axesDirty = _viewDirty = true;
+}
+
+/*
+Blends two cameras, moving in a straight line and turning along the shortest
+arc, for cameras that follow another smoothly or cut between two views over
+time.
+
+@param from - The camera at t = 0
+@param to - The camera at t = 1
+@param t - How far from one to the other
+@param out - Receives the blended position and orientation; may be from or to
+*/
+void Camera::Interpolate(Camera& from, Camera& to, float t, Camera* out)
+{
+	D3DXQUATERNION orientation;
+	D3DXVECTOR3 pos;
+
+	D3DXQuaternionSlerp(&orientation, &from._orientation, &to._orientation, t);
+	D3DXVec3Lerp(&pos, &from._pos, &to._pos, t);
+
+	out->setOrientation(&orientation);
+	out->setPosition(&pos);
+}
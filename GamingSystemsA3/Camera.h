@@ -1,8 +1,15 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
-#include "Headers.h"
+// Only math, so it is part of the core library.
+#include "CoreMath.h"
 
+/*
+The camera keeps its orientation as a unit quaternion, so turning it is a
+quaternion multiply and its axes stay orthonormal without being fixed up. The
+axes are read out of the quaternion and the view matrix rebuilt only after the
+camera has moved or turned.
+*/
 class Camera
 {
 public:
@@ -23,12 +30,22 @@ public:
 	void getRight(D3DXVECTOR3* right);
 	void getUp(D3DXVECTOR3* up);
 	void getLook(D3DXVECTOR3* look);
+	void getOrientation(D3DXQUATERNION* orientation);
+	void setOrientation(const D3DXQUATERNION* orientation);
+	void lookAt(const D3DXVECTOR3& eye, const D3DXVECTOR3& target, const D3DXVECTOR3& worldUp);
+	static void Interpolate(Camera& from, Camera& to, float t, Camera* out);
 private:
 	CameraType _cameraType;
-	D3DXVECTOR3 _right;
+	D3DXQUATERNION _orientation; // Turns the camera's local axes into world space
+	D3DXVECTOR3 _pos;
+	D3DXVECTOR3 _right; // Cached axes of _orientation
 	D3DXVECTOR3 _up;
 	D3DXVECTOR3 _look;
-	D3DXVECTOR3 _pos;
+	D3DXMATRIX _view;
+	bool _axesDirty; // _orientation changed since the axes were read out
+	bool _viewDirty; // _orientation or _pos changed since _view was built
+	void turn(const D3DXVECTOR3& axis, float angle, bool local);
+	void updateAxes();
 };
 
 #endif // !CAMERA_H
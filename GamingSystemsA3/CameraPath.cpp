@@ -0,0 +1,111 @@
+#include "CameraPath.h"
+#include <algorithm>
+
+CameraPath::CameraPath() :looped(false) {
+}
+
+void CameraPath::clear() {
+	keys.clear();
+}
+
+/*
+Adds a key after the last one.
+
+@param time - Seconds from the start of the path; must not be before the last key
+@param position - Where the camera is
+@param orientation - Which way the camera faces
+*/
+void CameraPath::addKey(float time, const D3DXVECTOR3& position, const D3DXQUATERNION& orientation) {
+	CameraKey key;
+
+	key.time = time;
+	key.position = position;
+	D3DXQuaternionNormalize(&key.orientation, &orientation);
+
+	// q and -q are the same orientation; keep neighbours on the same side so turns take the short way
+	if (!keys.empty() && D3DXQuaternionDot(&keys.back().orientation, &key.orientation) < 0.0f)
+		key.orientation = -key.orientation;
+
+	keys.push_back(key);
+}
+
+/*
+Adds a key where a camera is now, to record a path by flying it.
+
+@param time - Seconds from the start of the path; must not be before the last key
+@param camera - The camera to copy
+*/
+void CameraPath::addKey(float time, Camera& camera) {
+	D3DXVECTOR3 position;
+	D3DXQUATERNION orientation;
+
+	camera.getPosition(&position);
+	camera.getOrientation(&orientation);
+	addKey(time, position, orientation);
+}
+
+DWORD CameraPath::getNumKeys() {
+	return keys.size();
+}
+
+const CameraKey& CameraPath::getKey(DWORD i) {
+	return keys[i];
+}
+
+/*
+@return - The time of the last key
+*/
+float CameraPath::getDuration() {
+	return keys.empty() ? 0.0f : keys.back().time;
+}
+
+/*
+Sets whether times past the end of the path start it again instead of staying
+on the last key.
+
+@param loop - Whether the path repeats
+*/
+void CameraPath::setLooped(bool loop) {
+	looped = loop;
+}
+
+/*
+Moves a camera to where the path is at a time.
+
+@param time - Seconds from the start of the path
+@param camera - The camera to move
+*/
+void CameraPath::evaluate(float time, Camera* camera) {
+	D3DXVECTOR3 position;
+	D3DXQUATERNION orientation;
+	float duration = getDuration();
+
+	if (keys.empty())
+		return;
+
+	if (looped && duration > 0.0f)
+		time = fmodf(std::max(time, 0.0f), duration);
+
+	if (keys.size() == 1 || time <= keys.front().time) {
+		position = keys.front().position;
+		orientation = keys.front().orientation;
+	}
+	else if (time >= keys.back().time) {
+		position = keys.back().position;
+		orientation = keys.back().orientation;
+	}
+	else {
+		// The segment from key i to key i + 1 holds the time; the spline also needs the keys either side
+		DWORD i = std::upper_bound(keys.begin(), keys.end(), time, [](float t, const CameraKey& key) { return t < key.time; }) - keys.begin() - 1;
+		DWORD before = i > 0 ? i - 1 : 0;
+		DWORD after = std::min(i + 2, (DWORD)keys.size() - 1);
+		float span = keys[i + 1].time - keys[i].time;
+		float s = span > 0.0f ? (time - keys[i].time) / span : 0.0f;
+
+		D3DXVec3CatmullRom(&position, &keys[before].position, &keys[i].position, &keys[i + 1].position, &keys[after].position, s);
+		D3DXQuaternionSlerp(&orientation, &keys[i].orientation, &keys[i + 1].orientation, s);
+	}
+
+	camera->setOrientation(&orientation);
+	camera->setPosition(&position);
+}
@@ -0,0 +1,39 @@
+#ifndef CAMERAPATH_H
+#define CAMERAPATH_H
+
+#include "Camera.h"
+#include "CoreMath.h"
+#include <vector>
+
+//Where the camera is at one time along a path.
+struct CameraKey
+{
+	float time; // Seconds from the start of the path
+	D3DXVECTOR3 position;
+	D3DXQUATERNION orientation;
+};
+
+/*
+A scripted camera path through a list of keys. Positions follow a Catmull-Rom
+spline through the keys and orientations turn between them along the shortest
+arc, so a camera driven by the path passes every key smoothly. Used to fly the
+camera the same way on every run.
+*/
+class CameraPath {
+private:
+	std::vector<CameraKey> keys; // In order of time
+	bool looped;
+
+public:
+	CameraPath();
+	void clear();
+	void addKey(float time, const D3DXVECTOR3& position, const D3DXQUATERNION& orientation);
+	void addKey(float time, Camera& camera);
+	DWORD getNumKeys();
+	const CameraKey& getKey(DWORD);
+	float getDuration();
+	void setLooped(bool);
+	void evaluate(float time, Camera* camera);
+};
+
+#endif // !CAMERAPATH_H
@@ -0,0 +1,458 @@
+#ifndef COREMATH_H
+#define COREMATH_H
+
+// The core modules (the job system, allocators, index optimizer, frustum,
+// spatial grid, camera, camera path, placement and picking) are written against the D3DX math types like the rest of the
+// game, but include this header instead of Headers.h. On Windows it is D3DX
+// itself; elsewhere it defines the few D3DX types and functions they use, laid
+// out and behaving the same, so the core library builds with GCC and Clang.
+// The same goes for the handful of texture formats the core sizes.
+#ifdef _WIN32
+
+// The core uses std::min and std::max, which the windows.h macros would break
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <d3dx9.h>
+
+#else
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int DWORD;
+
+#define D3DX_PI ((float)3.141592654f)
+
+#define MAKEFOURCC(ch0, ch1, ch2, ch3) \
+	((DWORD)(BYTE)(ch0) | ((DWORD)(BYTE)(ch1) << 8) | ((DWORD)(BYTE)(ch2) << 16) | ((DWORD)(BYTE)(ch3) << 24))
+
+enum D3DFORMAT
+{
+	D3DFMT_UNKNOWN = 0,
+	D3DFMT_A8R8G8B8 = 21,
+	D3DFMT_X8R8G8B8 = 22,
+	D3DFMT_R5G6B5 = 23,
+	D3DFMT_X1R5G5B5 = 24,
+	D3DFMT_A1R5G5B5 = 25,
+	D3DFMT_A4R4G4B4 = 26,
+	D3DFMT_L16 = 81,
+	D3DFMT_A16B16G16R16F = 113,
+	D3DFMT_DXT1 = MAKEFOURCC('D', 'X', 'T', '1'),
+	D3DFMT_DXT2 = MAKEFOURCC('D', 'X', 'T', '2'),
+	D3DFMT_DXT3 = MAKEFOURCC('D', 'X', 'T', '3'),
+	D3DFMT_DXT4 = MAKEFOURCC('D', 'X', 'T', '4'),
+	D3DFMT_DXT5 = MAKEFOURCC('D', 'X', 'T', '5'),
+	D3DFMT_FORCE_DWORD = 0x7fffffff
+};
+
+struct D3DXVECTOR3
+{
+	float x, y, z;
+
+	D3DXVECTOR3() {
+	}
+
+	D3DXVECTOR3(float fx, float fy, float fz) :x(fx), y(fy), z(fz) {
+	}
+
+	operator float*() {
+		return &x;
+	}
+
+	operator const float*() const {
+		return &x;
+	}
+
+	D3DXVECTOR3& operator+=(const D3DXVECTOR3& v) {
+		x += v.x;
+		y += v.y;
+		z += v.z;
+		return *this;
+	}
+
+	D3DXVECTOR3& operator-=(const D3DXVECTOR3& v) {
+		x -= v.x;
+		y -= v.y;
+		z -= v.z;
+		return *this;
+	}
+
+	D3DXVECTOR3& operator*=(float f) {
+		x *= f;
+		y *= f;
+		z *= f;
+		return *this;
+	}
+
+	D3DXVECTOR3& operator/=(float f) {
+		return *this *= 1.0f / f;
+	}
+
+	D3DXVECTOR3 operator-() const {
+		return D3DXVECTOR3(-x, -y, -z);
+	}
+
+	D3DXVECTOR3 operator+(const D3DXVECTOR3& v) const {
+		return D3DXVECTOR3(x + v.x, y + v.y, z + v.z);
+	}
+
+	D3DXVECTOR3 operator-(const D3DXVECTOR3& v) const {
+		return D3DXVECTOR3(x - v.x, y - v.y, z - v.z);
+	}
+
+	D3DXVECTOR3 operator*(float f) const {
+		return D3DXVECTOR3(x * f, y * f, z * f);
+	}
+
+	D3DXVECTOR3 operator/(float f) const {
+		return *this * (1.0f / f);
+	}
+
+	bool operator==(const D3DXVECTOR3& v) const {
+		return x == v.x && y == v.y && z == v.z;
+	}
+
+	bool operator!=(const D3DXVECTOR3& v) const {
+		return !(*this == v);
+	}
+};
+
+inline D3DXVECTOR3 operator*(float f, const D3DXVECTOR3& v) {
+	return v * f;
+}
+
+struct D3DXPLANE
+{
+	float a, b, c, d;
+
+	D3DXPLANE() {
+	}
+
+	D3DXPLANE(float fa, float fb, float fc, float fd) :a(fa), b(fb), c(fc), d(fd) {
+	}
+};
+
+struct D3DXQUATERNION
+{
+	float x, y, z, w;
+
+	D3DXQUATERNION() {
+	}
+
+	D3DXQUATERNION(float fx, float fy, float fz, float fw) :x(fx), y(fy), z(fz), w(fw) {
+	}
+
+	D3DXQUATERNION operator-() const {
+		return D3DXQUATERNION(-x, -y, -z, -w);
+	}
+
+	bool operator==(const D3DXQUATERNION& q) const {
+		return x == q.x && y == q.y && z == q.z && w == q.w;
+	}
+
+	bool operator!=(const D3DXQUATERNION& q) const {
+		return !(*this == q);
+	}
+};
+
+struct D3DXMATRIX
+{
+	union {
+		struct {
+			float _11, _12, _13, _14;
+			float _21, _22, _23, _24;
+			float _31, _32, _33, _34;
+			float _41, _42, _43, _44;
+		};
+		float m[4][4];
+	};
+
+	D3DXMATRIX() {
+	}
+
+	float& operator()(unsigned row, unsigned col) {
+		return m[row][col];
+	}
+
+	float operator()(unsigned row, unsigned col) const {
+		return m[row][col];
+	}
+
+	D3DXMATRIX operator*(const D3DXMATRIX& other) const {
+		D3DXMATRIX product;
+
+		for (int r = 0; r < 4; r++) {
+			for (int c = 0; c < 4; c++)
+				product.m[r][c] = m[r][0] * other.m[0][c] + m[r][1] * other.m[1][c] + m[r][2] * other.m[2][c] + m[r][3] * other.m[3][c];
+		}
+		return product;
+	}
+};
+
+inline float D3DXVec3Dot(const D3DXVECTOR3* a, const D3DXVECTOR3* b) {
+	return a->x * b->x + a->y * b->y + a->z * b->z;
+}
+
+inline float D3DXVec3LengthSq(const D3DXVECTOR3* v) {
+	return D3DXVec3Dot(v, v);
+}
+
+inline float D3DXVec3Length(const D3DXVECTOR3* v) {
+	return sqrtf(D3DXVec3LengthSq(v));
+}
+
+inline D3DXVECTOR3* D3DXVec3Cross(D3DXVECTOR3* out, const D3DXVECTOR3* a, const D3DXVECTOR3* b) {
+	*out = D3DXVECTOR3(a->y * b->z - a->z * b->y, a->z * b->x - a->x * b->z, a->x * b->y - a->y * b->x);
+	return out;
+}
+
+inline D3DXVECTOR3* D3DXVec3Normalize(D3DXVECTOR3* out, const D3DXVECTOR3* v) {
+	float length = D3DXVec3Length(v);
+
+	*out = length > 0.0f ? *v / length : D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+	return out;
+}
+
+inline D3DXVECTOR3* D3DXVec3Lerp(D3DXVECTOR3* out, const D3DXVECTOR3* a, const D3DXVECTOR3* b, float s) {
+	*out = *a + (*b - *a) * s;
+	return out;
+}
+
+inline D3DXVECTOR3* D3DXVec3CatmullRom(D3DXVECTOR3* out, const D3DXVECTOR3* v0, const D3DXVECTOR3* v1, const D3DXVECTOR3* v2, const D3DXVECTOR3* v3, float s) {
+	*out = (*v1 * 2.0f + (*v2 - *v0) * s + (*v0 * 2.0f - *v1 * 5.0f + *v2 * 4.0f - *v3) * (s * s) +
+		(*v1 * 3.0f - *v0 - *v2 * 3.0f + *v3) * (s * s * s)) * 0.5f;
+	return out;
+}
+
+inline D3DXVECTOR3* D3DXVec3TransformCoord(D3DXVECTOR3* out, const D3DXVECTOR3* v, const D3DXMATRIX* m) {
+	float w = v->x * m->_14 + v->y * m->_24 + v->z * m->_34 + m->_44;
+
+	*out = D3DXVECTOR3(v->x * m->_11 + v->y * m->_21 + v->z * m->_31 + m->_41,
+		v->x * m->_12 + v->y * m->_22 + v->z * m->_32 + m->_42,
+		v->x * m->_13 + v->y * m->_23 + v->z * m->_33 + m->_43) / w;
+	return out;
+}
+
+inline D3DXVECTOR3* D3DXVec3TransformNormal(D3DXVECTOR3* out, const D3DXVECTOR3* v, const D3DXMATRIX* m) {
+	*out = D3DXVECTOR3(v->x * m->_11 + v->y * m->_21 + v->z * m->_31,
+		v->x * m->_12 + v->y * m->_22 + v->z * m->_32,
+		v->x * m->_13 + v->y * m->_23 + v->z * m->_33);
+	return out;
+}
+
+inline float D3DXQuaternionDot(const D3DXQUATERNION* a, const D3DXQUATERNION* b) {
+	return a->x * b->x + a->y * b->y + a->z * b->z + a->w * b->w;
+}
+
+inline D3DXQUATERNION* D3DXQuaternionIdentity(D3DXQUATERNION* out) {
+	*out = D3DXQUATERNION(0.0f, 0.0f, 0.0f, 1.0f);
+	return out;
+}
+
+inline D3DXQUATERNION* D3DXQuaternionNormalize(D3DXQUATERNION* out, const D3DXQUATERNION* q) {
+	float length = sqrtf(D3DXQuaternionDot(q, q));
+	float scale = length > 0.0f ? 1.0f / length : 0.0f;
+
+	*out = D3DXQUATERNION(q->x * scale, q->y * scale, q->z * scale, q->w * scale);
+	return out;
+}
+
+// The rotation a followed by the rotation b, which is b * a
+inline D3DXQUATERNION* D3DXQuaternionMultiply(D3DXQUATERNION* out, const D3DXQUATERNION* a, const D3DXQUATERNION* b) {
+	*out = D3DXQUATERNION(b->w * a->x + b->x * a->w + b->y * a->z - b->z * a->y,
+		b->w * a->y - b->x * a->z + b->y * a->w + b->z * a->x,
+		b->w * a->z + b->x * a->y - b->y * a->x + b->z * a->w,
+		b->w * a->w - b->x * a->x - b->y * a->y - b->z * a->z);
+	return out;
+}
+
+inline D3DXQUATERNION* D3DXQuaternionRotationAxis(D3DXQUATERNION* out, const D3DXVECTOR3* axis, float angle) {
+	D3DXVECTOR3 unit;
+	float s = sinf(angle * 0.5f);
+
+	D3DXVec3Normalize(&unit, axis);
+	*out = D3DXQUATERNION(unit.x * s, unit.y * s, unit.z * s, cosf(angle * 0.5f));
+	return out;
+}
+
+inline D3DXQUATERNION* D3DXQuaternionRotationMatrix(D3DXQUATERNION* out, const D3DXMATRIX* m) {
+	float trace = m->_11 + m->_22 + m->_33;
+
+	if (trace > 0.0f) {
+		float s = sqrtf(trace + 1.0f) * 2.0f;
+		*out = D3DXQUATERNION((m->_23 - m->_32) / s, (m->_31 - m->_13) / s, (m->_12 - m->_21) / s, 0.25f * s);
+	}
+	else if (m->_11 > m->_22 && m->_11 > m->_33) {
+		float s = sqrtf(1.0f + m->_11 - m->_22 - m->_33) * 2.0f;
+		*out = D3DXQUATERNION(0.25f * s, (m->_12 + m->_21) / s, (m->_31 + m->_13) / s, (m->_23 - m->_32) / s);
+	}
+	else if (m->_22 > m->_33) {
+		float s = sqrtf(1.0f + m->_22 - m->_11 - m->_33) * 2.0f;
+		*out = D3DXQUATERNION((m->_12 + m->_21) / s, 0.25f * s, (m->_23 + m->_32) / s, (m->_31 - m->_13) / s);
+	}
+	else {
+		float s = sqrtf(1.0f + m->_33 - m->_11 - m->_22) * 2.0f;
+		*out = D3DXQUATERNION((m->_31 + m->_13) / s, (m->_23 + m->_32) / s, 0.25f * s, (m->_12 - m->_21) / s);
+	}
+	return out;
+}
+
+// Takes the shorter arc, and blends linearly when the two are too close for the sines to be accurate
+inline D3DXQUATERNION* D3DXQuaternionSlerp(D3DXQUATERNION* out, const D3DXQUATERNION* a, const D3DXQUATERNION* b, float t) {
+	float dot = D3DXQuaternionDot(a, b), sign = 1.0f, wa = 1.0f - t, wb = t;
+
+	if (dot < 0.0f) {
+		sign = -1.0f;
+		dot = -dot;
+	}
+	if (1.0f - dot > 0.001f) {
+		float theta = acosf(dot);
+
+		wa = sinf(theta * wa) / sinf(theta);
+		wb = sinf(theta * wb) / sinf(theta);
+	}
+	wb *= sign;
+	*out = D3DXQUATERNION(a->x * wa + b->x * wb, a->y * wa + b->y * wb, a->z * wa + b->z * wb, a->w * wa + b->w * wb);
+	return out;
+}
+
+inline D3DXMATRIX* D3DXMatrixIdentity(D3DXMATRIX* out) {
+	for (int r = 0; r < 4; r++) {
+		for (int c = 0; c < 4; c++)
+			out->m[r][c] = r == c ? 1.0f : 0.0f;
+	}
+	return out;
+}
+
+inline D3DXMATRIX* D3DXMatrixRotationQuaternion(D3DXMATRIX* out, const D3DXQUATERNION* q) {
+	float xx = q->x * q->x, yy = q->y * q->y, zz = q->z * q->z;
+	float xy = q->x * q->y, xz = q->x * q->z, yz = q->y * q->z;
+	float wx = q->w * q->x, wy = q->w * q->y, wz = q->w * q->z;
+
+	D3DXMatrixIdentity(out);
+	out->_11 = 1.0f - 2.0f * (yy + zz); out->_12 = 2.0f * (xy + wz); out->_13 = 2.0f * (xz - wy);
+	out->_21 = 2.0f * (xy - wz); out->_22 = 1.0f - 2.0f * (xx + zz); out->_23 = 2.0f * (yz + wx);
+	out->_31 = 2.0f * (xz + wy); out->_32 = 2.0f * (yz - wx); out->_33 = 1.0f - 2.0f * (xx + yy);
+	return out;
+}
+
+// Scales, then rotates, then translates. Only the form the core uses is supported: no centers and no scaling rotation
+inline D3DXMATRIX* D3DXMatrixTransformation(D3DXMATRIX* out, const D3DXVECTOR3* scalingCenter, const D3DXQUATERNION* scalingRotation,
+	const D3DXVECTOR3* scaling, const D3DXVECTOR3* rotationCenter, const D3DXQUATERNION* rotation, const D3DXVECTOR3* translation) {
+	assert(!scalingCenter && !scalingRotation && !rotationCenter);
+	(void)scalingCenter;
+	(void)scalingRotation;
+	(void)rotationCenter;
+
+	if (rotation)
+		D3DXMatrixRotationQuaternion(out, rotation);
+	else
+		D3DXMatrixIdentity(out);
+	if (scaling) {
+		for (int c = 0; c < 3; c++) {
+			out->m[0][c] *= scaling->x;
+			out->m[1][c] *= scaling->y;
+			out->m[2][c] *= scaling->z;
+		}
+	}
+	if (translation) {
+		out->_41 = translation->x;
+		out->_42 = translation->y;
+		out->_43 = translation->z;
+	}
+	return out;
+}
+
+// By cofactors; returns NULL and leaves out alone if the matrix has no inverse
+inline D3DXMATRIX* D3DXMatrixInverse(D3DXMATRIX* out, float* determinant, const D3DXMATRIX* in) {
+	const float* a = &in->m[0][0];
+	float inv[16], det;
+
+	inv[0] = a[5] * a[10] * a[15] - a[5] * a[11] * a[14] - a[9] * a[6] * a[15] + a[9] * a[7] * a[14] + a[13] * a[6] * a[11] - a[13] * a[7] * a[10];
+	inv[4] = -a[4] * a[10] * a[15] + a[4] * a[11] * a[14] + a[8] * a[6] * a[15] - a[8] * a[7] * a[14] - a[12] * a[6] * a[11] + a[12] * a[7] * a[10];
+	inv[8] = a[4] * a[9] * a[15] - a[4] * a[11] * a[13] - a[8] * a[5] * a[15] + a[8] * a[7] * a[13] + a[12] * a[5] * a[11] - a[12] * a[7] * a[9];
+	inv[12] = -a[4] * a[9] * a[14] + a[4] * a[10] * a[13] + a[8] * a[5] * a[14] - a[8] * a[6] * a[13] - a[12] * a[5] * a[10] + a[12] * a[6] * a[9];
+	inv[1] = -a[1] * a[10] * a[15] + a[1] * a[11] * a[14] + a[9] * a[2] * a[15] - a[9] * a[3] * a[14] - a[13] * a[2] * a[11] + a[13] * a[3] * a[10];
+	inv[5] = a[0] * a[10] * a[15] - a[0] * a[11] * a[14] - a[8] * a[2] * a[15] + a[8] * a[3] * a[14] + a[12] * a[2] * a[11] - a[12] * a[3] * a[10];
+	inv[9] = -a[0] * a[9] * a[15] + a[0] * a[11] * a[13] + a[8] * a[1] * a[15] - a[8] * a[3] * a[13] - a[12] * a[1] * a[11] + a[12] * a[3] * a[9];
+	inv[13] = a[0] * a[9] * a[14] - a[0] * a[10] * a[13] - a[8] * a[1] * a[14] + a[8] * a[2] * a[13] + a[12] * a[1] * a[10] - a[12] * a[2] * a[9];
+	inv[2] = a[1] * a[6] * a[15] - a[1] * a[7] * a[14] - a[5] * a[2] * a[15] + a[5] * a[3] * a[14] + a[13] * a[2] * a[7] - a[13] * a[3] * a[6];
+	inv[6] = -a[0] * a[6] * a[15] + a[0] * a[7] * a[14] + a[4] * a[2] * a[15] - a[4] * a[3] * a[14] - a[12] * a[2] * a[7] + a[12] * a[3] * a[6];
+	inv[10] = a[0] * a[5] * a[15] - a[0] * a[7] * a[13] - a[4] * a[1] * a[15] + a[4] * a[3] * a[13] + a[12] * a[1] * a[7] - a[12] * a[3] * a[5];
+	inv[14] = -a[0] * a[5] * a[14] + a[0] * a[6] * a[13] + a[4] * a[1] * a[14] - a[4] * a[2] * a[13] - a[12] * a[1] * a[6] + a[12] * a[2] * a[5];
+	inv[3] = -a[1] * a[6] * a[11] + a[1] * a[7] * a[10] + a[5] * a[2] * a[11] - a[5] * a[3] * a[10] - a[9] * a[2] * a[7] + a[9] * a[3] * a[6];
+	inv[7] = a[0] * a[6] * a[11] - a[0] * a[7] * a[10] - a[4] * a[2] * a[11] + a[4] * a[3] * a[10] + a[8] * a[2] * a[7] - a[8] * a[3] * a[6];
+	inv[11] = -a[0] * a[5] * a[11] + a[0] * a[7] * a[9] + a[4] * a[1] * a[11] - a[4] * a[3] * a[9] - a[8] * a[1] * a[7] + a[8] * a[3] * a[5];
+	inv[15] = a[0] * a[5] * a[10] - a[0] * a[6] * a[9] - a[4] * a[1] * a[10] + a[4] * a[2] * a[9] + a[8] * a[1] * a[6] - a[8] * a[2] * a[5];
+
+	det = a[0] * inv[0] + a[1] * inv[4] + a[2] * inv[8] + a[3] * inv[12];
+	if (determinant)
+		*determinant = det;
+	if (det == 0.0f)
+		return NULL;
+
+	for (int i = 0; i < 16; i++)
+		(&out->m[0][0])[i] = inv[i] / det;
+	return out;
+}
+
+inline float D3DXPlaneDotCoord(const D3DXPLANE* p, const D3DXVECTOR3* v) {
+	return p->a * v->x + p->b * v->y + p->c * v->z + p->d;
+}
+
+inline D3DXPLANE* D3DXPlaneNormalize(D3DXPLANE* out, const D3DXPLANE* p) {
+	float length = sqrtf(p->a * p->a + p->b * p->b + p->c * p->c);
+	float scale = length > 0.0f ? 1.0f / length : 0.0f;
+
+	*out = D3DXPLANE(p->a * scale, p->b * scale, p->c * scale, p->d * scale);
+	return out;
+}
+
+inline D3DXMATRIX* D3DXMatrixPerspectiveFovLH(D3DXMATRIX* out, float fovy, float aspect, float zn, float zf) {
+	float yScale = 1.0f / tanf(fovy / 2.0f);
+
+	for (int r = 0; r < 4; r++) {
+		for (int c = 0; c < 4; c++)
+			out->m[r][c] = 0.0f;
+	}
+	out->_11 = yScale / aspect;
+	out->_22 = yScale;
+	out->_33 = zf / (zf - zn);
+	out->_34 = 1.0f;
+	out->_43 = -zn * zf / (zf - zn);
+	return out;
+}
+
+inline D3DXMATRIX* D3DXMatrixLookAtLH(D3DXMATRIX* out, const D3DXVECTOR3* eye, const D3DXVECTOR3* at, const D3DXVECTOR3* up) {
+	D3DXVECTOR3 zaxis = *at - *eye, xaxis, yaxis;
+
+	D3DXVec3Normalize(&zaxis, &zaxis);
+	D3DXVec3Cross(&xaxis, up, &zaxis);
+	D3DXVec3Normalize(&xaxis, &xaxis);
+	D3DXVec3Cross(&yaxis, &zaxis, &xaxis);
+
+	out->_11 = xaxis.x; out->_12 = yaxis.x; out->_13 = zaxis.x; out->_14 = 0.0f;
+	out->_21 = xaxis.y; out->_22 = yaxis.y; out->_23 = zaxis.y; out->_24 = 0.0f;
+	out->_31 = xaxis.z; out->_32 = yaxis.z; out->_33 = zaxis.z; out->_34 = 0.0f;
+	out->_41 = -D3DXVec3Dot(&xaxis, eye);
+	out->_42 = -D3DXVec3Dot(&yaxis, eye);
+	out->_43 = -D3DXVec3Dot(&zaxis, eye);
+	out->_44 = 1.0f;
+	return out;
+}
+
+#endif // _WIN32
+
+//Defines a ray.
+struct Ray
+{
+	D3DXVECTOR3 _origin;
+	D3DXVECTOR3 _direction;
+};
+
+#endif // !COREMATH_H
@@ -0,0 +1,406 @@
+#include "Headers.h"
+
+#ifdef _DEBUG
+static const DWORD EFFECT_COMPILE_FLAGS = D3DXSHADER_DEBUG | D3DXSHADER_SKIPOPTIMIZATION;
+#else
+static const DWORD EFFECT_COMPILE_FLAGS = D3DXSHADER_OPTIMIZATION_LEVEL3;
+#endif
+
+static const char* const COMMON_TECHNIQUES[] = { "RenderScene", "RenderScene1x", "RenderSceneQuantized", 0 };
+static const char* const SPECULAR_TECHNIQUES[] = { "RenderScene", "RenderScene1x", "RenderSceneQuantized", "RenderSceneMultiLight", "RenderSceneNormalMap", 0 };
+static const char* const SPECULAR_PARAMETERS[] = { "g_mWorld", "g_mView", "g_mProj", "g_vLight", "g_vLightColor", "Diffuse", "Specular", "Power",
+	"g_txScene", "g_vPosScale", "g_vPosBias", "g_iNumLights", "g_vLightPositions", "g_vLightColors", "g_vLightAttenuation",
+	"g_vLightDirections", "g_vLightCones", "g_vAmbient", "g_txNormal", "g_fBumpiness", 0 };
+static const char* const REFLECT_PARAMETERS[] = { "g_mWorld", "g_mView", "g_mProj", "g_vLight", "g_vLightColor", "Diffuse", "Specular", "Power",
+	"Reflectivity", "g_txScene", "g_txEnvMap", "g_vPosScale", "g_vPosBias", 0 };
+
+const EffectLayout SPECULAR_LAYOUT = { SPECULAR_TECHNIQUES, SPECULAR_PARAMETERS };
+const EffectLayout REFLECT_LAYOUT = { COMMON_TECHNIQUES, REFLECT_PARAMETERS };
+
+/*
+Builds the cache file name of an effect. The source, every define and the compile
+flags go into the hash, so changing any of them compiles the effect again.
+
+@param entry - The effect being compiled
+@param source - The source text of the effect
+@param path - Receives the path of the cache file
+
+@return - The hash the cache file is named by
+*/
+static unsigned long long CachePath(const EffectEntry& entry, const std::vector<char>& source, std::wstring* path) {
+	unsigned long long hash = HashEffectSource(source, entry.defineNames, entry.defineValues, EFFECT_COMPILE_FLAGS, D3DX_SDK_VERSION);
+	TCHAR name[MAX_PATH];
+	LPCWSTR base = wcsrchr(entry.file.c_str(), L'\\');
+
+	_stprintf_s(name, MAX_PATH, TEXT("%s\\%s.%016llx.fxo"), SHADER_CACHE_DIR, base ? base + 1 : entry.file.c_str(), hash);
+	*path = name;
+	return hash;
+}
+
+EffectManager::EffectManager() :pDevice(0) {
+}
+
+void EffectManager::setDevice(LPDIRECT3DDEVICE9* newDevice) {
+	pDevice = newDevice;
+}
+
+/*
+Reads the source text of an effect file, looking in the parent folder when it is
+not in the working directory, the same way Object looks for meshes.
+
+@param file - The effect file to read
+@param source - Receives the source text
+@param path - Receives the path the file was found at
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the file can not be found in either folder.
+*/
+int EffectManager::ReadSource(LPCWSTR file, std::vector<char>* source, std::wstring* path) {
+	TCHAR text[MAX_PATH];
+
+	if (ReadWholeFile(file, source)) {
+		*path = file;
+		return S_OK;
+	}
+
+	_stprintf_s(text, MAX_PATH, TEXT("..\\%s"), file);
+	if (ReadWholeFile(text, source)) {
+		*path = text;
+		return S_OK;
+	}
+
+	SetError(TEXT("Could not find effect %s"), file);
+	return E_FAIL;
+}
+
+/*
+Looks up the handles of every parameter and technique the game uses.
+
+@param pEffect - The effect, or an effect compiler, to search
+@param handles - Receives the handles; anything the effect does not declare is null
+*/
+void EffectManager::FindHandles(LPD3DXBASEEFFECT pEffect, EffectHandles* handles) {
+	handles->world = pEffect->GetParameterByName(NULL, "g_mWorld");
+	handles->view = pEffect->GetParameterByName(NULL, "g_mView");
+	handles->proj = pEffect->GetParameterByName(NULL, "g_mProj");
+	handles->light = pEffect->GetParameterByName(NULL, "g_vLight");
+	handles->lightColor = pEffect->GetParameterByName(NULL, "g_vLightColor");
+	handles->diffuse = pEffect->GetParameterByName(NULL, "Diffuse");
+	handles->specular = pEffect->GetParameterByName(NULL, "Specular");
+	handles->power = pEffect->GetParameterByName(NULL, "Power");
+	handles->reflectivity = pEffect->GetParameterByName(NULL, "Reflectivity");
+	handles->sceneTexture = pEffect->GetParameterByName(NULL, "g_txScene");
+	handles->envTexture = pEffect->GetParameterByName(NULL, "g_txEnvMap");
+	handles->normalTexture = pEffect->GetParameterByName(NULL, "g_txNormal");
+	handles->bumpiness = pEffect->GetParameterByName(NULL, "g_fBumpiness");
+	handles->posScale = pEffect->GetParameterByName(NULL, "g_vPosScale");
+	handles->posBias = pEffect->GetParameterByName(NULL, "g_vPosBias");
+	handles->numLights = pEffect->GetParameterByName(NULL, "g_iNumLights");
+	handles->lightPositions = pEffect->GetParameterByName(NULL, "g_vLightPositions");
+	handles->lightColors = pEffect->GetParameterByName(NULL, "g_vLightColors");
+	handles->lightAttenuation = pEffect->GetParameterByName(NULL, "g_vLightAttenuation");
+	handles->lightDirections = pEffect->GetParameterByName(NULL, "g_vLightDirections");
+	handles->lightCones = pEffect->GetParameterByName(NULL, "g_vLightCones");
+	handles->ambient = pEffect->GetParameterByName(NULL, "g_vAmbient");
+	handles->renderScene = pEffect->GetTechniqueByName("RenderScene");
+	handles->renderScene1x = pEffect->GetTechniqueByName("RenderScene1x");
+	handles->renderSceneQuantized = pEffect->GetTechniqueByName("RenderSceneQuantized");
+	handles->renderSceneMultiLight = pEffect->GetTechniqueByName("RenderSceneMultiLight");
+	handles->renderSceneNormalMap = pEffect->GetTechniqueByName("RenderSceneNormalMap");
+}
+
+/*
+Checks that an effect has the techniques and parameters of its layout and that
+every pass of every technique has both a vertex and a pixel shader. Each
+technique and pass is logged with its shader versions.
+
+@param pEffect - The effect to check, created without D3DXFX_NOT_CLONEABLE
+@param layout - The techniques and parameters the effect must declare
+@param name - The name of the effect, for the log
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if anything in the layout is missing or a pass lacks a shader.
+*/
+int EffectManager::ValidateLayout(LPD3DXBASEEFFECT pEffect, const EffectLayout* layout, LPCWSTR name) {
+	D3DXEFFECT_DESC effectDesc;
+	HRESULT r = S_OK;
+
+	if (FAILED(pEffect->GetDesc(&effectDesc))) {
+		SetError(TEXT("Could not describe effect %s"), name);
+		return E_FAIL;
+	}
+
+	LogMessage(TEXT("%s: %u parameters, %u techniques"), name, effectDesc.Parameters, effectDesc.Techniques);
+
+	for (UINT t = 0; t < effectDesc.Techniques; t++) {
+		D3DXHANDLE hTechnique = pEffect->GetTechnique(t);
+		D3DXTECHNIQUE_DESC techniqueDesc;
+
+		pEffect->GetTechniqueDesc(hTechnique, &techniqueDesc);
+		LogMessage(TEXT("  technique %S, %u passes"), techniqueDesc.Name, techniqueDesc.Passes);
+
+		if (techniqueDesc.Passes == 0) {
+			SetError(TEXT("%s: technique %S has no passes"), name, techniqueDesc.Name);
+			r = E_FAIL;
+		}
+
+		for (UINT p = 0; p < techniqueDesc.Passes; p++) {
+			D3DXPASS_DESC passDesc;
+
+			pEffect->GetPassDesc(pEffect->GetPass(hTechnique, p), &passDesc);
+			if (!passDesc.pVertexShaderFunction || !passDesc.pPixelShaderFunction) {
+				SetError(TEXT("%s: pass %S of technique %S is missing a shader"), name, passDesc.Name, techniqueDesc.Name);
+				r = E_FAIL;
+				continue;
+			}
+
+			DWORD vs = D3DXGetShaderVersion(passDesc.pVertexShaderFunction);
+			DWORD ps = D3DXGetShaderVersion(passDesc.pPixelShaderFunction);
+			LogMessage(TEXT("    pass %S: vs_%u_%u, ps_%u_%u"), passDesc.Name,
+				D3DSHADER_VERSION_MAJOR(vs), D3DSHADER_VERSION_MINOR(vs), D3DSHADER_VERSION_MAJOR(ps), D3DSHADER_VERSION_MINOR(ps));
+		}
+	}
+
+	for (DWORD i = 0; layout->techniques[i]; i++) {
+		if (!pEffect->GetTechniqueByName(layout->techniques[i])) {
+			SetError(TEXT("%s: missing technique %S"), name, layout->techniques[i]);
+			r = E_FAIL;
+		}
+	}
+
+	for (DWORD i = 0; layout->parameters[i]; i++) {
+		if (!pEffect->GetParameterByName(NULL, layout->parameters[i])) {
+			SetError(TEXT("%s: missing parameter %S"), name, layout->parameters[i]);
+			r = E_FAIL;
+		}
+	}
+
+	return r;
+}
+
+/*
+Loads an effect file the way the game does and checks that the device can draw
+with it. Used by the -validateeffects command line switch, on the null reference
+device, so the effect files can be checked on a machine that has no display.
+An effect compiler can not be checked instead: its passes have no shaders until
+the effect is compiled.
+
+@param pDevice - The device to create the effect on
+@param file - The effect file to check
+@param layout - The techniques and parameters the effect must declare
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the file can not be read, does not compile, does not match the
+		  layout or has no technique the device can run.
+*/
+int EffectManager::ValidateEffectFile(LPDIRECT3DDEVICE9* pDevice, LPCWSTR file, const EffectLayout* layout) {
+	EffectManager manager;
+	D3DXTECHNIQUE_DESC techniqueDesc;
+	DWORD id;
+
+	manager.setDevice(pDevice);
+	if (FAILED(manager.loadEffect(file, NULL, layout, &id)))
+		return E_FAIL;
+
+	const EffectHandles& handles = manager.getHandles(id);
+	if (!handles.bestTechnique) {
+		manager.release();
+		return E_FAIL;
+	}
+
+	manager.getEffect(id)->GetTechniqueDesc(handles.bestTechnique, &techniqueDesc);
+	LogMessage(TEXT("%s: loaded, drawing with technique %S%s"), file, techniqueDesc.Name,
+		handles.renderSceneNormalMap ? TEXT(" and normal mapping") : TEXT(""));
+	manager.release();
+
+	return S_OK;
+}
+
+/*
+Compiles an effect, or loads it from the cache, and creates it on the device. On
+failure the entry keeps the effect it had, so a bad edit while hot reloading
+leaves the last good version in use.
+
+@param entry - The effect to build
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the file can not be read, does not compile or does not match its layout.
+*/
+int EffectManager::build(EffectEntry& entry) {
+	std::vector<char> source, bytecode;
+	std::vector<D3DXMACRO> macros;
+	std::wstring path, cachePath;
+	LPD3DXEFFECTCOMPILER pCompiler = 0;
+	LPD3DXBUFFER pCompiled = 0;
+	LPD3DXBUFFER pErrors = 0;
+	LPD3DXEFFECT pEffect = 0;
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	HRESULT r;
+
+	if (FAILED(ReadSource(entry.file.c_str(), &source, &path)))
+		return E_FAIL;
+
+	if (GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attributes))
+		entry.lastWrite = attributes.ftLastWriteTime;
+
+	for (DWORD i = 0; i < entry.defineNames.size(); i++) {
+		D3DXMACRO macro = { entry.defineNames[i].c_str(), entry.defineValues[i].c_str() };
+		macros.push_back(macro);
+	}
+	D3DXMACRO end = { NULL, NULL };
+	macros.push_back(end);
+
+	CachePath(entry, source, &cachePath);
+
+	if (!ReadWholeFile(cachePath.c_str(), &bytecode) || bytecode.empty()) {
+		r = D3DXCreateEffectCompiler(&source[0], (UINT)source.size(), &macros[0], NULL, 0, &pCompiler, &pErrors);
+		if (SUCCEEDED(r)) {
+			if (pErrors)
+				pErrors->Release();
+			pErrors = 0;
+			r = pCompiler->CompileEffect(EFFECT_COMPILE_FLAGS, &pCompiled, &pErrors);
+			pCompiler->Release();
+		}
+		if (FAILED(r)) {
+			SetError(TEXT("Could not compile effect %s: %S"), entry.file.c_str(), pErrors ? (char*)pErrors->GetBufferPointer() : "");
+			if (pErrors)
+				pErrors->Release();
+			return E_FAIL;
+		}
+		if (pErrors)
+			pErrors->Release();
+		pErrors = 0;
+
+		bytecode.assign((char*)pCompiled->GetBufferPointer(), (char*)pCompiled->GetBufferPointer() + pCompiled->GetBufferSize());
+		pCompiled->Release();
+
+		CreateDirectory(SHADER_CACHE_DIR, NULL);
+		if (!WriteWholeFile(cachePath.c_str(), &bytecode[0], (DWORD)bytecode.size()))
+			SetError(TEXT("Could not write shader cache %s"), cachePath.c_str());
+		LogMessage(TEXT("Compiled effect %s"), entry.file.c_str());
+	}
+	else {
+		LogMessage(TEXT("Loaded effect %s from %s"), entry.file.c_str(), cachePath.c_str());
+	}
+
+	// Not D3DXFX_NOT_CLONEABLE: that frees the shader functions, and ValidateLayout reads their versions
+	r = D3DXCreateEffect(*pDevice, &bytecode[0], (UINT)bytecode.size(), NULL, NULL, 0, NULL, &pEffect, &pErrors);
+	if (FAILED(r)) {
+		SetError(TEXT("Could not create effect %s: %S"), entry.file.c_str(), pErrors ? (char*)pErrors->GetBufferPointer() : "");
+		if (pErrors)
+			pErrors->Release();
+		// A stale or damaged cache file would fail every time; compile from source next time
+		DeleteFile(cachePath.c_str());
+		return E_FAIL;
+	}
+	if (pErrors)
+		pErrors->Release();
+
+	if (FAILED(ValidateLayout(pEffect, entry.layout, entry.file.c_str()))) {
+		pEffect->Release();
+		return E_FAIL;
+	}
+
+	if (entry.pEffect)
+		entry.pEffect->Release();
+	entry.pEffect = pEffect;
+	FindHandles(pEffect, &entry.handles);
+
+	D3DXHANDLE candidates[] = { entry.handles.renderSceneMultiLight, entry.handles.renderScene, entry.handles.renderScene1x };
+	entry.handles.bestTechnique = 0;
+	for (int i = 0; i < sizeof(candidates) / sizeof(candidates[0]) && !entry.handles.bestTechnique; i++) {
+		if (candidates[i] && SUCCEEDED(pEffect->ValidateTechnique(candidates[i])))
+			entry.handles.bestTechnique = candidates[i];
+	}
+	if (!entry.handles.bestTechnique)
+		SetError(TEXT("%s: the device can not run any technique"), entry.file.c_str());
+
+	// Normal mapping is an upgrade of the multi-light technique, used only where that runs
+	if (entry.handles.bestTechnique != entry.handles.renderSceneMultiLight ||
+		(entry.handles.renderSceneNormalMap && FAILED(pEffect->ValidateTechnique(entry.handles.renderSceneNormalMap))))
+		entry.handles.renderSceneNormalMap = 0;
+
+	return S_OK;
+}
+
+/*
+Loads an effect file for the device.
+
+@param file - The effect file to load
+@param defines - Null terminated list of preprocessor defines, or NULL
+@param layout - The techniques and parameters the effect must declare
+@param id - Receives the id the effect is looked up by
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the effect can not be built.
+*/
+int EffectManager::loadEffect(LPCWSTR file, const D3DXMACRO* defines, const EffectLayout* layout, DWORD* id) {
+	EffectEntry entry;
+
+	entry.file = file;
+	entry.layout = layout;
+	entry.pEffect = 0;
+	ZeroMemory(&entry.lastWrite, sizeof(FILETIME));
+	ZeroMemory(&entry.handles, sizeof(EffectHandles));
+
+	for (DWORD i = 0; defines && defines[i].Name; i++) {
+		entry.defineNames.push_back(defines[i].Name);
+		entry.defineValues.push_back(defines[i].Definition ? defines[i].Definition : "");
+	}
+
+	if (FAILED(build(entry)))
+		return E_FAIL;
+
+	effects.push_back(entry);
+	*id = (DWORD)effects.size() - 1;
+
+	return S_OK;
+}
+
+LPD3DXEFFECT EffectManager::getEffect(DWORD id) {
+	return effects[id].pEffect;
+}
+
+const EffectHandles& EffectManager::getHandles(DWORD id) {
+	return effects[id].handles;
+}
+
+/*
+Rebuilds every effect whose file has been written since it was last built.
+*/
+void EffectManager::checkForChanges() {
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	TCHAR text[MAX_PATH];
+
+	for (DWORD i = 0; i < effects.size(); i++) {
+		EffectEntry& entry = effects[i];
+
+		if (!GetFileAttributesEx(entry.file.c_str(), GetFileExInfoStandard, &attributes)) {
+			_stprintf_s(text, MAX_PATH, TEXT("..\\%s"), entry.file.c_str());
+			if (!GetFileAttributesEx(text, GetFileExInfoStandard, &attributes))
+				continue;
+		}
+
+		if (CompareFileTime(&attributes.ftLastWriteTime, &entry.lastWrite) != 0) {
+			entry.lastWrite = attributes.ftLastWriteTime;
+			if (SUCCEEDED(build(entry)))
+				LogMessage(TEXT("Reloaded effect %s"), entry.file.c_str());
+		}
+	}
+}
+
+void EffectManager::onLostDevice() {
+	for (DWORD i = 0; i < effects.size(); i++)
+		effects[i].pEffect->OnLostDevice();
+}
+
+void EffectManager::onResetDevice() {
+	for (DWORD i = 0; i < effects.size(); i++)
+		effects[i].pEffect->OnResetDevice();
+}
+
+void EffectManager::release() {
+	for (DWORD i = 0; i < effects.size(); i++)
+		effects[i].pEffect->Release();
+	effects.clear();
+}
@@ -0,0 +1,81 @@
+#ifndef EFFECTMANAGER_H
+#define EFFECTMANAGER_H
+
+#include "Headers.h"
+#include <vector>
+#include <string>
+
+//Folder that compiled effects are cached in, relative to the working directory.
+#define SHADER_CACHE_DIR TEXT("ShaderCache")
+//Largest number of lights the multi-light technique loops over; matches MAX_LIGHTS in specular.fx.
+#define MAX_EFFECT_LIGHTS 8
+
+//The techniques and parameters an effect file must declare to be used by the game.
+struct EffectLayout
+{
+	const char* const* techniques; // Null terminated list of technique names
+	const char* const* parameters; // Null terminated list of parameter names
+};
+
+extern const EffectLayout SPECULAR_LAYOUT;
+extern const EffectLayout REFLECT_LAYOUT;
+
+//Handles of every parameter and technique the game sets, looked up once per load
+//so that drawing never searches the effect by name. Missing ones are null.
+struct EffectHandles
+{
+	D3DXHANDLE world, view, proj;
+	D3DXHANDLE light, lightColor;
+	D3DXHANDLE diffuse, specular, power, reflectivity;
+	D3DXHANDLE sceneTexture, envTexture, normalTexture, bumpiness;
+	D3DXHANDLE posScale, posBias;
+	D3DXHANDLE numLights, lightPositions, lightColors, lightAttenuation, lightDirections, lightCones, ambient;
+	D3DXHANDLE renderScene, renderScene1x, renderSceneQuantized, renderSceneMultiLight, renderSceneNormalMap;
+	D3DXHANDLE bestTechnique; // First technique, most capable first, that the device can run
+};
+
+/*
+An effect file compiled for the device, along with everything needed to compile
+it again when the file changes.
+*/
+struct EffectEntry
+{
+	std::wstring file;
+	std::vector<std::string> defineNames, defineValues;
+	const EffectLayout* layout;
+	FILETIME lastWrite;
+	LPD3DXEFFECT pEffect;
+	EffectHandles handles;
+};
+
+/*
+The EffectManager loads the game's .fx files. Compiled effects are written to
+SHADER_CACHE_DIR, named by a hash of the source text, the defines and the
+compiler flags, so an unchanged file is only compiled the first time it is
+used. Loaded files are polled for changes and rebuilt in place.
+*/
+class EffectManager {
+private:
+	LPDIRECT3DDEVICE9* pDevice;
+	std::vector<EffectEntry> effects;
+
+	int build(EffectEntry&);
+
+public:
+	EffectManager();
+	void setDevice(LPDIRECT3DDEVICE9*);
+	int loadEffect(LPCWSTR file, const D3DXMACRO* defines, const EffectLayout* layout, DWORD* id);
+	LPD3DXEFFECT getEffect(DWORD);
+	const EffectHandles& getHandles(DWORD);
+	void checkForChanges();
+	void onLostDevice();
+	void onResetDevice();
+	void release();
+
+	static int ReadSource(LPCWSTR file, std::vector<char>* source, std::wstring* path);
+	static void FindHandles(LPD3DXBASEEFFECT, EffectHandles*);
+	static int ValidateLayout(LPD3DXBASEEFFECT, const EffectLayout*, LPCWSTR name);
+	static int ValidateEffectFile(LPDIRECT3DDEVICE9*, LPCWSTR file, const EffectLayout*);
+};
+
+#endif // !EFFECTMANAGER_H
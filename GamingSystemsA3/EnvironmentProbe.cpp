@@ -0,0 +1,367 @@
+#include "Headers.h"
+
+EnvironmentProbe::EnvironmentProbe() :pDevice(0), pCube(0), pDepth(0), pSavedTarget(0), pSavedDepth(0), position(0.0f, 0.0f, 0.0f),
+	isStatic(false), nextFace(0), currentFace(-1), facesRendered(0), facesSkipped(0) {
+	ZeroMemory(&savedViewport, sizeof(D3DVIEWPORT9));
+	for (int i = 0; i < 6; i++) {
+		faceValid[i] = false;
+		faceSignatures[i] = 0;
+		pendingSignature[i] = 0;
+	}
+}
+
+void EnvironmentProbe::setDevice(LPDIRECT3DDEVICE9* newDevice) {
+	pDevice = newDevice;
+}
+
+/*
+Moves the probe. Every face is rendered again from the new position.
+
+@param newPosition - The point the cube map is captured from
+*/
+void EnvironmentProbe::setPosition(const D3DXVECTOR3& newPosition) {
+	position = newPosition;
+	for (int i = 0; i < 6; i++)
+		faceValid[i] = false;
+}
+
+const D3DXVECTOR3& EnvironmentProbe::getPosition() {
+	return position;
+}
+
+/*
+Creates the cube render target and its depth buffer. Both live in the default
+pool, so they are released when the device is lost and created again on reset.
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if either surface can not be created.
+*/
+int EnvironmentProbe::createTargets() {
+	if (FAILED((*pDevice)->CreateCubeTexture(PROBE_FACE_SIZE, 1, D3DUSAGE_RENDERTARGET, D3DFMT_X8R8G8B8, D3DPOOL_DEFAULT, &pCube, NULL))) {
+		SetError(TEXT("Could not create the environment cube map"));
+		return E_FAIL;
+	}
+
+	if (FAILED((*pDevice)->CreateDepthStencilSurface(PROBE_FACE_SIZE, PROBE_FACE_SIZE, D3DFMT_D16, D3DMULTISAMPLE_NONE, 0, TRUE, &pDepth, NULL))) {
+		SetError(TEXT("Could not create the environment depth buffer"));
+		pCube->Release();
+		pCube = 0;
+		return E_FAIL;
+	}
+
+	for (int i = 0; i < 6; i++)
+		faceValid[i] = false;
+
+	return S_OK;
+}
+
+/*
+Sets the probe up to be rendered at runtime.
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the render targets can not be created.
+*/
+int EnvironmentProbe::init() {
+	cleanup();
+	isStatic = false;
+	return createTargets();
+}
+
+/*
+Loads a baked cube map. A loaded probe is static: it is never rendered, and it
+lives in the managed pool so it survives a device reset.
+
+@param file - The DDS file to load
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the file can not be loaded.
+*/
+int EnvironmentProbe::load(LPCWSTR file) {
+	LPDIRECT3DCUBETEXTURE9 pLoaded = 0;
+
+	if (FAILED(D3DXCreateCubeTextureFromFile(*pDevice, file, &pLoaded)))
+		return E_FAIL;
+
+	cleanup();
+	pCube = pLoaded;
+	isStatic = true;
+	for (int i = 0; i < 6; i++)
+		faceValid[i] = true;
+
+	LogMessage(TEXT("Loaded baked environment map %s"), file);
+	return S_OK;
+}
+
+/*
+Writes the current cube map to a DDS file. Render targets can not be read
+directly, so each face is copied to a system memory cube map first.
+
+@param file - The DDS file to write
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if a face has not been rendered yet or the copy or save fails.
+*/
+int EnvironmentProbe::bake(LPCWSTR file) {
+	LPDIRECT3DCUBETEXTURE9 pCopy = 0;
+	HRESULT r = S_OK;
+
+	if (isStatic || !isComplete()) {
+		SetError(TEXT("The environment map can only be baked once every face has been rendered"));
+		return E_FAIL;
+	}
+
+	if (FAILED((*pDevice)->CreateCubeTexture(PROBE_FACE_SIZE, 1, 0, D3DFMT_X8R8G8B8, D3DPOOL_SYSTEMMEM, &pCopy, NULL))) {
+		SetError(TEXT("Could not create the environment map copy"));
+		return E_FAIL;
+	}
+
+	for (int i = 0; i < 6 && SUCCEEDED(r); i++) {
+		LPDIRECT3DSURFACE9 pSource = 0, pDest = 0;
+
+		pCube->GetCubeMapSurface((D3DCUBEMAP_FACES)i, 0, &pSource);
+		pCopy->GetCubeMapSurface((D3DCUBEMAP_FACES)i, 0, &pDest);
+		r = (*pDevice)->GetRenderTargetData(pSource, pDest);
+		pSource->Release();
+		pDest->Release();
+	}
+
+	if (SUCCEEDED(r))
+		r = D3DXSaveTextureToFile(file, D3DXIFF_DDS, pCopy, NULL);
+	pCopy->Release();
+
+	if (FAILED(r)) {
+		SetError(TEXT("Could not bake the environment map to %s"), file);
+		return E_FAIL;
+	}
+
+	LogMessage(TEXT("Baked environment map to %s"), file);
+	return S_OK;
+}
+
+void EnvironmentProbe::cleanup() {
+	if (pCube)
+		pCube->Release();
+	pCube = 0;
+
+	if (pDepth)
+		pDepth->Release();
+	pDepth = 0;
+}
+
+/*
+Releases the render targets before the device is reset. A static probe is in
+the managed pool and is kept.
+*/
+void EnvironmentProbe::onLostDevice() {
+	if (!isStatic)
+		cleanup();
+}
+
+/*
+Recreates the render targets after the device has been reset. Their contents
+were lost, so every face is rendered again.
+*/
+void EnvironmentProbe::onResetDevice() {
+	if (!isStatic && !pCube)
+		createTargets();
+}
+
+bool EnvironmentProbe::isBaked() {
+	return isStatic;
+}
+
+/*
+Checks whether every face holds a rendered image.
+
+@return - Returns true once all six faces have been rendered at least once
+*/
+bool EnvironmentProbe::isComplete() {
+	for (int i = 0; i < 6; i++) {
+		if (!faceValid[i])
+			return false;
+	}
+	return pCube != 0;
+}
+
+LPDIRECT3DCUBETEXTURE9 EnvironmentProbe::getTexture() {
+	return pCube;
+}
+
+/*
+Builds the camera of a cube face: a 90 degree view from the probe along the
+face's axis, with the up vectors Direct3D's cube maps expect.
+
+@param face - The face, a D3DCUBEMAP_FACES value
+@param view - Receives the view matrix
+@param proj - Receives the projection matrix
+*/
+void EnvironmentProbe::getFaceMatrices(int face, D3DXMATRIX* view, D3DXMATRIX* proj) {
+	static const D3DXVECTOR3 looks[6] = {
+		D3DXVECTOR3(1.0f, 0.0f, 0.0f), D3DXVECTOR3(-1.0f, 0.0f, 0.0f),
+		D3DXVECTOR3(0.0f, 1.0f, 0.0f), D3DXVECTOR3(0.0f, -1.0f, 0.0f),
+		D3DXVECTOR3(0.0f, 0.0f, 1.0f), D3DXVECTOR3(0.0f, 0.0f, -1.0f)
+	};
+	static const D3DXVECTOR3 ups[6] = {
+		D3DXVECTOR3(0.0f, 1.0f, 0.0f), D3DXVECTOR3(0.0f, 1.0f, 0.0f),
+		D3DXVECTOR3(0.0f, 0.0f, -1.0f), D3DXVECTOR3(0.0f, 0.0f, 1.0f),
+		D3DXVECTOR3(0.0f, 1.0f, 0.0f), D3DXVECTOR3(0.0f, 1.0f, 0.0f)
+	};
+	D3DXVECTOR3 at = position + looks[face];
+
+	D3DXMatrixLookAtLH(view, &position, &at, &ups[face]);
+	D3DXMatrixPerspectiveFovLH(proj, D3DX_PI / 2, 1.0f, 0.1f, 100.0f);
+}
+
+/*
+Checks whether the probe is inside an Object's bounding sphere. Such an Object
+would cover whole faces from the inside, so it is left out of the cube map.
+
+@param center - The center of the bounding sphere
+@param radius - The radius of the bounding sphere
+
+@return - Returns true if the probe is inside the sphere
+*/
+bool EnvironmentProbe::contains(const D3DXVECTOR3& center, float radius) {
+	D3DXVECTOR3 offset = center - position;
+
+	return D3DXVec3LengthSq(&offset) < radius * radius;
+}
+
+/*
+Summarizes what a face sees: the placement and detail level of every Object in
+the face's frustum that the probe is not inside, and the scene state passed in for everything else that
+changes the image, such as the lights.
+
+@param face - The face to summarize
+@param items - The Objects in the scene as they will be drawn
+@param count - The number of items
+@param sceneState - A hash of the rest of the scene's state
+
+@return - The signature of the face
+*/
+unsigned long long EnvironmentProbe::computeSignature(int face, const DrawItem* items, int count, unsigned long long sceneState) {
+	unsigned long long signature = HashBytes(HASH_SEED, &sceneState, sizeof(sceneState));
+	D3DXMATRIX view, proj, viewProj;
+	Frustum frustum;
+
+	getFaceMatrices(face, &view, &proj);
+	viewProj = view * proj;
+	BuildFrustum(viewProj, &frustum);
+
+	for (int i = 0; i < count; i++) {
+		const DrawItem& item = items[i];
+
+		if (!SphereInFrustum(frustum, item.center, item.radius) || contains(item.center, item.radius))
+			continue;
+
+		signature = HashBytes(signature, &item.object, sizeof(item.object));
+		signature = HashBytes(signature, &item.world, sizeof(D3DXMATRIX));
+		signature = HashBytes(signature, &item.lod, sizeof(item.lod));
+	}
+
+	return signature;
+}
+
+/*
+Picks the faces to render this frame. Faces are visited in turn from where the
+last search stopped; a face is picked if it has never been rendered or if what
+it sees has changed, and unchanged faces are skipped. At most
+PROBE_FACES_PER_FRAME faces are picked.
+
+@param objects - The Objects in the scene
+@param count - The number of Objects
+@param sceneState - A hash of the rest of the scene's state
+@param faces - Receives the faces to render, room for PROBE_FACES_PER_FRAME
+
+@return - The number of faces picked
+*/
+int EnvironmentProbe::selectFaces(const DrawItem* items, int count, unsigned long long sceneState, int* faces) {
+	int picked = 0;
+
+	if (isStatic || !pCube)
+		return 0;
+
+	for (int tried = 0; tried < 6 && picked < PROBE_FACES_PER_FRAME; tried++) {
+		int face = nextFace;
+		unsigned long long signature = computeSignature(face, items, count, sceneState);
+
+		nextFace = (nextFace + 1) % 6;
+		if (faceValid[face] && signature == faceSignatures[face]) {
+			facesSkipped++;
+			continue;
+		}
+
+		pendingSignature[face] = signature;
+		faces[picked++] = face;
+	}
+
+	return picked;
+}
+
+/*
+Redirects rendering to a cube face and clears it. The caller draws every Object
+inside the returned frustum with the returned matrices, then calls endFace.
+
+@param face - The face to render
+@param view - Receives the view matrix of the face
+@param proj - Receives the projection matrix of the face
+@param frustum - Receives the frustum of the face
+
+@return - Returns false if the face can not be rendered to
+*/
+bool EnvironmentProbe::beginFace(int face, D3DXMATRIX* view, D3DXMATRIX* proj, Frustum* frustum) {
+	LPDIRECT3DSURFACE9 pFace = 0;
+	D3DXMATRIX viewProj;
+
+	if (FAILED(pCube->GetCubeMapSurface((D3DCUBEMAP_FACES)face, 0, &pFace)))
+		return false;
+
+	(*pDevice)->GetRenderTarget(0, &pSavedTarget);
+	(*pDevice)->GetDepthStencilSurface(&pSavedDepth);
+	(*pDevice)->GetViewport(&savedViewport);
+
+	// Setting the render target also sets the viewport to the whole face
+	(*pDevice)->SetRenderTarget(0, pFace);
+	(*pDevice)->SetDepthStencilSurface(pDepth);
+	pFace->Release();
+
+	(*pDevice)->Clear(0, NULL, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, D3DCOLOR_XRGB(0, 0, 25), 1.0f, 0);
+
+	getFaceMatrices(face, view, proj);
+	viewProj = *view * *proj;
+	BuildFrustum(viewProj, frustum);
+	currentFace = face;
+
+	return true;
+}
+
+/*
+Puts the back buffer, its depth buffer and viewport back after a face has been
+rendered, and records what the face saw.
+*/
+void EnvironmentProbe::endFace() {
+	(*pDevice)->SetRenderTarget(0, pSavedTarget);
+	(*pDevice)->SetDepthStencilSurface(pSavedDepth);
+	(*pDevice)->SetViewport(&savedViewport);
+	pSavedTarget->Release();
+	pSavedDepth->Release();
+	pSavedTarget = 0;
+	pSavedDepth = 0;
+
+	faceValid[currentFace] = true;
+	faceSignatures[currentFace] = pendingSignature[currentFace];
+	facesRendered++;
+	currentFace = -1;
+}
+
+/*
+Gets how many faces were rendered and skipped since the last call, and resets
+the counts.
+
+@param rendered - Receives the number of faces rendered
+@param skipped - Receives the number of faces skipped because nothing they see changed
+*/
+void EnvironmentProbe::getCounters(DWORD* rendered, DWORD* skipped) {
+	*rendered = facesRendered;
+	*skipped = facesSkipped;
+	facesRendered = 0;
+	facesSkipped = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef ENVIRONMENTPROBE_H
+#define ENVIRONMENTPROBE_H
+
+#include "Headers.h"
+
+//Edge length in texels of each face of the environment cube map.
+#define PROBE_FACE_SIZE 256
+//Most cube faces rendered in one frame; the rest wait for later frames.
+#define PROBE_FACES_PER_FRAME 2
+
+/*
+An EnvironmentProbe captures the scene around a point into a cube map for
+reflect.fx. Dynamic probes render a few faces each frame in turn, and skip a face
+when nothing it sees has changed since it was last rendered. A probe can also be
+baked to a DDS file and loaded back as a static cube map that is never rendered.
+*/
+class EnvironmentProbe {
+private:
+	LPDIRECT3DDEVICE9* pDevice;
+	LPDIRECT3DCUBETEXTURE9 pCube; // Render target in the default pool, or the loaded static map
+	LPDIRECT3DSURFACE9 pDepth; // Depth buffer the size of one face
+	LPDIRECT3DSURFACE9 pSavedTarget, pSavedDepth; // Back buffer and depth buffer while a face is rendered
+	D3DVIEWPORT9 savedViewport;
+	D3DXVECTOR3 position;
+	bool isStatic;
+	int nextFace; // Face the next search for stale faces starts at
+	int currentFace; // Face being rendered between beginFace and endFace
+	bool faceValid[6];
+	unsigned long long faceSignatures[6]; // What each face saw when it was last rendered
+	unsigned long long pendingSignature[6];
+	DWORD facesRendered, facesSkipped; // Since the counters were last reset
+
+	int createTargets();
+	unsigned long long computeSignature(int face, const DrawItem* items, int count, unsigned long long sceneState);
+
+public:
+	EnvironmentProbe();
+	void setDevice(LPDIRECT3DDEVICE9*);
+	void setPosition(const D3DXVECTOR3&);
+	const D3DXVECTOR3& getPosition();
+	int init();
+	int load(LPCWSTR file);
+	int bake(LPCWSTR file);
+	void cleanup();
+	void onLostDevice();
+	void onResetDevice();
+	bool isBaked();
+	bool isComplete();
+	bool contains(const D3DXVECTOR3& center, float radius);
+	LPDIRECT3DCUBETEXTURE9 getTexture();
+	void getFaceMatrices(int face, D3DXMATRIX* view, D3DXMATRIX* proj);
+	int selectFaces(const DrawItem* items, int count, unsigned long long sceneState, int* faces);
+	bool beginFace(int face, D3DXMATRIX* view, D3DXMATRIX* proj, Frustum* frustum);
+	void endFace();
+	void getCounters(DWORD* rendered, DWORD* skipped);
+};
+
+#endif // !ENVIRONMENTPROBE_H
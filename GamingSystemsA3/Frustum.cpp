@@ -0,0 +1,69 @@
+#include "Frustum.h"
+
+/*
+Extracts the planes of the frustum from a combined view and projection matrix.
+The planes are in the space the matrix transforms from, so a matrix that
+includes a reflection gives planes that test unreflected positions.
+
+@param viewProj - The view matrix multiplied by the projection matrix
+@param frustum - Receives the normalized planes
+*/
+void BuildFrustum(const D3DXMATRIX& viewProj, Frustum* frustum) {
+	const D3DXMATRIX& m = viewProj;
+
+	// Direct3D clips to -w <= x <= w, -w <= y <= w and 0 <= z <= w
+	frustum->planes[0] = D3DXPLANE(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41);
+	frustum->planes[1] = D3DXPLANE(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41);
+	frustum->planes[2] = D3DXPLANE(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42);
+	frustum->planes[3] = D3DXPLANE(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42);
+	frustum->planes[4] = D3DXPLANE(m._13, m._23, m._33, m._43);
+	frustum->planes[5] = D3DXPLANE(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43);
+
+	for (int i = 0; i < 6; i++)
+		D3DXPlaneNormalize(&frustum->planes[i], &frustum->planes[i]);
+}
+
+/*
+Checks whether a sphere is at least partly inside a frustum.
+
+@param frustum - The frustum to test against
+@param center - The center of the sphere
+@param radius - The radius of the sphere
+
+@return - Returns false if the sphere is entirely outside one of the planes
+*/
+bool SphereInFrustum(const Frustum& frustum, const D3DXVECTOR3& center, float radius) {
+	for (int i = 0; i < 6; i++) {
+		if (D3DXPlaneDotCoord(&frustum.planes[i], &center) < -radius)
+			return false;
+	}
+	return true;
+}
+
+/*
+Checks where an axis-aligned box lies relative to a frustum. For each plane only
+the corner furthest along the plane's normal and the one furthest against it are
+tested.
+
+@param frustum - The frustum to test against
+@param boxMin - The corner of the box with the smallest coordinates
+@param boxMax - The corner of the box with the largest coordinates
+
+@return - FRUSTUM_OUTSIDE if the box is entirely outside one of the planes,
+		  FRUSTUM_INSIDE if it is inside all of them, FRUSTUM_INTERSECTS otherwise
+*/
+FrustumOverlap BoxInFrustum(const Frustum& frustum, const D3DXVECTOR3& boxMin, const D3DXVECTOR3& boxMax) {
+	FrustumOverlap overlap = FRUSTUM_INSIDE;
+
+	for (int i = 0; i < 6; i++) {
+		const D3DXPLANE& plane = frustum.planes[i];
+		D3DXVECTOR3 inner(plane.a >= 0.0f ? boxMax.x : boxMin.x, plane.b >= 0.0f ? boxMax.y : boxMin.y, plane.c >= 0.0f ? boxMax.z : boxMin.z);
+		D3DXVECTOR3 outer(plane.a >= 0.0f ? boxMin.x : boxMax.x, plane.b >= 0.0f ? boxMin.y : boxMax.y, plane.c >= 0.0f ? boxMin.z : boxMax.z);
+
+		if (D3DXPlaneDotCoord(&plane, &inner) < 0.0f)
+			return FRUSTUM_OUTSIDE;
+		if (D3DXPlaneDotCoord(&plane, &outer) < 0.0f)
+			overlap = FRUSTUM_INTERSECTS;
+	}
+	return overlap;
+}
@@ -0,0 +1,19 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "CoreMath.h"
+
+//The six planes of a view frustum, facing inwards: left, right, bottom, top, near, far.
+struct Frustum
+{
+	D3DXPLANE planes[6];
+};
+
+//Where a box lies relative to a frustum.
+enum FrustumOverlap { FRUSTUM_OUTSIDE, FRUSTUM_INTERSECTS, FRUSTUM_INSIDE };
+
+void BuildFrustum(const D3DXMATRIX& viewProj, Frustum*);
+bool SphereInFrustum(const Frustum&, const D3DXVECTOR3& center, float radius);
+FrustumOverlap BoxInFrustum(const Frustum&, const D3DXVECTOR3& boxMin, const D3DXVECTOR3& boxMax);
+
+#endif // !FRUSTUM_H
@@ -1,4 +1,5 @@
 #include "Headers.h"
+#include <cfloat>
 
 /*
  Sets up and creates the directX render device that will display the game.
@@ -12,15 +13,18 @@
  @param ppDevice - A pointer to the graphics device that will store the
  				   created device
  
+ A headless benchmark creates the null reference device instead, which takes
+ every call but draws nothing, to time the CPU side of a frame without a GPU.
+ 
  @return - Returns an int to be used as an HRESULT in the FAILED() macro.
 		   Fails if:
 			- It can not get the display adapter information
 			- It can not create the render device
  */
 int Game::InitDirect3DDevice(HWND hWndTarget, BOOL bWindowed, D3DFORMAT FullScreenFormat, LPDIRECT3D9 pD3D, LPDIRECT3DDEVICE9* ppDevice) {
-	D3DPRESENT_PARAMETERS d3dpp;//rendering info
 	D3DDISPLAYMODE d3ddm;//current display mode info
 	HRESULT r = 0;
+	D3DDEVTYPE deviceType = headless ? D3DDEVTYPE_NULLREF : D3DDEVTYPE_HAL;
 
 	if (*ppDevice)
 		(*ppDevice)->Release();
@@ -34,8 +38,8 @@ int Game::InitDirect3DDevice(HWND hWndTarget, BOOL bWindowed, D3DFORMAT FullScre
 
 	//bWindowed = !bWindowed;
 
-	width = d3ddm.Width;
-	height = d3ddm.Height;
+	width = headless ? 512 : d3ddm.Width;
+	height = headless ? 512 : d3ddm.Height;
 
 	d3dpp.BackBufferWidth = width;
 	d3dpp.BackBufferHeight = height;
@@ -46,37 +50,127 @@ int Game::InitDirect3DDevice(HWND hWndTarget, BOOL bWindowed, D3DFORMAT FullScre
 	d3dpp.hDeviceWindow = hWndTarget;
 	d3dpp.Windowed = bWindowed;
 	d3dpp.EnableAutoDepthStencil = TRUE;
-	d3dpp.AutoDepthStencilFormat = D3DFMT_D16;
+	d3dpp.AutoDepthStencilFormat = ChooseDepthFormat(pD3D, deviceType, d3ddm.Format, d3dpp.BackBufferFormat);
+	hasStencil = d3dpp.AutoDepthStencilFormat != D3DFMT_D16;
 	d3dpp.FullScreen_RefreshRateInHz = 0;//default refresh rate
-	d3dpp.PresentationInterval = bWindowed ? 0 : D3DPRESENT_INTERVAL_IMMEDIATE;
+	// A benchmark presents as fast as it can, windowed or not, so vsync does not cap it
+	d3dpp.PresentationInterval = bWindowed && benchmarkScene.empty() ? 0 : D3DPRESENT_INTERVAL_IMMEDIATE;
 	d3dpp.Flags = D3DPRESENTFLAG_LOCKABLE_BACKBUFFER;
 
-	r = pD3D->CreateDevice(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, hWndTarget, D3DCREATE_SOFTWARE_VERTEXPROCESSING, &d3dpp, ppDevice);
+	r = pD3D->CreateDevice(D3DADAPTER_DEFAULT, deviceType, hWndTarget,
+		ResourceManager::chooseVertexProcessing(pD3D, deviceType), &d3dpp, ppDevice);
 	if (FAILED(r)) {
 		SetError(TEXT("Could not create the render device"));
 		return E_FAIL;
 	}
 
+	SetDeviceStates();
+
+	return S_OK;
+}
+
+/*
+ Picks the depth buffer format, preferring formats with a stencil buffer for the
+ mirror. Falls back to a 16-bit depth buffer without stencil.
+
+ @param pD3D - The directX COM object used to check the formats
+ @param deviceType - The type of device the formats are for
+ @param adapterFormat - The display mode format of the adapter
+ @param backBufferFormat - The format of the back buffer the depth buffer is used with
+
+ @return - The first supported format
+ */
+D3DFORMAT Game::ChooseDepthFormat(LPDIRECT3D9 pD3D, D3DDEVTYPE deviceType, D3DFORMAT adapterFormat, D3DFORMAT backBufferFormat) {
+	static const D3DFORMAT formats[] = { D3DFMT_D24S8, D3DFMT_D24X4S4, D3DFMT_D15S1 };
+
+	for (int i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		if (SUCCEEDED(pD3D->CheckDeviceFormat(D3DADAPTER_DEFAULT, deviceType, adapterFormat, D3DUSAGE_DEPTHSTENCIL, D3DRTYPE_SURFACE, formats[i])) &&
+			SUCCEEDED(pD3D->CheckDepthStencilMatch(D3DADAPTER_DEFAULT, deviceType, adapterFormat, backBufferFormat, formats[i])))
+			return formats[i];
+	}
+
+	SetError(TEXT("No depth format with a stencil buffer, the mirror is disabled"));
+	return D3DFMT_D16;
+}
+
+/*
+ Sets the render states, lights and transforms that the game relies on. Device
+ state does not survive a reset, so this is called again after every reset.
+ */
+void Game::SetDeviceStates() {
 	// Turn on the zbuffer
-	(*ppDevice)->SetRenderState(D3DRS_ZENABLE, TRUE);
+	pDevice->SetRenderState(D3DRS_ZENABLE, TRUE);
 
 	// Turn on ambient lighting 
-	(*ppDevice)->SetRenderState(D3DRS_AMBIENT, 0xffffffff);
+	pDevice->SetRenderState(D3DRS_AMBIENT, ambientOn ? 0xffffffff : 0x00000000);
 
+	pDevice->SetRenderState(D3DRS_LIGHTING, TRUE);
+}
+
+/*
+ Resets the device once the window can be rendered to again, after the render
+ thread found it lost. Default pool resources are released before the reset and
+ recreated after it; managed resources are restored by the runtime.
+
+ Direct3D 9 must reset a full screen device on the thread that owns its focus
+ window, so this runs on the window thread, with no frame in flight so the
+ render thread is not using the device meanwhile.
+
+ @return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		   Returns S_FALSE while the device is lost and nothing should be rendered.
+		   Fails if the device could not be reset.
+ */
+int Game::HandleLostDevice() {
+	HRESULT r;
+
+	pipeline->waitIdle();
+	r = pDevice->TestCooperativeLevel();
+
+	if (r == D3DERR_DEVICELOST) {
+		Sleep(50);
+		return S_FALSE;
+	}
+
+	if (r == D3DERR_DEVICENOTRESET) {
+		font->OnLostDevice();
+		effects.onLostDevice();
+		probe.onLostDevice();
+		resources.onLostDevice();
+
+		r = pDevice->Reset(&d3dpp);
+		if (FAILED(r)) {
+			SetError(TEXT("Could not reset the render device"));
+			return E_FAIL;
+		}
+
+		font->OnResetDevice();
+		effects.onResetDevice();
+		resources.onResetDevice();
+		probe.onResetDevice();
+
+		SetDeviceStates();
+		lightManager.onResetDevice();
+
+		resources.reportResidency();
+	}
+
+	deviceLost = false;
 	return S_OK;
 }
 
 /*
  The default constructor for a Game object, initializes its member variables.
  */
-Game::Game() :pD3D(0), pDevice(0), backSurface(0), bmpSurface(0), frame(FrameTracker()), fps(0) {}
+Game::Game() :pDevice(0), backSurface(0), frame(FrameTracker()), pipelined(true), deviceLost(false), bakeRequested(false), specularEffect(0), reflectEffect(0), effectsLoaded(false), compactVertices(false), renderPath(RENDER_FIXED), reflectivity(0.5f), ambientOn(true), fps(0), headless(false), drawStats(0) {
+}
 
 /*
 A constructor for a Game object that stores the hWnd, initializes its member variables.
 
 @param newHwnd - The handle to the window that created the game object.
 */
-Game::Game(HWND newHwnd) :hWnd(newHwnd), pD3D(0), pDevice(0), backSurface(0), bmpSurface(0), frame(FrameTracker()), fps(0) {}
+Game::Game(HWND newHwnd) :hWnd(newHwnd), pDevice(0), backSurface(0), frame(FrameTracker()), pipelined(true), deviceLost(false), bakeRequested(false), specularEffect(0), reflectEffect(0), effectsLoaded(false), compactVertices(false), renderPath(RENDER_FIXED), reflectivity(0.5f), ambientOn(true), fps(0), headless(false), drawStats(0) {
+}
 
 /*
  A setter for the hWnd field of the Game class.
@@ -133,7 +227,9 @@ The WndProc processes messages sent to it by the OS.
 @return Returns the result of the message processing and depends on the message sent
 */
 long CALLBACK Game::WndProc(HWND paramHWND, UINT uMessage, WPARAM wParam, LPARAM lParam) {
-	POINT curPos;
+	// Key and mouse input is queued and applied once per frame in simulate
+	if (input.handleMessage(uMessage, wParam, lParam))
+		return 0;
 
 	switch (uMessage) {
 		case WM_CREATE:
@@ -145,138 +241,6 @@ long CALLBACK Game::WndProc(HWND paramHWND, UINT uMessage, WPARAM wParam, LPARAM
 			ValidateRect(hWnd, NULL);//basically saying - yeah we took care of any paint msg without any overhead
 			return 0;
 		}
-		case WM_LBUTTONDOWN:  // *** PICKING ***
-		{
-			GetCursorPos(&startPos);
-
-			// compute the ray in view space given the clicked screen point
-			Ray ray = CalcPickingRay(LOWORD(lParam), HIWORD(lParam));
-
-			// transform the ray to world space
-			D3DXMATRIX view;
-			pDevice->GetTransform(D3DTS_VIEW, &view);
-
-			D3DXMATRIX viewInverse;
-			D3DXMatrixInverse(&viewInverse, 0, &view);
-
-			TransformRay(&ray, &viewInverse);
-			//selectedModel = 0;
-			wostringstream ss;
-			int i = 0;
-			for (Object obj: models) {
-				models[i]._radius = 1.0;
-				models[i]._center.x = models[i].worldMatrix._41; //x 
-				models[i]._center.y = models[i].worldMatrix._42 +1; //y
-				models[i]._center.z = models[i].worldMatrix._43; //z
-				float p41 = models[i].worldMatrix._41;
-				float p42 = models[i].worldMatrix._42;
-				float p43 = models[i].worldMatrix._43;
-				float p44 = models[i].worldMatrix._44;
-				// test for a hit
-				if (raySphereIntersectionTest(&ray, &models[i])) {
-					
-					/*if (i == 0) {
-						::MessageBox(0, TEXT("Hit Dwarf!"), TEXT("HIT"), 0);
-						ss << "HIT Dwarf obj:  " << i << endl;
-					}
-					else {
-						::MessageBox(0, TEXT("Hit Tiger!"), TEXT("HIT"), 0);
-						ss << "HIT Tiger obj:  " << i << endl;
-					}
-					ss << "test matrix obj: "  << i << "\n" << p41 << " , " << p42 << " , " << p43 << " , " << p44 << endl;
-					OutputDebugStringW(ss.str().c_str()); */
-					selectedModel = i;
-				}
-				i++;
-			}
-
-			return 0;
-		}
-		case WM_RBUTTONDOWN:
-		{
-			GetCursorPos(&startPos);
-			return 0;
-		}
-		case WM_MBUTTONDOWN:
-		{
-			GetCursorPos(&startPos);
-			return 0;
-		}
-		case WM_MOUSEMOVE:
-		{
-			if (wParam == MK_LBUTTON) {
-				GetCursorPos(&curPos);
-				models[selectedModel].translate((curPos.x - startPos.x) / 200.0f, -(curPos.y - startPos.y) / 200.0f, 0);
-				startPos = curPos;
-			}
-			if (wParam == MK_RBUTTON) {
-				GetCursorPos(&curPos);
-				models[selectedModel].rotateAboutX(-(curPos.y - startPos.y) / 100.0f);
-				models[selectedModel].rotateAboutY(-(curPos.x - startPos.x) / 100.0f);
-				startPos = curPos;
-			}
-			if (wParam == MK_MBUTTON) {
-				GetCursorPos(&curPos);
-				models[selectedModel].rotateAboutZ(-(curPos.x - startPos.x) / 1000.0f);
-				models[selectedModel].translate(0.0f, 0.0f, (curPos.y - startPos.y) / 200.0f);
-
-			}
-			return 0;
-		}
-		case WM_KEYDOWN:
-			if (wParam == 0x31) {
-				/*selectedModel = 0;
-				float p41 = models[selectedModel].worldMatrix._41;
-				float p42 = models[selectedModel].worldMatrix._42;
-				float p43 = models[selectedModel].worldMatrix._43;
-				float p44 = models[selectedModel].worldMatrix._44;
-				/*wostringstream ss;
-				ss << "test matrix obj 0: \n " << p41 << " , " << p42 << " , " << p43 << " , " << p44 << endl;
-				OutputDebugStringW(ss.str().c_str()); */
-				//MessageBox(0, TEXT("Mesh Matrix:"), models[selectedModel].worldMatrix._11, 0);
-			}
-			if (wParam == 0x32) {
-				/*selectedModel = 1;
-				float p41 = models[selectedModel].worldMatrix._41;
-				float p42 = models[selectedModel].worldMatrix._42;
-				float p43 = models[selectedModel].worldMatrix._43;
-				float p44 = models[selectedModel].worldMatrix._44;
-				/*wostringstream ss;
-				ss << "test matrix obj 1: \n " << p41 << " , " << p42 << " , " << p43 << " , " << p44 << endl;
-				OutputDebugStringW(ss.str().c_str());*/
-			}
-			if (wParam == 0x33) {
-				lightsOn[0] = !lightsOn[0];
-				if (lightsOn[0])
-				{
-					// Turn on ambient lighting 
-					pDevice->SetRenderState(D3DRS_AMBIENT, 0xFFFFFFFF);
-				}
-				else 
-				{
-					// Turn off ambient lighting 
-					pDevice->SetRenderState(D3DRS_AMBIENT, 0x00000000);
-				}
-			}
-			if (wParam == 0x34) {
-				lightsOn[1] = !lightsOn[1];
-
-				// Turn on/off directional light
-				pDevice->LightEnable(0, lightsOn[1]);
-			}
-			if (wParam == 0x35) {
-				lightsOn[2] = !lightsOn[2];
-
-				// Turn on/off directional light
-				pDevice->LightEnable(1, lightsOn[2]);
-			}
-			if (wParam == 0x36) {
-				lightsOn[3] = !lightsOn[3];
-
-				// Turn on/off directional light
-				pDevice->LightEnable(2, lightsOn[3]);
-			}
-			return 0;
 		case WM_DESTROY:
 		{
 			PostQuitMessage(0);
@@ -289,6 +253,66 @@ long CALLBACK Game::WndProc(HWND paramHWND, UINT uMessage, WPARAM wParam, LPARAM
 	}
 }
 
+/*
+Records the input of every frame from the start of the game, to be written to a
+file when the game shuts down.
+
+@param file - The file the recording is written to
+*/
+void Game::recordInput(LPCWSTR file) {
+	recordFile = file;
+	input.startRecording();
+}
+
+/*
+Plays a recording made with recordInput in place of live input, and quits once
+every recorded frame has been simulated. Each frame takes the time step it was
+recorded with, so a replay simulates the same frames however fast it renders
+and the time it takes measures performance alone.
+
+@param file - The recording to replay
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the recording can not be loaded.
+*/
+int Game::replayInput(LPCWSTR file) {
+	return input.loadReplay(file);
+}
+
+/*
+Runs a benchmark from the first frame: the camera flies a fixed path with a
+fixed time step, vsync is off, and once it is done a JSON report is written to
+<scene>.benchmark.json and the game quits. Must be called before GameInit.
+
+@param scene - Names the run and picks the camera path, see Benchmark
+@param nullDevice - Whether to render on the null reference device, with no GPU work
+*/
+void Game::setBenchmark(LPCWSTR scene, bool nullDevice) {
+	benchmarkScene = scene;
+	headless = nullDevice;
+}
+
+/*
+Sets how much device memory the models' streamed textures may take.
+
+@param bytes - The budget
+*/
+void Game::setStreamingBudget(unsigned long long bytes) {
+	streaming.setBudget(bytes);
+}
+
+/*
+Has the models converted to the compact vertex layout, which halves their vertex
+memory but drops normal mapping. Only the effects decode compact vertices, so the
+models keep float vertices if the effects do not load. Must be called before
+GameInit.
+
+@param enable - Whether to convert the models
+*/
+void Game::setCompactVertices(bool enable) {
+	compactVertices = enable;
+}
+
 /*
  Initializes the directX surfaces, device, and various components used to
  display the game.
@@ -305,7 +329,7 @@ int Game::GameInit() {
 	D3DSURFACE_DESC desc;
 	LPDIRECT3DSURFACE9 pSurface = 0;
 
-	pD3D = Direct3DCreate9(D3D_SDK_VERSION);//COM object
+	pD3D.Attach(Direct3DCreate9(D3D_SDK_VERSION));//COM object
 	if (pD3D == NULL) {
 		SetError(TEXT("Could not create IDirect3D9 object"));
 		return E_FAIL;
@@ -346,19 +370,88 @@ int Game::GameInit() {
 
 	cam = Camera(Camera::CameraType::AIRCRAFT);
 
+	resources.setDevice(&pDevice);
+
+	// Loaded before the models, which can only be made compact if the effects are there to draw them
+	effects.setDevice(&pDevice);
+	if (FAILED(loadEffects()))
+		SetError(TEXT("Could not load effects, drawing with the fixed-function pipeline"));
+
 	models[0] = Object(&pDevice, TEXT("Dwarf.x"));
+	models[0].setStreaming(&streaming);
+	models[0].setCompactVertices(compactVertices && effectsLoaded);
 	models[0].InitGeometry();
+	resources.registerObject(&models[0]);
 
 	models[1] = Object(&pDevice, TEXT("tiger.x"));
+	models[1].setStreaming(&streaming);
+	models[1].setCompactVertices(compactVertices && effectsLoaded);
 	models[1].InitGeometry();
+	resources.registerObject(&models[1]);
+
+	// Every texture is registered by now; they load as the first frames find them wanted
+	streaming.start();
+
+	// Only textures stream. Every detail level of both models stays resident in the managed pool: together
+	// they are a small part of what the textures take, the coarsest level is the occluder, and hot reload
+	// swaps whole meshes. The numbers are logged so the argument is checked against the shipped assets
+	ResidencyStats meshes;
+	StreamingStats textureStats;
+	resources.getTotals(&meshes);
+	streaming.takeStats(&textureStats);
+	LogMessage(TEXT("Residency budget: meshes %.2f MB always resident, streamed textures %.2f MB at full detail, budget %.2f MB"),
+		(meshes.vertexBytes + meshes.indexBytes) / 1048576.0, textureStats.bytesOnDisk / 1048576.0, textureStats.budget / 1048576.0);
+	if (meshes.vertexBytes + meshes.indexBytes > textureStats.budget * STREAMING_MESH_SHARE)
+		SetError(TEXT("The model meshes take more than %.0f%% of the streaming budget and should be streamed too"), STREAMING_MESH_SHARE * 100.0);
+
+	// The models hide each other through their coarsest detail levels
+	for (int i = 0; i < 2; i++)
+		occluderMeshes[i] = occlusion.addOccluder(models[i].getOccluderVertices(), models[i].getOccluderIndices());
+
+	// Edited models and textures are swapped in as they are saved; a benchmark keeps what it started with
+	if (benchmarkScene.empty()) {
+		for (int i = 0; i < 2; i++)
+			hotReload.addModel(&models[i]);
+		hotReload.start(&streaming);
+	}
+
+	resources.reportResidency();
 
 	selectedModel = 0;
 
+	// Per-frame work that splits into many independent items, such as binning large numbers of lights, runs on every hardware thread
+	jobs.reset(new JobSystem());
+	jobs->start(0);
+	lightManager.setJobSystem(jobs.get());
+	occlusion.setJobSystem(jobs.get());
+
+	frameArena.reset(new LinearArena(FRAME_ARENA_BLOCK, MEMORY_FRAME));
+	lightManager.setFrameArena(frameArena.get());
+
 	createLights();
 
-	lightsOn[1] = false;
-	lightsOn[2] = false;
-	lightsOn[3] = false;
+	// A mirror on the floor below the models
+	mirror.setDevice(&pDevice);
+	if (hasStencil && FAILED(mirror.init(D3DXPLANE(0.0f, 1.0f, 0.0f, 1.0f), D3DXVECTOR3(0.0f, -1.0f, 0.0f), 5.0f)))
+		SetError(TEXT("Could not create the mirror"));
+
+	// An environment map captured between the models for reflect.fx; a baked map is used as is
+	probe.setDevice(&pDevice);
+	probe.setPosition(D3DXVECTOR3(0.0f, 1.0f, 0.0f));
+	if (FAILED(probe.load(TEXT(ENVMAP_PATH))) && FAILED(probe.init()))
+		SetError(TEXT("Could not create the environment map"));
+
+	// The same projection the models used to set on the device, kept so the game thread never reads it back
+	D3DXMatrixPerspectiveFovLH(&projection, D3DX_PI / 4, 1.0f, 1.0f, 100.0f);
+
+	// From here on only the render thread uses the device
+	pipeline.reset(new RenderPipeline());
+	pipeline->start(StaticRender, this);
+
+	lastTime = replayStart = timeGetTime();
+
+	if (!benchmarkScene.empty())
+		benchmark.start(benchmarkScene.c_str(), BENCHMARK_FRAMES);
 
 	return S_OK;
 }
@@ -369,28 +462,191 @@ Releases the resources used by the game, first the display adapter, and then the
 @return - Returns an int to be used as an HRESULT in the FAILED() macro. Should never fail.
 */
 int Game::GameShutdown() {
+	// The render thread has to let go of the device before anything is released
+	if (pipeline) {
+		pipeline->stop();
+		pipeline.reset();
+	}
+
+	if (input.isRecording())
+		input.saveRecording(recordFile.c_str());
+
+	// Nothing may be cooked for the models once they start going away
+	hotReload.shutdown();
+
+	effects.release();
+	mirror.cleanup();
+	probe.cleanup();
+
+	if (jobs) {
+		lightManager.setJobSystem(0);
+		occlusion.setJobSystem(0);
+		jobs.reset();
+	}
+
+	if (frameArena) {
+		lightManager.setFrameArena(0);
+		frameArena.reset();
+	}
+
 	for (int i = 0; i < 2; i++) {
+		resources.unregisterObject(&models[i]);
 		models[i].cleanup();
 	}
+	streaming.shutdown();
+
+	font.Release();
+	bmpSurface.Release();
 
-	if (pDevice)
+	if (pDevice) {
 		pDevice->Release();
+		pDevice = 0;
+	}
 
-	if (pD3D)
-		pD3D->Release();
+	pD3D.Release();
 
 	return S_OK;
 }
 
 /*
-Renders the next frame on a the back buffer surface with the background, fps counter,
-and user-drawn line. After rendering it uses the present method to show the frame.
+Reads input and moves the scene on by one frame, then records everything the
+frame is drawn from into a snapshot for the render thread. Nothing here touches
+the device.
+
+@param snapshot - The snapshot to fill
+@param secondPassed - Whether a second has passed since the last statistics were logged
+*/
+void Game::simulate(FrameSnapshot* snapshot, bool secondPassed) {
+	LARGE_INTEGER inputTime;
+	InputFrame inputFrame;
+	D3DVIEWPORT9 viewport = { 0, 0, (DWORD)width, (DWORD)height, 0.0f, 1.0f };
+	Frustum frustum;
+	D3DXVECTOR3 eye;
+
+	float curTime = timeGetTime();
+	float timeDelta = (curTime - lastTime) / 1000;
+
+	// A benchmark places the camera itself and steps time evenly
+	if (benchmark.isRunning())
+		timeDelta = benchmark.beginFrame(&cam);
+
+	QueryPerformanceCounter(&inputTime);
+	input.beginFrame(timeDelta, &inputFrame);
+	lastTime = curTime;
+
+	if (input.replayFinished()) {
+		LogMessage(TEXT("Replayed %u frames in %.3f s"), input.getReplayFrames(), (curTime - replayStart) / 1000);
+		PostQuitMessage(0);
+	}
+
+	if (!benchmark.isRunning())
+		applyInput(inputFrame);
+	else if (inputFrame.pressed[ACTION_QUIT])
+		PostQuitMessage(0);
+
+	// Models whose new meshes the render thread swapped in last frame also change their bounds and occluders now
+	if (hotReload.update(&reloadedModels)) {
+		for (DWORD r = 0; r < reloadedModels.size(); r++) {
+			DWORD m = reloadedModels[r];
+			occlusion.replaceOccluder(occluderMeshes[m], models[m].getOccluderVertices(), models[m].getOccluderIndices());
+		}
+	}
+
+	snapshot->inputTime = inputTime.QuadPart;
+	cam.getViewMatrix(&snapshot->view);
+	snapshot->proj = projection;
+	BuildFrustum(snapshot->view * snapshot->proj, &frustum);
+
+	lightManager.binLights(snapshot->view, snapshot->proj, viewport, 1.0f, 100.0f);
+
+	cam.getPosition(&eye);
+	streaming.update(eye, snapshot->proj, (float)height);
+
+	// Two models are far too few to pay for splitting across the job system
+	snapshot->items.resize(2);
+	for (int i = 0; i < 2; i++) {
+		DrawItem& item = snapshot->items[i];
+		Object& model = models[i];
+		DWORD ids[MAX_OBJECT_LIGHTS];
+		D3DXVECTOR3 viewCenter;
+
+		model.selectLod(snapshot->view, snapshot->proj, (float)height);
+		item.object = i;
+		item.world = model.getWorldMatrix();
+		item.lod = model.getLod();
+		model.getBoundingSphere(&item.center, &item.radius);
+		item.visible = false;
+		spatial.update(i, item.center, item.radius);
+
+		// Lights are chosen once per model and reused by the mirror and probe passes
+		D3DXVec3TransformCoord(&viewCenter, &item.center, &snapshot->view);
+		item.numLights = lightManager.gatherLights(viewCenter, item.radius, ids, MAX_OBJECT_LIGHTS);
+		for (DWORD l = 0; l < item.numLights; l++)
+			item.lights[l] = lightManager.getLight(ids[l]);
+	}
+
+	spatial.queryFrustum(frustum, &visibleModels);
+
+	// Models in the frustum draw their occluders, then the ones hidden behind them are not queued
+	occluders.clear();
+	occlusionQueries.clear();
+	for (DWORD v = 0; v < visibleModels.size(); v++) {
+		const DrawItem& item = snapshot->items[visibleModels[v]];
+		OccluderInstance occluder;
+		OcclusionQuery query;
+
+		occluder.mesh = occluderMeshes[item.object];
+		occluder.world = item.world;
+		occluders.push_back(occluder);
+
+		query.boxMin = item.center - D3DXVECTOR3(item.radius, item.radius, item.radius);
+		query.boxMax = item.center + D3DXVECTOR3(item.radius, item.radius, item.radius);
+		occlusionQueries.push_back(query);
+	}
+	occlusion.render(snapshot->view * snapshot->proj, occluders.empty() ? NULL : &occluders[0], (DWORD)occluders.size());
+	occlusion.cull(occlusionQueries.empty() ? NULL : &occlusionQueries[0], (DWORD)occlusionQueries.size());
+	for (DWORD v = 0; v < visibleModels.size(); v++)
+		snapshot->items[visibleModels[v]].visible = !occlusionQueries[v].occluded;
+
+	snapshot->renderPath = renderPath;
+	snapshot->reflectivity = reflectivity;
+	snapshot->ambientOn = ambientOn;
+	snapshot->fps = fps;
+	snapshot->sceneSignature = sceneSignature();
+	snapshot->bakeProbe = bakeRequested;
+	snapshot->secondPassed = secondPassed;
+	bakeRequested = false;
+}
+
+/*
+Lets the RenderPipeline call renderFrame on the render thread.
+
+@param game - The Game to render
+@param snapshot - The frame to render
+@param stats - Counts what the frame submits
+
+@return - The result of renderFrame
+*/
+int Game::StaticRender(void* game, const FrameSnapshot& snapshot, DrawStats* stats) {
+	return ((Game*)game)->renderFrame(snapshot, stats);
+}
+
+/*
+Renders a frame on a the back buffer surface with the background, fps counter,
+and models. After rendering it uses the present method to show the frame. This
+runs on the render thread and is the only place the device is used once the
+game has started, but for resetting it once lost, so everything it draws comes
+from the snapshot. A lost device is only noticed here; frames are dropped until
+GameLoop has reset it on the window thread.
+
+@param snapshot - The frame to render
+@param stats - Counts the draw calls, triangles and state changes of the frame
 
 @return - Returns an int to be used as an HRESULT in the FAILED() macro.
 		  Fails if:
 			- A directX device has not yet been created
 */
-int Game::Render() {
+int Game::renderFrame(const FrameSnapshot& snapshot, DrawStats* stats) {
 	HRESULT r;
 	D3DLOCKED_RECT LockedRect;//locked area of display memory(buffer really) we are drawing to
 	LPDIRECT3DSURFACE9 pBackSurf = 0;
@@ -398,12 +654,9 @@ int Game::Render() {
 	RECT rect;
 	TEXTMETRIC fontMetrics;
 
-	//models[0].translate(0.01f, 0.0f, 0.0f);
-	//models[0].rotateAboutZ(1.0f);
-
 	font->GetTextMetrics(&fontMetrics);
 	UINT charWidth = fontMetrics.tmAveCharWidth;
-	_stprintf_s(text, 200, TEXT("FPS: %d"), fps);
+	_stprintf_s(text, 200, TEXT("FPS: %d"), snapshot.fps);
 
 	rect.top = 0;
 	rect.left = width - charWidth * (wcslen(text) + 2);
@@ -415,8 +668,37 @@ int Game::Render() {
 		return E_FAIL;
 	}
 
-	//clear the display arera with colour black, ignore stencil buffer
-	pDevice->Clear(0, 0, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, D3DCOLOR_XRGB(0, 0, 25), 1.0f, 0);
+	// The window thread resets the device; until it has, frames are dropped
+	if (deviceLost)
+		return S_FALSE;
+	if (FAILED(pDevice->TestCooperativeLevel())) {
+		deviceLost = true;
+		return S_FALSE;
+	}
+
+	// Textures that finished reading and models cooked again are created before anything is drawn with them.
+	// Not while the device is lost: they wait in their queues until it is back
+	streaming.service(pDevice);
+	hotReload.service();
+
+	if (snapshot.secondPassed) {
+		if (!probe.isBaked()) {
+			DWORD rendered, skipped;
+
+			probe.getCounters(&rendered, &skipped);
+			LogMessage(TEXT("Environment map: %u faces rendered, %u skipped"), rendered, skipped);
+		}
+		if (mirror.isEnabled())
+			LogMessage(TEXT("Mirror pass: %.3f ms, %u objects drawn, %u culled"), mirror.getMirrorTime(), mirror.getDrawnObjects(), mirror.getCulledObjects());
+		effects.checkForChanges();
+	}
+
+	if (snapshot.bakeProbe && FAILED(probe.bake(TEXT(ENVMAP_PATH)))) {
+		SetError(TEXT("Could not bake the environment map"));
+	}
+
+	//clear the display arera with colour black, and the stencil buffer the mirror is marked in
+	pDevice->Clear(0, 0, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER | (hasStencil ? D3DCLEAR_STENCIL : 0), D3DCOLOR_XRGB(0, 0, 25), 1.0f, 0);
 
 	//get pointer to backbuffer
 	r = pDevice->GetBackBuffer(0, 0, D3DBACKBUFFER_TYPE_MONO, &pBackSurf);
@@ -437,20 +719,52 @@ int Game::Render() {
 
 
 	pDevice->BeginScene();
+	drawStats = stats;
 
-	float curTime = timeGetTime();
+	pDevice->SetRenderState(D3DRS_AMBIENT, snapshot.ambientOn ? 0xFFFFFFFF : 0x00000000);
 
-	updateCam((curTime - lastTime) / 1000);
+	if (effectsLoaded) {
+		DWORD ids[] = { specularEffect, reflectEffect };
+		D3DXVECTOR4 ambient = snapshot.ambientOn ? D3DXVECTOR4(1.0f, 1.0f, 1.0f, 1.0f) : D3DXVECTOR4(0.0f, 0.0f, 0.0f, 0.0f);
 
-	lastTime = curTime;
+		for (int e = 0; e < 2; e++) {
+			LPD3DXEFFECT pEffect = effects.getEffect(ids[e]);
+			const EffectHandles& handles = effects.getHandles(ids[e]);
 
-	D3DXMATRIX camView;
+			if (handles.ambient)
+				pEffect->SetVector(handles.ambient, &ambient);
+			if (handles.reflectivity)
+				pEffect->SetFloat(handles.reflectivity, snapshot.reflectivity);
+		}
+	}
 
-	cam.getViewMatrix(&camView);
+	setViewProjection(snapshot.view, snapshot.proj);
 
-	for (int i = 0; i < 2; i++) {
-		models[i].setupMatrices(camView);
-		models[i].drawObject();
+	updateProbe(snapshot);
+
+	D3DXMATRIX mirrorView, mirrorProj;
+	Frustum mirrorFrustum;
+
+	if (mirror.beginMirror(snapshot.view, snapshot.proj, &mirrorView, &mirrorProj, &mirrorFrustum)) {
+		DWORD drawn = 0;
+
+		setViewProjection(mirrorView, mirrorProj);
+		for (DWORD i = 0; i < snapshot.items.size(); i++) {
+			const DrawItem& item = snapshot.items[i];
+
+			if (SphereInFrustum(mirrorFrustum, item.center, item.radius)) {
+				drawModel(item, mirrorView, snapshot.renderPath);
+				drawn++;
+			}
+		}
+		setViewProjection(snapshot.view, snapshot.proj);
+
+		mirror.endMirror(drawn, snapshot.items.size() - drawn);
+	}
+
+	for (DWORD i = 0; i < snapshot.items.size(); i++) {
+		if (snapshot.items[i].visible)
+			drawModel(snapshot.items[i], snapshot.view, snapshot.renderPath);
 	}
 
 	DWORD* pData = (DWORD*)(LockedRect.pBits);
@@ -462,6 +776,7 @@ int Game::Render() {
 	}
 
 	pDevice->EndScene();
+	drawStats = 0;
 
 	pBackSurf->UnlockRect();
 	pData = 0;
@@ -475,27 +790,90 @@ int Game::Render() {
 }
 
 /*
-The game loop updates the frame counter, and the fps if a second has passed, then calls
-render to update the screen.
+The game loop updates the frame counter, and the fps if a second has passed, then
+simulates the next frame into a snapshot for the render thread. When pipelining is
+switched off with the P key it waits for each frame to be presented before
+simulating the next, to compare against.
 
 @return - Returns an int to be used as an HRESULT in the FAILED() macro.
 */
 int Game::GameLoop() {
+	bool secondPassed;
+
 	frame.incCount();
 
-	if (frame.secondPassed()) {
+	secondPassed = frame.secondPassed();
+	if (secondPassed) {
+		RenderPipelineStats stats;
+
 		fps = frame.getFPS();
 		frame.startReset();
+		LogMessage(TEXT("FPS: %d, lights: %u, light binning: %.3f ms"), fps, lightManager.getNumLights(), lightManager.getBinTime());
+
+		const OcclusionStats& occlusionStats = occlusion.getStats();
+		LogMessage(TEXT("Occlusion: %u occluders, %u triangles, %u of %u objects culled, rasterize %.3f ms, test %.3f ms"),
+			occlusionStats.occluders, occlusionStats.triangles, occlusionStats.culled, occlusionStats.tested, occlusionStats.rasterizeTime, occlusionStats.testTime);
+
+		StreamingStats streamingStats;
+		streaming.takeStats(&streamingStats);
+		LogMessage(TEXT("Streaming: %u of %u textures resident, %.2f of %.2f MB, %.2f MB in flight, %u loads, %u trims, %u evictions, %u reloads, %u stalls"),
+			streamingStats.resident, streamingStats.textures, streamingStats.bytesResident / 1048576.0, streamingStats.budget / 1048576.0,
+			streamingStats.bytesInFlight / 1048576.0, streamingStats.loads, streamingStats.trims, streamingStats.evictions, streamingStats.reloads, streamingStats.stalls);
+		if (benchmark.isRunning())
+			benchmark.addStreamingStats(streamingStats);
+
+		pipeline->takeStats(&stats);
+		if (benchmark.isRunning())
+			benchmark.addStats(stats);
+		if (stats.frames > 0) {
+			LogMessage(TEXT("%s: simulate %.3f ms, render %.3f ms, game thread waited %.3f ms, input to present %.2f ms average, %.2f ms worst"),
+				pipelined ? TEXT("Pipelined") : TEXT("Serial"), stats.simulateTime / stats.frames, stats.renderTime / stats.frames,
+				stats.waitTime / stats.frames, stats.latencyTotal / stats.frames, stats.latencyMax);
+		}
 	}
 
-	this->Render();
+	if (deviceLost && FAILED(HandleLostDevice()))
+		return E_FAIL;
 
-	if (GetAsyncKeyState(VK_ESCAPE))
-		PostQuitMessage(0);
+	FrameSnapshot* snapshot = pipeline->beginFrame();
+	simulate(snapshot, secondPassed);
+	pipeline->submit();
+
+	if (!pipelined)
+		pipeline->waitIdle();
+
+	// Nothing simulated needs its scratch memory once the snapshot is submitted
+	frameArena->reset();
+
+	if (benchmark.isRunning()) {
+		benchmark.endFrame();
+		if (benchmark.isFinished())
+			finishBenchmark();
+	}
 
 	return S_OK;
 }
 
+/*
+Writes the benchmark report once the last frame has been presented, then quits.
+*/
+void Game::finishBenchmark() {
+	RenderPipelineStats stats;
+	ResidencyStats residency;
+	StreamingStats streamingStats;
+	std::wstring report = benchmarkScene + L".benchmark.json";
+
+	pipeline->waitIdle();
+	pipeline->takeStats(&stats);
+	benchmark.addStats(stats);
+	streaming.takeStats(&streamingStats);
+	benchmark.addStreamingStats(streamingStats);
+	resources.getTotals(&residency);
+
+	// A benchmark that fails, such as one whose steady-state frames allocate, exits with 1
+	PostQuitMessage(FAILED(benchmark.writeReport(report.c_str(), residency, headless)) ? 1 : 0);
+}
+
 /*
 Loads the bitmap specified by bmpPath to the target surface. The bitmap is loaded based on
 its own dimensions. (i.e. not yet scaled to fit the screen)
@@ -539,70 +917,415 @@ int Game::LoadBitmapToSurface(LPCTSTR bmpPath, LPDIRECT3DSURFACE9* target, LPDIR
 	return S_OK;
 }
 
+/*
+Adds the scene's original lights to the LightManager: a directional light, a
+green point light and a blue point light. They start switched off and are
+toggled with keys 4 to 6.
+*/
 void Game::createLights() {
-	ZeroMemory(&lights[0], sizeof(D3DLIGHT9));
-	lights[0].Type = D3DLIGHT_DIRECTIONAL;
-	lights[0].Diffuse = D3DXCOLOR(1.0f, 1.0f, 1.0f, 1.0f);
-	lights[0].Direction = D3DXVECTOR3(-100.0f, -100.0f, 0.0f);
-	lights[0].Position = D3DXVECTOR3(100.0f, 100.0f, 0.0f);
-	lights[0].Range = 100.0f;
-	pDevice->SetLight(0, &(lights[0]));
-	pDevice->LightEnable(0, false);
-
-	ZeroMemory(&lights[1], sizeof(D3DLIGHT9));
-	lights[1].Type = D3DLIGHT_POINT;
-	lights[1].Diffuse = D3DXCOLOR(0.0f, 1.0f, 0.0f, 1.0f);
-	lights[1].Position = D3DXVECTOR3(-5.0f, -5.0f, -5.0f);
-	lights[1].Range = 100.0f;
-	lights[1].Attenuation0 = 0.0f;
-	lights[1].Attenuation1 = 0.125f;
-	lights[1].Attenuation2 = 0.0f;
-	lights[1].Falloff = 1.0f;
-	pDevice->SetLight(1, &(lights[1]));
-	pDevice->LightEnable(1, false);
-
-	ZeroMemory(&lights[2], sizeof(D3DLIGHT9));
-	lights[2].Type = D3DLIGHT_POINT;
-	lights[2].Diffuse = D3DXCOLOR(0.0f, 0.0f, 1.0f, 1.0f);
-	lights[2].Direction = D3DXVECTOR3(-12.0f, 0.0f, 30.0f);
-	lights[2].Position = D3DXVECTOR3(0.0f, 0.0f, -1.0f);
-	lights[2].Range = 100.0f;
-	lights[2].Attenuation0 = 0.0f;
-	lights[2].Attenuation1 = 0.125f;
-	lights[2].Attenuation2 = 0.0f;
-	lights[2].Falloff = 1.0f;
-	lights[2].Phi = D3DXToRadian(40.0f);    // set the outer cone to 30 degrees
-	lights[2].Theta = D3DXToRadian(20.0f);    // set the inner cone to 10 degrees
-	pDevice->SetLight(2, &(lights[2]));
-	pDevice->LightEnable(2, false);
+	D3DLIGHT9 light;
+
+	ZeroMemory(&light, sizeof(D3DLIGHT9));
+	light.Type = D3DLIGHT_DIRECTIONAL;
+	light.Diffuse = D3DXCOLOR(1.0f, 1.0f, 1.0f, 1.0f);
+	light.Direction = D3DXVECTOR3(-100.0f, -100.0f, 0.0f);
+	light.Position = D3DXVECTOR3(100.0f, 100.0f, 0.0f);
+	light.Range = 100.0f;
+	lightManager.setEnabled(lightManager.addLight(light), false);
+
+	ZeroMemory(&light, sizeof(D3DLIGHT9));
+	light.Type = D3DLIGHT_POINT;
+	light.Diffuse = D3DXCOLOR(0.0f, 1.0f, 0.0f, 1.0f);
+	light.Position = D3DXVECTOR3(-5.0f, -5.0f, -5.0f);
+	light.Range = 100.0f;
+	light.Attenuation0 = 0.0f;
+	light.Attenuation1 = 0.125f;
+	light.Attenuation2 = 0.0f;
+	light.Falloff = 1.0f;
+	lightManager.setEnabled(lightManager.addLight(light), false);
+
+	ZeroMemory(&light, sizeof(D3DLIGHT9));
+	light.Type = D3DLIGHT_POINT;
+	light.Diffuse = D3DXCOLOR(0.0f, 0.0f, 1.0f, 1.0f);
+	light.Direction = D3DXVECTOR3(-12.0f, 0.0f, 30.0f);
+	light.Position = D3DXVECTOR3(0.0f, 0.0f, -1.0f);
+	light.Range = 100.0f;
+	light.Attenuation0 = 0.0f;
+	light.Attenuation1 = 0.125f;
+	light.Attenuation2 = 0.0f;
+	light.Falloff = 1.0f;
+	light.Phi = D3DXToRadian(40.0f);    // set the outer cone to 30 degrees
+	light.Theta = D3DXToRadian(20.0f);    // set the inner cone to 10 degrees
+	lightManager.setEnabled(lightManager.addLight(light), false);
+}
 
-	pDevice->SetRenderState(D3DRS_LIGHTING, TRUE);
+/*
+Scatters small coloured point lights through the space around the models, to
+load the light binning with many more lights than the fixed-function pipeline
+could hold.
+
+@param count - The number of lights to add
+*/
+void Game::addRandomLights(DWORD count) {
+	D3DLIGHT9 light;
+
+	for (DWORD i = 0; i < count; i++) {
+		ZeroMemory(&light, sizeof(D3DLIGHT9));
+		light.Type = D3DLIGHT_POINT;
+		light.Diffuse = D3DXCOLOR(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, 1.0f);
+		light.Position = D3DXVECTOR3(rand() / (float)RAND_MAX * 40.0f - 20.0f, rand() / (float)RAND_MAX * 10.0f - 5.0f, rand() / (float)RAND_MAX * 40.0f - 20.0f);
+		light.Range = 4.0f;
+		light.Attenuation0 = 1.0f;
+		light.Attenuation1 = 0.5f;
+		light.Attenuation2 = 0.25f;
+		lightManager.addLight(light);
+	}
+}
+
+/*
+Times the light binning with increasing numbers of lights and logs the average
+time per frame for each. The lights added for the benchmark are removed again.
+*/
+void Game::benchmarkLightBinning() {
+	static const DWORD counts[] = { 256, 1024, 4096 };
+	static const int FRAMES = 100;
+	D3DXMATRIX camView;
+	D3DVIEWPORT9 viewport = { 0, 0, (DWORD)width, (DWORD)height, 0.0f, 1.0f };
+	DWORD first = lightManager.getNumLights();
+
+	cam.getViewMatrix(&camView);
+
+	for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		double total = 0.0;
+
+		addRandomLights(counts[c] - (lightManager.getNumLights() - first));
+		for (int i = 0; i < FRAMES; i++) {
+			lightManager.binLights(camView, projection, viewport, 1.0f, 100.0f);
+			total += lightManager.getBinTime();
+		}
+		LogMessage(TEXT("Light binning, %u lights: %.3f ms"), counts[c], total / FRAMES);
+	}
+
+	lightManager.removeLights(first);
+}
+
+/*
+Loads specular.fx and reflect.fx. The models are drawn fixed-function until both
+have loaded.
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if either effect can not be loaded.
+*/
+int Game::loadEffects() {
+	if (FAILED(effects.loadEffect(TEXT("specular.fx"), NULL, &SPECULAR_LAYOUT, &specularEffect)))
+		return E_FAIL;
+
+	if (FAILED(effects.loadEffect(TEXT("reflect.fx"), NULL, &REFLECT_LAYOUT, &reflectEffect)))
+		return E_FAIL;
+
+	effectsLoaded = effects.getHandles(specularEffect).bestTechnique && effects.getHandles(reflectEffect).bestTechnique;
+	LogMessage(TEXT("Effects loaded: %s"), effectsLoaded ? TEXT("yes") : TEXT("no"));
+
+	return effectsLoaded ? S_OK : E_FAIL;
+}
+
+/*
+Sets the view and projection used to draw the models, on the device and on the
+effects.
+
+@param view - The view matrix
+@param proj - The projection matrix
+*/
+void Game::setViewProjection(const D3DXMATRIX& view, const D3DXMATRIX& proj) {
+	pDevice->SetTransform(D3DTS_VIEW, &view);
+	pDevice->SetTransform(D3DTS_PROJECTION, &proj);
+	drawStats->stateChanges += effectsLoaded ? 6 : 2;
+
+	if (effectsLoaded) {
+		DWORD ids[] = { specularEffect, reflectEffect };
+
+		for (int e = 0; e < 2; e++) {
+			const EffectHandles& handles = effects.getHandles(ids[e]);
+
+			effects.getEffect(ids[e])->SetMatrix(handles.view, &view);
+			effects.getEffect(ids[e])->SetMatrix(handles.proj, &proj);
+		}
+	}
 }
 
-void Game::updateCam(float timeDelta) {
-	if (::GetAsyncKeyState('W') & 0x8000f)
+/*
+Draws one of the models with its lights, through the effect of the render path
+or the fixed-function pipeline.
+
+@param item - The model to draw, as the snapshot recorded it
+@param view - The view matrix it is drawn with, used to place the lights
+@param path - The render path of the frame
+*/
+void Game::drawModel(const DrawItem& item, const D3DXMATRIX& view, RenderPath path) {
+	Object& model = models[item.object];
+
+	// Compact meshes can only be decoded by the effects
+	if (effectsLoaded && (path != RENDER_FIXED || model.isCompact())) {
+		DWORD id = path == RENDER_REFLECT ? reflectEffect : specularEffect;
+		LPD3DXEFFECT pEffect = effects.getEffect(id);
+		const EffectHandles& handles = effects.getHandles(id);
+
+		setEffectLights(pEffect, handles, item.lights, item.numLights, view);
+		model.drawObject(pEffect, handles, handles.bestTechnique, item.world, item.lod, drawStats);
+	}
+	else {
+		lightManager.applyLights(pDevice, item.lights, item.numLights);
+		model.drawObject(item.world, item.lod, drawStats);
+	}
+	drawStats->stateChanges += item.numLights;
+}
+
+/*
+Hashes the state outside the Objects that changes what the environment map
+sees: the lights, the ambient light and how the models are drawn.
+
+@return - The hash of the scene state
+*/
+unsigned long long Game::sceneSignature() {
+	unsigned long long hash = HASH_SEED;
+	DWORD count = lightManager.getNumLights();
+
+	hash = HashBytes(hash, &count, sizeof(count));
+	for (DWORD i = 0; i < count; i++) {
+		bool on = lightManager.isEnabled(i);
+
+		hash = HashBytes(hash, &on, sizeof(on));
+		if (on)
+			hash = HashBytes(hash, &lightManager.getLight(i), sizeof(D3DLIGHT9));
+	}
+	hash = HashBytes(hash, &ambientOn, sizeof(ambientOn));
+	hash = HashBytes(hash, &renderPath, sizeof(renderPath));
+
+	return hash;
+}
+
+/*
+Renders the environment map faces that are due this frame, then hands the map
+to reflect.fx. The map is unbound while its faces are rendered, since a texture
+can not be sampled while it is the render target.
+
+@param snapshot - The frame being rendered; its view and projection are put back afterwards
+*/
+void Game::updateProbe(const FrameSnapshot& snapshot) {
+	int faces[PROBE_FACES_PER_FRAME];
+	int count = snapshot.items.empty() ? 0 : probe.selectFaces(&snapshot.items[0], snapshot.items.size(), snapshot.sceneSignature, faces);
+	LPD3DXEFFECT pReflect = effectsLoaded ? effects.getEffect(reflectEffect) : 0;
+	D3DXHANDLE envTexture = effectsLoaded ? effects.getHandles(reflectEffect).envTexture : 0;
+
+	if (count > 0) {
+		if (envTexture)
+			pReflect->SetTexture(envTexture, NULL);
+
+		for (int f = 0; f < count; f++) {
+			D3DXMATRIX faceView, faceProj;
+			Frustum faceFrustum;
+
+			if (!probe.beginFace(faces[f], &faceView, &faceProj, &faceFrustum))
+				continue;
+
+			setViewProjection(faceView, faceProj);
+			for (DWORD i = 0; i < snapshot.items.size(); i++) {
+				const DrawItem& item = snapshot.items[i];
+
+				if (SphereInFrustum(faceFrustum, item.center, item.radius) && !probe.contains(item.center, item.radius))
+					drawModel(item, faceView, snapshot.renderPath);
+			}
+			probe.endFace();
+		}
+		setViewProjection(snapshot.view, snapshot.proj);
+	}
+
+	if (envTexture)
+		pReflect->SetTexture(envTexture, probe.getTexture());
+}
+
+/*
+Passes an Object's lights to an effect. The multi-light technique takes every
+light; the single light techniques take the brightest one and otherwise keep
+the light declared in the effect file.
+
+@param pEffect - The effect the Object is drawn with
+@param handles - The handles of the effect's parameters
+@param lights - The lights chosen for the Object, brightest first
+@param count - The number of lights
+@param view - The camera's view matrix
+*/
+void Game::setEffectLights(LPD3DXEFFECT pEffect, const EffectHandles& handles, const D3DLIGHT9* lights, DWORD count, const D3DXMATRIX& view) {
+	if (handles.bestTechnique == handles.renderSceneMultiLight) {
+		ShaderLights shaderLights;
+
+		count = min(count, (DWORD)MAX_EFFECT_LIGHTS);
+		lightManager.getShaderLights(lights, count, view, &shaderLights);
+
+		pEffect->SetInt(handles.numLights, count);
+		pEffect->SetVectorArray(handles.lightPositions, shaderLights.positions, count);
+		pEffect->SetVectorArray(handles.lightColors, shaderLights.colors, count);
+		pEffect->SetVectorArray(handles.lightAttenuation, shaderLights.attenuation, count);
+		pEffect->SetVectorArray(handles.lightDirections, shaderLights.directions, count);
+		pEffect->SetVectorArray(handles.lightCones, shaderLights.cones, count);
+	}
+	else if (count > 0) {
+		D3DXMATRIX identity;
+		ShaderLights shaderLights;
+
+		// The single light techniques move g_vLight to view space themselves
+		D3DXMatrixIdentity(&identity);
+		lightManager.getShaderLights(lights, 1, identity, &shaderLights);
+
+		pEffect->SetVector(handles.light, &shaderLights.positions[0]);
+		pEffect->SetVector(handles.lightColor, &shaderLights.colors[0]);
+	}
+}
+
+/*
+Applies one frame of input: the keys pressed, a click picking the model under
+the cursor, mouse drags moving the selected model and held keys moving the
+camera. Drags arrive summed over the frame, so a model is moved once a frame
+however many mouse messages there were.
+
+@param in - The frame's input
+*/
+void Game::applyInput(const InputFrame& in) {
+	for (int a = 0; a < ACTION_COUNT; a++) {
+		for (DWORD n = 0; n < in.pressed[a]; n++)
+			doAction((InputAction)a);
+	}
+
+	if (in.clicked)
+		pickModel(in.clickX, in.clickY);
+
+	if (in.dragX[MOUSE_LEFT] != 0.0f || in.dragY[MOUSE_LEFT] != 0.0f)
+		models[selectedModel].translate(in.dragX[MOUSE_LEFT] / 200.0f, -in.dragY[MOUSE_LEFT] / 200.0f, 0);
+	if (in.dragX[MOUSE_RIGHT] != 0.0f || in.dragY[MOUSE_RIGHT] != 0.0f) {
+		models[selectedModel].rotateAboutX(-in.dragY[MOUSE_RIGHT] / 100.0f);
+		models[selectedModel].rotateAboutY(-in.dragX[MOUSE_RIGHT] / 100.0f);
+	}
+	if (in.dragX[MOUSE_MIDDLE] != 0.0f || in.dragY[MOUSE_MIDDLE] != 0.0f) {
+		models[selectedModel].rotateAboutZ(-in.dragX[MOUSE_MIDDLE] / 1000.0f);
+		models[selectedModel].translate(0.0f, 0.0f, in.dragY[MOUSE_MIDDLE] / 200.0f);
+	}
+
+	updateCam(in);
+}
+
+/*
+Carries out an action whose key was pressed.
+
+@param action - The action
+*/
+void Game::doAction(InputAction action) {
+	switch (action) {
+		case ACTION_TOGGLE_AMBIENT:
+			// Turn ambient lighting on or off; the render thread sets it on the device
+			ambientOn = !ambientOn;
+			break;
+		case ACTION_TOGGLE_LIGHT_0:
+			// Turn on/off directional light
+			lightManager.setEnabled(0, !lightManager.isEnabled(0));
+			break;
+		case ACTION_TOGGLE_LIGHT_1:
+			// Turn on/off point light
+			lightManager.setEnabled(1, !lightManager.isEnabled(1));
+			break;
+		case ACTION_TOGGLE_LIGHT_2:
+			// Turn on/off second point light
+			lightManager.setEnabled(2, !lightManager.isEnabled(2));
+			break;
+		case ACTION_ADD_LIGHTS:
+			// Scatter more point lights through the scene
+			addRandomLights(256);
+			break;
+		case ACTION_REMOVE_LIGHTS:
+			// Remove the scattered lights, keeping the original three
+			lightManager.removeLights(3);
+			break;
+		case ACTION_BENCHMARK_LIGHTS:
+			benchmarkLightBinning();
+			break;
+		case ACTION_BAKE_PROBE:
+			// The render thread saves the environment map with the next frame
+			bakeRequested = true;
+			break;
+		case ACTION_TOGGLE_PIPELINE:
+			// Switch between overlapping simulation with rendering and waiting for each frame
+			pipelined = !pipelined;
+			break;
+		case ACTION_CYCLE_RENDER_PATH:
+			// Switch between fixed-function, specular.fx and reflect.fx
+			if (effectsLoaded)
+				renderPath = (RenderPath)((renderPath + 1) % RENDER_PATH_COUNT);
+			break;
+		case ACTION_QUIT:
+			PostQuitMessage(0);
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+Selects the nearest model under a point of the window, if there is one.
+
+@param x - The x coordinate in client pixels
+@param y - The y coordinate in client pixels
+*/
+void Game::pickModel(int x, int y) {
+	DWORD hit;
+	float distance;
+
+	// compute the ray in view space given the clicked screen point
+	Ray ray = CalcPickingRay(x, y);
+
+	// transform the ray to world space
+	D3DXMATRIX view;
+	cam.getViewMatrix(&view);
+
+	D3DXMATRIX viewInverse;
+	D3DXMatrixInverse(&viewInverse, 0, &view);
+
+	TransformRay(&ray, &viewInverse);
+
+	// test for a hit against the models' bounding spheres, as of the last simulated frame
+	if (spatial.raycast(ray, FLT_MAX, &hit, &distance))
+		selectedModel = hit;
+}
+
+/*
+Moves the camera by the actions held down this frame.
+
+@param in - The frame's input
+*/
+void Game::updateCam(const InputFrame& in) {
+	float timeDelta = in.timeDelta;
+
+	if (in.held[ACTION_WALK_FORWARD])
 		cam.walk(1.0f * timeDelta);
-	if (::GetAsyncKeyState('S') & 0x8000f)
+	if (in.held[ACTION_WALK_BACK])
 		cam.walk(-1.0f * timeDelta);
-	if (::GetAsyncKeyState('A') & 0x8000f)
+	if (in.held[ACTION_STRAFE_LEFT])
 		cam.strafe(-1.0f * timeDelta);
-	if (::GetAsyncKeyState('D') & 0x8000f)
+	if (in.held[ACTION_STRAFE_RIGHT])
 		cam.strafe(1.0f * timeDelta);
-	if (::GetAsyncKeyState('R') & 0x8000f)
+	if (in.held[ACTION_FLY_UP])
 		cam.fly(1.0f * timeDelta);
-	if (::GetAsyncKeyState('F') & 0x8000f)
+	if (in.held[ACTION_FLY_DOWN])
 		cam.fly(-1.0f * timeDelta);
-	if (::GetAsyncKeyState(VK_UP) & 0x8000f)
+	if (in.held[ACTION_PITCH_UP])
 		cam.pitch(0.5f * timeDelta);
-	if (::GetAsyncKeyState(VK_DOWN) & 0x8000f)
+	if (in.held[ACTION_PITCH_DOWN])
 		cam.pitch(-0.5f * timeDelta);
-	if (::GetAsyncKeyState(VK_LEFT) & 0x8000f)
+	if (in.held[ACTION_YAW_LEFT])
 		cam.yaw(-0.5f * timeDelta);
-	if (::GetAsyncKeyState(VK_RIGHT) & 0x8000f)
+	if (in.held[ACTION_YAW_RIGHT])
 		cam.yaw(0.5f * timeDelta);
-	if (::GetAsyncKeyState('N') & 0x8000f)
+	if (in.held[ACTION_ROLL_LEFT])
 		cam.roll(0.5f * timeDelta);
-	if (::GetAsyncKeyState('M') & 0x8000f)
+	if (in.held[ACTION_ROLL_RIGHT])
 		cam.roll(-0.5f * timeDelta);
 }
 
@@ -611,57 +1334,18 @@ void Game::updateCam(float timeDelta) {
 //Compute a picking ray in "View Space".
 Ray Game::CalcPickingRay(int x, int y)
 {
-	float px = 0.0f;
-	float py = 0.0f;
-	D3DVIEWPORT9 vp;
-	pDevice->GetViewport(&vp);
-	D3DXMATRIX proj;
-	pDevice->GetTransform(D3DTS_PROJECTION, &proj);
-	px = (((2.0f*x) / vp.Width) - 1.0f) / proj(0, 0);
-	py = (((-2.0f*y) / vp.Height) + 1.0f) / proj(1, 1);
-	Ray ray;
-	ray._origin = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
-	ray._direction = D3DXVECTOR3(px, py, 1.0f);
-	return ray;
+	// The device belongs to the render thread, so use the game's own copies
+	return ComputePickingRay(x, y, width, height, projection);
 }
 
-
-
 //Transform our picking ray into "World Space" where the objects are.
 void Game::TransformRay(Ray* ray, D3DXMATRIX* T)
 {
-	// transform the ray's origin, w = 1.  Transforms points.
-	D3DXVec3TransformCoord(
-		&ray->_origin,
-		&ray->_origin,
-		T);
-	// transform the ray's direction, w = 0.  Transforms vectors.
-	D3DXVec3TransformNormal(
-		&ray->_direction,
-		&ray->_direction,
-		T);
-	// normalize the direction
-	D3DXVec3Normalize(&ray->_direction, &ray->_direction);
+	TransformPickingRay(ray, T);
 }
 
-
-
 //Returns true if the ray passed in intersects the sphere passed in.  Returns false if ray misses.
 bool Game::raySphereIntersectionTest(Ray* ray, Object* sphere)
 {
-	D3DXVECTOR3 v = ray->_origin - sphere->_center;
-	float b = 2.0f * D3DXVec3Dot(&ray->_direction, &v);
-	float c = D3DXVec3Dot(&v, &v) - (sphere->_radius * sphere->_radius);
-	// find the discriminant
-	float discriminant = (b * b) - (4.0f * c);
-	// test for imaginary number
-	if (discriminant < 0.0f)
-		return false;
-	discriminant = sqrtf(discriminant);
-	float s0 = (-b + discriminant) / 2.0f;
-	float s1 = (-b - discriminant) / 2.0f;
-	// if a solution is >= 0, then we intersected the sphere
-	if (s0 >= 0.0f || s1 >= 0.0f)
-		return true;
-	return false;
+	return RayHitsSphere(ray, sphere->_center, sphere->_radius);
 }
@@ -5,26 +5,71 @@
 #include "FrameTracker.h"
 #include "Object.h"
 #include "Camera.h"
+#include "SpatialGrid.h"
+#include "OcclusionCuller.h"
+#include "HotReload.h"
+#include <atomic>
+#include <memory>
 
 /*
  The game class uses directX to display the "game".
+
+ A Game owns the device and everything created on it. Its address is handed to
+ the window and the render thread, and its models point back at its device, so
+ it can be neither copied nor moved; construct it where it will live.
 */
 class Game {
 private:
 	HWND hWnd;
-	LPDIRECT3D9 pD3D;//COM object
+	CComPtr<IDirect3D9> pD3D;//COM object
 	LPDIRECT3DDEVICE9 pDevice;//graphics device
+	D3DPRESENT_PARAMETERS d3dpp;//rendering info, kept to reset the device
+	ResourceManager resources;
+	StreamingManager streaming; // Loads the models' textures as the camera nears them; outlives the models
 	LPDIRECT3DSURFACE9 backSurface;
-	LPDIRECT3DSURFACE9 bmpSurface;
-	LPD3DXFONT font;
+	CComPtr<IDirect3DSurface9> bmpSurface;
+	CComPtr<ID3DXFont> font;
 	FrameTracker frame;
 	Camera cam;
 	Object models[2];
-	D3DLIGHT9 lights[3];
-	bool lightsOn[4];
+	SpatialGrid spatial; // Bounding spheres of the models, by index; every visibility and picking query goes through it
+	std::vector<DWORD> visibleModels; // Reused by simulate so the query does not allocate each frame
+	OcclusionCuller occlusion;
+	DWORD occluderMeshes[2]; // Each model's occluder in occlusion
+	std::vector<OccluderInstance> occluders; // Reused by simulate, like visibleModels
+	std::vector<OcclusionQuery> occlusionQueries;
+	HotReloader hotReload; // Swaps in the models' meshes and textures when their files change
+	std::vector<DWORD> reloadedModels; // Reused by simulate, like visibleModels
+	Reflection mirror;
+	bool hasStencil;
+	EnvironmentProbe probe;
+	std::unique_ptr<JobSystem> jobs;
+	std::unique_ptr<LinearArena> frameArena; // Scratch memory of the frame being simulated, reset at the end of GameLoop
+	LightManager lightManager;
+	std::unique_ptr<RenderPipeline> pipeline;
+	bool pipelined; // Whether the next frame is simulated while this one renders
+	std::atomic<bool> deviceLost; // Set by the render thread on finding the device lost; cleared by the window thread once it is reset
+	bool bakeRequested; // Save the environment map with the next frame
+	D3DXMATRIX projection;
+	EffectManager effects;
+	DWORD specularEffect, reflectEffect;
+	bool effectsLoaded;
+	bool compactVertices; // Convert the models to the compact vertex layout when the effects load
+	RenderPath renderPath;
+	float reflectivity;
+	bool ambientOn;
 	int width, height, fps, selectedModel;
 	float lastTime;
-	POINT startPos;
+	InputSystem input;
+	std::wstring recordFile; // Where the recorded input is saved on shutdown
+	float replayStart;
+	Benchmark benchmark;
+	std::wstring benchmarkScene; // Empty unless benchmarking
+	bool headless; // Render on the null reference device
+	DrawStats* drawStats; // Counts what the frame being rendered submits; render thread only
+
+	Game(const Game&);
+	Game& operator=(const Game&);
 
 public:
 	Game();
@@ -33,14 +78,36 @@ public:
 	HWND GetHWND();
 	int LoadBitmapToSurface(LPCTSTR, LPDIRECT3DSURFACE9*, LPDIRECT3DDEVICE9);
 	int InitDirect3DDevice(HWND, BOOL, D3DFORMAT, LPDIRECT3D9, LPDIRECT3DDEVICE9*);
+	int HandleLostDevice();
+	void SetDeviceStates();
 	static long CALLBACK StaticProc(HWND, UINT, WPARAM, LPARAM);
 	long CALLBACK WndProc(HWND, UINT, WPARAM, LPARAM);
+	void recordInput(LPCWSTR file);
+	int replayInput(LPCWSTR file);
+	void setBenchmark(LPCWSTR scene, bool nullDevice);
+	void setStreamingBudget(unsigned long long bytes);
+	void setCompactVertices(bool);
+	void finishBenchmark();
 	int GameInit();
 	int GameShutdown();
-	int Render();
+	void simulate(FrameSnapshot*, bool secondPassed);
+	static int StaticRender(void*, const FrameSnapshot&, DrawStats*);
+	int renderFrame(const FrameSnapshot&, DrawStats*);
 	int GameLoop();
 	void createLights();
-	void updateCam(float timeDelta);
+	void addRandomLights(DWORD count);
+	void benchmarkLightBinning();
+	int loadEffects();
+	void setViewProjection(const D3DXMATRIX& view, const D3DXMATRIX& proj);
+	void drawModel(const DrawItem&, const D3DXMATRIX& view, RenderPath);
+	static D3DFORMAT ChooseDepthFormat(LPDIRECT3D9, D3DDEVTYPE, D3DFORMAT adapterFormat, D3DFORMAT backBufferFormat);
+	unsigned long long sceneSignature();
+	void updateProbe(const FrameSnapshot&);
+	void setEffectLights(LPD3DXEFFECT, const EffectHandles&, const D3DLIGHT9* lights, DWORD count, const D3DXMATRIX& view);
+	void applyInput(const InputFrame&);
+	void doAction(InputAction);
+	void pickModel(int x, int y);
+	void updateCam(const InputFrame&);
 	Ray CalcPickingRay(int x, int y);  //Compute a picking ray in "View Space"
 	void TransformRay(Ray* ray, D3DXMATRIX* T); //Transform computed ray into "World space" / object's local space.
 	bool raySphereIntersectionTest(Ray* ray, Object* sphere);
@@ -0,0 +1,49 @@
+#include "Hash.h"
+
+/*
+Hashes a block of bytes with 64-bit FNV-1a, continuing from a previous hash.
+
+@param hash - The hash so far
+@param data - The bytes to add
+@param size - The number of bytes
+
+@return - The new hash
+*/
+unsigned long long HashBytes(unsigned long long hash, const void* data, size_t size) {
+	const unsigned char* bytes = (const unsigned char*)data;
+
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+Hashes everything that decides what an effect compiles to, which names its
+compiled file in the shader cache. Each define's name and value is hashed with
+its terminating zero, so moving characters from one to the other changes the
+hash.
+
+@param source - The source text of the effect
+@param defineNames - The names of the defines it is compiled with
+@param defineValues - Their values, one for each name
+@param compileFlags - The D3DXSHADER_ flags it is compiled with
+@param compilerVersion - The version of the compiler, so a new one compiles it again
+
+@return - The hash
+*/
+unsigned long long HashEffectSource(const std::vector<char>& source, const std::vector<std::string>& defineNames,
+	const std::vector<std::string>& defineValues, DWORD compileFlags, DWORD compilerVersion) {
+	unsigned long long hash = HASH_SEED;
+
+	if (!source.empty())
+		hash = HashBytes(hash, &source[0], source.size());
+	for (DWORD i = 0; i < defineNames.size(); i++) {
+		hash = HashBytes(hash, defineNames[i].c_str(), defineNames[i].size() + 1);
+		hash = HashBytes(hash, defineValues[i].c_str(), defineValues[i].size() + 1);
+	}
+	hash = HashBytes(hash, &compileFlags, sizeof(compileFlags));
+	hash = HashBytes(hash, &compilerVersion, sizeof(compilerVersion));
+	return hash;
+}
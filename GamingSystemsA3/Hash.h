@@ -0,0 +1,17 @@
+#ifndef HASH_H
+#define HASH_H
+
+// Hashes bytes and strings only, so the cache keys built from it are tested on
+// any platform.
+#include "CoreMath.h"
+#include <string>
+#include <vector>
+
+//Starting value for HashBytes.
+#define HASH_SEED 14695981039346656037ULL
+
+unsigned long long HashBytes(unsigned long long hash, const void* data, size_t size);
+unsigned long long HashEffectSource(const std::vector<char>& source, const std::vector<std::string>& defineNames,
+	const std::vector<std::string>& defineValues, DWORD compileFlags, DWORD compilerVersion);
+
+#endif // !HASH_H
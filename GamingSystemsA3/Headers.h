@@ -6,12 +6,36 @@
 #include<sstream>
 #include <string>
 #include "Main.h"
+#include "JobSystem.h"
+#include "Hash.h"
+#include "MemorySystem.h"
+#include "TextureSize.h"
 #include "Camera.h"
+#include "CameraPath.h"
+#include "Placement.h"
+#include "ResourceManager.h"
+#include "StreamingManager.h"
+#include "VertexQuantizer.h"
+#include "LightManager.h"
+#include "EffectManager.h"
+#include "Frustum.h"
+#include "Reflection.h"
+#include "InputSystem.h"
+#include "RenderPipeline.h"
+#include "EnvironmentProbe.h"
+#include "Benchmark.h"
+#include "MicroBenchmark.h"
+#include "SpatialGrid.h"
+#include "OcclusionCuller.h"
 #include "Game.h"
 #include "Util.h"
 #include "FrameTracker.h"
 #include "Object.h"
-#include "Reflection.h"
+#include "HotReload.h"
 #include "Picking.h"
+#include "MeshOptimizer.h"
+#include "TangentFrame.h"
+#include "Animation.h"
+#include "TextureCompressor.h"
 using namespace std;
 #endif
\ No newline at end of file
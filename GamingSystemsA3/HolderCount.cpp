@@ -0,0 +1,47 @@
+#include "HolderCount.h"
+
+HolderCount::HolderCount() :holders(0) {
+}
+
+/*
+Makes a count for a new owner, which nothing points at yet.
+*/
+HolderCount::HolderCount(const HolderCount&) :holders(0) {
+}
+
+/*
+Leaves the count alone, since the holders point at this owner and not at the
+one its contents came from.
+
+@return - This count
+*/
+HolderCount& HolderCount::operator=(const HolderCount&) {
+	return *this;
+}
+
+/*
+Records that a manager keeps a pointer to the owner.
+*/
+void HolderCount::add() {
+	holders++;
+}
+
+/*
+Records that a manager let go of the owner. Letting go more times than it was
+held leaves the count at zero.
+*/
+void HolderCount::remove() {
+	if (holders > 0)
+		holders--;
+}
+
+unsigned HolderCount::get() const {
+	return holders;
+}
+
+/*
+@return - Whether any manager points at the owner, so it must not move
+*/
+bool HolderCount::isHeld() const {
+	return holders > 0;
+}
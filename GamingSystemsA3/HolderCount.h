@@ -0,0 +1,28 @@
+#ifndef HOLDERCOUNT_H
+#define HOLDERCOUNT_H
+
+// Plain bookkeeping with no device in it, so the rules for when something may
+// move are tested on any platform.
+
+/*
+A HolderCount records how many managers keep a pointer to the thing that owns
+it, which pins the owner in place until each of them lets go. The holders point
+at the owner's address, not at its contents, so they never follow the contents
+into a copy or a move: a count made from another starts at zero, and assigning
+one keeps the holders it already had.
+*/
+class HolderCount {
+private:
+	unsigned holders;
+
+public:
+	HolderCount();
+	HolderCount(const HolderCount&);
+	HolderCount& operator=(const HolderCount&);
+	void add();
+	void remove();
+	unsigned get() const;
+	bool isHeld() const;
+};
+
+#endif // !HOLDERCOUNT_H
@@ -0,0 +1,389 @@
+#include "Headers.h"
+#include "HotReload.h"
+
+HotReloader::HotReloader() :streaming(0), quitEvent(NULL) {
+}
+
+HotReloader::~HotReloader() {
+	shutdown();
+}
+
+/*
+Watches an Object's file. Must be called before start, once the Object has been
+loaded, so the reload cooks it the same way: compact if it is compact, with
+tangent frames if it has them.
+
+@param object - The Object; it is held in place until shutdown
+*/
+void HotReloader::addModel(Object* object) {
+	WatchedModel model;
+
+	object->addHolder();
+	model.object = object;
+	model.file = object->getFile();
+	model.compact = object->isCompact();
+	model.tangents = object->hasTangentFrames();
+	models.push_back(model);
+}
+
+/*
+Starts the thread that watches the asset folders.
+
+@param manager - The StreamingManager to reload textures through, or null to reload only models
+*/
+void HotReloader::start(StreamingManager* manager) {
+	if (thread.joinable())
+		return;
+
+	streaming = manager;
+	quitEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	thread = std::thread(&HotReloader::watchMain, this);
+}
+
+/*
+Stops the watch thread and lets go of the models. Cooked models that were not
+swapped in yet are dropped.
+*/
+void HotReloader::shutdown() {
+	if (thread.joinable()) {
+		SetEvent(quitEvent);
+		thread.join();
+	}
+	if (quitEvent) {
+		CloseHandle(quitEvent);
+		quitEvent = NULL;
+	}
+
+	cooked.clear();
+	uploaded.clear();
+	for (DWORD i = 0; i < models.size(); i++)
+		models[i].object->removeHolder();
+	models.clear();
+}
+
+/*
+Copies one detail level of a mesh into memory: its vertex declaration, vertices,
+indices and subsets.
+
+@param pMesh - The mesh to read
+@param data - Receives the copy
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if a buffer of the mesh can not be locked.
+*/
+int ReadMeshData(LPD3DXMESH pMesh, CookedMesh* data) {
+	BYTE* pVertices = 0;
+	BYTE* pIndices = 0;
+	DWORD* pAttributes = 0;
+	DWORD tableSize = 0;
+
+	pMesh->GetDeclaration(data->declaration);
+	data->options = pMesh->GetOptions();
+	data->numFaces = pMesh->GetNumFaces();
+	data->numVertices = pMesh->GetNumVertices();
+	data->vertices.resize(data->numVertices * pMesh->GetNumBytesPerVertex());
+	data->indices.resize(data->numFaces * 3 * (data->options & D3DXMESH_32BIT ? sizeof(DWORD) : sizeof(WORD)));
+	data->attributes.resize(data->numFaces);
+
+	if (FAILED(pMesh->LockVertexBuffer(D3DLOCK_READONLY, (void**)&pVertices))) {
+		SetError(TEXT("Could not lock vertex buffer"));
+		return E_FAIL;
+	}
+	memcpy(&data->vertices[0], pVertices, data->vertices.size());
+	pMesh->UnlockVertexBuffer();
+
+	if (FAILED(pMesh->LockIndexBuffer(D3DLOCK_READONLY, (void**)&pIndices))) {
+		SetError(TEXT("Could not lock index buffer"));
+		return E_FAIL;
+	}
+	memcpy(&data->indices[0], pIndices, data->indices.size());
+	pMesh->UnlockIndexBuffer();
+
+	if (FAILED(pMesh->LockAttributeBuffer(D3DLOCK_READONLY, &pAttributes))) {
+		SetError(TEXT("Could not lock attribute buffer"));
+		return E_FAIL;
+	}
+	memcpy(&data->attributes[0], pAttributes, data->attributes.size() * sizeof(DWORD));
+	pMesh->UnlockAttributeBuffer();
+
+	pMesh->GetAttributeTable(NULL, &tableSize);
+	data->attributeTable.resize(tableSize);
+	if (tableSize > 0)
+		pMesh->GetAttributeTable(&data->attributeTable[0], &tableSize);
+
+	return S_OK;
+}
+
+/*
+Creates a mesh from a copy made by ReadMeshData, in the pool the game's meshes
+are loaded into.
+
+@param data - The copy
+@param pDevice - The device to create the mesh on
+@param ppMesh - Receives the mesh
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the mesh can not be created or filled; nothing is returned then.
+*/
+int CreateMeshFromData(const CookedMesh& data, LPDIRECT3DDEVICE9 pDevice, LPD3DXMESH* ppMesh) {
+	LPD3DXMESH pMesh = 0;
+	BYTE* pVertices = 0;
+	BYTE* pIndices = 0;
+	DWORD* pAttributes = 0;
+
+	*ppMesh = 0;
+	if (FAILED(D3DXCreateMesh(data.numFaces, data.numVertices, (data.options & D3DXMESH_32BIT) | ResourceManager::meshOptions(),
+		data.declaration, pDevice, &pMesh))) {
+		SetError(TEXT("Could not create mesh"));
+		return E_FAIL;
+	}
+
+	if (FAILED(pMesh->LockVertexBuffer(0, (void**)&pVertices)) || FAILED(pMesh->LockIndexBuffer(0, (void**)&pIndices)) ||
+		FAILED(pMesh->LockAttributeBuffer(0, &pAttributes))) {
+		SetError(TEXT("Could not lock the new mesh"));
+		pMesh->Release();
+		return E_FAIL;
+	}
+	memcpy(pVertices, &data.vertices[0], data.vertices.size());
+	memcpy(pIndices, &data.indices[0], data.indices.size());
+	memcpy(pAttributes, &data.attributes[0], data.attributes.size() * sizeof(DWORD));
+	pMesh->UnlockVertexBuffer();
+	pMesh->UnlockIndexBuffer();
+	pMesh->UnlockAttributeBuffer();
+
+	if (!data.attributeTable.empty())
+		pMesh->SetAttributeTable(&data.attributeTable[0], (DWORD)data.attributeTable.size());
+
+	*ppMesh = pMesh;
+	return S_OK;
+}
+
+/*
+Waits for changes in the asset folders until shutdown. A file is reloaded once
+HOTRELOAD_SETTLE_MS have passed since its last change, so a save that writes it
+several times is reloaded once, after the last write.
+*/
+void HotReloader::watchMain() {
+	static const LPCWSTR folders[HOTRELOAD_FOLDERS] = { TEXT("."), TEXT("..") };
+	const DWORD filter = FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME;
+	HANDLE directories[HOTRELOAD_FOLDERS];
+	OVERLAPPED overlapped[HOTRELOAD_FOLDERS];
+	std::vector<DWORD> notifications[HOTRELOAD_FOLDERS]; // DWORDs, as ReadDirectoryChangesW needs aligned records
+	HANDLE events[1 + HOTRELOAD_FOLDERS];
+	DWORD watching = 0;
+	std::vector<ChangedFile> changed;
+	LPDIRECT3D9 pD3D = 0;
+	LPDIRECT3DDEVICE9 pCookDevice = 0;
+
+	events[0] = quitEvent;
+	for (DWORD f = 0; f < HOTRELOAD_FOLDERS; f++) {
+		HANDLE hDirectory = CreateFile(folders[f], FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+			OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+
+		if (hDirectory == INVALID_HANDLE_VALUE)
+			continue;
+
+		directories[watching] = hDirectory;
+		ZeroMemory(&overlapped[watching], sizeof(OVERLAPPED));
+		overlapped[watching].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		notifications[watching].resize(HOTRELOAD_NOTIFY_BYTES / sizeof(DWORD));
+		if (!ReadDirectoryChangesW(hDirectory, &notifications[watching][0], HOTRELOAD_NOTIFY_BYTES, FALSE, filter, NULL, &overlapped[watching], NULL)) {
+			SetError(TEXT("Hot reload: could not watch %s"), folders[f]);
+			CloseHandle(overlapped[watching].hEvent);
+			CloseHandle(hDirectory);
+			continue;
+		}
+		events[1 + watching] = overlapped[watching].hEvent;
+		watching++;
+	}
+	LogMessage(TEXT("Hot reload: watching %u folders"), watching);
+
+	for (;;) {
+		DWORD r = WaitForMultipleObjects(1 + watching, events, FALSE, changed.empty() ? INFINITE : HOTRELOAD_SETTLE_MS);
+		DWORD now;
+
+		if (r == WAIT_OBJECT_0 || r == WAIT_FAILED)
+			break;
+
+		if (r > WAIT_OBJECT_0 && r <= WAIT_OBJECT_0 + watching) {
+			DWORD d = r - WAIT_OBJECT_0 - 1;
+			DWORD bytes = 0;
+
+			if (GetOverlappedResult(directories[d], &overlapped[d], &bytes, FALSE) && bytes > 0) {
+				BYTE* record = (BYTE*)&notifications[d][0];
+
+				for (;;) {
+					FILE_NOTIFY_INFORMATION* info = (FILE_NOTIFY_INFORMATION*)record;
+
+					if (info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_MODIFIED || info->Action == FILE_ACTION_RENAMED_NEW_NAME) {
+						std::wstring name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+						DWORD c = 0;
+
+						while (c < changed.size() && _wcsicmp(changed[c].name.c_str(), name.c_str()) != 0)
+							c++;
+						if (c == changed.size()) {
+							ChangedFile file;
+							file.name = name;
+							changed.push_back(file);
+						}
+						changed[c].lastChange = timeGetTime();
+					}
+
+					if (info->NextEntryOffset == 0)
+						break;
+					record += info->NextEntryOffset;
+				}
+			}
+			else {
+				// The buffer overflowed, so which files changed is lost
+				SetError(TEXT("Hot reload: too many changes at once, some files were not reloaded"));
+			}
+
+			ResetEvent(overlapped[d].hEvent);
+			ReadDirectoryChangesW(directories[d], &notifications[d][0], HOTRELOAD_NOTIFY_BYTES, FALSE, filter, NULL, &overlapped[d], NULL);
+		}
+
+		now = timeGetTime();
+		for (DWORD c = 0; c < changed.size();) {
+			if (now - changed[c].lastChange >= HOTRELOAD_SETTLE_MS) {
+				reloadFile(changed[c].name.c_str(), &pD3D, &pCookDevice);
+				changed.erase(changed.begin() + c);
+			}
+			else {
+				c++;
+			}
+		}
+	}
+
+	// The buffers must outlive the reads in flight, so each is cancelled and waited for
+	for (DWORD d = 0; d < watching; d++) {
+		DWORD bytes;
+
+		CancelIo(directories[d]);
+		GetOverlappedResult(directories[d], &overlapped[d], &bytes, TRUE);
+		CloseHandle(overlapped[d].hEvent);
+		CloseHandle(directories[d]);
+	}
+
+	if (pCookDevice)
+		pCookDevice->Release();
+	if (pD3D)
+		pD3D->Release();
+}
+
+/*
+Reloads whatever the game loaded from a changed file: textures through the
+StreamingManager, models by cooking them again. Other files are ignored.
+
+@param name - The file name, relative to the folder it changed in
+@param ppD3D - The IDirect3D9 object of the cook device
+@param ppCookDevice - The null reference device models are cooked on, created the first time one is needed
+*/
+void HotReloader::reloadFile(LPCWSTR name, LPDIRECT3D9* ppD3D, LPDIRECT3DDEVICE9* ppCookDevice) {
+	if (streaming && streaming->reload(name) > 0)
+		LogMessage(TEXT("Hot reload: %s changed, reading it again"), name);
+
+	for (DWORD m = 0; m < models.size(); m++) {
+		if (_wcsicmp(models[m].file.c_str(), name) != 0)
+			continue;
+
+		if (!*ppCookDevice && FAILED(CreateNullDevice(ppD3D, ppCookDevice))) {
+			SetError(TEXT("Hot reload: no device to cook %s on"), name);
+			return;
+		}
+		cook(m, ppCookDevice);
+	}
+}
+
+/*
+Cooks a model again on the watch thread and queues it for the render thread to
+swap in.
+
+@param model - Index of the model
+@param ppCookDevice - The device to cook on; used only by this thread
+*/
+void HotReloader::cook(DWORD model, LPDIRECT3DDEVICE9* ppCookDevice) {
+	std::unique_ptr<CookedModel> result(new CookedModel());
+	Object scratch(ppCookDevice, models[model].file.c_str());
+	LARGE_INTEGER start, end, frequency;
+
+	QueryPerformanceCounter(&start);
+	scratch.setCompactVertices(models[model].compact);
+	if (FAILED(scratch.CookMesh(models[model].tangents, result.get()))) {
+		SetError(TEXT("Hot reload: could not cook %s, keeping the old mesh"), models[model].file.c_str());
+		return;
+	}
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+
+	result->model = model;
+	result->cookTime = (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart;
+
+	std::lock_guard<std::mutex> hold(lock);
+	cooked.push_back(std::move(result));
+}
+
+/*
+Swaps in the models cooked since the last frame, creating their detail levels
+on the device. Called on the render thread at the start of each frame, before
+anything is drawn, so no draw sees half a model.
+*/
+void HotReloader::service() {
+	LARGE_INTEGER start, end, frequency;
+
+	{
+		std::lock_guard<std::mutex> hold(lock);
+		if (cooked.empty())
+			return;
+		uploading.swap(cooked);
+	}
+
+	QueryPerformanceFrequency(&frequency);
+	for (DWORD i = 0; i < uploading.size(); i++) {
+		const WatchedModel& model = models[uploading[i]->model];
+
+		QueryPerformanceCounter(&start);
+		if (FAILED(model.object->uploadMeshes(*uploading[i]))) {
+			SetError(TEXT("Hot reload: could not swap in %s, keeping the old mesh"), model.file.c_str());
+			uploading[i].reset();
+			continue;
+		}
+		QueryPerformanceCounter(&end);
+
+		LogMessage(TEXT("Hot reload: %s cooked in %.3f ms, swapped in in %.3f ms"), model.file.c_str(),
+			uploading[i]->cookTime, (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart);
+	}
+
+	std::lock_guard<std::mutex> hold(lock);
+	for (DWORD i = 0; i < uploading.size(); i++) {
+		if (uploading[i])
+			uploaded.push_back(std::move(uploading[i]));
+	}
+	uploading.clear();
+}
+
+/*
+Hands the models the render thread swapped in their new bounds and occluders.
+Called on the game thread at the start of each frame.
+
+@param reloaded - Receives the index of each model reloaded, in the order the models were added
+
+@return - Whether any model was reloaded
+*/
+bool HotReloader::update(std::vector<DWORD>* reloaded) {
+	reloaded->clear();
+
+	{
+		std::lock_guard<std::mutex> hold(lock);
+		if (uploaded.empty())
+			return false;
+		adopting.swap(uploaded);
+	}
+
+	for (DWORD i = 0; i < adopting.size(); i++) {
+		models[adopting[i]->model].object->adoptBounds(*adopting[i]);
+		reloaded->push_back(adopting[i]->model);
+	}
+	adopting.clear();
+	return true;
+}
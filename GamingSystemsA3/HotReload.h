@@ -0,0 +1,111 @@
+#ifndef HOTRELOAD_H
+#define HOTRELOAD_H
+
+#include "Headers.h"
+#include "Object.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Milliseconds a changed file must go without changing again before it is reloaded, so one still being saved is not read half written.
+#define HOTRELOAD_SETTLE_MS 250
+//Bytes of change notifications each watched folder can hold between two reads of them.
+#define HOTRELOAD_NOTIFY_BYTES 16384
+//Folders watched: the working directory and its parent, the two places assets are looked for.
+#define HOTRELOAD_FOLDERS 2
+
+//One detail level of a mesh held in memory, so it can be cooked on one device and created on another.
+struct CookedMesh
+{
+	D3DVERTEXELEMENT9 declaration[MAX_FVF_DECL_SIZE];
+	DWORD options; // Of the mesh it was read from
+	DWORD numFaces, numVertices;
+	std::vector<BYTE> vertices, indices;
+	std::vector<DWORD> attributes; // Subset of each face
+	std::vector<D3DXATTRIBUTERANGE> attributeTable;
+};
+
+//A model cooked again after its file changed: everything a reload replaces.
+struct CookedModel
+{
+	DWORD model; // Index of the Object in the order it was added to the HotReloader
+	DWORD numLods;
+	CookedMesh lods[MAX_LODS];
+	D3DXVECTOR3 boundCenter;
+	float boundRadius;
+	bool compact, tangentFrames;
+	QuantizationInfo quantization;
+	std::vector<D3DMATERIAL9> materials;
+	std::vector<D3DXVECTOR3> occluderVertices;
+	std::vector<DWORD> occluderIndices;
+	double cookTime; // Milliseconds spent cooking on the watch thread
+};
+
+/*
+The HotReloader watches the folders the game loads its assets from and reloads
+the ones that change while it runs, so a model or texture can be edited without
+restarting.
+
+A thread of its own waits on ReadDirectoryChangesW for both folders. Once a
+changed file has settled, textures are handed to the StreamingManager, which
+reads them again and swaps them in between frames. A changed .x file is cooked
+again on the same thread, the way InitGeometry cooks it but on a null reference
+device of its own, and copied into memory. At the start of a frame the render
+thread creates the new detail levels on the real device and swaps them in all
+at once; the game thread then takes the new bounds and occluder. Neither thread
+waits for a cook.
+
+A reload keeps the model's textures, so a new file needs as many materials as
+the old one; one that has a different number is reported and not swapped in.
+Effects are not handled here, the EffectManager polls its own files.
+*/
+class HotReloader {
+private:
+	//What a model was loaded with, read before the watch thread starts.
+	struct WatchedModel
+	{
+		Object* object;
+		std::wstring file;
+		bool compact, tangents;
+	};
+
+	//A changed file waiting to settle.
+	struct ChangedFile
+	{
+		std::wstring name;
+		DWORD lastChange; // timeGetTime of its latest notification
+	};
+
+	std::vector<WatchedModel> models;
+	StreamingManager* streaming;
+	std::thread thread;
+	HANDLE quitEvent;
+	std::mutex lock;
+	std::vector<std::unique_ptr<CookedModel> > cooked; // Waiting for service
+	std::vector<std::unique_ptr<CookedModel> > uploaded; // Swapped in, waiting for update
+	std::vector<std::unique_ptr<CookedModel> > uploading; // Reused by service
+	std::vector<std::unique_ptr<CookedModel> > adopting; // Reused by update
+
+	HotReloader(const HotReloader&);
+	HotReloader& operator=(const HotReloader&);
+
+	void watchMain();
+	void reloadFile(LPCWSTR name, LPDIRECT3D9* ppD3D, LPDIRECT3DDEVICE9* ppCookDevice);
+	void cook(DWORD model, LPDIRECT3DDEVICE9* ppCookDevice);
+
+public:
+	HotReloader();
+	~HotReloader();
+	void addModel(Object*);
+	void start(StreamingManager*);
+	void shutdown();
+	void service();
+	bool update(std::vector<DWORD>* reloaded);
+};
+
+int ReadMeshData(LPD3DXMESH, CookedMesh*);
+int CreateMeshFromData(const CookedMesh&, LPDIRECT3DDEVICE9, LPD3DXMESH*);
+
+#endif // !HOTRELOAD_H
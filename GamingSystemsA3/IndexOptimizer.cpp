@@ -0,0 +1,299 @@
+#include "IndexOptimizer.h"
+#include <algorithm>
+
+/*
+Simulates a FIFO post-transform vertex cache over an index list.
+
+@param indices - The triangle list to measure
+@param numVertices - The number of vertices the indices refer to
+@param cacheSize - The number of entries in the simulated cache
+
+@return - The ACMR and ATVR of the index list
+*/
+MeshCacheStats MeasureVertexCache(const std::vector<DWORD>& indices, DWORD numVertices, DWORD cacheSize) {
+	MeshCacheStats stats = { 0.0f, 0.0f };
+	std::vector<DWORD> cacheTime(numVertices, 0);
+	DWORD misses = 0;
+	DWORD usedVertices = 0;
+
+	if (indices.empty())
+		return stats;
+
+	for (DWORD i = 0; i < indices.size(); i++) {
+		DWORD v = indices[i];
+
+		if (cacheTime[v] == 0)
+			usedVertices++;
+
+		// A vertex is still cached if fewer than cacheSize misses happened since it was loaded
+		if (cacheTime[v] == 0 || misses - cacheTime[v] >= cacheSize) {
+			misses++;
+			cacheTime[v] = misses;
+		}
+	}
+
+	stats.acmr = (float)misses / (indices.size() / 3);
+	stats.atvr = (float)misses / usedVertices;
+	return stats;
+}
+
+/*
+Reorders a triangle list for the post-transform vertex cache using Tipsify
+(Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and
+Reduced Overdraw", 2007). Runs in time linear in the number of indices.
+
+@param indices - The triangle list to reorder in place
+@param numVertices - The number of vertices the indices refer to
+@param cacheSize - The number of entries in the targeted cache
+@param clusters - If not NULL, receives the first face of each cluster. A new
+				  cluster starts every time the fan hits a dead end.
+*/
+void TipsifyIndices(std::vector<DWORD>& indices, DWORD numVertices, DWORD cacheSize, std::vector<DWORD>* clusters) {
+	DWORD numFaces = (DWORD)indices.size() / 3;
+	std::vector<DWORD> liveCount(numVertices, 0);
+	std::vector<DWORD> offsets(numVertices + 1, 0);
+	std::vector<DWORD> adjacency(indices.size());
+	std::vector<DWORD> cacheTime(numVertices, 0);
+	std::vector<bool> emitted(numFaces, false);
+	std::vector<DWORD> deadEnd;
+	std::vector<DWORD> candidates;
+	std::vector<DWORD> output;
+	DWORD timeStamp = cacheSize + 1;
+	DWORD cursor = 0;
+	long fanning;
+
+	if (clusters)
+		clusters->clear();
+
+	if (numFaces == 0)
+		return;
+
+	// Build the vertex to triangle adjacency
+	for (DWORD i = 0; i < indices.size(); i++)
+		liveCount[indices[i]]++;
+
+	for (DWORD v = 0; v < numVertices; v++)
+		offsets[v + 1] = offsets[v] + liveCount[v];
+
+	std::vector<DWORD> fill(offsets.begin(), offsets.end() - 1);
+	for (DWORD f = 0; f < numFaces; f++) {
+		for (DWORD k = 0; k < 3; k++)
+			adjacency[fill[indices[f * 3 + k]]++] = f;
+	}
+
+	deadEnd.reserve(indices.size());
+	output.reserve(indices.size());
+
+	if (clusters)
+		clusters->push_back(0);
+
+	fanning = indices[0];
+	while (fanning >= 0) {
+		candidates.clear();
+
+		// Emit every remaining triangle around the fanning vertex
+		for (DWORD j = offsets[fanning]; j < offsets[fanning + 1]; j++) {
+			DWORD t = adjacency[j];
+			if (emitted[t])
+				continue;
+
+			for (DWORD k = 0; k < 3; k++) {
+				DWORD v = indices[t * 3 + k];
+				output.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				liveCount[v]--;
+				if (timeStamp - cacheTime[v] > cacheSize) {
+					cacheTime[v] = timeStamp;
+					timeStamp++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		// Pick the candidate that will still be in the cache after its fan is emitted
+		long next = -1;
+		long bestPriority = -1;
+		for (DWORD j = 0; j < candidates.size(); j++) {
+			DWORD v = candidates[j];
+			if (liveCount[v] > 0) {
+				long priority = 0;
+				if (timeStamp - cacheTime[v] + 2 * liveCount[v] <= cacheSize)
+					priority = timeStamp - cacheTime[v];
+				if (priority > bestPriority) {
+					bestPriority = priority;
+					next = v;
+				}
+			}
+		}
+
+		// Dead end: fall back to recently referenced vertices, then to the input order
+		if (next == -1) {
+			while (!deadEnd.empty()) {
+				DWORD v = deadEnd.back();
+				deadEnd.pop_back();
+				if (liveCount[v] > 0) {
+					next = v;
+					break;
+				}
+			}
+			while (next == -1 && cursor < numVertices) {
+				if (liveCount[cursor] > 0)
+					next = cursor;
+				cursor++;
+			}
+			if (clusters && next != -1)
+				clusters->push_back((DWORD)output.size() / 3);
+		}
+
+		fanning = next;
+	}
+
+	indices.swap(output);
+}
+
+/*
+Sorts the clusters produced by TipsifyIndices so that clusters facing away from
+the mesh centroid are drawn first, which lets the depth test reject most of the
+occluded clusters drawn later from any viewpoint.
+
+@param indices - The tipsified triangle list to reorder in place
+@param clusters - The first face of each cluster
+@param positions - The vertex positions the indices refer to
+*/
+void SortClustersForOverdraw(std::vector<DWORD>& indices, const std::vector<DWORD>& clusters, const std::vector<D3DXVECTOR3>& positions) {
+	DWORD numFaces = (DWORD)indices.size() / 3;
+	DWORD numClusters = (DWORD)clusters.size();
+	D3DXVECTOR3 meshCentroid(0.0f, 0.0f, 0.0f);
+	std::vector<std::pair<float, DWORD> > keys(numClusters);
+	std::vector<DWORD> output;
+
+	if (numClusters < 2)
+		return;
+
+	for (DWORD i = 0; i < indices.size(); i++)
+		meshCentroid += positions[indices[i]];
+	meshCentroid /= (float)indices.size();
+
+	for (DWORD c = 0; c < numClusters; c++) {
+		DWORD end = (c + 1 < numClusters) ? clusters[c + 1] : numFaces;
+		D3DXVECTOR3 centroid(0.0f, 0.0f, 0.0f);
+		D3DXVECTOR3 normal(0.0f, 0.0f, 0.0f);
+		float area = 0.0f;
+
+		for (DWORD f = clusters[c]; f < end; f++) {
+			const D3DXVECTOR3& p0 = positions[indices[f * 3]];
+			const D3DXVECTOR3& p1 = positions[indices[f * 3 + 1]];
+			const D3DXVECTOR3& p2 = positions[indices[f * 3 + 2]];
+			D3DXVECTOR3 e1 = p1 - p0;
+			D3DXVECTOR3 e2 = p2 - p0;
+			D3DXVECTOR3 faceNormal;
+
+			// The cross product's length is twice the face area, so it doubles as the weight
+			D3DXVec3Cross(&faceNormal, &e1, &e2);
+			float weight = D3DXVec3Length(&faceNormal);
+			centroid += (p0 + p1 + p2) * (weight / 3.0f);
+			normal += faceNormal;
+			area += weight;
+		}
+
+		if (area > 0.0f)
+			centroid /= area;
+
+		D3DXVECTOR3 toCluster = centroid - meshCentroid;
+		keys[c].first = -D3DXVec3Dot(&toCluster, &normal);
+		keys[c].second = c;
+	}
+
+	std::stable_sort(keys.begin(), keys.end());
+
+	output.reserve(indices.size());
+	for (DWORD i = 0; i < numClusters; i++) {
+		DWORD c = keys[i].second;
+		DWORD end = (c + 1 < numClusters) ? clusters[c + 1] : numFaces;
+		output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + end * 3);
+	}
+
+	indices.swap(output);
+}
+
+/*
+Builds a vertex remap that orders vertices by their first use in the index list,
+so vertex fetches walk the vertex buffer mostly sequentially. Unreferenced
+vertices are moved to the end.
+
+@param indices - The triangle list that will be drawn
+@param numVertices - The number of vertices the indices refer to
+@param remap - Receives the new position of each old vertex
+*/
+void BuildFetchRemap(const std::vector<DWORD>& indices, DWORD numVertices, std::vector<DWORD>& remap) {
+	DWORD next = 0;
+
+	remap.assign(numVertices, 0xFFFFFFFF);
+
+	for (DWORD i = 0; i < indices.size(); i++) {
+		if (remap[indices[i]] == 0xFFFFFFFF)
+			remap[indices[i]] = next++;
+	}
+
+	for (DWORD v = 0; v < numVertices; v++) {
+		if (remap[v] == 0xFFFFFFFF)
+			remap[v] = next++;
+	}
+}
+
+/*
+Reorders a mesh's triangle list for rendering. Each subset is reordered for the
+vertex cache on its own, so faces stay inside their subset, and its clusters are
+sorted for overdraw when positions are given. The vertices are then renumbered
+in first-use order, and each subset's vertex range follows its vertices.
+
+@param indices - The triangle list, with the faces of each subset contiguous
+@param numVertices - The number of vertices the indices refer to
+@param subsets - The runs of faces to keep together; their vertex ranges are updated
+@param positions - The vertex positions for the overdraw sort, or empty to skip it
+@param flags - A combination of the MESHOPT_ flags
+@param remap - Receives the new position of each old vertex, for moving the
+			   vertices to match, or is left empty without MESHOPT_VERTEXFETCH
+*/
+void OptimizeIndices(std::vector<DWORD>& indices, DWORD numVertices, std::vector<IndexSubset>& subsets, const std::vector<D3DXVECTOR3>& positions, DWORD flags, std::vector<DWORD>* remap) {
+	bool sortOverdraw = (flags & MESHOPT_OVERDRAW) && positions.size() == numVertices;
+
+	remap->clear();
+
+	if (flags & MESHOPT_VERTEXCACHE) {
+		for (DWORD a = 0; a < subsets.size(); a++) {
+			std::vector<DWORD> subset(indices.begin() + subsets[a].faceStart * 3,
+				indices.begin() + (subsets[a].faceStart + subsets[a].faceCount) * 3);
+			std::vector<DWORD> clusters;
+
+			TipsifyIndices(subset, numVertices, VERTEX_CACHE_SIZE, sortOverdraw ? &clusters : NULL);
+			if (sortOverdraw)
+				SortClustersForOverdraw(subset, clusters, positions);
+
+			std::copy(subset.begin(), subset.end(), indices.begin() + subsets[a].faceStart * 3);
+		}
+	}
+
+	if (flags & MESHOPT_VERTEXFETCH) {
+		BuildFetchRemap(indices, numVertices, *remap);
+		for (DWORD i = 0; i < indices.size(); i++)
+			indices[i] = (*remap)[indices[i]];
+
+		// Vertex ranges of the subsets moved with the vertices
+		for (DWORD a = 0; a < subsets.size(); a++) {
+			DWORD first = subsets[a].faceStart * 3;
+			DWORD last = (subsets[a].faceStart + subsets[a].faceCount) * 3;
+			DWORD minVertex = 0xFFFFFFFF, maxVertex = 0;
+
+			for (DWORD i = first; i < last; i++) {
+				minVertex = std::min(minVertex, indices[i]);
+				maxVertex = std::max(maxVertex, indices[i]);
+			}
+			if (first < last) {
+				subsets[a].vertexStart = minVertex;
+				subsets[a].vertexCount = maxVertex - minVertex + 1;
+			}
+		}
+	}
+}
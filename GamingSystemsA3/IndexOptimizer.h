@@ -0,0 +1,37 @@
+#ifndef INDEXOPTIMIZER_H
+#define INDEXOPTIMIZER_H
+
+// Works on plain index lists, so it is part of the core library; MeshOptimizer
+// reads and writes D3DX meshes with it.
+#include "CoreMath.h"
+#include <vector>
+
+//Size of the simulated post-transform vertex cache used for reordering and reporting.
+#define VERTEX_CACHE_SIZE 16
+
+//Flags for OptimizeIndices and OptimizeMesh.
+#define MESHOPT_VERTEXCACHE	0x1 // Reorder triangles for the post-transform cache (Tipsify)
+#define MESHOPT_VERTEXFETCH	0x2 // Reorder vertices in first-use order for fetch locality
+#define MESHOPT_OVERDRAW	0x4 // Sort Tipsify clusters front-to-back for overdraw
+
+//Vertex cache efficiency of an index buffer.
+struct MeshCacheStats
+{
+	float acmr; // Average cache miss ratio: transformed vertices per triangle
+	float atvr; // Average transform to vertex ratio: transformed vertices per used vertex
+};
+
+//A run of faces drawn together, such as one material's, and the vertices they use.
+struct IndexSubset
+{
+	DWORD faceStart, faceCount;
+	DWORD vertexStart, vertexCount;
+};
+
+MeshCacheStats MeasureVertexCache(const std::vector<DWORD>& indices, DWORD numVertices, DWORD cacheSize);
+void TipsifyIndices(std::vector<DWORD>& indices, DWORD numVertices, DWORD cacheSize, std::vector<DWORD>* clusters);
+void SortClustersForOverdraw(std::vector<DWORD>& indices, const std::vector<DWORD>& clusters, const std::vector<D3DXVECTOR3>& positions);
+void BuildFetchRemap(const std::vector<DWORD>& indices, DWORD numVertices, std::vector<DWORD>& remap);
+void OptimizeIndices(std::vector<DWORD>& indices, DWORD numVertices, std::vector<IndexSubset>& subsets, const std::vector<D3DXVECTOR3>& positions, DWORD flags, std::vector<DWORD>* remap);
+
+#endif // !INDEXOPTIMIZER_H
@@ -0,0 +1,364 @@
+#include "Headers.h"
+#include "InputSystem.h"
+
+//Start of an input recording, followed by each frame's time step, each frame's event count and then the events.
+struct InputRecordingHeader
+{
+	DWORD magic;
+	DWORD version;
+	DWORD frames;
+	DWORD events;
+};
+
+/*
+Creates an InputSystem with the game's default key bindings.
+*/
+InputSystem::InputSystem() :mouseX(0), mouseY(0), mouseKnown(false), recording(false), replaying(false), replayFrame(0), replayEvent(0) {
+	ZeroMemory(keys, sizeof(keys));
+	clearBindings();
+
+	bind('W', ACTION_WALK_FORWARD);
+	bind('S', ACTION_WALK_BACK);
+	bind('A', ACTION_STRAFE_LEFT);
+	bind('D', ACTION_STRAFE_RIGHT);
+	bind('R', ACTION_FLY_UP);
+	bind('F', ACTION_FLY_DOWN);
+	bind(VK_UP, ACTION_PITCH_UP);
+	bind(VK_DOWN, ACTION_PITCH_DOWN);
+	bind(VK_LEFT, ACTION_YAW_LEFT);
+	bind(VK_RIGHT, ACTION_YAW_RIGHT);
+	bind('N', ACTION_ROLL_LEFT);
+	bind('M', ACTION_ROLL_RIGHT);
+
+	bind('3', ACTION_TOGGLE_AMBIENT);
+	bind('4', ACTION_TOGGLE_LIGHT_0);
+	bind('5', ACTION_TOGGLE_LIGHT_1);
+	bind('6', ACTION_TOGGLE_LIGHT_2);
+	bind('7', ACTION_ADD_LIGHTS);
+	bind('8', ACTION_REMOVE_LIGHTS);
+	bind('9', ACTION_BENCHMARK_LIGHTS);
+	bind('0', ACTION_CYCLE_RENDER_PATH);
+	bind('B', ACTION_BAKE_PROBE);
+	bind('P', ACTION_TOGGLE_PIPELINE);
+	bind(VK_ESCAPE, ACTION_QUIT);
+}
+
+/*
+Binds a key to an action, replacing what the key was bound to before. Several
+keys can be bound to the same action.
+
+@param key - The virtual key code
+@param action - The action, ACTION_NONE to unbind the key
+*/
+void InputSystem::bind(BYTE key, InputAction action) {
+	bindings[key] = action;
+}
+
+/*
+Unbinds every key.
+*/
+void InputSystem::clearBindings() {
+	for (int k = 0; k < 256; k++)
+		bindings[k] = ACTION_NONE;
+}
+
+void InputSystem::pushEvent(WORD type, WORD code, int x, int y) {
+	LARGE_INTEGER now;
+	InputEvent e;
+
+	QueryPerformanceCounter(&now);
+	e.time = now.QuadPart;
+	e.type = type;
+	e.code = code;
+	e.x = (short)x;
+	e.y = (short)y;
+	queue.push_back(e);
+}
+
+/*
+Queues the input in a window message until the next frame. Nothing is applied
+to the game here, so however many messages arrive the work is done once a frame.
+
+@param message - The window message
+@param wParam - Additional message information
+@param lParam - Additional message information
+
+@return - Returns true if the message was input and needs no further handling
+*/
+bool InputSystem::handleMessage(UINT message, WPARAM wParam, LPARAM lParam) {
+	int x = (short)LOWORD(lParam);
+	int y = (short)HIWORD(lParam);
+
+	switch (message) {
+		case WM_KEYDOWN:
+			// Auto-repeat is not a new press
+			if (!(lParam & (1 << 30)))
+				pushEvent(INPUT_KEY_DOWN, (WORD)(wParam & 0xFF), 0, 0);
+			return true;
+		case WM_KEYUP:
+			pushEvent(INPUT_KEY_UP, (WORD)(wParam & 0xFF), 0, 0);
+			return true;
+		case WM_LBUTTONDOWN:
+			pushEvent(INPUT_MOUSE_DOWN, MOUSE_LEFT, x, y);
+			return true;
+		case WM_RBUTTONDOWN:
+			pushEvent(INPUT_MOUSE_DOWN, MOUSE_RIGHT, x, y);
+			return true;
+		case WM_MBUTTONDOWN:
+			pushEvent(INPUT_MOUSE_DOWN, MOUSE_MIDDLE, x, y);
+			return true;
+		case WM_LBUTTONUP:
+			pushEvent(INPUT_MOUSE_UP, MOUSE_LEFT, x, y);
+			return true;
+		case WM_RBUTTONUP:
+			pushEvent(INPUT_MOUSE_UP, MOUSE_RIGHT, x, y);
+			return true;
+		case WM_MBUTTONUP:
+			pushEvent(INPUT_MOUSE_UP, MOUSE_MIDDLE, x, y);
+			return true;
+		case WM_MOUSEMOVE:
+			// The buttons held during the move, so a release outside the window is not missed
+			pushEvent(INPUT_MOUSE_MOVE, (WORD)(wParam & (MK_LBUTTON | MK_RBUTTON | MK_MBUTTON)), x, y);
+			return true;
+		case WM_KILLFOCUS:
+			// Keys released while another window has focus never send WM_KEYUP here
+			pushEvent(INPUT_FOCUS_LOST, 0, 0, 0);
+			return false;
+	}
+
+	return false;
+}
+
+/*
+Folds one event into the frame and the held key state.
+
+@param e - The event
+@param frame - The frame being built
+*/
+void InputSystem::applyEvent(const InputEvent& e, InputFrame* frame) {
+	switch (e.type) {
+		case INPUT_KEY_DOWN:
+			if (!keys[e.code & 0xFF] && bindings[e.code & 0xFF] != ACTION_NONE)
+				frame->pressed[bindings[e.code & 0xFF]]++;
+			keys[e.code & 0xFF] = true;
+			break;
+		case INPUT_KEY_UP:
+			keys[e.code & 0xFF] = false;
+			break;
+		case INPUT_MOUSE_DOWN:
+			if (e.code == MOUSE_LEFT && !frame->clicked) {
+				frame->clicked = true;
+				frame->clickX = e.x;
+				frame->clickY = e.y;
+			}
+			mouseX = e.x;
+			mouseY = e.y;
+			mouseKnown = true;
+			break;
+		case INPUT_MOUSE_UP:
+			mouseX = e.x;
+			mouseY = e.y;
+			mouseKnown = true;
+			break;
+		case INPUT_MOUSE_MOVE:
+		{
+			// A drag only counts while a single button is down
+			int button = e.code == MK_LBUTTON ? MOUSE_LEFT : e.code == MK_RBUTTON ? MOUSE_RIGHT : e.code == MK_MBUTTON ? MOUSE_MIDDLE : -1;
+
+			if (button >= 0 && mouseKnown) {
+				frame->dragX[button] += (float)(e.x - mouseX);
+				frame->dragY[button] += (float)(e.y - mouseY);
+			}
+			mouseX = e.x;
+			mouseY = e.y;
+			mouseKnown = true;
+			break;
+		}
+		case INPUT_FOCUS_LOST:
+			ZeroMemory(keys, sizeof(keys));
+			mouseKnown = false;
+			break;
+	}
+}
+
+/*
+Builds the input of the next frame from the events queued since the last one,
+or from the next recorded frame while replaying. A frame that is recorded keeps
+its events and time step.
+
+@param timeDelta - Seconds since the last frame; replaced by the recorded step while replaying
+@param frame - Receives the frame's input
+*/
+void InputSystem::beginFrame(float timeDelta, InputFrame* frame) {
+	ZeroMemory(frame, sizeof(InputFrame));
+
+	if (replaying) {
+		// Live input is ignored so the replay runs exactly as it was recorded
+		queue.clear();
+		if (replayFrame >= recordedCounts.size())
+			return;
+
+		DWORD count = recordedCounts[replayFrame];
+
+		timeDelta = recordedSteps[replayFrame];
+		for (DWORD i = 0; i < count; i++)
+			applyEvent(recordedEvents[replayEvent + i], frame);
+		frame->events = count;
+		replayEvent += count;
+		replayFrame++;
+	}
+	else {
+		for (DWORD i = 0; i < queue.size(); i++)
+			applyEvent(queue[i], frame);
+		frame->events = queue.size();
+
+		if (recording) {
+			recordedEvents.insert(recordedEvents.end(), queue.begin(), queue.end());
+			recordedCounts.push_back(queue.size());
+			recordedSteps.push_back(timeDelta);
+		}
+		queue.clear();
+	}
+
+	frame->timeDelta = timeDelta;
+	for (int k = 0; k < 256; k++) {
+		if (keys[k])
+			frame->held[bindings[k]] = true;
+	}
+	frame->held[ACTION_NONE] = false;
+}
+
+/*
+Starts recording every following frame, discarding anything recorded before.
+*/
+void InputSystem::startRecording() {
+	recordedEvents.clear();
+	recordedCounts.clear();
+	recordedSteps.clear();
+	replaying = false;
+	recording = true;
+}
+
+/*
+Writes the frames recorded so far to a file that loadReplay can read.
+
+@param file - The file to write
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if nothing is being recorded or the file can not be written.
+*/
+int InputSystem::saveRecording(LPCWSTR file) {
+	InputRecordingHeader header;
+	std::vector<char> data;
+
+	if (!recording) {
+		SetError(TEXT("No input is being recorded"));
+		return E_FAIL;
+	}
+
+	header.magic = INPUT_RECORDING_MAGIC;
+	header.version = INPUT_RECORDING_VERSION;
+	header.frames = recordedCounts.size();
+	header.events = recordedEvents.size();
+
+	data.resize(sizeof(InputRecordingHeader) + header.frames * (sizeof(float) + sizeof(DWORD)) + header.events * sizeof(InputEvent));
+	char* p = &data[0];
+	memcpy(p, &header, sizeof(InputRecordingHeader));
+	p += sizeof(InputRecordingHeader);
+	if (header.frames > 0) {
+		memcpy(p, &recordedSteps[0], header.frames * sizeof(float));
+		p += header.frames * sizeof(float);
+		memcpy(p, &recordedCounts[0], header.frames * sizeof(DWORD));
+		p += header.frames * sizeof(DWORD);
+	}
+	if (header.events > 0)
+		memcpy(p, &recordedEvents[0], header.events * sizeof(InputEvent));
+
+	if (!WriteWholeFile(file, &data[0], data.size())) {
+		SetError(TEXT("Could not write the input recording %s"), file);
+		return E_FAIL;
+	}
+
+	LogMessage(TEXT("Recorded %u frames of input, %u events, to %s"), header.frames, header.events, file);
+	return S_OK;
+}
+
+/*
+Loads a recording made by saveRecording and replays it from the next frame on,
+in place of live input. Keys and the mouse start released, as they did when
+recording started.
+
+@param file - The recording to replay
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the file can not be read or is not a recording of this version.
+*/
+int InputSystem::loadReplay(LPCWSTR file) {
+	InputRecordingHeader header;
+	std::vector<char> data;
+
+	if (!ReadWholeFile(file, &data) || data.size() < sizeof(InputRecordingHeader)) {
+		SetError(TEXT("Could not read the input recording %s"), file);
+		return E_FAIL;
+	}
+
+	memcpy(&header, &data[0], sizeof(InputRecordingHeader));
+	if (header.magic != INPUT_RECORDING_MAGIC || header.version != INPUT_RECORDING_VERSION ||
+		data.size() != sizeof(InputRecordingHeader) + header.frames * (sizeof(float) + sizeof(DWORD)) + (size_t)header.events * sizeof(InputEvent)) {
+		SetError(TEXT("%s is not an input recording"), file);
+		return E_FAIL;
+	}
+
+	const char* p = &data[sizeof(InputRecordingHeader)];
+	DWORD total = 0;
+
+	recordedSteps.resize(header.frames);
+	recordedCounts.resize(header.frames);
+	recordedEvents.resize(header.events);
+	if (header.frames > 0) {
+		memcpy(&recordedSteps[0], p, header.frames * sizeof(float));
+		p += header.frames * sizeof(float);
+		memcpy(&recordedCounts[0], p, header.frames * sizeof(DWORD));
+		p += header.frames * sizeof(DWORD);
+	}
+	if (header.events > 0)
+		memcpy(&recordedEvents[0], p, header.events * sizeof(InputEvent));
+
+	for (DWORD i = 0; i < header.frames; i++)
+		total += recordedCounts[i];
+	if (total != header.events) {
+		SetError(TEXT("%s is not an input recording"), file);
+		return E_FAIL;
+	}
+
+	ZeroMemory(keys, sizeof(keys));
+	mouseKnown = false;
+	queue.clear();
+	recording = false;
+	replaying = true;
+	replayFrame = replayEvent = 0;
+
+	return S_OK;
+}
+
+bool InputSystem::isRecording() {
+	return recording;
+}
+
+bool InputSystem::isReplaying() {
+	return replaying;
+}
+
+/*
+@return - Returns true once every recorded frame has been replayed
+*/
+bool InputSystem::replayFinished() {
+	return replaying && replayFrame >= recordedCounts.size();
+}
+
+/*
+@return - The number of frames in the loaded recording
+*/
+DWORD InputSystem::getReplayFrames() {
+	return recordedCounts.size();
+}
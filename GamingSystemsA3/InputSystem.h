@@ -0,0 +1,94 @@
+#ifndef INPUTSYSTEM_H
+#define INPUTSYSTEM_H
+
+#include "Headers.h"
+#include <vector>
+
+//Identifies an input recording file, "INPT".
+#define INPUT_RECORDING_MAGIC 0x54504E49
+#define INPUT_RECORDING_VERSION 1
+
+//What the game does in response to input. Keys are bound to actions, never read directly.
+enum InputAction {
+	ACTION_NONE,
+	// Held, applied every frame the key is down
+	ACTION_WALK_FORWARD, ACTION_WALK_BACK, ACTION_STRAFE_LEFT, ACTION_STRAFE_RIGHT, ACTION_FLY_UP, ACTION_FLY_DOWN,
+	ACTION_PITCH_UP, ACTION_PITCH_DOWN, ACTION_YAW_LEFT, ACTION_YAW_RIGHT, ACTION_ROLL_LEFT, ACTION_ROLL_RIGHT,
+	// Pressed, applied once each time the key goes down
+	ACTION_TOGGLE_AMBIENT, ACTION_TOGGLE_LIGHT_0, ACTION_TOGGLE_LIGHT_1, ACTION_TOGGLE_LIGHT_2,
+	ACTION_ADD_LIGHTS, ACTION_REMOVE_LIGHTS, ACTION_BENCHMARK_LIGHTS, ACTION_CYCLE_RENDER_PATH,
+	ACTION_BAKE_PROBE, ACTION_TOGGLE_PIPELINE, ACTION_QUIT,
+	ACTION_COUNT
+};
+
+enum MouseButton { MOUSE_LEFT, MOUSE_RIGHT, MOUSE_MIDDLE, MOUSE_BUTTONS };
+
+enum InputEventType { INPUT_KEY_DOWN, INPUT_KEY_UP, INPUT_MOUSE_DOWN, INPUT_MOUSE_UP, INPUT_MOUSE_MOVE, INPUT_FOCUS_LOST };
+
+//One raw input message. Recordings store these as they are, so the layout is fixed size.
+struct InputEvent
+{
+	LONGLONG time; // QueryPerformanceCounter when the message was handled
+	WORD type; // InputEventType
+	WORD code; // Virtual key, or MouseButton
+	short x, y; // Mouse position in client pixels
+};
+
+//The input of one frame, with every event since the last frame folded in.
+struct InputFrame
+{
+	float timeDelta; // Seconds since the last frame
+	bool held[ACTION_COUNT];
+	DWORD pressed[ACTION_COUNT]; // Times each action's key went down
+	float dragX[MOUSE_BUTTONS], dragY[MOUSE_BUTTONS]; // Pixels moved while only that button was down
+	bool clicked; // Whether the left button went down
+	int clickX, clickY; // Where it first went down
+	DWORD events; // Raw events folded into the frame
+};
+
+/*
+The InputSystem buffers the window's key and mouse messages and hands them to
+the game once per frame, so the cost and the result of a frame do not depend on
+how many messages arrived during it. Keys map to actions through a binding
+table; mouse movement is summed into one drag per button.
+
+Frames can be recorded, each frame's events together with its time step, and
+replayed later in place of live input. A replayed frame sees exactly the input
+and time step it was recorded with, so the simulation repeats exactly.
+*/
+class InputSystem {
+private:
+	std::vector<InputEvent> queue; // Live events since the last frame
+	InputAction bindings[256]; // Action of each virtual key
+	bool keys[256];
+	int mouseX, mouseY;
+	bool mouseKnown;
+
+	bool recording;
+	std::vector<InputEvent> recordedEvents; // Every frame's events back to back
+	std::vector<DWORD> recordedCounts; // Events of each frame
+	std::vector<float> recordedSteps; // Time step of each frame
+
+	bool replaying;
+	DWORD replayFrame; // Next frame to replay
+	DWORD replayEvent; // First event of that frame
+
+	void pushEvent(WORD type, WORD code, int x, int y);
+	void applyEvent(const InputEvent&, InputFrame*);
+
+public:
+	InputSystem();
+	void bind(BYTE key, InputAction action);
+	void clearBindings();
+	bool handleMessage(UINT message, WPARAM wParam, LPARAM lParam);
+	void beginFrame(float timeDelta, InputFrame* frame);
+	void startRecording();
+	int saveRecording(LPCWSTR file);
+	int loadReplay(LPCWSTR file);
+	bool isRecording();
+	bool isReplaying();
+	bool replayFinished();
+	DWORD getReplayFrames();
+};
+
+#endif // !INPUTSYSTEM_H
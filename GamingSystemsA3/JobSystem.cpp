@@ -0,0 +1,303 @@
+#include "JobSystem.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+//The system and deque of the calling thread, if it is one of a system's workers.
+static thread_local const JobSystem* tlsSystem = 0;
+static thread_local unsigned tlsThread = 0;
+
+JobSystem::JobSystem() :numThreads(0), queued(0), sleeping(0), quitting(false), executed(0), stolen(0) {
+}
+
+JobSystem::~JobSystem() {
+	stop();
+}
+
+/*
+Starts the worker threads. The thread that calls start, and any other thread
+that is not a worker, runs jobs on the first deque.
+
+@param threads - The number of threads to run jobs on, the calling thread
+				 included, or 0 for one per hardware thread
+*/
+void JobSystem::start(unsigned threads) {
+	stop();
+
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	numThreads = std::max(1u, std::min(threads, (unsigned)MAX_JOB_THREADS));
+	queues.reset(new WorkerQueue[numThreads]);
+	quitting = false;
+	executed = 0;
+	stolen = 0;
+
+	for (unsigned t = 1; t < numThreads; t++)
+		workers.push_back(std::thread(&JobSystem::workerMain, this, t));
+}
+
+/*
+Wakes and joins the worker threads. Jobs still queued are not run, so every
+counter should have been waited on first.
+*/
+void JobSystem::stop() {
+	quitting = true;
+	{
+		std::lock_guard<std::mutex> hold(sleepLock);
+		wake.notify_all();
+	}
+	for (unsigned t = 0; t < workers.size(); t++)
+		workers[t].join();
+	workers.clear();
+	queues.reset();
+	numThreads = 0;
+	queued = 0;
+}
+
+unsigned JobSystem::getNumThreads() {
+	return numThreads;
+}
+
+/*
+Gets the deque of the calling thread, which jobs can use to pick per-thread
+buffers. Every thread that is not one of this system's workers gets 0.
+
+@return - A thread index below getNumThreads()
+*/
+unsigned JobSystem::getThreadIndex() {
+	return tlsSystem == this ? tlsThread : 0;
+}
+
+/*
+Takes the newest job from a thread's own deque.
+
+@param thread - The thread's deque
+@param job - Receives the job
+
+@return - Returns false if the deque is empty
+*/
+bool JobSystem::pop(unsigned thread, Job* job) {
+	WorkerQueue& queue = queues[thread];
+	std::lock_guard<std::mutex> hold(queue.lock);
+
+	if (queue.jobs.empty())
+		return false;
+	*job = queue.jobs.back();
+	queue.jobs.pop_back();
+	queued--;
+	return true;
+}
+
+/*
+Takes the oldest job from the first other deque that has one, starting with
+the next thread's so thieves spread out over their victims.
+
+@param thread - The stealing thread
+@param job - Receives the job
+
+@return - Returns false if every other deque is empty
+*/
+bool JobSystem::steal(unsigned thread, Job* job) {
+	for (unsigned i = 1; i < numThreads; i++) {
+		WorkerQueue& queue = queues[(thread + i) % numThreads];
+		std::lock_guard<std::mutex> hold(queue.lock);
+
+		if (queue.jobs.empty())
+			continue;
+		*job = queue.jobs.front();
+		queue.jobs.pop_front();
+		queued--;
+		stolen.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+/*
+Runs one job, the thread's own if it has any and a stolen one if not.
+
+@param thread - The running thread
+
+@return - Returns false if there was no job anywhere
+*/
+bool JobSystem::runOne(unsigned thread) {
+	Job job;
+
+	if (queued == 0 || (!pop(thread, &job) && !steal(thread, &job)))
+		return false;
+
+	job.function(job.data, job.begin, job.end);
+	executed.fetch_add(1, std::memory_order_relaxed);
+	if (job.counter)
+		job.counter->pending--;
+	return true;
+}
+
+/*
+Runs jobs until the system stops, sleeping whenever every deque is empty.
+
+@param thread - The worker's deque
+*/
+void JobSystem::workerMain(unsigned thread) {
+	tlsSystem = this;
+	tlsThread = thread;
+
+	while (!quitting) {
+		if (runOne(thread))
+			continue;
+
+		std::unique_lock<std::mutex> hold(sleepLock);
+		sleeping++;
+		wake.wait(hold, [this] { return queued > 0 || quitting; });
+		sleeping--;
+	}
+}
+
+/*
+Queues a job on the calling thread's deque. If the system has not been started
+the job runs straight away.
+
+@param job - The job to run; its counter, if any, is counted up now and down
+			 when the job finishes
+*/
+void JobSystem::run(const Job& job) {
+	if (numThreads == 0) {
+		job.function(job.data, job.begin, job.end);
+		return;
+	}
+
+	if (job.counter)
+		job.counter->pending++;
+	{
+		WorkerQueue& queue = queues[getThreadIndex()];
+		std::lock_guard<std::mutex> hold(queue.lock);
+		queue.jobs.push_back(job);
+	}
+	queued++;
+
+	// A worker about to sleep either sees the new job or is waiting by the time the lock is free
+	if (sleeping > 0) {
+		std::lock_guard<std::mutex> hold(sleepLock);
+		wake.notify_one();
+	}
+}
+
+/*
+Runs jobs, the group's or any other, until every job of a group has finished.
+
+@param counter - The group to wait for
+*/
+void JobSystem::wait(JobCounter* counter) {
+	unsigned thread = getThreadIndex();
+
+	while (counter->pending > 0) {
+		// The rest of the group is running on other threads
+		if (numThreads == 0 || !runOne(thread))
+			std::this_thread::yield();
+	}
+}
+
+/*
+Splits a range into jobs, runs them on every thread and waits for all of them.
+
+@param count - The number of items
+@param grain - The items in each job, or 0 to give each thread about four jobs
+@param function - Runs a run of items
+@param data - Passed to every job
+*/
+void JobSystem::parallelFor(unsigned count, unsigned grain, JobFunction function, void* data) {
+	JobCounter counter;
+
+	if (count == 0)
+		return;
+	if (grain == 0)
+		grain = std::max(1u, count / (std::max(1u, numThreads) * 4));
+
+	for (unsigned begin = 0; begin < count; begin += grain) {
+		Job job = { function, data, begin, std::min(begin + grain, count), &counter };
+		run(job);
+	}
+	wait(&counter);
+}
+
+/*
+Gets how many jobs have run since the system started.
+
+@param pExecuted - Receives the number of jobs run
+@param pStolen - Receives how many of them were stolen from another thread's deque
+*/
+void JobSystem::getCounters(unsigned long long* pExecuted, unsigned long long* pStolen) {
+	*pExecuted = executed;
+	*pStolen = stolen;
+}
+
+/*
+Stands in for per-item engine work: enough arithmetic per item that the work,
+not the scheduling, dominates.
+*/
+static void BenchmarkItems(void* data, unsigned begin, unsigned end) {
+	float* values = (float*)data;
+
+	for (unsigned i = begin; i < end; i++) {
+		float x = values[i];
+		for (int k = 0; k < 64; k++)
+			x = x * 0.999f + sqrtf(x + 1.0f) * 0.001f;
+		values[i] = x;
+	}
+}
+
+static void EmptyJob(void*, unsigned, unsigned) {
+}
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+Measures the job system with one thread, every doubling of threads, and the
+most threads. For each count it times a parallel for over JOB_BENCHMARK_ITEMS
+items to find the speedup over one thread, and JOB_BENCHMARK_EMPTY_JOBS jobs
+that do nothing to find what scheduling one job costs.
+
+@param maxThreads - The most threads to try, or 0 for one per hardware thread
+@param results - Receives one result per thread count
+*/
+void BenchmarkJobSystem(unsigned maxThreads, std::vector<JobBenchmarkResult>* results) {
+	std::vector<float> values(JOB_BENCHMARK_ITEMS);
+	std::vector<unsigned> counts;
+	JobSystem jobs;
+
+	if (maxThreads == 0)
+		maxThreads = std::thread::hardware_concurrency();
+	maxThreads = std::max(1u, std::min(maxThreads, (unsigned)MAX_JOB_THREADS));
+	for (unsigned t = 1; t < maxThreads; t *= 2)
+		counts.push_back(t);
+	counts.push_back(maxThreads);
+
+	results->clear();
+	for (unsigned c = 0; c < counts.size(); c++) {
+		JobBenchmarkResult result;
+		unsigned long long executed;
+
+		jobs.start(counts[c]);
+		result.threads = counts[c];
+		result.milliseconds = 1e30;
+		result.overheadMicroseconds = 1e30;
+
+		for (int run = 0; run < JOB_BENCHMARK_RUNS; run++) {
+			std::fill(values.begin(), values.end(), 1.0f);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			jobs.parallelFor(JOB_BENCHMARK_ITEMS, 0, BenchmarkItems, &values[0]);
+			result.milliseconds = std::min(result.milliseconds, MillisecondsSince(start));
+
+			start = std::chrono::steady_clock::now();
+			jobs.parallelFor(JOB_BENCHMARK_EMPTY_JOBS, 1, EmptyJob, 0);
+			result.overheadMicroseconds = std::min(result.overheadMicroseconds, MillisecondsSince(start) * 1000.0 / JOB_BENCHMARK_EMPTY_JOBS);
+		}
+
+		jobs.getCounters(&executed, &result.stolen);
+		result.speedup = results->empty() ? 1.0 : (*results)[0].milliseconds / result.milliseconds;
+		results->push_back(result);
+		jobs.stop();
+	}
+}
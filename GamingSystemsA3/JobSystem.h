@@ -0,0 +1,107 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+// Only the standard library is used here, so the job system and its benchmark
+// build and run on any platform, not just alongside Direct3D.
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Most threads a JobSystem runs jobs on, the calling thread included.
+#define MAX_JOB_THREADS 64
+//Items in the parallel for the job system benchmark times.
+#define JOB_BENCHMARK_ITEMS (1 << 18)
+//Empty jobs the job system benchmark runs to measure the cost of scheduling one.
+#define JOB_BENCHMARK_EMPTY_JOBS 100000
+//Times each job system benchmark configuration is run; the fastest run is kept.
+#define JOB_BENCHMARK_RUNS 5
+
+//Runs the items [begin, end) of a range, with the data the job was given.
+typedef void(*JobFunction)(void* data, unsigned begin, unsigned end);
+
+//The jobs of a group that are still to finish.
+struct JobCounter
+{
+	std::atomic<long> pending;
+
+	JobCounter() :pending(0) {}
+};
+
+struct Job
+{
+	JobFunction function;
+	void* data;
+	unsigned begin, end;
+	JobCounter* counter; // Counted down when the job finishes, may be null
+};
+
+/*
+A JobSystem runs jobs on a fixed set of threads. Each thread owns a deque: it
+pushes and pops its own jobs at the back, most recent first while their data is
+still in cache, and when its deque is empty it steals the oldest job from the
+front of another's. Threads that find nothing anywhere sleep until a job is
+pushed.
+
+A thread that did not start the system, such as the game's, shares the first
+deque and runs jobs on it while it waits, so start(n) uses n threads in total.
+Dependencies are counters: every job pushed with a counter adds one to it, and
+wait() runs jobs until it drops back to zero. A job may push and wait on jobs of
+its own.
+*/
+class JobSystem {
+private:
+	struct WorkerQueue
+	{
+		std::mutex lock;
+		std::deque<Job> jobs;
+		char padding[64]; // Keeps threads locking neighbouring deques off each other's cache lines
+	};
+
+	std::unique_ptr<WorkerQueue[]> queues;
+	std::vector<std::thread> workers;
+	unsigned numThreads;
+	std::atomic<long> queued; // Jobs pushed and not yet taken by any thread
+	std::atomic<unsigned> sleeping;
+	std::atomic<bool> quitting;
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::atomic<unsigned long long> executed, stolen;
+
+	JobSystem(const JobSystem&);
+	JobSystem& operator=(const JobSystem&);
+
+	bool pop(unsigned thread, Job* job);
+	bool steal(unsigned thread, Job* job);
+	bool runOne(unsigned thread);
+	void workerMain(unsigned thread);
+
+public:
+	JobSystem();
+	~JobSystem();
+	void start(unsigned threads);
+	void stop();
+	unsigned getNumThreads();
+	unsigned getThreadIndex();
+	void run(const Job& job);
+	void wait(JobCounter* counter);
+	void parallelFor(unsigned count, unsigned grain, JobFunction function, void* data);
+	void getCounters(unsigned long long* executed, unsigned long long* stolen);
+};
+
+//How the job system did with one number of threads.
+struct JobBenchmarkResult
+{
+	unsigned threads;
+	double milliseconds; // Fastest parallel for of JOB_BENCHMARK_ITEMS items
+	double speedup; // Over the one thread run
+	double overheadMicroseconds; // Wall time per empty job
+	unsigned long long stolen; // Jobs taken from another thread's deque across every run
+};
+
+void BenchmarkJobSystem(unsigned maxThreads, std::vector<JobBenchmarkResult>* results);
+
+#endif // !JOBSYSTEM_H
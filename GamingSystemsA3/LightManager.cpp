@@ -0,0 +1,491 @@
+#include "Headers.h"
+#include <algorithm>
+#include <cfloat>
+#include <emmintrin.h>
+
+LightManager::LightManager() :jobs(0), frameArena(0), gatherStamp(0), tilesX(0), tilesY(0), width(0), height(0), nearZ(1.0f), farZ(100.0f), appliedLights(0), binTime(0) {
+	D3DXMatrixIdentity(&proj);
+	computeSlices();
+}
+
+/*
+Adds a light to the scene. New lights start enabled.
+
+@param light - The light to add
+
+@return - The id of the light
+*/
+DWORD LightManager::addLight(const D3DLIGHT9& light) {
+	lights.push_back(light);
+	enabled.push_back(true);
+	lightStamps.push_back(0);
+	return (DWORD)lights.size() - 1;
+}
+
+/*
+Removes every light from the given id onwards.
+
+@param first - The id of the first light to remove
+*/
+void LightManager::removeLights(DWORD first) {
+	if (first >= lights.size())
+		return;
+
+	lights.erase(lights.begin() + first, lights.end());
+	enabled.erase(enabled.begin() + first, enabled.end());
+	lightStamps.erase(lightStamps.begin() + first, lightStamps.end());
+}
+
+void LightManager::setEnabled(DWORD id, bool on) {
+	enabled[id] = on;
+}
+
+bool LightManager::isEnabled(DWORD id) {
+	return enabled[id];
+}
+
+DWORD LightManager::getNumLights() {
+	return (DWORD)lights.size();
+}
+
+const D3DLIGHT9& LightManager::getLight(DWORD id) {
+	return lights[id];
+}
+
+/*
+Places the depth slices exponentially between the near and far planes, so near
+slices stay thin.
+*/
+void LightManager::computeSlices() {
+	for (int s = 0; s < LIGHT_DEPTH_SLICES; s++)
+		sliceStarts[s] = nearZ * powf(farZ / nearZ, (float)s / LIGHT_DEPTH_SLICES);
+}
+
+/*
+@param viewZ - A view space depth
+@return - The depth slice the depth is in, clamped to the first and last slice
+*/
+DWORD LightManager::depthSlice(float viewZ) {
+	DWORD slice = 0;
+
+	for (int s = 1; s < LIGHT_DEPTH_SLICES; s++)
+		slice += sliceStarts[s] <= viewZ;
+	return slice;
+}
+
+/*
+Finds the clusters covered by a view space sphere. The screen rectangle is
+bounded by dividing the sphere's extent by both its nearest and furthest depth,
+which is conservative for spheres on either side of the view axis.
+
+@param center - The center of the sphere in view space
+@param radius - The radius of the sphere
+@param rect - Receives the first and last tile in x and y and the first and last depth slice
+
+@return - Returns false if the sphere is outside the view frustum
+*/
+bool LightManager::projectSphere(const D3DXVECTOR3& center, float radius, DWORD* rect) {
+	float minX = -1.0f, maxX = 1.0f, minY = -1.0f, maxY = 1.0f;
+	float zMin, zMax;
+
+	if (center.z + radius < nearZ || center.z - radius > farZ)
+		return false;
+
+	zMin = max(center.z - radius, nearZ);
+	zMax = min(center.z + radius, farZ);
+
+	// A sphere that crosses the near plane can cover any part of the screen
+	if (center.z - radius > nearZ) {
+		float x0 = (center.x - radius) * proj._11;
+		float x1 = (center.x + radius) * proj._11;
+		float y0 = (center.y - radius) * proj._22;
+		float y1 = (center.y + radius) * proj._22;
+
+		minX = min(x0 / zMin, x0 / zMax);
+		maxX = max(x1 / zMin, x1 / zMax);
+		minY = min(y0 / zMin, y0 / zMax);
+		maxY = max(y1 / zMin, y1 / zMax);
+	}
+
+	if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f)
+		return false;
+
+	// Normalized device coordinates to tiles, y grows down the screen; the same sums as projectLights
+	float tilesPerX = 0.5f * width / LIGHT_TILE_SIZE;
+	float tilesPerY = 0.5f * height / LIGHT_TILE_SIZE;
+	rect[0] = (DWORD)min(max((minX + 1.0f) * tilesPerX, 0.0f), (float)(tilesX - 1));
+	rect[1] = (DWORD)min(max((maxX + 1.0f) * tilesPerX, 0.0f), (float)(tilesX - 1));
+	rect[2] = (DWORD)min(max((1.0f - maxY) * tilesPerY, 0.0f), (float)(tilesY - 1));
+	rect[3] = (DWORD)min(max((1.0f - minY) * tilesPerY, 0.0f), (float)(tilesY - 1));
+
+	rect[4] = depthSlice(zMin);
+	rect[5] = depthSlice(zMax);
+
+	return true;
+}
+
+/*
+Finds the clusters covered by a run of view space lights. Lights outside the
+view get an empty rectangle, first tile after last. Four lights are projected
+at a time with SSE, doing what projectSphere does for one; the lights left over
+go through projectSphere.
+
+@param begin - The first light to project
+@param end - One past the last light to project
+*/
+void LightManager::projectLights(DWORD begin, DWORD end) {
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minusOne = _mm_set1_ps(-1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 nearV = _mm_set1_ps(nearZ);
+	const __m128 farV = _mm_set1_ps(farZ);
+	const __m128 scaleX = _mm_set1_ps(proj._11);
+	const __m128 scaleY = _mm_set1_ps(proj._22);
+	const __m128 tilesPerX = _mm_set1_ps(0.5f * width / LIGHT_TILE_SIZE);
+	const __m128 tilesPerY = _mm_set1_ps(0.5f * height / LIGHT_TILE_SIZE);
+	const __m128 lastTileX = _mm_set1_ps((float)(tilesX - 1));
+	const __m128 lastTileY = _mm_set1_ps((float)(tilesY - 1));
+	DWORD l = begin;
+
+	for (; l + 4 <= end; l += 4) {
+		__m128 x = _mm_loadu_ps(&viewX[l]);
+		__m128 y = _mm_loadu_ps(&viewY[l]);
+		__m128 z = _mm_loadu_ps(&viewZ[l]);
+		__m128 r = _mm_loadu_ps(&viewRadius[l]);
+		__m128 front = _mm_sub_ps(z, r);
+		__m128 back = _mm_add_ps(z, r);
+		__m128 outside = _mm_or_ps(_mm_cmplt_ps(back, nearV), _mm_cmpgt_ps(front, farV));
+		__m128 zMin = _mm_max_ps(front, nearV);
+		__m128 zMax = _mm_min_ps(back, farV);
+
+		// Bounds of the sphere divided by its nearest and furthest depth
+		__m128 x0 = _mm_mul_ps(_mm_sub_ps(x, r), scaleX);
+		__m128 x1 = _mm_mul_ps(_mm_add_ps(x, r), scaleX);
+		__m128 y0 = _mm_mul_ps(_mm_sub_ps(y, r), scaleY);
+		__m128 y1 = _mm_mul_ps(_mm_add_ps(y, r), scaleY);
+		__m128 minX = _mm_min_ps(_mm_div_ps(x0, zMin), _mm_div_ps(x0, zMax));
+		__m128 maxX = _mm_max_ps(_mm_div_ps(x1, zMin), _mm_div_ps(x1, zMax));
+		__m128 minY = _mm_min_ps(_mm_div_ps(y0, zMin), _mm_div_ps(y0, zMax));
+		__m128 maxY = _mm_max_ps(_mm_div_ps(y1, zMin), _mm_div_ps(y1, zMax));
+
+		// A sphere that crosses the near plane can cover any part of the screen
+		__m128 crosses = _mm_cmple_ps(front, nearV);
+		minX = _mm_or_ps(_mm_and_ps(crosses, minusOne), _mm_andnot_ps(crosses, minX));
+		maxX = _mm_or_ps(_mm_and_ps(crosses, one), _mm_andnot_ps(crosses, maxX));
+		minY = _mm_or_ps(_mm_and_ps(crosses, minusOne), _mm_andnot_ps(crosses, minY));
+		maxY = _mm_or_ps(_mm_and_ps(crosses, one), _mm_andnot_ps(crosses, maxY));
+
+		outside = _mm_or_ps(outside, _mm_or_ps(_mm_cmplt_ps(maxX, minusOne), _mm_cmpgt_ps(minX, one)));
+		outside = _mm_or_ps(outside, _mm_or_ps(_mm_cmplt_ps(maxY, minusOne), _mm_cmpgt_ps(minY, one)));
+
+		// Clamped while still floats, so truncating gives the tile; y grows down the screen
+		__m128i tiles[4], slices[2];
+		tiles[0] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(minX, one), tilesPerX), zero), lastTileX));
+		tiles[1] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(maxX, one), tilesPerX), zero), lastTileX));
+		tiles[2] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(one, maxY), tilesPerY), zero), lastTileY));
+		tiles[3] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(one, minY), tilesPerY), zero), lastTileY));
+
+		// Each slice start at or before a depth moves it one slice further; the masks are -1 where true
+		slices[0] = slices[1] = _mm_setzero_si128();
+		for (int s = 1; s < LIGHT_DEPTH_SLICES; s++) {
+			__m128 start = _mm_set1_ps(sliceStarts[s]);
+			slices[0] = _mm_sub_epi32(slices[0], _mm_castps_si128(_mm_cmple_ps(start, zMin)));
+			slices[1] = _mm_sub_epi32(slices[1], _mm_castps_si128(_mm_cmple_ps(start, zMax)));
+		}
+
+		int outsideMask = _mm_movemask_ps(outside);
+		DWORD values[6][4];
+		for (int i = 0; i < 4; i++)
+			_mm_storeu_si128((__m128i*)values[i], tiles[i]);
+		_mm_storeu_si128((__m128i*)values[4], slices[0]);
+		_mm_storeu_si128((__m128i*)values[5], slices[1]);
+
+		for (int lane = 0; lane < 4; lane++) {
+			DWORD* rect = &lightRects[(l + lane) * 6];
+
+			for (int i = 0; i < 6; i++)
+				rect[i] = values[i][lane];
+			if (outsideMask & (1 << lane)) {
+				rect[0] = 1;
+				rect[1] = 0;
+			}
+		}
+	}
+
+	for (; l < end; l++) {
+		DWORD* rect = &lightRects[l * 6];
+		if (!projectSphere(D3DXVECTOR3(viewX[l], viewY[l], viewZ[l]), viewRadius[l], rect)) {
+			rect[0] = 1;
+			rect[1] = 0;
+		}
+	}
+}
+
+void LightManager::ProjectLightsJob(void* data, unsigned begin, unsigned end) {
+	((LightManager*)data)->projectLights(begin, end);
+}
+
+/*
+Bins the enabled local lights into clusters for the current camera. Lights are
+moved to view space and projected to the clusters they cover, then the entries
+of each cluster are counted and the cluster lists filled.
+
+@param view - The camera's view matrix
+@param projection - The camera's projection matrix
+@param vp - The viewport being rendered to
+@param nearPlane - The distance to the near clipping plane
+@param farPlane - The distance to the far clipping plane
+*/
+void LightManager::binLights(const D3DXMATRIX& view, const D3DXMATRIX& projection, const D3DVIEWPORT9& vp, float nearPlane, float farPlane) {
+	LARGE_INTEGER start, end, frequency;
+	DWORD numClusters, numLocal;
+
+	QueryPerformanceCounter(&start);
+
+	proj = projection;
+	width = (float)vp.Width;
+	height = (float)vp.Height;
+	nearZ = nearPlane;
+	farZ = farPlane;
+	computeSlices();
+	tilesX = (vp.Width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	tilesY = (vp.Height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	numClusters = tilesX * tilesY * LIGHT_DEPTH_SLICES;
+
+	localLights.clear();
+	globalLights.clear();
+	viewX.clear();
+	viewY.clear();
+	viewZ.clear();
+	viewRadius.clear();
+
+	for (DWORD i = 0; i < lights.size(); i++) {
+		if (!enabled[i])
+			continue;
+
+		if (lights[i].Type == D3DLIGHT_DIRECTIONAL) {
+			globalLights.push_back(i);
+			continue;
+		}
+
+		const D3DVECTOR& p = lights[i].Position;
+		localLights.push_back(i);
+		viewX.push_back(p.x * view._11 + p.y * view._21 + p.z * view._31 + view._41);
+		viewY.push_back(p.x * view._12 + p.y * view._22 + p.z * view._32 + view._42);
+		viewZ.push_back(p.x * view._13 + p.y * view._23 + p.z * view._33 + view._43);
+		viewRadius.push_back(lights[i].Range);
+	}
+
+	numLocal = (DWORD)localLights.size();
+	lightRects.resize(numLocal * 6);
+	clusterOffsets.assign(numClusters + 1, 0);
+
+	// Each light writes only its own rectangle, so many lights are projected in parallel
+	if (jobs && numLocal >= LIGHT_PARALLEL_MIN)
+		jobs->parallelFor(numLocal, 0, ProjectLightsJob, this);
+	else
+		projectLights(0, numLocal);
+
+	// Count the lights of each cluster
+	for (DWORD l = 0; l < numLocal; l++) {
+		DWORD* rect = &lightRects[l * 6];
+		if (rect[0] > rect[1])
+			continue;
+
+		for (DWORD z = rect[4]; z <= rect[5]; z++)
+			for (DWORD y = rect[2]; y <= rect[3]; y++)
+				for (DWORD x = rect[0]; x <= rect[1]; x++)
+					clusterOffsets[(z * tilesY + y) * tilesX + x + 1]++;
+	}
+
+	for (DWORD c = 0; c < numClusters; c++)
+		clusterOffsets[c + 1] += clusterOffsets[c];
+
+	// Fill the cluster lists
+	std::vector<DWORD> cursor(clusterOffsets.begin(), clusterOffsets.end() - 1);
+	clusterLights.resize(clusterOffsets[numClusters]);
+	for (DWORD l = 0; l < numLocal; l++) {
+		DWORD* rect = &lightRects[l * 6];
+		if (rect[0] > rect[1])
+			continue;
+
+		for (DWORD z = rect[4]; z <= rect[5]; z++)
+			for (DWORD y = rect[2]; y <= rect[3]; y++)
+				for (DWORD x = rect[0]; x <= rect[1]; x++)
+					clusterLights[cursor[(z * tilesY + y) * tilesX + x]++] = l;
+	}
+
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	binTime = (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart;
+}
+
+/*
+Picks the lights that affect a view space sphere from the clusters it covers.
+Candidates are ranked by their unshadowed intensity at the sphere's center, and
+directional lights always rank first.
+
+@param viewCenter - The center of the sphere in view space
+@param radius - The radius of the sphere
+@param ids - Receives the ids of the chosen lights
+@param maxLights - The most lights to choose
+
+@return - The number of lights chosen
+*/
+DWORD LightManager::gatherLights(const D3DXVECTOR3& viewCenter, float radius, DWORD* ids, DWORD maxLights) {
+	DWORD rect[6];
+	DWORD count, numCandidates = 0;
+	DWORD bound = globalLights.size() + localLights.size(); // Each light is a candidate at most once
+	std::pair<float, DWORD>* list;
+
+	gatherStamp++;
+	if (frameArena) {
+		list = frameArena->allocArray<std::pair<float, DWORD> >(bound);
+	}
+	else {
+		candidates.resize(bound);
+		list = bound > 0 ? &candidates[0] : 0;
+	}
+
+	for (DWORD i = 0; i < globalLights.size(); i++)
+		list[numCandidates++] = std::make_pair(-FLT_MAX, globalLights[i]);
+
+	if (!localLights.empty() && projectSphere(viewCenter, radius, rect)) {
+		for (DWORD z = rect[4]; z <= rect[5]; z++) {
+			for (DWORD y = rect[2]; y <= rect[3]; y++) {
+				for (DWORD x = rect[0]; x <= rect[1]; x++) {
+					DWORD c = (z * tilesY + y) * tilesX + x;
+
+					for (DWORD j = clusterOffsets[c]; j < clusterOffsets[c + 1]; j++) {
+						DWORD l = clusterLights[j];
+						DWORD id = localLights[l];
+
+						if (lightStamps[id] == gatherStamp)
+							continue;
+						lightStamps[id] = gatherStamp;
+
+						D3DXVECTOR3 toLight(viewX[l] - viewCenter.x, viewY[l] - viewCenter.y, viewZ[l] - viewCenter.z);
+						float distance = D3DXVec3Length(&toLight);
+						if (distance > viewRadius[l] + radius)
+							continue;
+
+						// Attenuated brightness at the nearest point of the sphere
+						const D3DLIGHT9& light = lights[id];
+						float d = max(0.0f, distance - radius);
+						float attenuation = light.Attenuation0 + light.Attenuation1 * d + light.Attenuation2 * d * d;
+						float brightness = (light.Diffuse.r + light.Diffuse.g + light.Diffuse.b) / max(attenuation, 1e-3f);
+						list[numCandidates++] = std::make_pair(-brightness, id);
+					}
+				}
+			}
+		}
+	}
+
+	count = min(numCandidates, maxLights);
+	std::partial_sort(list, list + count, list + numCandidates);
+	for (DWORD i = 0; i < count; i++)
+		ids[i] = list[i].second;
+
+	return count;
+}
+
+/*
+Loads lights into the fixed-function light slots, disabling the slots that the
+previous call used but this one does not. The lights are copies, so they can be
+applied on the render thread while the game thread changes the scene's lights.
+
+@param pDevice - The device to set the lights on
+@param chosen - The lights to set
+@param count - The number of lights, at most MAX_OBJECT_LIGHTS
+*/
+void LightManager::applyLights(LPDIRECT3DDEVICE9 pDevice, const D3DLIGHT9* chosen, DWORD count) {
+	for (DWORD i = 0; i < count; i++) {
+		pDevice->SetLight(i, &chosen[i]);
+		pDevice->LightEnable(i, TRUE);
+	}
+
+	for (DWORD i = count; i < appliedLights; i++)
+		pDevice->LightEnable(i, FALSE);
+
+	appliedLights = count;
+}
+
+/*
+Converts lights to the view space arrays read by the multi-light technique of
+specular.fx. A directional light is placed far away along its direction with no
+falloff. Spot lights pass their direction and the cosines of half their inner
+(Theta) and outer (Phi) cone angles; every other light gets a cone that covers
+every direction.
+
+@param chosen - The lights to convert
+@param count - The number of lights, at most MAX_OBJECT_LIGHTS
+@param view - The camera's view matrix
+@param out - Receives the lights
+*/
+void LightManager::getShaderLights(const D3DLIGHT9* chosen, DWORD count, const D3DXMATRIX& view, ShaderLights* out) {
+	for (DWORD i = 0; i < count; i++) {
+		const D3DLIGHT9& light = chosen[i];
+		D3DXVECTOR3 position, direction(light.Direction.x, light.Direction.y, light.Direction.z);
+
+		if (light.Type == D3DLIGHT_DIRECTIONAL) {
+			D3DXVec3Normalize(&direction, &direction);
+			position = direction * -10000.0f;
+			out->attenuation[i] = D3DXVECTOR4(1.0f, 0.0f, 0.0f, FLT_MAX);
+		}
+		else {
+			position = D3DXVECTOR3(light.Position.x, light.Position.y, light.Position.z);
+			out->attenuation[i] = D3DXVECTOR4(light.Attenuation0, light.Attenuation1, light.Attenuation2, light.Range);
+		}
+
+		if (light.Type == D3DLIGHT_SPOT) {
+			D3DXVec3TransformNormal(&direction, &direction, &view);
+			D3DXVec3Normalize(&direction, &direction);
+			out->directions[i] = D3DXVECTOR4(direction.x, direction.y, direction.z, 0.0f);
+			out->cones[i] = D3DXVECTOR4(cosf(light.Theta * 0.5f), cosf(light.Phi * 0.5f), light.Falloff, 0.0f);
+		}
+		else {
+			// Cosines below any dot product put every direction inside the inner cone
+			out->directions[i] = D3DXVECTOR4(0.0f, 0.0f, 1.0f, 0.0f);
+			out->cones[i] = D3DXVECTOR4(-1.0f, -2.0f, 1.0f, 0.0f);
+		}
+
+		D3DXVec3TransformCoord(&position, &position, &view);
+		out->positions[i] = D3DXVECTOR4(position.x, position.y, position.z, 1.0f);
+		out->colors[i] = D3DXVECTOR4(light.Diffuse.r, light.Diffuse.g, light.Diffuse.b, light.Diffuse.a);
+	}
+}
+
+/*
+Forgets the light slots that were enabled, since a reset disables every light.
+*/
+void LightManager::onResetDevice() {
+	appliedLights = 0;
+}
+
+/*
+Lets binLights spread large numbers of lights over a job system.
+
+@param pJobs - The job system to use, or null to bin on the calling thread
+*/
+void LightManager::setJobSystem(JobSystem* pJobs) {
+	jobs = pJobs;
+}
+
+/*
+Lets gatherLights take its scratch memory from an arena that is reset once a
+frame, instead of keeping a buffer of its own.
+
+@param arena - The per-frame arena, or null to use the LightManager's own buffer
+*/
+void LightManager::setFrameArena(LinearArena* arena) {
+	frameArena = arena;
+}
+
+/*
+Gets the time spent binning lights in the last frame.
+
+@return - The time in milliseconds
+*/
+double LightManager::getBinTime() {
+	return binTime;
+}
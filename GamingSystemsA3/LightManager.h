@@ -0,0 +1,84 @@
+#ifndef LIGHTMANAGER_H
+#define LIGHTMANAGER_H
+
+#include "Headers.h"
+#include <vector>
+
+//Size in pixels of a screen-space light tile.
+#define LIGHT_TILE_SIZE 64
+//Number of exponential depth slices between the near and far planes.
+#define LIGHT_DEPTH_SLICES 16
+//Local lights above which binLights projects lights on the job system.
+#define LIGHT_PARALLEL_MIN 256
+//Lights applied to one Object; also the fixed-function pipeline's limit.
+#define MAX_OBJECT_LIGHTS 8
+
+//Lights converted for the multi-light technique of specular.fx, in view space.
+struct ShaderLights
+{
+	D3DXVECTOR4 positions[MAX_OBJECT_LIGHTS];
+	D3DXVECTOR4 colors[MAX_OBJECT_LIGHTS];
+	D3DXVECTOR4 attenuation[MAX_OBJECT_LIGHTS]; // Constant, linear, quadratic, range
+	D3DXVECTOR4 directions[MAX_OBJECT_LIGHTS]; // Where a spot light points
+	D3DXVECTOR4 cones[MAX_OBJECT_LIGHTS]; // Cosines of the inner and outer half angles, falloff
+};
+
+/*
+The LightManager holds every light in the scene. Each frame the local lights are
+binned into clusters (screen tiles split into depth slices) so that an Object
+only looks at the lights whose volume overlaps the clusters it covers, instead
+of at every light in the scene. Directional lights reach every cluster.
+*/
+class LightManager {
+private:
+	JobSystem* jobs;
+	LinearArena* frameArena; // Holds each gather's candidates until the frame ends
+	std::vector<D3DLIGHT9> lights;
+	std::vector<bool> enabled;
+
+	// Enabled local lights in view space, kept as separate arrays so the
+	// projection loop loads four lights into each SSE register
+	std::vector<float> viewX, viewY, viewZ, viewRadius;
+	std::vector<DWORD> localLights; // Index into lights of each view space entry
+	std::vector<DWORD> globalLights; // Enabled directional lights
+
+	// Light lists of every cluster, stored back to back
+	std::vector<DWORD> clusterOffsets;
+	std::vector<DWORD> clusterLights;
+	std::vector<DWORD> lightRects; // minX, maxX, minY, maxY, minSlice, maxSlice per local light
+	std::vector<DWORD> lightStamps; // Last gather each light was seen in, to skip duplicates
+	DWORD gatherStamp;
+	std::vector<std::pair<float, DWORD> > candidates; // Used instead of the frame arena when there is none
+
+	D3DXMATRIX proj;
+	int tilesX, tilesY;
+	float width, height, nearZ, farZ;
+	float sliceStarts[LIGHT_DEPTH_SLICES]; // View depth each depth slice begins at
+	DWORD appliedLights; // Fixed-function light slots enabled by the last applyLights
+	double binTime; // Milliseconds spent in the last binLights
+
+	void computeSlices();
+	DWORD depthSlice(float viewZ);
+	bool projectSphere(const D3DXVECTOR3&, float, DWORD*);
+	void projectLights(DWORD begin, DWORD end);
+	static void ProjectLightsJob(void*, unsigned, unsigned);
+
+public:
+	LightManager();
+	DWORD addLight(const D3DLIGHT9&);
+	void removeLights(DWORD first);
+	void setEnabled(DWORD, bool);
+	bool isEnabled(DWORD);
+	DWORD getNumLights();
+	const D3DLIGHT9& getLight(DWORD);
+	void binLights(const D3DXMATRIX& view, const D3DXMATRIX& proj, const D3DVIEWPORT9& vp, float nearZ, float farZ);
+	DWORD gatherLights(const D3DXVECTOR3& viewCenter, float radius, DWORD* ids, DWORD maxLights);
+	void applyLights(LPDIRECT3DDEVICE9, const D3DLIGHT9* chosen, DWORD count);
+	void getShaderLights(const D3DLIGHT9* chosen, DWORD count, const D3DXMATRIX& view, ShaderLights* out);
+	void onResetDevice();
+	void setJobSystem(JobSystem*);
+	void setFrameArena(LinearArena*);
+	double getBinTime();
+};
+
+#endif // !LIGHTMANAGER_H
@@ -2,6 +2,26 @@
 
 #include "Headers.h"
 
+/*
+ Finds a command line switch followed by a file name, such as -record input.rec.
+
+ @param pstrCmdLine - The command line
+ @param name - The switch
+ @param file - Receives the file name
+ @param size - The number of characters file can hold
+
+ @return - Returns true if the switch was followed by a name that is not another switch
+*/
+static bool GetSwitchFile(PSTR pstrCmdLine, const char* name, WCHAR* file, int size) {
+	const char* found = strstr(pstrCmdLine, name);
+	char value[MAX_PATH];
+
+	if (!found || sscanf_s(found + strlen(name), " %259s", value, (unsigned)MAX_PATH) != 1 || value[0] == '-')
+		return false;
+
+	return MultiByteToWideChar(CP_ACP, 0, value, -1, file, size) > 0;
+}
+
 /*
  WinMain is the entry point for the Win32 API. Creates a custom window class and
  an instance of it to be the game's window. Finally, it starts the game loop for
@@ -9,7 +29,20 @@
  
  @param hInstance - The handle to the instance of the executable
  @param hPrevInstance - Has no meaning, was used in 16-bit Windows
- @param pstrCmdLine - A string containing the command line arguments
+ @param pstrCmdLine - A string containing the command line arguments.
+					 -validateeffects loads the effect files on the null device and exits
+					 -meshstats logs the vertex cache ACMR and ATVR of each mesh before and after optimizing and exits
+					 -benchtangents times tangent frame generation on Dwarf.x and exits
+					 -benchanimation times skinning instances of the dwarf and exits
+					 -microbench times each engine hot path, checks it against microbench.baseline and exits; the first run saves the baseline
+					 -savebaseline with -microbench saves the run as the new baseline
+					 -record <file> saves every frame's input to the file on exit
+					 -replay <file> plays recorded input instead of live input, then exits
+					 -benchmark [scene] flies a fixed camera path, writes <scene>.benchmark.json and exits
+					 -headless with -benchmark renders on the null reference device in a hidden window
+					 -streambudget <MB> caps the device memory of streamed textures
+					 -compactvertices draws the models with 16-bit positions and normals, without normal maps
+					 -compresstextures builds mip chains, compresses the textures to TextureCache, writes TextureCache\report.csv and exits
  @param iCmdShow - a flag that says whether the main application window will be
 				   minimized, maximized, or shown normally
 */
@@ -17,10 +50,47 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR pstrCmdLin
 	HWND hWnd;
 	MSG msg;
 	WNDCLASSEX wc;
-	Game newGame;
 
 	static TCHAR strAppName[] = TEXT("First Windows App, Zen Style");
 
+	// Load the effect files on the null device, without creating a window
+	if (strstr(pstrCmdLine, "-validateeffects")) {
+		LPDIRECT3D9 pD3D;
+		LPDIRECT3DDEVICE9 pDevice;
+
+		if (FAILED(CreateNullDevice(&pD3D, &pDevice)))
+			return 1;
+		HRESULT r = EffectManager::ValidateEffectFile(&pDevice, TEXT("specular.fx"), &SPECULAR_LAYOUT);
+		if (FAILED(EffectManager::ValidateEffectFile(&pDevice, TEXT("reflect.fx"), &REFLECT_LAYOUT)))
+			r = E_FAIL;
+		LogMessage(TEXT("Effects loaded: %s"), SUCCEEDED(r) ? TEXT("yes") : TEXT("no"));
+		pDevice->Release();
+		pD3D->Release();
+		return FAILED(r) ? 1 : 0;
+	}
+
+	// Measure the vertex cache before and after optimizing each shipped mesh, without a window
+	if (strstr(pstrCmdLine, "-meshstats")) {
+		static const LPCWSTR meshes[] = { TEXT("Dwarf.x"), TEXT("tiger.x"), TEXT("DwarfWithEffectInstance.x") };
+		return FAILED(ReportMeshStats(meshes, sizeof(meshes) / sizeof(meshes[0]))) ? 1 : 0;
+	}
+
+	// Time tangent frame generation on a null device, without a window
+	if (strstr(pstrCmdLine, "-benchtangents"))
+		return FAILED(BenchmarkTangentFrames(TEXT("Dwarf.x"))) ? 1 : 0;
+
+	// Time sampling, blending and skinning animated instances, without a window
+	if (strstr(pstrCmdLine, "-benchanimation"))
+		return FAILED(BenchmarkAnimation(TEXT("DwarfWithEffectInstance.x"), ANIMATION_BENCHMARK_INSTANCES)) ? 1 : 0;
+
+	// Time the engine's hot paths one at a time and fail on a regression past the baseline
+	if (strstr(pstrCmdLine, "-microbench"))
+		return FAILED(RunMicroBenchmarks(MICROBENCH_BASELINE, strstr(pstrCmdLine, "-savebaseline") != NULL)) ? 1 : 0;
+
+	// Compress the textures ahead of time, reporting throughput and quality for each
+	if (strstr(pstrCmdLine, "-compresstextures"))
+		return FAILED(RunTextureTool()) ? 1 : 0;
+
 	wc.cbSize = sizeof(WNDCLASSEX);
 	wc.style = CS_HREDRAW | CS_VREDRAW | CS_OWNDC;
 	wc.cbClsExtra = sizeof(Game*);
@@ -48,12 +118,41 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR pstrCmdLin
 		hInstance,
 		NULL);
 
-	newGame = Game(hWnd);
+	Game newGame(hWnd);
 
 	SetClassLongPtr(hWnd, 0, (LONG)&newGame);
 
-	ShowWindow(hWnd, iCmdShow);
-	UpdateWindow(hWnd);
+	WCHAR inputFile[MAX_PATH];
+	bool headless = false;
+
+	if (strstr(pstrCmdLine, "-benchmark")) {
+		WCHAR scene[MAX_PATH];
+
+		if (!GetSwitchFile(pstrCmdLine, "-benchmark", scene, MAX_PATH))
+			wcscpy_s(scene, MAX_PATH, BENCHMARK_DEFAULT_SCENE);
+		headless = strstr(pstrCmdLine, "-headless") != NULL;
+		newGame.setBenchmark(scene, headless);
+	}
+
+	newGame.setCompactVertices(strstr(pstrCmdLine, "-compactvertices") != NULL);
+
+	const char* budget = strstr(pstrCmdLine, "-streambudget");
+	unsigned megabytes;
+	if (budget && sscanf_s(budget + strlen("-streambudget"), " %u", &megabytes) == 1)
+		newGame.setStreamingBudget(megabytes * 1024ULL * 1024ULL);
+
+	if (GetSwitchFile(pstrCmdLine, "-replay", inputFile, MAX_PATH)) {
+		if (FAILED(newGame.replayInput(inputFile)))
+			return 1;
+	}
+	else if (GetSwitchFile(pstrCmdLine, "-record", inputFile, MAX_PATH)) {
+		newGame.recordInput(inputFile);
+	}
+
+	if (!headless) {
+		ShowWindow(hWnd, iCmdShow);
+		UpdateWindow(hWnd);
+	}
 
 	if (FAILED(newGame.GameInit())) {
 		SetError(TEXT("Initialization Failed"));
@@ -8,9 +8,10 @@
 #include <stdio.h>
 #include <string>
 #include <d3d9.h>
-//Must be replaced with just d3dx9.h if that works, or the full path
-#include <C:\Program Files (x86)\Microsoft DirectX SDK (June 2010)\Include\d3dx9.h>
+//Found through $(DXSDK_DIR)Include, set by the DirectX SDK installer
+#include <d3dx9.h>
 
 #define BMP_PATH "baboon.bmp"
+#define ENVMAP_PATH "envmap.dds"
 
 #endif // !MAIN_H
@@ -0,0 +1,211 @@
+#include "MemorySystem.h"
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+static std::atomic<unsigned long long> heapAllocations(0);
+static thread_local unsigned long long threadAllocations = 0;
+
+static struct
+{
+	std::atomic<unsigned long long> allocations, frees, bytes, peakBytes;
+} tagCounters[MEMORY_TAG_COUNT];
+
+/*
+Every allocation in the program goes through these, so a frame that should
+allocate nothing can be checked by reading GetHeapAllocations before and after.
+*/
+void* operator new(size_t size) {
+	void* p = malloc(size ? size : 1);
+
+	if (!p)
+		throw std::bad_alloc();
+	heapAllocations++;
+	threadAllocations++;
+	return p;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	free(p);
+}
+
+/*
+@return - The number of heap allocations made by the whole program so far, on every thread
+*/
+unsigned long long GetHeapAllocations() {
+	return heapAllocations;
+}
+
+/*
+@return - The number of heap allocations made by the calling thread so far
+*/
+unsigned long long GetThreadHeapAllocations() {
+	return threadAllocations;
+}
+
+/*
+Allocates memory on the heap for a subsystem, counting it against the subsystem.
+Arenas and pools take their blocks from here.
+
+@param size - The number of bytes
+@param tag - The subsystem the memory is for
+
+@return - The memory
+*/
+void* MemoryAllocate(size_t size, MemoryTag tag) {
+	void* p = operator new(size);
+	unsigned long long bytes = tagCounters[tag].bytes += size;
+	unsigned long long peak = tagCounters[tag].peakBytes;
+
+	tagCounters[tag].allocations++;
+	while (bytes > peak && !tagCounters[tag].peakBytes.compare_exchange_weak(peak, bytes));
+	return p;
+}
+
+/*
+Frees memory from MemoryAllocate.
+
+@param p - The memory
+@param size - The number of bytes it was allocated with
+@param tag - The subsystem it was allocated for
+*/
+void MemoryFree(void* p, size_t size, MemoryTag tag) {
+	if (!p)
+		return;
+
+	tagCounters[tag].bytes -= size;
+	tagCounters[tag].frees++;
+	operator delete(p);
+}
+
+/*
+Gets what a subsystem has allocated.
+
+@param tag - The subsystem
+@param counters - Receives its counters
+*/
+void GetMemoryCounters(MemoryTag tag, MemoryCounters* counters) {
+	counters->allocations = tagCounters[tag].allocations;
+	counters->frees = tagCounters[tag].frees;
+	counters->bytes = tagCounters[tag].bytes;
+	counters->peakBytes = tagCounters[tag].peakBytes;
+}
+
+/*
+@return - The name a subsystem is reported under
+*/
+const wchar_t* GetMemoryTagName(MemoryTag tag) {
+	static const wchar_t* const names[MEMORY_TAG_COUNT] = { L"frame", L"asset", L"scene" };
+
+	return names[tag];
+}
+
+LinearArena::LinearArena(size_t size, MemoryTag memoryTag) :head(0), blockSize(size), tag(memoryTag), used(0), peak(0) {
+}
+
+LinearArena::~LinearArena() {
+	release();
+}
+
+/*
+Chains on a new block to allocate from.
+
+@param minimum - Bytes the block must have room for
+*/
+void LinearArena::addBlock(size_t minimum) {
+	size_t size = std::max(blockSize, minimum);
+	Block* block = (Block*)MemoryAllocate(sizeof(Block) + size, tag);
+
+	block->next = head;
+	block->size = size;
+	block->used = 0;
+	head = block;
+}
+
+/*
+Allocates memory that lives until the arena is reset or released.
+
+@param size - The number of bytes
+@param alignment - The alignment of the memory, a power of two
+
+@return - The memory
+*/
+void* LinearArena::allocate(size_t size, size_t alignment) {
+	for (;;) {
+		if (head) {
+			char* data = (char*)(head + 1);
+			size_t offset = ((size_t)(data + head->used) + alignment - 1) & ~(alignment - 1);
+
+			offset -= (size_t)data;
+			if (offset + size <= head->size) {
+				used += offset + size - head->used;
+				peak = std::max(peak, used);
+				head->used = offset + size;
+				return data + offset;
+			}
+		}
+		addBlock(size + alignment);
+	}
+}
+
+/*
+Frees everything allocated from the arena. A chain of blocks is swapped for one
+block the size of the whole chain, so the next cycle fits without growing.
+*/
+void LinearArena::reset() {
+	if (head && head->next) {
+		size_t total = 0;
+
+		for (Block* block = head; block; block = block->next)
+			total += block->size;
+		release();
+		addBlock(total);
+	}
+	else if (head) {
+		head->used = 0;
+	}
+	used = 0;
+}
+
+/*
+Returns every block to the heap.
+*/
+void LinearArena::release() {
+	while (head) {
+		Block* next = head->next;
+		MemoryFree(head, sizeof(Block) + head->size, tag);
+		head = next;
+	}
+	used = 0;
+}
+
+/*
+@return - Bytes handed out since the last reset
+*/
+size_t LinearArena::getUsed() {
+	return used;
+}
+
+/*
+@return - The most bytes handed out between two resets
+*/
+size_t LinearArena::getPeak() {
+	return peak;
+}
@@ -0,0 +1,154 @@
+#ifndef MEMORYSYSTEM_H
+#define MEMORYSYSTEM_H
+
+// Like the job system, only the standard library is used here, so the
+// allocators build and run on any platform, not just alongside Direct3D.
+#include <stddef.h>
+
+//Bytes in each block of the per-frame arena; a frame that needs more grows it once.
+#define FRAME_ARENA_BLOCK (256 * 1024)
+//Bytes in each block of an Object's asset arena.
+#define ASSET_ARENA_BLOCK (16 * 1024)
+//Bytes each arena allocation is aligned to unless asked otherwise.
+#define ARENA_ALIGNMENT 16
+
+//Who memory is allocated for, so each subsystem's use can be counted.
+enum MemoryTag { MEMORY_FRAME, MEMORY_ASSET, MEMORY_SCENE, MEMORY_TAG_COUNT };
+
+//What one subsystem has allocated through MemoryAllocate.
+struct MemoryCounters
+{
+	unsigned long long allocations; // Blocks taken from the heap
+	unsigned long long frees;
+	unsigned long long bytes; // Bytes held now
+	unsigned long long peakBytes;
+};
+
+void* MemoryAllocate(size_t size, MemoryTag tag);
+void MemoryFree(void* p, size_t size, MemoryTag tag);
+void GetMemoryCounters(MemoryTag tag, MemoryCounters* counters);
+const wchar_t* GetMemoryTagName(MemoryTag tag);
+unsigned long long GetHeapAllocations();
+unsigned long long GetThreadHeapAllocations();
+
+/*
+A LinearArena hands out memory by moving a pointer through large blocks and
+frees all of it at once, so many small allocations with the same lifetime cost
+a pointer bump each and a single free. Nothing allocated from it is destructed;
+it only holds plain data.
+
+When a block runs out another is chained on. reset replaces a chain with one
+block big enough for all of it, so an arena reset every frame stops touching the
+heap once it has seen its largest frame.
+*/
+class LinearArena {
+private:
+	struct Block
+	{
+		Block* next;
+		size_t size; // Bytes of data after the header
+		size_t used;
+	};
+
+	Block* head; // The block being allocated from; earlier blocks follow it
+	size_t blockSize;
+	MemoryTag tag;
+	size_t used; // Bytes handed out since the last reset, alignment included
+	size_t peak;
+
+	LinearArena(const LinearArena&);
+	LinearArena& operator=(const LinearArena&);
+
+	void addBlock(size_t minimum);
+
+public:
+	LinearArena(size_t blockSize, MemoryTag tag);
+	~LinearArena();
+	void* allocate(size_t size, size_t alignment = ARENA_ALIGNMENT);
+	template<class T> T* allocArray(size_t count) {
+		return (T*)allocate(sizeof(T) * count, alignof(T) > ARENA_ALIGNMENT ? alignof(T) : ARENA_ALIGNMENT);
+	}
+	void reset();
+	void release();
+	size_t getUsed();
+	size_t getPeak();
+};
+
+/*
+A Pool hands out fixed-size slots for one type from chunks of many slots, and
+takes them back onto a free list, so nodes that come and go reuse the same
+memory instead of going through the heap one at a time. Slots are raw storage:
+the caller constructs and destructs what it puts in them. Every chunk is freed
+when the pool is.
+*/
+template<class T> class Pool {
+private:
+	union Slot
+	{
+		Slot* next;
+		alignas(T) char storage[sizeof(T)]; // Aligned for T, however strict; chunks come from the heap, so up to what it guarantees
+	};
+
+	struct Chunk
+	{
+		Chunk* next;
+		Slot slots[1]; // slotsPerChunk of them
+	};
+
+	Chunk* chunks;
+	Slot* freeList;
+	unsigned slotsPerChunk;
+	MemoryTag tag;
+	unsigned live; // Slots handed out and not yet freed
+
+	Pool(const Pool&);
+	Pool& operator=(const Pool&);
+
+	size_t chunkBytes() {
+		return sizeof(Chunk) + (slotsPerChunk - 1) * sizeof(Slot);
+	}
+
+public:
+	Pool(unsigned chunkSlots, MemoryTag memoryTag) :chunks(0), freeList(0), slotsPerChunk(chunkSlots > 0 ? chunkSlots : 1), tag(memoryTag), live(0) {
+	}
+
+	~Pool() {
+		while (chunks) {
+			Chunk* next = chunks->next;
+			MemoryFree(chunks, chunkBytes(), tag);
+			chunks = next;
+		}
+	}
+
+	T* allocate() {
+		if (!freeList) {
+			Chunk* chunk = (Chunk*)MemoryAllocate(chunkBytes(), tag);
+
+			chunk->next = chunks;
+			chunks = chunk;
+			for (unsigned i = 0; i < slotsPerChunk; i++) {
+				chunk->slots[i].next = freeList;
+				freeList = &chunk->slots[i];
+			}
+		}
+
+		Slot* slot = freeList;
+		freeList = slot->next;
+		live++;
+		return (T*)slot->storage;
+	}
+
+	void free(T* p) {
+		Slot* slot = (Slot*)p;
+
+		slot->next = freeList;
+		freeList = slot;
+		live--;
+	}
+
+	unsigned getLive() {
+		return live;
+	}
+};
+
+#endif // !MEMORYSYSTEM_H
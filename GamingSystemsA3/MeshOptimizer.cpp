@@ -0,0 +1,231 @@
+#include "Headers.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+
+/*
+Copies the index buffer of a mesh into a 32-bit index list.
+
+@param pMesh - The mesh to read
+@param indices - Receives the mesh's indices, three per face
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+*/
+int ReadIndices(LPD3DXMESH pMesh, std::vector<DWORD>& indices) {
+	void* pData = 0;
+	DWORD count = pMesh->GetNumFaces() * 3;
+
+	if (FAILED(pMesh->LockIndexBuffer(D3DLOCK_READONLY, &pData))) {
+		SetError(TEXT("Could not lock index buffer"));
+		return E_FAIL;
+	}
+
+	indices.resize(count);
+	if (pMesh->GetOptions() & D3DXMESH_32BIT) {
+		memcpy(&indices[0], pData, count * sizeof(DWORD));
+	}
+	else {
+		WORD* pWords = (WORD*)pData;
+		for (DWORD i = 0; i < count; i++)
+			indices[i] = pWords[i];
+	}
+
+	pMesh->UnlockIndexBuffer();
+	return S_OK;
+}
+
+/*
+Writes a 32-bit index list back into the index buffer of a mesh.
+
+@param pMesh - The mesh to write
+@param indices - The new indices, three per face
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+*/
+static int WriteIndices(LPD3DXMESH pMesh, const std::vector<DWORD>& indices) {
+	void* pData = 0;
+
+	if (FAILED(pMesh->LockIndexBuffer(0, &pData))) {
+		SetError(TEXT("Could not lock index buffer"));
+		return E_FAIL;
+	}
+
+	if (pMesh->GetOptions() & D3DXMESH_32BIT) {
+		memcpy(pData, &indices[0], indices.size() * sizeof(DWORD));
+	}
+	else {
+		WORD* pWords = (WORD*)pData;
+		for (DWORD i = 0; i < indices.size(); i++)
+			pWords[i] = (WORD)indices[i];
+	}
+
+	pMesh->UnlockIndexBuffer();
+	return S_OK;
+}
+
+/*
+Optimizes a loaded mesh for rendering. Faces are first sorted by attribute so each
+material subset is contiguous, then OptimizeIndices reorders the index list and
+the vertices are moved to match. The vertex cache statistics before and after
+are written to the debug output.
+
+@param pMesh - The mesh to optimize in place
+@param pAdjacency - The mesh's adjacency, or NULL to generate it
+@param flags - A combination of the MESHOPT_ flags
+@param name - The name of the mesh used when reporting statistics
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if:
+			- The attribute sort fails
+			- The vertex or index buffer can not be locked
+*/
+int OptimizeMesh(LPD3DXMESH pMesh, DWORD* pAdjacency, DWORD flags, LPCWSTR name) {
+	std::vector<DWORD> indices;
+	std::vector<DWORD> generatedAdjacency;
+	std::vector<D3DXATTRIBUTERANGE> attributes;
+	std::vector<IndexSubset> subsets;
+	std::vector<D3DXVECTOR3> positions;
+	std::vector<DWORD> remap;
+	DWORD numVertices = pMesh->GetNumVertices();
+	DWORD numAttributes = 0;
+	MeshCacheStats before, after;
+
+	if (FAILED(ReadIndices(pMesh, indices)))
+		return E_FAIL;
+	before = MeasureVertexCache(indices, numVertices, VERTEX_CACHE_SIZE);
+
+	if (pAdjacency == NULL) {
+		generatedAdjacency.resize(pMesh->GetNumFaces() * 3);
+		pMesh->GenerateAdjacency(0.0f, &generatedAdjacency[0]);
+		pAdjacency = &generatedAdjacency[0];
+	}
+
+	if (FAILED(pMesh->OptimizeInplace(D3DXMESHOPT_ATTRSORT, pAdjacency, NULL, NULL, NULL))) {
+		SetError(TEXT("Could not sort mesh by attribute"));
+		return E_FAIL;
+	}
+
+	pMesh->GetAttributeTable(NULL, &numAttributes);
+	attributes.resize(numAttributes);
+	if (numAttributes > 0)
+		pMesh->GetAttributeTable(&attributes[0], &numAttributes);
+
+	if (FAILED(ReadIndices(pMesh, indices)))
+		return E_FAIL;
+
+	subsets.resize(numAttributes);
+	for (DWORD a = 0; a < numAttributes; a++) {
+		subsets[a].faceStart = attributes[a].FaceStart;
+		subsets[a].faceCount = attributes[a].FaceCount;
+		subsets[a].vertexStart = attributes[a].VertexStart;
+		subsets[a].vertexCount = attributes[a].VertexCount;
+	}
+
+	if ((flags & MESHOPT_VERTEXCACHE) && (flags & MESHOPT_OVERDRAW) && (pMesh->GetFVF() & D3DFVF_POSITION_MASK) == D3DFVF_XYZ) {
+		BYTE* pVertices = 0;
+		DWORD stride = pMesh->GetNumBytesPerVertex();
+
+		if (FAILED(pMesh->LockVertexBuffer(D3DLOCK_READONLY, (void**)&pVertices))) {
+			SetError(TEXT("Could not lock vertex buffer"));
+			return E_FAIL;
+		}
+		positions.resize(numVertices);
+		for (DWORD v = 0; v < numVertices; v++)
+			positions[v] = *(D3DXVECTOR3*)(pVertices + v * stride);
+		pMesh->UnlockVertexBuffer();
+	}
+
+	OptimizeIndices(indices, numVertices, subsets, positions, flags, &remap);
+
+	if (!remap.empty()) {
+		std::vector<BYTE> oldVertices;
+		BYTE* pVertices = 0;
+		DWORD stride = pMesh->GetNumBytesPerVertex();
+
+		if (FAILED(pMesh->LockVertexBuffer(0, (void**)&pVertices))) {
+			SetError(TEXT("Could not lock vertex buffer"));
+			return E_FAIL;
+		}
+		oldVertices.assign(pVertices, pVertices + numVertices * stride);
+		for (DWORD v = 0; v < numVertices; v++)
+			memcpy(pVertices + remap[v] * stride, &oldVertices[v * stride], stride);
+		pMesh->UnlockVertexBuffer();
+
+		for (DWORD a = 0; a < numAttributes; a++) {
+			attributes[a].VertexStart = subsets[a].vertexStart;
+			attributes[a].VertexCount = subsets[a].vertexCount;
+		}
+	}
+
+	if (FAILED(WriteIndices(pMesh, indices)))
+		return E_FAIL;
+
+	if (numAttributes > 0)
+		pMesh->SetAttributeTable(&attributes[0], numAttributes);
+
+	after = MeasureVertexCache(indices, numVertices, VERTEX_CACHE_SIZE);
+	LogMessage(TEXT("%s: %u faces, %u vertices, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f"),
+		name, pMesh->GetNumFaces(), numVertices, before.acmr, after.acmr, before.atvr, after.atvr);
+
+	return S_OK;
+}
+
+/*
+Loads each mesh on a null reference device and measures its vertex cache
+efficiency as the file stores it and after OptimizeMesh, the way Object loads
+it. Used by the -meshstats command line switch. Each mesh's ACMR and ATVR
+before and after are written to the debug output.
+
+@param files - The .x files to measure
+@param numFiles - How many files there are
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the device can not be created, or a mesh can not be loaded or optimized.
+*/
+int ReportMeshStats(const LPCWSTR* files, DWORD numFiles) {
+	LPDIRECT3D9 pD3D = 0;
+	LPDIRECT3DDEVICE9 pDevice = 0;
+	HRESULT r = S_OK;
+
+	if (FAILED(CreateNullDevice(&pD3D, &pDevice)))
+		return E_FAIL;
+
+	for (DWORD f = 0; f < numFiles; f++) {
+		LPD3DXMESH pMesh = 0;
+		LPD3DXBUFFER pAdjacencyBuffer = 0;
+		std::vector<DWORD> indices;
+		MeshCacheStats before, after;
+
+		if (FAILED(D3DXLoadMeshFromX(files[f], D3DXMESH_SYSTEMMEM, pDevice, &pAdjacencyBuffer, NULL, NULL, NULL, &pMesh))) {
+			TCHAR text[MAX_PATH];
+			_stprintf_s(text, MAX_PATH, TEXT("..\\%s"), files[f]);
+			if (FAILED(D3DXLoadMeshFromX(text, D3DXMESH_SYSTEMMEM, pDevice, &pAdjacencyBuffer, NULL, NULL, NULL, &pMesh))) {
+				SetError(TEXT("Could not find mesh %s"), files[f]);
+				r = E_FAIL;
+				continue;
+			}
+		}
+
+		if (SUCCEEDED(ReadIndices(pMesh, indices)) &&
+			SUCCEEDED(OptimizeMesh(pMesh, (DWORD*)pAdjacencyBuffer->GetBufferPointer(),
+				MESHOPT_VERTEXCACHE | MESHOPT_VERTEXFETCH | MESHOPT_OVERDRAW, files[f]))) {
+			before = MeasureVertexCache(indices, pMesh->GetNumVertices(), VERTEX_CACHE_SIZE);
+			ReadIndices(pMesh, indices);
+			after = MeasureVertexCache(indices, pMesh->GetNumVertices(), VERTEX_CACHE_SIZE);
+			LogMessage(TEXT("Mesh stats %s: %u faces, %u vertices, cache %u, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f"),
+				files[f], pMesh->GetNumFaces(), pMesh->GetNumVertices(), VERTEX_CACHE_SIZE,
+				before.acmr, after.acmr, before.atvr, after.atvr);
+		}
+		else {
+			SetError(TEXT("Could not optimize mesh %s"), files[f]);
+			r = E_FAIL;
+		}
+
+		pAdjacencyBuffer->Release();
+		pMesh->Release();
+	}
+
+	pDevice->Release();
+	pD3D->Release();
+
+	return r;
+}
@@ -0,0 +1,12 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include "Headers.h"
+#include "IndexOptimizer.h"
+#include <vector>
+
+int ReadIndices(LPD3DXMESH pMesh, std::vector<DWORD>& indices);
+int OptimizeMesh(LPD3DXMESH pMesh, DWORD* pAdjacency, DWORD flags, LPCWSTR name);
+int ReportMeshStats(const LPCWSTR* files, DWORD numFiles);
+
+#endif // !MESHOPTIMIZER_H
@@ -0,0 +1,470 @@
+#include "MicroBenchmark.h"
+#include "Picking.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+// Written by every case so the optimizer can not drop the work being timed
+static volatile float sink;
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void MicroBenchmark::add(const std::string& name, MicroBenchmarkFunction function, void* data) {
+	Case c = { name, function, data };
+
+	cases.push_back(c);
+}
+
+/*
+Times one case. The run is grown until it takes MICROBENCH_MIN_MS, then repeated
+MICROBENCH_RUNS times and the fastest kept.
+
+@param c - The case
+@param result - Receives the time and allocations per operation
+*/
+void MicroBenchmark::TimeCase(const Case& c, MicroBenchmarkResult* result) {
+	unsigned long long iterations = 1;
+	double ms;
+
+	for (;;) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		c.function(c.data, iterations);
+		ms = MillisecondsSince(start);
+
+		if (ms >= MICROBENCH_MIN_MS || iterations >= MICROBENCH_MAX_ITERATIONS)
+			break;
+
+		// Aim a little past the minimum from this run's rate, growing at most tenfold
+		unsigned long long next = ms > 0.0 ? (unsigned long long)(iterations * MICROBENCH_MIN_MS * 1.2 / ms) + 1 : iterations * 10;
+		iterations = std::min(std::min(next, iterations * 10), MICROBENCH_MAX_ITERATIONS);
+	}
+
+	result->name = c.name;
+	result->iterations = iterations;
+	result->nsPerOp = ms * 1000000.0 / iterations;
+	result->allocationsPerOp = 0.0;
+	result->baselineNsPerOp = result->baselineAllocationsPerOp = 0.0;
+	result->regressed = false;
+
+	for (int run = 1; run < MICROBENCH_RUNS; run++) {
+		unsigned long long allocations = GetThreadHeapAllocations();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		c.function(c.data, iterations);
+		ms = MillisecondsSince(start);
+
+		result->allocationsPerOp = (double)(GetThreadHeapAllocations() - allocations) / iterations;
+		result->nsPerOp = std::min(result->nsPerOp, ms * 1000000.0 / iterations);
+	}
+}
+
+/*
+Times every case in the order they were added.
+
+@param results - Receives a result for each case
+*/
+void MicroBenchmark::run(std::vector<MicroBenchmarkResult>* results) {
+	results->resize(cases.size());
+	for (size_t i = 0; i < cases.size(); i++)
+		TimeCase(cases[i], &(*results)[i]);
+}
+
+/*
+Loads the results of an earlier run.
+
+@param file - The baseline file
+@param results - Receives the cases in the file, with their time and allocations per operation
+@param badLine - Receives the first line that could not be read, if there is one
+
+@return - BASELINE_MISSING if the file can not be opened, BASELINE_BAD if a line
+		  is not a name, a time and an allocation count, BASELINE_LOADED otherwise
+*/
+BaselineStatus MicroBenchmark::LoadBaseline(const char* file, std::vector<MicroBenchmarkResult>* results, std::string* badLine) {
+	std::ifstream text(file);
+	std::string line;
+
+	results->clear();
+	if (!text.is_open())
+		return BASELINE_MISSING;
+
+	while (std::getline(text, line)) {
+		std::istringstream fields(line);
+		MicroBenchmarkResult result;
+
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		if (!std::getline(fields, result.name, '\t') || !(fields >> result.nsPerOp >> result.allocationsPerOp)) {
+			*badLine = line;
+			return BASELINE_BAD;
+		}
+		result.iterations = 0;
+		result.baselineNsPerOp = result.baselineAllocationsPerOp = 0.0;
+		result.regressed = false;
+		results->push_back(result);
+	}
+
+	return BASELINE_LOADED;
+}
+
+/*
+Saves results as the baseline later runs are checked against.
+
+@param file - The baseline file to write
+@param results - The results to save
+
+@return - Whether the file was written
+*/
+bool MicroBenchmark::SaveBaseline(const char* file, const std::vector<MicroBenchmarkResult>& results) {
+	std::ofstream text(file);
+
+	if (!text.is_open())
+		return false;
+
+	text.setf(std::ios::fixed);
+	text.precision(3);
+	text << "# name\tns per op\tallocations per op\n";
+	for (size_t i = 0; i < results.size(); i++)
+		text << results[i].name << '\t' << results[i].nsPerOp << '\t' << results[i].allocationsPerOp << '\n';
+
+	text.close();
+	return !text.fail();
+}
+
+/*
+Fills in each result's baseline and marks it regressed if it takes more time or
+makes more allocations per operation than MICROBENCH_THRESHOLD above it.
+
+@param results - The results of this run
+@param baseline - The results of the baseline run
+
+@return - The number of cases that regressed
+*/
+unsigned MicroBenchmark::CompareToBaseline(std::vector<MicroBenchmarkResult>* results, const std::vector<MicroBenchmarkResult>& baseline) {
+	unsigned regressions = 0;
+
+	for (size_t i = 0; i < results->size(); i++) {
+		MicroBenchmarkResult& result = (*results)[i];
+
+		for (size_t j = 0; j < baseline.size(); j++) {
+			if (baseline[j].name == result.name) {
+				result.baselineNsPerOp = baseline[j].nsPerOp;
+				result.baselineAllocationsPerOp = baseline[j].allocationsPerOp;
+				result.regressed = result.nsPerOp > result.baselineNsPerOp * (1.0 + MICROBENCH_THRESHOLD) ||
+					result.allocationsPerOp > result.baselineAllocationsPerOp * (1.0 + MICROBENCH_THRESHOLD) + 0.001;
+				break;
+			}
+		}
+
+		if (result.regressed)
+			regressions++;
+	}
+	return regressions;
+}
+
+/*
+Sets up what the cases work on: a grid of MICROBENCH_GRID_OBJECTS spheres from
+a fixed seed, a frustum and picking scene looking into it, and a job system on
+every hardware thread.
+*/
+CoreMicroBenchmarks::CoreMicroBenchmarks() :pickCenter(0.0f, 1.0f, 0.0f), pickRadius(1.0f), arena(FRAME_ARENA_BLOCK, MEMORY_FRAME), pool(MICROBENCH_ARENA_RESET, MEMORY_SCENE) {
+	D3DXMATRIX view;
+	unsigned seed = 1;
+
+	D3DXMatrixPerspectiveFovLH(&projection, D3DX_PI / 4, 1.0f, 1.0f, 100.0f);
+	viewCamera.getViewMatrix(&view);
+	D3DXMatrixInverse(&viewInverse, 0, &view);
+	BuildFrustum(view * projection, &gridFrustum);
+
+	gridCenters.resize(MICROBENCH_GRID_OBJECTS);
+	for (DWORD i = 0; i < MICROBENCH_GRID_OBJECTS; i++) {
+		float c[3];
+
+		for (int axis = 0; axis < 3; axis++) {
+			seed = seed * 1664525u + 1013904223u;
+			c[axis] = ((seed >> 8) / 16777216.0f - 0.5f) * MICROBENCH_GRID_EXTENT;
+		}
+		gridCenters[i] = D3DXVECTOR3(c[0], c[1], c[2]);
+		grid.insert(i, gridCenters[i], 1.0f + (i & 3));
+	}
+
+	jobItems.assign(MICROBENCH_JOB_ITEMS, 1.0f);
+	jobs.start(0);
+}
+
+/*
+Adds every case to a suite. The suite points at this object's fixtures, so it
+must not outlive it.
+
+@param suite - The suite to add the cases to
+*/
+void CoreMicroBenchmarks::addTo(MicroBenchmark* suite) {
+	suite->add("Camera::getViewMatrix/cached", CameraViewMatrixCached, this);
+	suite->add("Camera::getViewMatrix/moved", CameraViewMatrixMoved, this);
+	suite->add("Camera::pitch", CameraPitch, this);
+	suite->add("Camera::yaw", CameraYaw, this);
+	suite->add("Camera::roll", CameraRoll, this);
+	suite->add("Camera::walk/after yaw", CameraWalk, this);
+
+	suite->add("Placement::translate", PlacementTranslate, this);
+	suite->add("Placement::rotateAboutX", PlacementRotateAboutX, this);
+	suite->add("Placement::rotateAboutY", PlacementRotateAboutY, this);
+	suite->add("Placement::rotateAboutZ", PlacementRotateAboutZ, this);
+	suite->add("Placement::getWorldMatrix/after rotate", PlacementWorldMatrix, this);
+
+	suite->add("Picking/ray, transform and sphere test", PickRay, this);
+
+	suite->add("SpatialGrid::queryFrustum", GridQueryFrustum, this);
+	suite->add("SpatialGrid::querySphere", GridQuerySphere, this);
+	suite->add("SpatialGrid::raycast", GridRaycast, this);
+	suite->add("SpatialGrid::update/small move", GridUpdate, this);
+
+	suite->add("JobSystem::parallelFor/1024 items", JobParallelFor, this);
+
+	suite->add("LinearArena::allocate", ArenaAllocate, this);
+	suite->add("Pool::allocate and free", PoolAllocate, this);
+	suite->add("MemoryAllocate and MemoryFree", HeapAllocate, this);
+}
+
+void CoreMicroBenchmarks::CameraViewMatrixCached(void* data, unsigned long long iterations) {
+	Camera& camera = ((CoreMicroBenchmarks*)data)->viewCamera;
+	D3DXMATRIX view;
+
+	for (unsigned long long i = 0; i < iterations; i++) {
+		camera.getViewMatrix(&view);
+		sink = view._43;
+	}
+}
+
+void CoreMicroBenchmarks::CameraViewMatrixMoved(void* data, unsigned long long iterations) {
+	Camera& camera = ((CoreMicroBenchmarks*)data)->viewCamera;
+	D3DXVECTOR3 position(0.0f, 2.0f, -10.0f);
+	D3DXMATRIX view;
+
+	for (unsigned long long i = 0; i < iterations; i++) {
+		position.x = (float)(i & 15);
+		camera.setPosition(&position);
+		camera.getViewMatrix(&view);
+		sink = view._43;
+	}
+}
+
+void CoreMicroBenchmarks::CameraPitch(void* data, unsigned long long iterations) {
+	Camera& camera = ((CoreMicroBenchmarks*)data)->turnCamera;
+
+	for (unsigned long long i = 0; i < iterations; i++)
+		camera.pitch(0.001f);
+}
+
+void CoreMicroBenchmarks::CameraYaw(void* data, unsigned long long iterations) {
+	Camera& camera = ((CoreMicroBenchmarks*)data)->turnCamera;
+
+	for (unsigned long long i = 0; i < iterations; i++)
+		camera.yaw(0.001f);
+}
+
+void CoreMicroBenchmarks::CameraRoll(void* data, unsigned long long iterations) {
+	Camera& camera = ((CoreMicroBenchmarks*)data)->turnCamera;
+
+	for (unsigned long long i = 0; i < iterations; i++)
+		camera.roll(0.001f);
+}
+
+void CoreMicroBenchmarks::CameraWalk(void* data, unsigned long long iterations) {
+	Camera& camera = ((CoreMicroBenchmarks*)data)->walkCamera;
+
+	// Alternate turning and walking, so every step has to read the axes out of a new orientation
+	for (unsigned long long i = 0; i < iterations; i++) {
+		camera.yaw(0.001f);
+		camera.walk((i & 1) ? 0.01f : -0.01f);
+	}
+}
+
+void CoreMicroBenchmarks::PlacementTranslate(void* data, unsigned long long iterations) {
+	Placement& placement = ((CoreMicroBenchmarks*)data)->placement;
+
+	for (unsigned long long i = 0; i < iterations; i++)
+		placement.translate((i & 1) ? 0.01f : -0.01f, 0.0f, 0.0f);
+	sink = placement.getWorldMatrix()._41;
+}
+
+void CoreMicroBenchmarks::PlacementRotateAboutX(void* data, unsigned long long iterations) {
+	Placement& placement = ((CoreMicroBenchmarks*)data)->placement;
+
+	for (unsigned long long i = 0; i < iterations; i++)
+		placement.rotateAboutX(0.001f);
+	sink = placement.getWorldMatrix()._22;
+}
+
+void CoreMicroBenchmarks::PlacementRotateAboutY(void* data, unsigned long long iterations) {
+	Placement& placement = ((CoreMicroBenchmarks*)data)->placement;
+
+	for (unsigned long long i = 0; i < iterations; i++)
+		placement.rotateAboutY(0.001f);
+	sink = placement.getWorldMatrix()._11;
+}
+
+void CoreMicroBenchmarks::PlacementRotateAboutZ(void* data, unsigned long long iterations) {
+	Placement& placement = ((CoreMicroBenchmarks*)data)->placement;
+
+	for (unsigned long long i = 0; i < iterations; i++)
+		placement.rotateAboutZ(0.001f);
+	sink = placement.getWorldMatrix()._11;
+}
+
+void CoreMicroBenchmarks::PlacementWorldMatrix(void* data, unsigned long long iterations) {
+	Placement& placement = ((CoreMicroBenchmarks*)data)->placement;
+
+	// Turn before each call so the matrix is rebuilt every time, as it is for a model being dragged
+	for (unsigned long long i = 0; i < iterations; i++) {
+		placement.rotateAboutY(0.001f);
+		sink = placement.getWorldMatrix()._11;
+	}
+}
+
+void CoreMicroBenchmarks::PickRay(void* data, unsigned long long iterations) {
+	CoreMicroBenchmarks* self = (CoreMicroBenchmarks*)data;
+	DWORD hits = 0;
+
+	// Sweep the ray across a 512 x 512 viewport, as a mouse would
+	for (unsigned long long i = 0; i < iterations; i++) {
+		Ray ray = ComputePickingRay((int)(i & 511), (int)((i * 7) & 511), 512, 512, self->projection);
+
+		TransformPickingRay(&ray, &self->viewInverse);
+		if (RayHitsSphere(&ray, self->pickCenter, self->pickRadius))
+			hits++;
+	}
+	sink = (float)hits;
+}
+
+void CoreMicroBenchmarks::GridQueryFrustum(void* data, unsigned long long iterations) {
+	CoreMicroBenchmarks* self = (CoreMicroBenchmarks*)data;
+
+	for (unsigned long long i = 0; i < iterations; i++) {
+		self->grid.queryFrustum(self->gridFrustum, &self->gridResults);
+		sink = (float)self->gridResults.size();
+	}
+}
+
+void CoreMicroBenchmarks::GridQuerySphere(void* data, unsigned long long iterations) {
+	CoreMicroBenchmarks* self = (CoreMicroBenchmarks*)data;
+
+	// Centered on each object in turn, about the reach of a local light
+	for (unsigned long long i = 0; i < iterations; i++) {
+		self->grid.querySphere(self->gridCenters[i % MICROBENCH_GRID_OBJECTS], 20.0f, &self->gridResults);
+		sink = (float)self->gridResults.size();
+	}
+}
+
+void CoreMicroBenchmarks::GridRaycast(void* data, unsigned long long iterations) {
+	CoreMicroBenchmarks* self = (CoreMicroBenchmarks*)data;
+	DWORD id;
+	float distance;
+
+	// From the middle of the scene out toward each object in turn
+	for (unsigned long long i = 0; i < iterations; i++) {
+		Ray ray;
+
+		ray._origin = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		D3DXVec3Normalize(&ray._direction, &self->gridCenters[i % MICROBENCH_GRID_OBJECTS]);
+		if (self->grid.raycast(ray, MICROBENCH_GRID_EXTENT, &id, &distance))
+			sink = distance;
+	}
+}
+
+void CoreMicroBenchmarks::GridUpdate(void* data, unsigned long long iterations) {
+	CoreMicroBenchmarks* self = (CoreMicroBenchmarks*)data;
+
+	// Nudge each object out and back, as a frame of moving models would, so every update is a move
+	for (unsigned long long i = 0; i < iterations; i++) {
+		DWORD id = (DWORD)((i >> 1) % MICROBENCH_GRID_OBJECTS);
+		D3DXVECTOR3 center = self->gridCenters[id];
+
+		center.x += (i & 1) ? 0.0f : 0.5f;
+		self->grid.update(id, center, 1.0f + (id & 3));
+	}
+}
+
+void CoreMicroBenchmarks::JobParallelFor(void* data, unsigned long long iterations) {
+	CoreMicroBenchmarks* self = (CoreMicroBenchmarks*)data;
+
+	for (unsigned long long i = 0; i < iterations; i++)
+		self->jobs.parallelFor(MICROBENCH_JOB_ITEMS, 0, ScaleItemsJob, self);
+	sink = self->jobItems[0];
+}
+
+void CoreMicroBenchmarks::ScaleItemsJob(void* data, unsigned begin, unsigned end) {
+	std::vector<float>& items = ((CoreMicroBenchmarks*)data)->jobItems;
+
+	for (unsigned i = begin; i < end; i++)
+		items[i] = items[i] * 0.999f + 0.001f;
+}
+
+void CoreMicroBenchmarks::ArenaAllocate(void* data, unsigned long long iterations) {
+	LinearArena& arena = ((CoreMicroBenchmarks*)data)->arena;
+
+	for (unsigned long long i = 0; i < iterations; i++) {
+		char* p = (char*)arena.allocate(MICROBENCH_ALLOCATION_BYTES);
+
+		p[0] = (char)i;
+		if ((i + 1) % MICROBENCH_ARENA_RESET == 0)
+			arena.reset();
+	}
+	arena.reset();
+}
+
+void CoreMicroBenchmarks::PoolAllocate(void* data, unsigned long long iterations) {
+	Pool<char[MICROBENCH_ALLOCATION_BYTES]>& pool = ((CoreMicroBenchmarks*)data)->pool;
+
+	for (unsigned long long i = 0; i < iterations; i++) {
+		char(*p)[MICROBENCH_ALLOCATION_BYTES] = pool.allocate();
+
+		(*p)[0] = (char)i;
+		pool.free(p);
+	}
+}
+
+void CoreMicroBenchmarks::HeapAllocate(void* data, unsigned long long iterations) {
+	for (unsigned long long i = 0; i < iterations; i++) {
+		char* p = (char*)MemoryAllocate(MICROBENCH_ALLOCATION_BYTES, MEMORY_SCENE);
+
+		p[0] = (char)i;
+		MemoryFree(p, MICROBENCH_ALLOCATION_BYTES, MEMORY_SCENE);
+	}
+}
+
+/*
+Turns a Placement by MICROBENCH_DRIFT_ROTATIONS random rotations about its X, Y
+and Z axes, rebuilding its world matrix after each like a frame would, and
+measures how far the matrix ends up from a rotation. The rotations come from a
+fixed seed, so every run turns the same way.
+
+@param nsPerRotation - Receives the time per rotation, the rebuild included
+@param error - Receives the orthonormality error of the final world matrix
+
+@return - Whether the error is within MICROBENCH_MAX_DRIFT
+*/
+bool CheckRotationDrift(double* nsPerRotation, float* error) {
+	Placement placement;
+	unsigned seed = 1;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (DWORD i = 0; i < MICROBENCH_DRIFT_ROTATIONS; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		float angle = ((seed >> 8) / 16777216.0f - 0.5f) * D3DX_PI;
+
+		switch ((seed >> 30) % 3) {
+		case 0: placement.rotateAboutX(angle); break;
+		case 1: placement.rotateAboutY(angle); break;
+		default: placement.rotateAboutZ(angle); break;
+		}
+		sink = placement.getWorldMatrix()._11;
+	}
+
+	*nsPerRotation = MillisecondsSince(start) * 1000000.0 / MICROBENCH_DRIFT_ROTATIONS;
+	*error = Placement::OrthonormalityError(placement.getWorldMatrix());
+	return *error <= MICROBENCH_MAX_DRIFT;
+}
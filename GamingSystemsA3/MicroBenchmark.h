@@ -0,0 +1,146 @@
+#ifndef MICROBENCHMARK_H
+#define MICROBENCHMARK_H
+
+// Timed with std::chrono and checked against a plain text baseline, so the
+// harness and every case that only needs the core library run on any platform.
+#include "Camera.h"
+#include "Frustum.h"
+#include "JobSystem.h"
+#include "MemorySystem.h"
+#include "Placement.h"
+#include "SpatialGrid.h"
+#include <string>
+#include <vector>
+
+//File the micro-benchmark results are compared against; the first run without one saves it.
+#define MICROBENCH_BASELINE "microbench.baseline"
+//How much slower than its baseline a case may run before the suite fails, as a fraction.
+#define MICROBENCH_THRESHOLD 0.15
+//Each case repeats its operation until a run takes at least this long.
+#define MICROBENCH_MIN_MS 50.0
+//Most times an operation is repeated in one run, however cheap it is.
+#define MICROBENCH_MAX_ITERATIONS 100000000ULL
+//Runs of each case; the fastest is kept, as it is the one least disturbed by the rest of the system.
+#define MICROBENCH_RUNS 5
+//Random rotations the drift check turns a Placement by.
+#define MICROBENCH_DRIFT_ROTATIONS 1000000
+//Most a Placement's world matrix may be off a rotation at the end of the drift check.
+#define MICROBENCH_MAX_DRIFT 1e-4f
+//Objects in the spatial grid the micro-benchmark queries, spread over a cube this wide.
+#define MICROBENCH_GRID_OBJECTS 10000
+#define MICROBENCH_GRID_EXTENT 400.0f
+//Items in the job system case's parallel for; about a frame's worth of light projection.
+#define MICROBENCH_JOB_ITEMS 1024
+//Bytes each allocator case allocates per operation.
+#define MICROBENCH_ALLOCATION_BYTES 64
+//Allocations the arena case makes between resets, as a frame would.
+#define MICROBENCH_ARENA_RESET 1024
+
+//Repeats one operation a number of times.
+typedef void(*MicroBenchmarkFunction)(void* data, unsigned long long iterations);
+
+//What one micro-benchmark case measured.
+struct MicroBenchmarkResult
+{
+	std::string name;
+	unsigned long long iterations; // Operations in each run
+	double nsPerOp; // Of the fastest run
+	double allocationsPerOp; // Heap allocations made by the operation
+	double baselineNsPerOp; // 0 if the baseline has no entry for the case
+	double baselineAllocationsPerOp;
+	bool regressed; // Slower than the baseline by more than the threshold, or allocates more
+};
+
+//What LoadBaseline found.
+enum BaselineStatus { BASELINE_LOADED, BASELINE_MISSING, BASELINE_BAD };
+
+/*
+A MicroBenchmark times the engine's hot paths one at a time, Google Benchmark
+style: each case repeats a single operation until the run is long enough to
+time, and reports nanoseconds and heap allocations per operation.
+
+Allocations are those made through the program's operator new; D3DX allocates
+on its own heap and is not counted.
+
+Results are checked against a baseline file with one case per line, "name<TAB>ns
+per op<TAB>allocations per op"; a case that takes more time or makes more
+allocations per operation than MICROBENCH_THRESHOLD above its baseline fails the
+suite. A case the baseline has no entry for is reported but not checked.
+*/
+class MicroBenchmark {
+private:
+	struct Case
+	{
+		std::string name;
+		MicroBenchmarkFunction function;
+		void* data;
+	};
+
+	std::vector<Case> cases;
+
+	static void TimeCase(const Case&, MicroBenchmarkResult*);
+
+public:
+	void add(const std::string& name, MicroBenchmarkFunction function, void* data);
+	void run(std::vector<MicroBenchmarkResult>* results);
+	static BaselineStatus LoadBaseline(const char* file, std::vector<MicroBenchmarkResult>* results, std::string* badLine);
+	static bool SaveBaseline(const char* file, const std::vector<MicroBenchmarkResult>& results);
+	static unsigned CompareToBaseline(std::vector<MicroBenchmarkResult>* results, const std::vector<MicroBenchmarkResult>& baseline);
+};
+
+/*
+The micro-benchmark cases that only need the core library, and what they work
+on: the camera's movement and view matrix, moving a Placement, picking, spatial
+grid queries, a small parallel for, and the allocators against the heap. The
+Windows suite adds them to its own alongside the D3DX cases, and the
+CoreBenchmarks target runs them alone.
+*/
+class CoreMicroBenchmarks {
+private:
+	Camera viewCamera, turnCamera, walkCamera;
+	Placement placement;
+	D3DXMATRIX projection, viewInverse; // Picking rays are cast through these
+	D3DXVECTOR3 pickCenter;
+	float pickRadius;
+	SpatialGrid grid;
+	std::vector<D3DXVECTOR3> gridCenters;
+	Frustum gridFrustum;
+	std::vector<DWORD> gridResults;
+	JobSystem jobs;
+	std::vector<float> jobItems;
+	LinearArena arena;
+	Pool<char[MICROBENCH_ALLOCATION_BYTES]> pool;
+
+	CoreMicroBenchmarks(const CoreMicroBenchmarks&);
+	CoreMicroBenchmarks& operator=(const CoreMicroBenchmarks&);
+
+	static void CameraViewMatrixCached(void*, unsigned long long iterations);
+	static void CameraViewMatrixMoved(void*, unsigned long long iterations);
+	static void CameraPitch(void*, unsigned long long iterations);
+	static void CameraYaw(void*, unsigned long long iterations);
+	static void CameraRoll(void*, unsigned long long iterations);
+	static void CameraWalk(void*, unsigned long long iterations);
+	static void PlacementTranslate(void*, unsigned long long iterations);
+	static void PlacementRotateAboutX(void*, unsigned long long iterations);
+	static void PlacementRotateAboutY(void*, unsigned long long iterations);
+	static void PlacementRotateAboutZ(void*, unsigned long long iterations);
+	static void PlacementWorldMatrix(void*, unsigned long long iterations);
+	static void PickRay(void*, unsigned long long iterations);
+	static void GridQueryFrustum(void*, unsigned long long iterations);
+	static void GridQuerySphere(void*, unsigned long long iterations);
+	static void GridRaycast(void*, unsigned long long iterations);
+	static void GridUpdate(void*, unsigned long long iterations);
+	static void JobParallelFor(void*, unsigned long long iterations);
+	static void ScaleItemsJob(void*, unsigned begin, unsigned end);
+	static void ArenaAllocate(void*, unsigned long long iterations);
+	static void PoolAllocate(void*, unsigned long long iterations);
+	static void HeapAllocate(void*, unsigned long long iterations);
+
+public:
+	CoreMicroBenchmarks();
+	void addTo(MicroBenchmark* suite);
+};
+
+bool CheckRotationDrift(double* nsPerRotation, float* error);
+
+#endif // !MICROBENCHMARK_H
@@ -1,6 +1,7 @@
 #include "Headers.h"
 
-Object::Object() :pMesh(0), pMeshMaterials(0), pMeshTextures(0), dwNumMaterials(0), pDevice(0), filename(){}
+Object::Object() :numLods(0), currentLod(0), boundRadius(0), compactVertices(false), compact(false), pMeshMaterials(0), streaming(0), tangentFrames(false), dwNumMaterials(0), pDevice(0), filename() {
+}
 
 /*
 Constructor for an Object, stores the filename for the .x object to load.
@@ -8,7 +9,80 @@ Constructor for an Object, stores the filename for the .x object to load.
 @param newDevice - The directx device that is being used to display the objects
 @param newFilename - The file path of the .x file to object to load and display
 */
-Object::Object(LPDIRECT3DDEVICE9* newDevice, LPCWSTR newFilename) : pMesh(0), pMeshMaterials(0), pMeshTextures(0), dwNumMaterials(0), pDevice(newDevice), filename(newFilename) {}
+Object::Object(LPDIRECT3DDEVICE9* newDevice, LPCWSTR newFilename) : numLods(0), currentLod(0), boundRadius(0), compactVertices(false), compact(false), pMeshMaterials(0), streaming(0), tangentFrames(false), dwNumMaterials(0), pDevice(newDevice), filename(newFilename) {
+}
+
+/*
+Takes over another Object's meshes, textures and materials. The Object moved
+from must not be held by a manager.
+
+@param other - The Object to move from, left empty
+*/
+Object::Object(Object&& other) {
+	assert(!other.isHeld() && "Object moved while a manager still points at it");
+	moveFrom(other);
+}
+
+/*
+Releases what the Object holds, then takes over another Object's meshes,
+textures and materials. Neither Object may be held by a manager.
+
+@param other - The Object to move from, left empty
+
+@return - This Object
+*/
+Object& Object::operator=(Object&& other) {
+	assert(!isHeld() && !other.isHeld() && "Object moved while a manager still points at it");
+	if (this != &other) {
+		cleanup();
+		moveFrom(other);
+	}
+	return *this;
+}
+
+Object::~Object() {
+	cleanup();
+}
+
+/*
+Hands every resource of an Object over to this one, which must be empty. The
+COM references are passed on rather than copied, so no reference counts change.
+
+@param other - The Object to move from, left empty
+*/
+void Object::moveFrom(Object& other) {
+	pMesh.Attach(other.pMesh.Detach());
+	for (DWORD i = 0; i < MAX_LODS; i++)
+		lodMeshes[i].Attach(other.lodMeshes[i].Detach());
+	numLods = other.numLods;
+	currentLod = other.currentLod;
+	boundCenter = other.boundCenter;
+	boundRadius = other.boundRadius;
+	compactVertices = other.compactVertices;
+	compact = other.compact;
+	quantization = other.quantization;
+	occluderVertices.swap(other.occluderVertices);
+	occluderIndices.swap(other.occluderIndices);
+	assets = std::move(other.assets);
+	pMeshMaterials = other.pMeshMaterials;
+	meshTextures.swap(other.meshTextures);
+	normalTextures.swap(other.normalTextures);
+	tangentFrames = other.tangentFrames;
+	streaming = other.streaming;
+	streamedTextures.swap(other.streamedTextures);
+	streamedNormals.swap(other.streamedNormals);
+	dwNumMaterials = other.dwNumMaterials;
+	pDevice = other.pDevice;
+	filename = other.filename;
+	placement = other.placement;
+	_center = other._center;
+	_radius = other._radius;
+
+	other.pMeshMaterials = 0;
+	other.numLods = other.currentLod = other.dwNumMaterials = 0;
+	other.compact = other.tangentFrames = false;
+	other.streaming = 0;
+}
 
 void Object::setFile(LPCWSTR newFilename) {
 	filename = newFilename;
@@ -18,36 +92,123 @@ void Object::setDevice(LPDIRECT3DDEVICE9* newDevice) {
 	pDevice = newDevice;
 }
 
+LPCWSTR Object::getFile() {
+	return filename;
+}
+
 /*
-Loads the .x file, and the corresponding materials and textures.
+Loads a texture from the working directory, or failing that from its parent.
+The compressed version in TEXTURE_CACHE_DIR is used instead when there is one.
+
+@param pDevice - The device to create the texture on
+@param name - The file name of the texture
+@param ppTexture - Receives the texture, or null if it could not be loaded
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the texture is in neither folder.
 */
-int Object::InitGeometry() {
-	LPD3DXBUFFER pD3DXMtrlBuffer;
+static int CreateTextureNearby(LPDIRECT3DDEVICE9 pDevice, LPCTSTR name, LPDIRECT3DTEXTURE9* ppTexture) {
+	std::wstring cooked;
+
+	// Prefer the block compressed version the texture tool made, if there is one
+	CookedTexturePath(name, &cooked);
+	*ppTexture = NULL;
+	if (SUCCEEDED(D3DXCreateTextureFromFile(pDevice, cooked.c_str(), ppTexture)))
+		return S_OK;
+
+	if (SUCCEEDED(D3DXCreateTextureFromFile(pDevice, name, ppTexture)))
+		return S_OK;
+
+	// If texture is not in current folder, try parent folder
+	const TCHAR* strPrefix = TEXT("..\\");
+	const int lenPrefix = lstrlen(strPrefix);
+	TCHAR strTexture[MAX_PATH];
+	lstrcpyn(strTexture, strPrefix, MAX_PATH);
+	lstrcpyn(strTexture + lenPrefix, name, MAX_PATH - lenPrefix);
+	if (SUCCEEDED(D3DXCreateTextureFromFile(pDevice, strTexture, ppTexture)))
+		return S_OK;
+
+	*ppTexture = NULL;
+	return E_FAIL;
+}
+
+/*
+Loads the .x file and cooks it for drawing: reorders it for the vertex cache,
+vertex fetch and overdraw, generates its detail levels and occluder, and
+converts them to compact vertices if asked to. Textures are left to the caller.
+
+@param ppMaterials - Receives the material buffer of the file, which the caller releases
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the file is in neither the working directory nor its parent,
+		  or the mesh could not be reordered; nothing is kept then.
+*/
+int Object::LoadMesh(LPD3DXBUFFER* ppMaterials) {
+	LPD3DXBUFFER pAdjacencyBuffer;
+	HRESULT r;
 
 	// Load the mesh from the specified file
-	if (FAILED(D3DXLoadMeshFromX(filename, D3DXMESH_SYSTEMMEM,
-		*pDevice, NULL,
-		&pD3DXMtrlBuffer, NULL, &dwNumMaterials,
+	if (FAILED(D3DXLoadMeshFromX(filename, ResourceManager::meshOptions(),
+		*pDevice, &pAdjacencyBuffer,
+		ppMaterials, NULL, &dwNumMaterials,
 		&pMesh)))
 	{
 		TCHAR text[200];
 		_stprintf_s(text, 200, TEXT("..\\%s"), filename);
 		// If model is not in current folder, try parent folder
-		if (FAILED(D3DXLoadMeshFromX(text, D3DXMESH_SYSTEMMEM,
-			*pDevice, NULL,
-			&pD3DXMtrlBuffer, NULL, &dwNumMaterials,
+		if (FAILED(D3DXLoadMeshFromX(text, ResourceManager::meshOptions(),
+			*pDevice, &pAdjacencyBuffer,
+			ppMaterials, NULL, &dwNumMaterials,
 			&pMesh)))
-		{
-			MessageBox(NULL, TEXT("Could not find mesh"), TEXT("Object.cpp"), MB_OK);
 			return E_FAIL;
-		}
+	}
+
+	// Reorder the mesh for the vertex cache, vertex fetch and overdraw
+	r = OptimizeMesh(pMesh, (DWORD*)pAdjacencyBuffer->GetBufferPointer(),
+		MESHOPT_VERTEXCACHE | MESHOPT_VERTEXFETCH | MESHOPT_OVERDRAW, filename);
+	pAdjacencyBuffer->Release();
+	if (FAILED(r)) {
+		// A half reordered mesh may index the wrong vertices, so none of it is kept
+		SetError(TEXT("Could not optimize mesh %s"), filename);
+		if (*ppMaterials)
+			(*ppMaterials)->Release();
+		*ppMaterials = NULL;
+		pMesh.Release();
+		dwNumMaterials = 0;
+		return E_FAIL;
+	}
+
+	GenerateLods();
+
+	if (compactVertices)
+		BuildCompactMeshes();
+
+	return S_OK;
+}
+
+/*
+Loads the .x file, and the corresponding materials, textures and normal maps.
+Meshes with normal maps are given tangent frames.
+*/
+int Object::InitGeometry() {
+	LPD3DXBUFFER pD3DXMtrlBuffer;
+
+	if (FAILED(LoadMesh(&pD3DXMtrlBuffer)))
+	{
+		MessageBox(NULL, TEXT("Could not find mesh"), TEXT("Object.cpp"), MB_OK);
+		return E_FAIL;
 	}
 
 	// We need to extract the material properties and texture names from the 
 	// pD3DXMtrlBuffer
 	D3DXMATERIAL* d3dxMaterials = (D3DXMATERIAL*)pD3DXMtrlBuffer->GetBufferPointer();
-	pMeshMaterials = new D3DMATERIAL9[dwNumMaterials];
-	pMeshTextures = new LPDIRECT3DTEXTURE9[dwNumMaterials];
+	assets.reset(new LinearArena(ASSET_ARENA_BLOCK, MEMORY_ASSET));
+	pMeshMaterials = assets->allocArray<D3DMATERIAL9>(dwNumMaterials);
+	meshTextures.assign(dwNumMaterials, CComPtr<IDirect3DTexture9>());
+	normalTextures.assign(dwNumMaterials, CComPtr<IDirect3DTexture9>());
+	streamedTextures.assign(dwNumMaterials, STREAMING_NONE);
+	streamedNormals.assign(dwNumMaterials, STREAMING_NONE);
+	DWORD numNormalMaps = 0;
 
 	for (DWORD i = 0; i < dwNumMaterials; i++)
 	{
@@ -57,58 +218,411 @@ int Object::InitGeometry() {
 		// Set the ambient color for the material (D3DX does not do this)
 		pMeshMaterials[i].Ambient = pMeshMaterials[i].Diffuse;
 
-		pMeshTextures[i] = NULL;
 		if (d3dxMaterials[i].pTextureFilename != NULL &&
 			lstrlenA(d3dxMaterials[i].pTextureFilename) > 0)
 		{
+			// A normal map sits next to its texture with _bumpmap added to the name; most materials have none
+			CA2CT strName(d3dxMaterials[i].pTextureFilename);
+			LPCTSTR strExtension = _tcsrchr(strName, TEXT('.'));
+			int lenBase = strExtension ? (int)(strExtension - (LPCTSTR)strName) : lstrlen(strName);
+			TCHAR strNormal[MAX_PATH];
+			_stprintf_s(strNormal, MAX_PATH, TEXT("%.*s_bumpmap%s"), lenBase, (LPCTSTR)strName, strExtension ? strExtension : TEXT(""));
+
+			// Streamed textures are only registered here; the manager loads them when they are wanted
+			if (streaming) {
+				streamedTextures[i] = streaming->addTexture(strName, this);
+				if (streamedTextures[i] == STREAMING_NONE)
+					MessageBox(NULL, TEXT("Could not find texture map"), TEXT("Object.cpp"), MB_OK);
+				streamedNormals[i] = streaming->addTexture(strNormal, this);
+				if (streamedNormals[i] != STREAMING_NONE)
+					numNormalMaps++;
+				continue;
+			}
+
 			// Create the texture
-			if (FAILED(D3DXCreateTextureFromFile(*pDevice,
-				CA2CT(d3dxMaterials[i].pTextureFilename),
-				&pMeshTextures[i])))
+			if (FAILED(CreateTextureNearby(*pDevice, strName, &meshTextures[i])))
 			{
-				// If texture is not in current folder, try parent folder
-				const TCHAR* strPrefix = TEXT("..\\");
-				const int lenPrefix = lstrlen(strPrefix);
-				TCHAR strTexture[MAX_PATH];
-				lstrcpyn(strTexture, strPrefix, MAX_PATH);
-				lstrcpyn(strTexture + lenPrefix, CA2CT(d3dxMaterials[i].pTextureFilename), MAX_PATH - lenPrefix);
-				// If texture is not in current folder, try parent folder
-				if (FAILED(D3DXCreateTextureFromFile(*pDevice,
-					strTexture,
-					&pMeshTextures[i])))
-				{
-					MessageBox(NULL, TEXT("Could not find texture map"), TEXT("Object.cpp"), MB_OK);
-				}
+				MessageBox(NULL, TEXT("Could not find texture map"), TEXT("Object.cpp"), MB_OK);
 			}
+
+			if (SUCCEEDED(CreateTextureNearby(*pDevice, strNormal, &normalTextures[i])))
+				numNormalMaps++;
 		}
 	}
 
 	// Done with the material buffer
 	pD3DXMtrlBuffer->Release();
 
-	D3DXMatrixIdentity(&worldMatrix);
+	// The compact layout has no room for tangents, so compact meshes are not normal mapped
+	if (numNormalMaps > 0 && !compact) {
+		LogMessage(TEXT("%s: %u of %u materials have normal maps"), filename, numNormalMaps, dwNumMaterials);
+		GenerateTangentFrames();
+	}
 
 	return S_OK;
 }
 
 /*
+Loads and cooks the .x file the way InitGeometry does, without its textures,
+and copies the result into memory so it can be created on another device. The
+HotReloader calls this on a scratch Object whose device only it uses.
 
+@param tangents - Whether to give the detail levels tangent frames, as the Object being reloaded has
+@param cooked - Receives the detail levels, bounds, materials and occluder
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the file can not be loaded or a level can not be read back.
 */
-void Object::cleanup() {
-	if (pMeshMaterials != NULL)
-		delete[] pMeshMaterials;
+int Object::CookMesh(bool tangents, CookedModel* cooked) {
+	LPD3DXBUFFER pMaterialBuffer = 0;
 
-	if (pMeshTextures)
-	{
-		for (DWORD i = 0; i < dwNumMaterials; i++)
-		{
-			if (pMeshTextures[i])
-				pMeshTextures[i]->Release();
+	if (FAILED(LoadMesh(&pMaterialBuffer)))
+		return E_FAIL;
+
+	cooked->materials.resize(dwNumMaterials);
+	if (pMaterialBuffer) {
+		D3DXMATERIAL* d3dxMaterials = (D3DXMATERIAL*)pMaterialBuffer->GetBufferPointer();
+
+		for (DWORD i = 0; i < dwNumMaterials; i++) {
+			cooked->materials[i] = d3dxMaterials[i].MatD3D;
+			cooked->materials[i].Ambient = cooked->materials[i].Diffuse;
+		}
+		pMaterialBuffer->Release();
+	}
+
+	if (tangents && !compact)
+		GenerateTangentFrames();
+
+	for (DWORD i = 0; i < numLods; i++) {
+		if (FAILED(ReadMeshData(lodMeshes[i], &cooked->lods[i])))
+			return E_FAIL;
+	}
+
+	cooked->numLods = numLods;
+	cooked->boundCenter = boundCenter;
+	cooked->boundRadius = boundRadius;
+	cooked->compact = compact;
+	cooked->tangentFrames = tangentFrames;
+	cooked->quantization = quantization;
+	cooked->occluderVertices.swap(occluderVertices);
+	cooked->occluderIndices.swap(occluderIndices);
+	return S_OK;
+}
+
+/*
+Replaces the Object's detail levels and materials with ones cooked by CookMesh,
+created on the Object's device. Every level is created before any is replaced,
+so the Object is drawn whole with either the old mesh or the new one. Called on
+the render thread between frames; the bounds and occluder the game thread reads
+are taken separately by adoptBounds.
+
+@param cooked - The cooked mesh
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the mesh has a different number of materials, as the
+		  textures are kept, or a level can not be created. The Object is
+		  left as it was.
+*/
+int Object::uploadMeshes(const CookedModel& cooked) {
+	CComPtr<ID3DXMesh> meshes[MAX_LODS];
+
+	if (cooked.materials.size() != dwNumMaterials) {
+		SetError(TEXT("%s: %u materials instead of %u, restart to load it"), filename, (DWORD)cooked.materials.size(), dwNumMaterials);
+		return E_FAIL;
+	}
+
+	for (DWORD i = 0; i < cooked.numLods; i++) {
+		if (FAILED(CreateMeshFromData(cooked.lods[i], *pDevice, &meshes[i])))
+			return E_FAIL;
+	}
+
+	for (DWORD i = 0; i < MAX_LODS; i++)
+		lodMeshes[i].Attach(meshes[i].Detach());
+	pMesh = lodMeshes[0];
+	compact = cooked.compact;
+	tangentFrames = cooked.tangentFrames;
+	quantization = cooked.quantization;
+	for (DWORD i = 0; i < dwNumMaterials; i++)
+		pMeshMaterials[i] = cooked.materials[i];
+
+	return S_OK;
+}
+
+/*
+Takes the bounds, number of detail levels and occluder of a mesh cooked by
+CookMesh once uploadMeshes has put it in place. Called on the game thread, the
+only one that reads them.
+
+@param cooked - The cooked mesh; its occluder is moved out
+*/
+void Object::adoptBounds(CookedModel& cooked) {
+	boundCenter = cooked.boundCenter;
+	boundRadius = cooked.boundRadius;
+	numLods = cooked.numLods;
+	currentLod = min(currentLod, numLods - 1);
+	occluderVertices.swap(cooked.occluderVertices);
+	occluderIndices.swap(cooked.occluderIndices);
+}
+
+/*
+Generates the coarser detail levels of the mesh with D3DX's quadric error metric
+simplifier. Texture coordinates are weighted so UV seams survive, and material
+subset boundaries are kept by the simplifier's boundary weight. Each level is
+reordered for the vertex cache like the full mesh, and the triangle count of
+every level is written to the debug output.
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the mesh can not be cleaned for simplification. The full
+		  detail mesh is still usable in that case.
+*/
+int Object::GenerateLods() {
+	LPD3DXMESH pCleanMesh = 0;
+	D3DXATTRIBUTEWEIGHTS weights;
+	std::vector<DWORD> adjacency(pMesh->GetNumFaces() * 3);
+	std::vector<DWORD> cleanAdjacency(pMesh->GetNumFaces() * 3);
+	BYTE* pVertices = 0;
+
+	lodMeshes[0] = pMesh;
+	numLods = 1;
+	currentLod = 0;
+
+	// The bounding sphere drives the projected size used to pick a level
+	if (SUCCEEDED(pMesh->LockVertexBuffer(D3DLOCK_READONLY, (void**)&pVertices))) {
+		D3DXComputeBoundingSphere((D3DXVECTOR3*)pVertices, pMesh->GetNumVertices(),
+			pMesh->GetNumBytesPerVertex(), &boundCenter, &boundRadius);
+		pMesh->UnlockVertexBuffer();
+	}
+
+	pMesh->GenerateAdjacency(0.0f, &adjacency[0]);
+	if (FAILED(D3DXCleanMesh(D3DXCLEAN_SIMPLIFICATION, pMesh, &adjacency[0], &pCleanMesh, &cleanAdjacency[0], NULL))) {
+		SetError(TEXT("Could not clean mesh for simplification"));
+		return E_FAIL;
+	}
+
+	ZeroMemory(&weights, sizeof(D3DXATTRIBUTEWEIGHTS));
+	weights.Position = 1.0f;
+	weights.Boundary = 1000.0f;
+	weights.Normal = 1.0f;
+	weights.Texcoord[0] = 1.0f;
+
+	LogMessage(TEXT("%s: LOD 0 %u triangles"), filename, pMesh->GetNumFaces());
+
+	for (DWORD i = 1; i < MAX_LODS; i++) {
+		DWORD targetFaces = pMesh->GetNumFaces() >> i;
+		LPD3DXMESH pLod = 0;
+
+		if (FAILED(D3DXSimplifyMesh(pCleanMesh, &cleanAdjacency[0], &weights, NULL, targetFaces, D3DXMESHSIMP_FACE, &pLod)))
+			break;
+
+		if (FAILED(OptimizeMesh(pLod, NULL, MESHOPT_VERTEXCACHE | MESHOPT_VERTEXFETCH, filename))) {
+			pLod->Release();
+			break;
+		}
+		lodMeshes[i].Attach(pLod);
+		numLods++;
+
+		LogMessage(TEXT("%s: LOD %u %u triangles (target %u)"), filename, i, pLod->GetNumFaces(), targetFaces);
+	}
+
+	pCleanMesh->Release();
+
+	// Read while the levels still hold float positions
+	ReadOccluder();
+	return S_OK;
+}
+
+/*
+Copies the positions and indices of the coarsest detail level, which the
+OcclusionCuller rasterizes to hide what is behind the Object.
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  The Object then has no occluder.
+*/
+int Object::ReadOccluder() {
+	LPD3DXMESH pLod = lodMeshes[numLods - 1];
+	BYTE* pVertices = 0;
+	DWORD stride = pLod->GetNumBytesPerVertex();
+
+	occluderVertices.clear();
+	if (FAILED(ReadIndices(pLod, occluderIndices)))
+		return E_FAIL;
+
+	if (FAILED(pLod->LockVertexBuffer(D3DLOCK_READONLY, (void**)&pVertices))) {
+		SetError(TEXT("Could not lock vertex buffer"));
+		occluderIndices.clear();
+		return E_FAIL;
+	}
+
+	occluderVertices.resize(pLod->GetNumVertices());
+	for (DWORD i = 0; i < occluderVertices.size(); i++)
+		occluderVertices[i] = *(D3DXVECTOR3*)(pVertices + i * stride);
+	pLod->UnlockVertexBuffer();
+
+	LogMessage(TEXT("%s: occluder %u triangles"), filename, (DWORD)occluderIndices.size() / 3);
+	return S_OK;
+}
+
+/*
+Converts every detail level to the compact vertex layout: positions quantized to
+16 bits inside the bounding box, octahedral normals and half-float texture
+coordinates. The float meshes are released, so compact Objects can only be drawn
+through a vertex shader that decodes the layout. Devices that can not fetch the
+layout keep the float meshes. The memory saved and the error bounds are written
+to the debug output.
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if a level could not be converted, in which case the Object
+		  keeps its float meshes.
+*/
+int Object::BuildCompactMeshes() {
+	LPD3DXMESH compactMeshes[MAX_LODS];
+	DWORD floatStride = lodMeshes[0]->GetNumBytesPerVertex();
+
+	if (!SupportsCompactVertices(*pDevice)) {
+		LogMessage(TEXT("%s: device can not decode compact vertices, keeping float vertices"), filename);
+		return S_OK;
+	}
+
+	if (FAILED(ComputeQuantization(lodMeshes[0], &quantization)))
+		return E_FAIL;
+
+	for (DWORD i = 0; i < numLods; i++) {
+		if (FAILED(BuildCompactMesh(lodMeshes[i], *pDevice, &quantization, &compactMeshes[i]))) {
+			for (DWORD j = 0; j < i; j++)
+				compactMeshes[j]->Release();
+			return E_FAIL;
 		}
-		delete[] pMeshTextures;
 	}
-	if (pMesh != NULL)
-		pMesh->Release();
+
+	for (DWORD i = 0; i < numLods; i++) {
+		lodMeshes[i].Attach(compactMeshes[i]);
+	}
+	pMesh = lodMeshes[0];
+	compact = true;
+
+	LogMessage(TEXT("%s: compact vertices %u -> %u bytes per vertex, %u bytes saved over %u levels"),
+		filename, floatStride, (DWORD)sizeof(CompactVertex), quantization.floatBytes - quantization.compactBytes, numLods);
+	LogMessage(TEXT("%s: compact vertices max error position %f, normal %f deg, uv %f"),
+		filename, quantization.maxPositionError, quantization.maxNormalError, quantization.maxUvError);
+
+	return S_OK;
+}
+
+/*
+Adds tangent frames to every detail level so the Object can be normal mapped.
+Each level is processed with its subsets spread over every hardware thread, and
+the time taken is written to the debug output.
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if a level could not be given tangents, in which case the
+		  Object keeps its meshes and is drawn without normal maps.
+*/
+int Object::GenerateTangentFrames() {
+	LPD3DXMESH tangentMeshes[MAX_LODS];
+	TangentStats stats;
+
+	for (DWORD i = 0; i < numLods; i++) {
+		if (FAILED(ComputeTangentFrames(lodMeshes[i], *pDevice, 0, &tangentMeshes[i], &stats))) {
+			for (DWORD j = 0; j < i; j++)
+				tangentMeshes[j]->Release();
+			return E_FAIL;
+		}
+
+		LogMessage(TEXT("%s: LOD %u tangent frames, %u vertices in %u subsets on %u threads, %.3f ms"),
+			filename, i, stats.vertices, stats.subsets, stats.threads, stats.milliseconds);
+	}
+
+	for (DWORD i = 0; i < numLods; i++) {
+		lodMeshes[i].Attach(tangentMeshes[i]);
+	}
+	pMesh = lodMeshes[0];
+	tangentFrames = true;
+
+	return S_OK;
+}
+
+bool Object::hasTangentFrames() {
+	return tangentFrames;
+}
+
+/*
+Has a StreamingManager load the Object's textures instead of loading them all in
+InitGeometry, which it must be called before.
+
+@param manager - The manager, or null to load the textures directly
+*/
+void Object::setStreaming(StreamingManager* manager) {
+	streaming = manager;
+}
+
+/*
+@return - The texture of a material to draw with, or null if it has none or it is not resident
+*/
+LPDIRECT3DTEXTURE9 Object::getTexture(DWORD material) {
+	return streaming ? streaming->getTexture(streamedTextures[material]) : (LPDIRECT3DTEXTURE9)meshTextures[material];
+}
+
+/*
+@return - The normal map of a material to draw with, or null if it has none or it is not resident
+*/
+LPDIRECT3DTEXTURE9 Object::getNormalTexture(DWORD material) {
+	return streaming ? streaming->getTexture(streamedNormals[material]) : (LPDIRECT3DTEXTURE9)normalTextures[material];
+}
+
+/*
+Records that a manager keeps a pointer to the Object, which pins it in place
+until the manager calls removeHolder.
+*/
+void Object::addHolder() {
+	holders.add();
+}
+
+void Object::removeHolder() {
+	holders.remove();
+}
+
+/*
+@return - Whether a manager points at the Object, so it must not move
+*/
+bool Object::isHeld() {
+	return holders.isHeld() || (streaming && !streamedTextures.empty());
+}
+
+void Object::setCompactVertices(bool enable) {
+	compactVertices = enable;
+}
+
+bool Object::isCompact() {
+	return compact;
+}
+
+const QuantizationInfo& Object::getQuantization() {
+	return quantization;
+}
+
+/*
+Releases the Object's meshes, textures and materials before it is destroyed,
+leaving it empty so it can be loaded again.
+*/
+void Object::cleanup() {
+	meshTextures.clear();
+	normalTextures.clear();
+	if (streaming)
+		streaming->removeUser(this);
+	streamedTextures.clear();
+	streamedNormals.clear();
+	occluderVertices.clear();
+	occluderIndices.clear();
+
+	// The material array lives in the asset arena
+	assets.reset();
+	pMeshMaterials = 0;
+	for (DWORD i = 0; i < MAX_LODS; i++)
+		lodMeshes[i].Release();
+	pMesh.Release();
+
+	numLods = currentLod = dwNumMaterials = 0;
+	compact = tangentFrames = false;
 }
 
 void Object::setupMatrices(D3DXMATRIX matView) {
@@ -126,8 +640,83 @@ void Object::setupMatrices(D3DXMATRIX matView) {
 	(*pDevice)->SetTransform(D3DTS_PROJECTION, &matProj);
 }
 
-void Object::drawObject() {
-	(*pDevice)->SetTransform(D3DTS_WORLD, &worldMatrix);
+/*
+Picks the detail level to draw from the projected size of the Object's bounding
+sphere. Each level covers a band of projected diameters; a level only changes once
+the size has moved LOD_HYSTERESIS past the band edge, so an Object sitting on a
+boundary does not pop back and forth between levels.
+
+@param matView - The camera's view matrix
+@param matProj - The camera's projection matrix
+@param viewportHeight - The height in pixels of the viewport drawn to
+*/
+void Object::selectLod(const D3DXMATRIX& matView, const D3DXMATRIX& matProj, float viewportHeight) {
+	// Projected diameter in pixels below which each coarser level is used
+	static const float thresholds[MAX_LODS] = { 0.0f, 256.0f, 128.0f, 64.0f };
+	static const float LOD_HYSTERESIS = 0.15f;
+	D3DXVECTOR3 center;
+	float radius, viewZ, pixels;
+
+	if (numLods <= 1)
+		return;
+
+	getBoundingSphere(&center, &radius);
+	D3DXVec3TransformCoord(&center, &center, &matView);
+
+	viewZ = max(center.z, 0.001f);
+	pixels = radius * matProj._22 / viewZ * viewportHeight;
+
+	while (currentLod + 1 < numLods && pixels < thresholds[currentLod + 1] * (1.0f - LOD_HYSTERESIS))
+		currentLod++;
+	while (currentLod > 0 && pixels > thresholds[currentLod] * (1.0f + LOD_HYSTERESIS))
+		currentLod--;
+}
+
+/*
+Gets the bounding sphere of the Object in world space.
+
+@param center - Receives the center of the sphere
+@param radius - Receives the radius, scaled by the largest axis of the world matrix
+*/
+void Object::getBoundingSphere(D3DXVECTOR3* center, float* radius) {
+	D3DXVECTOR3 scale;
+	float largest;
+
+	placement.getScale(&scale);
+	largest = max(fabsf(scale.x), max(fabsf(scale.y), fabsf(scale.z)));
+
+	D3DXVec3TransformCoord(center, &boundCenter, &getWorldMatrix());
+	*radius = boundRadius * largest;
+}
+
+const std::vector<D3DXVECTOR3>& Object::getOccluderVertices() {
+	return occluderVertices;
+}
+
+const std::vector<DWORD>& Object::getOccluderIndices() {
+	return occluderIndices;
+}
+
+DWORD Object::getLod() {
+	return currentLod;
+}
+
+/*
+Draws the Object with the fixed-function pipeline.
+
+@param world - The world matrix to draw with
+@param lod - The detail level to draw
+@param stats - Counts the draw calls, triangles and state changes
+*/
+void Object::drawObject(const D3DXMATRIX& world, DWORD lod, DrawStats* stats) {
+	// A reload can leave fewer levels than the game thread picked from until it catches up
+	while (lod > 0 && !lodMeshes[lod])
+		lod--;
+
+	(*pDevice)->SetTransform(D3DTS_WORLD, &world);
+	stats->drawCalls += dwNumMaterials;
+	stats->triangles += lodMeshes[lod]->GetNumFaces();
+	stats->stateChanges += 1 + 2 * dwNumMaterials;
 
 	// Meshes are divided into subsets, one for each material. Render them in
 	// a loop
@@ -135,64 +724,185 @@ void Object::drawObject() {
 	{
 		// Set the material and texture for this subset
 		(*pDevice)->SetMaterial(&pMeshMaterials[i]);
-		(*pDevice)->SetTexture(0, pMeshTextures[i]);
+		(*pDevice)->SetTexture(0, getTexture(i));
 
 		// Draw the mesh subset
-		pMesh->DrawSubset(i);
+		lodMeshes[lod]->DrawSubset(i);
+	}
+}
+
+/*
+Draws the Object with an effect instead of the fixed-function pipeline. The
+material of each subset is passed through the effect's precomputed handles, and
+compact meshes are drawn with the technique that decodes their vertices. Objects
+with tangent frames drawn with the multi-light technique are normal mapped
+instead when the effect can.
+
+@param pEffect - The effect to draw with, with the view and projection already set
+@param handles - The handles of the effect's parameters
+@param technique - The technique to draw float vertices with
+@param world - The world matrix to draw with
+@param lod - The detail level to draw
+@param stats - Counts the draw calls, triangles and state changes
+*/
+void Object::drawObject(LPD3DXEFFECT pEffect, const EffectHandles& handles, D3DXHANDLE technique, const D3DXMATRIX& world, DWORD lod, DrawStats* stats) {
+	UINT numPasses;
+	bool normalMapped = tangentFrames && technique == handles.renderSceneMultiLight && handles.renderSceneNormalMap;
+
+	while (lod > 0 && !lodMeshes[lod])
+		lod--;
+
+	if (normalMapped)
+		technique = handles.renderSceneNormalMap;
+
+	if (compact) {
+		D3DXVECTOR4 scale(quantization.posScale, 0.0f);
+		D3DXVECTOR4 bias(quantization.posBias, 0.0f);
+
+		technique = handles.renderSceneQuantized;
+		pEffect->SetVector(handles.posScale, &scale);
+		pEffect->SetVector(handles.posBias, &bias);
+	}
+
+	pEffect->SetTechnique(technique);
+	pEffect->SetMatrix(handles.world, &world);
+
+	pEffect->Begin(&numPasses, 0);
+	stats->drawCalls += numPasses * dwNumMaterials;
+	stats->triangles += numPasses * lodMeshes[lod]->GetNumFaces();
+	stats->stateChanges += (compact ? 4 : 2) + numPasses * dwNumMaterials * (normalMapped ? 6 : 4);
+	for (UINT p = 0; p < numPasses; p++) {
+		pEffect->BeginPass(p);
+
+		for (DWORD i = 0; i < dwNumMaterials; i++)
+		{
+			const D3DMATERIAL9& material = pMeshMaterials[i];
+
+			pEffect->SetVector(handles.diffuse, (const D3DXVECTOR4*)&material.Diffuse);
+			pEffect->SetVector(handles.specular, (const D3DXVECTOR4*)&material.Specular);
+			pEffect->SetFloat(handles.power, max(material.Power, 1.0f));
+			pEffect->SetTexture(handles.sceneTexture, getTexture(i));
+			if (normalMapped) {
+				LPDIRECT3DTEXTURE9 pNormal = getNormalTexture(i);
+
+				pEffect->SetTexture(handles.normalTexture, pNormal);
+				pEffect->SetFloat(handles.bumpiness, pNormal ? 1.0f : 0.0f);
+			}
+			pEffect->CommitChanges();
+
+			lodMeshes[lod]->DrawSubset(i);
+		}
+
+		pEffect->EndPass();
 	}
+	pEffect->End();
 }
 
 void Object::translate(float x, float y, float z) {
-	D3DXMATRIX transMatrix;
+	placement.translate(x, y, z);
+}
 
-	D3DXMatrixTranslation(&transMatrix, x, y, z);
-	D3DXMatrixMultiply(&worldMatrix, &worldMatrix, &transMatrix);
+void Object::rotate(const D3DXQUATERNION& rotation) {
+	placement.rotate(rotation);
 }
 
 void Object::rotateAboutX(float theta) {
-	D3DXMATRIX rotMatrix;
-	float x, y, z;
+	placement.rotateAboutX(theta);
+}
 
-	x = worldMatrix._41;
-	y = worldMatrix._42;
-	z = worldMatrix._43;
+void Object::rotateAboutY(float theta) {
+	placement.rotateAboutY(theta);
+}
 
-	this->translate(-x, -y, -z);
+void Object::rotateAboutZ(float theta) {
+	placement.rotateAboutZ(theta);
+}
 
-	D3DXMatrixRotationX(&rotMatrix, theta);
-	D3DXMatrixMultiply(&worldMatrix, &worldMatrix, &rotMatrix);
+const D3DXMATRIX& Object::getWorldMatrix() {
+	return placement.getWorldMatrix();
+}
 
-	this->translate(x, y, z);
+void Object::getPosition(D3DXVECTOR3* pos) {
+	placement.getPosition(pos);
 }
 
-void Object::rotateAboutY(float theta) {
-	D3DXMATRIX rotMatrix;
-	float x, y, z;
+void Object::setPosition(const D3DXVECTOR3& pos) {
+	placement.setPosition(pos);
+}
 
-	x = worldMatrix._41;
-	y = worldMatrix._42;
-	z = worldMatrix._43;
+void Object::getOrientation(D3DXQUATERNION* rotation) {
+	placement.getOrientation(rotation);
+}
 
-	this->translate(-x, -y, -z);
+void Object::setOrientation(const D3DXQUATERNION& rotation) {
+	placement.setOrientation(rotation);
+}
 
-	D3DXMatrixRotationY(&rotMatrix, theta);
-	D3DXMatrixMultiply(&worldMatrix, &worldMatrix, &rotMatrix);
+void Object::getScale(D3DXVECTOR3* size) {
+	placement.getScale(size);
+}
 
-	this->translate(x, y, z);
+void Object::setScale(const D3DXVECTOR3& size) {
+	placement.setScale(size);
 }
 
-void Object::rotateAboutZ(float theta) {
-	D3DXMATRIX rotMatrix;
-	float x, y, z;
+/*
+Releases the Object's default pool resources before the device is reset. The mesh
+and textures live in the managed pool and are restored by the runtime, so there
+is currently nothing to release.
+*/
+void Object::onLostDevice() {
+}
 
-	x = worldMatrix._41;
-	y = worldMatrix._42;
-	z = worldMatrix._43;
+/*
+Recreates the Object's default pool resources after the device has been reset.
+*/
+void Object::onResetDevice() {
+}
 
-	this->translate(-x, -y, -z);
+/*
+Gets the memory held by the Object's mesh and textures.
 
-	D3DXMatrixRotationZ(&rotMatrix, theta);
-	D3DXMatrixMultiply(&worldMatrix, &worldMatrix, &rotMatrix);
+@param stats - Receives the sizes of the vertex buffer, index buffer and textures,
+			   and how they are split between the pools
+*/
+void Object::getResidency(ResidencyStats* stats) {
+	LPDIRECT3DVERTEXBUFFER9 pVB = 0;
+	LPDIRECT3DINDEXBUFFER9 pIB = 0;
+	D3DVERTEXBUFFER_DESC vbDesc;
+	D3DINDEXBUFFER_DESC ibDesc;
+	D3DSURFACE_DESC texDesc;
+
+	ZeroMemory(stats, sizeof(ResidencyStats));
+
+	for (DWORD i = 0; i < numLods; i++) {
+		if (SUCCEEDED(lodMeshes[i]->GetVertexBuffer(&pVB))) {
+			pVB->GetDesc(&vbDesc);
+			stats->vertexBytes += vbDesc.Size;
+			AddResidency(stats, vbDesc.Pool, vbDesc.Size);
+			pVB->Release();
+		}
 
-	this->translate(x, y, z);
-}
\ No newline at end of file
+		if (SUCCEEDED(lodMeshes[i]->GetIndexBuffer(&pIB))) {
+			pIB->GetDesc(&ibDesc);
+			stats->indexBytes += ibDesc.Size;
+			AddResidency(stats, ibDesc.Pool, ibDesc.Size);
+			pIB->Release();
+		}
+	}
+
+	for (DWORD i = 0; i < meshTextures.size(); i++) {
+		if (meshTextures[i]) {
+			DWORD bytes = TextureBytes(meshTextures[i]);
+			meshTextures[i]->GetLevelDesc(0, &texDesc);
+			stats->textureBytes += bytes;
+			AddResidency(stats, texDesc.Pool, bytes);
+		}
+		if (normalTextures[i]) {
+			DWORD bytes = TextureBytes(normalTextures[i]);
+			normalTextures[i]->GetLevelDesc(0, &texDesc);
+			stats->textureBytes += bytes;
+			AddResidency(stats, texDesc.Pool, bytes);
+		}
+	}
+}
@@ -2,44 +2,125 @@
 #define OBJECT_H
 
 #include "Headers.h"
+#include "HolderCount.h"
+#include "Placement.h"
 #include <atlbase.h>
+#include <cassert>
+#include <memory>
+#include <vector>
 
-//Defines a ray.
-struct Ray
-{
-	D3DXVECTOR3 _origin;
-	D3DXVECTOR3 _direction;
-};
-
+//Number of detail levels generated for each mesh, including the full detail mesh.
+#define MAX_LODS 4
 
+struct CookedModel;
 
 /*
 An Object represents a model loaded from a .x file.
+
+Where an Object is placed is kept in a Placement, a position, an orientation
+and a scale that the world matrix is rebuilt from only when asked for after a
+change, so however long an Object is turned its world matrix does not drift
+away from a rotation.
+
+An Object owns its meshes, textures and materials and releases them when it is
+destroyed, so it can not be copied, only moved; a move hands the resources over
+without touching the device and leaves the source empty. An Object registered
+with a ResourceManager or a HotReloader, or whose textures are streamed, is
+pointed at by the manager and must not be moved until it is unregistered and
+cleaned up; the move constructor and move assignment assert that it is not.
+
+An Object given a StreamingManager before InitGeometry loads no textures itself;
+it registers them with the manager, which loads them as the camera comes near,
+and draws with whatever detail of them is resident.
+
+A running Object can be given a new mesh when its file changes: CookMesh builds
+it on another Object and device, uploadMeshes swaps its levels in on the render
+thread and adoptBounds hands the game thread its bounds and occluder.
 */
 class Object {
 private:
-	LPD3DXMESH pMesh; // Our mesh object in sysmem
+	CComPtr<ID3DXMesh> pMesh; // Our mesh object, full detail
+	CComPtr<ID3DXMesh> lodMeshes[MAX_LODS]; // Detail levels, lodMeshes[0] is pMesh
+	DWORD numLods; // Number of detail levels generated
+	DWORD currentLod; // Detail level drawn this frame
+	D3DXVECTOR3 boundCenter; // Bounding sphere of the mesh in model space
+	float boundRadius;
+	bool compactVertices; // Whether to convert the mesh to the compact vertex layout
+	bool compact; // Whether the detail levels hold compact vertices
+	QuantizationInfo quantization; // How compact vertices decode to model space
+	std::vector<D3DXVECTOR3> occluderVertices; // Positions of the coarsest detail level, kept for CPU occlusion culling
+	std::vector<DWORD> occluderIndices;
+	std::unique_ptr<LinearArena> assets; // Holds the material array, freed in one go
 	D3DMATERIAL9* pMeshMaterials; // Materials for our mesh
-	LPDIRECT3DTEXTURE9* pMeshTextures; // Textures for our mesh
+	std::vector<CComPtr<IDirect3DTexture9> > meshTextures; // Textures for our mesh
+	std::vector<CComPtr<IDirect3DTexture9> > normalTextures; // Tangent space normal maps, null where a material has none
+	StreamingManager* streaming; // Loads the textures instead when set
+	std::vector<DWORD> streamedTextures, streamedNormals; // Ids in streaming, STREAMING_NONE where a material has none
+	bool tangentFrames; // Whether the detail levels carry tangents for normal mapping
 	DWORD dwNumMaterials;   // Number of mesh materials
 	LPDIRECT3DDEVICE9* pDevice;//graphics device
 	
 	LPCWSTR filename;
 
+	Placement placement; // Where the Object is in the world
+	HolderCount holders; // Managers keeping a pointer to the Object, see addHolder
+
+	Object(const Object&);
+	Object& operator=(const Object&);
+	void moveFrom(Object&);
+	LPDIRECT3DTEXTURE9 getTexture(DWORD material);
+	LPDIRECT3DTEXTURE9 getNormalTexture(DWORD material);
+	bool isHeld();
+
 public:
 	Object();
 	Object(LPDIRECT3DDEVICE9*, LPCWSTR);
+	Object(Object&&);
+	Object& operator=(Object&&);
+	~Object();
 	void setFile(LPCWSTR);
 	void setDevice(LPDIRECT3DDEVICE9*);
+	LPCWSTR getFile();
 	int InitGeometry();
+	int LoadMesh(LPD3DXBUFFER* ppMaterials);
+	int CookMesh(bool tangents, CookedModel*);
+	int uploadMeshes(const CookedModel&);
+	void adoptBounds(CookedModel&);
+	int GenerateLods();
+	int ReadOccluder();
+	int BuildCompactMeshes();
+	int GenerateTangentFrames();
+	bool hasTangentFrames();
+	void setStreaming(StreamingManager*);
+	void setCompactVertices(bool);
+	bool isCompact();
+	const QuantizationInfo& getQuantization();
 	void cleanup();
+	void addHolder();
+	void removeHolder();
+	void onLostDevice();
+	void onResetDevice();
+	void getResidency(ResidencyStats*);
 	void setupMatrices(D3DXMATRIX matView);
-	void drawObject();
+	void selectLod(const D3DXMATRIX& matView, const D3DXMATRIX& matProj, float viewportHeight);
+	void getBoundingSphere(D3DXVECTOR3* center, float* radius);
+	const std::vector<D3DXVECTOR3>& getOccluderVertices();
+	const std::vector<DWORD>& getOccluderIndices();
+	DWORD getLod();
+	void drawObject(const D3DXMATRIX& world, DWORD lod, DrawStats*);
+	void drawObject(LPD3DXEFFECT, const EffectHandles&, D3DXHANDLE technique, const D3DXMATRIX& world, DWORD lod, DrawStats*);
 	void translate(float, float, float);
 	void rotateAboutX(float);
 	void rotateAboutY(float);
 	void rotateAboutZ(float);
-	D3DXMATRIX worldMatrix;
+	void rotate(const D3DXQUATERNION& rotation);
+	const D3DXMATRIX& getWorldMatrix();
+	void getPosition(D3DXVECTOR3*);
+	void setPosition(const D3DXVECTOR3&);
+	void getOrientation(D3DXQUATERNION*);
+	void setOrientation(const D3DXQUATERNION&);
+	void getScale(D3DXVECTOR3*);
+	void setScale(const D3DXVECTOR3&);
 	D3DXVECTOR3 _center;
 	float _radius;
 
@@ -0,0 +1,396 @@
+#include "Headers.h"
+#include "OcclusionCuller.h"
+#include <cfloat>
+
+OcclusionCuller::OcclusionCuller() :jobs(0), instances(0), queries(0) {
+	DWORD size = 0;
+
+	for (DWORD level = 0; level < OCCLUSION_LEVELS; level++) {
+		levelWidth[level] = max(1, OCCLUSION_WIDTH >> level);
+		levelHeight[level] = max(1, OCCLUSION_HEIGHT >> level);
+		levelOffset[level] = size;
+		size += levelWidth[level] * levelHeight[level];
+	}
+
+	// Until the first frame is rendered nothing is hidden
+	depth.assign(size, 1.0f);
+	D3DXMatrixIdentity(&viewProj);
+	ZeroMemory(&stats, sizeof(OcclusionStats));
+}
+
+/*
+Sets the job system the depth buffer is rasterized and tested on. Without one
+it is all done on the calling thread.
+
+@param jobSystem - The job system, or null
+*/
+void OcclusionCuller::setJobSystem(JobSystem* jobSystem) {
+	jobs = jobSystem;
+}
+
+/*
+Adds a mesh that can hide what is behind it. A simplified version of a model
+works best: it is rasterized every frame it is drawn, and it should not reach
+outside the model it stands for.
+
+@param vertices - The positions of the mesh in model space
+@param indices - Three per triangle
+
+@return - The id to draw the occluder with
+*/
+DWORD OcclusionCuller::addOccluder(const std::vector<D3DXVECTOR3>& vertices, const std::vector<DWORD>& indices) {
+	OccluderMesh mesh;
+
+	meshes.push_back(mesh);
+	meshes.back().vertices = vertices;
+	meshes.back().indices = indices;
+	return (DWORD)meshes.size() - 1;
+}
+
+/*
+Swaps the mesh of an occluder, such as when its model is reloaded. Instances
+drawn from then on use the new mesh.
+
+@param id - The id from addOccluder
+@param vertices - The positions of the new mesh in model space
+@param indices - Three per triangle
+*/
+void OcclusionCuller::replaceOccluder(DWORD id, const std::vector<D3DXVECTOR3>& vertices, const std::vector<DWORD>& indices) {
+	if (id >= meshes.size())
+		return;
+
+	meshes[id].vertices = vertices;
+	meshes[id].indices = indices;
+}
+
+void OcclusionCuller::clearOccluders() {
+	meshes.clear();
+}
+
+void OcclusionCuller::SetupJob(void* data, unsigned begin, unsigned end) {
+	OcclusionCuller* culler = (OcclusionCuller*)data;
+
+	for (unsigned i = begin; i < end; i++)
+		culler->setupInstance(i);
+}
+
+void OcclusionCuller::RasterizeJob(void* data, unsigned begin, unsigned end) {
+	OcclusionCuller* culler = (OcclusionCuller*)data;
+
+	for (unsigned band = begin; band < end; band++)
+		culler->rasterizeBand(band * OCCLUSION_BAND_ROWS, (band + 1) * OCCLUSION_BAND_ROWS);
+}
+
+void OcclusionCuller::TestJob(void* data, unsigned begin, unsigned end) {
+	OcclusionCuller* culler = (OcclusionCuller*)data;
+
+	for (unsigned i = begin; i < end; i++)
+		culler->queries[i].occluded = culler->testBox(culler->queries[i].boxMin, culler->queries[i].boxMax);
+}
+
+/*
+Projects the vertices of one occluder instance, four components at a time, and
+sets up its triangles for rasterizing. Triangles that reach too close to the
+eye, cover no pixel centers or have no area are marked empty.
+
+@param instance - The index of the instance in the list being rendered
+*/
+void OcclusionCuller::setupInstance(DWORD instance) {
+	const OccluderMesh& mesh = meshes[instances[instance].mesh];
+	D3DXMATRIX m = instances[instance].world * viewProj;
+	const __m128 row0 = _mm_loadu_ps(m.m[0]), row1 = _mm_loadu_ps(m.m[1]);
+	const __m128 row2 = _mm_loadu_ps(m.m[2]), row3 = _mm_loadu_ps(m.m[3]);
+	__m128* clip = clipVertices.empty() ? NULL : &clipVertices[vertexStart[instance]];
+	ScreenTriangle* screen = triangles.empty() ? NULL : &triangles[triangleStart[instance]];
+
+	for (DWORD v = 0; v < mesh.vertices.size(); v++) {
+		const D3DXVECTOR3& p = mesh.vertices[v];
+
+		clip[v] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.x), row0), _mm_mul_ps(_mm_set1_ps(p.y), row1)),
+			_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.z), row2), row3));
+	}
+
+	for (DWORD t = 0; t < mesh.indices.size() / 3; t++) {
+		ScreenTriangle& tri = screen[t];
+		float x[3], y[3], z[3];
+		float left = FLT_MAX, right = -FLT_MAX, top = FLT_MAX, bottom = -FLT_MAX;
+		bool drawn = true;
+
+		tri.minX = tri.minY = 1;
+		tri.maxX = tri.maxY = 0;
+
+		for (int k = 0; k < 3; k++) {
+			float c[4];
+
+			_mm_storeu_ps(c, clip[mesh.indices[t * 3 + k]]);
+			if (c[3] < OCCLUSION_NEAR_W) {
+				drawn = false;
+				break;
+			}
+			x[k] = (c[0] / c[3] * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+			y[k] = (0.5f - c[1] / c[3] * 0.5f) * OCCLUSION_HEIGHT;
+			z[k] = c[2] / c[3];
+			left = min(left, x[k]);
+			right = max(right, x[k]);
+			top = min(top, y[k]);
+			bottom = max(bottom, y[k]);
+		}
+		if (!drawn)
+			continue;
+
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if (fabsf(area) < 1e-6f)
+			continue;
+
+		// Pixels whose centers are inside the triangle's bounds
+		tri.minX = max(0, (int)ceilf(left - 0.5f));
+		tri.maxX = min(OCCLUSION_WIDTH - 1, (int)floorf(right - 0.5f));
+		tri.minY = max(0, (int)ceilf(top - 0.5f));
+		tri.maxY = min(OCCLUSION_HEIGHT - 1, (int)floorf(bottom - 0.5f));
+
+		// Either winding is drawn: each edge is flipped to be positive on the side of the third vertex
+		for (int k = 0; k < 3; k++) {
+			int a = k, b = (k + 1) % 3, c = (k + 2) % 3;
+			float sign;
+
+			tri.edgeA[k] = y[a] - y[b];
+			tri.edgeB[k] = x[b] - x[a];
+			tri.edgeC[k] = x[a] * y[b] - x[b] * y[a];
+			sign = tri.edgeA[k] * x[c] + tri.edgeB[k] * y[c] + tri.edgeC[k] < 0.0f ? -1.0f : 1.0f;
+			tri.edgeA[k] *= sign;
+			tri.edgeB[k] *= sign;
+			tri.edgeC[k] *= sign;
+		}
+
+		tri.depthX = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+		tri.depthY = ((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0])) / area;
+		tri.depthC = z[0] - tri.depthX * x[0] - tri.depthY * y[0];
+	}
+}
+
+/*
+Clears a band of rows of the depth buffer and draws every occluder triangle
+into it, keeping the nearest depth at each pixel. Four neighbouring pixels are
+tested against the edges and depth tested at once. The band's rows of the
+pyramid levels that fit inside it are then built.
+
+@param top - The first row of the band
+@param bottom - The row after the last row of the band
+*/
+void OcclusionCuller::rasterizeBand(int top, int bottom) {
+	const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (int i = top * OCCLUSION_WIDTH; i < bottom * OCCLUSION_WIDTH; i++)
+		depth[i] = 1.0f;
+
+	for (DWORD t = 0; t < triangles.size(); t++) {
+		const ScreenTriangle& tri = triangles[t];
+		int firstRow = max(top, tri.minY), lastRow = min(bottom - 1, tri.maxY);
+		int firstX = tri.minX & ~3;
+
+		if (tri.minX > tri.maxX || firstRow > lastRow)
+			continue;
+
+		const __m128 a0 = _mm_set1_ps(tri.edgeA[0]), a1 = _mm_set1_ps(tri.edgeA[1]), a2 = _mm_set1_ps(tri.edgeA[2]);
+		const __m128 step0 = _mm_set1_ps(tri.edgeA[0] * 4.0f), step1 = _mm_set1_ps(tri.edgeA[1] * 4.0f), step2 = _mm_set1_ps(tri.edgeA[2] * 4.0f);
+		const __m128 depthX = _mm_set1_ps(tri.depthX), depthStep = _mm_set1_ps(tri.depthX * 4.0f);
+		const __m128 px = _mm_add_ps(_mm_set1_ps((float)firstX), offsets);
+
+		for (int y = firstRow; y <= lastRow; y++) {
+			float py = y + 0.5f;
+			float* row = &depth[y * OCCLUSION_WIDTH];
+			__m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), _mm_set1_ps(tri.edgeB[0] * py + tri.edgeC[0]));
+			__m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), _mm_set1_ps(tri.edgeB[1] * py + tri.edgeC[1]));
+			__m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), _mm_set1_ps(tri.edgeB[2] * py + tri.edgeC[2]));
+			__m128 z = _mm_add_ps(_mm_mul_ps(depthX, px), _mm_set1_ps(tri.depthY * py + tri.depthC));
+
+			for (int x = firstX; x <= tri.maxX; x += 4) {
+				__m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+
+				if (_mm_movemask_ps(inside)) {
+					__m128 old = _mm_loadu_ps(row + x);
+					__m128 nearer = _mm_min_ps(old, z);
+
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+				}
+				e0 = _mm_add_ps(e0, step0);
+				e1 = _mm_add_ps(e1, step1);
+				e2 = _mm_add_ps(e2, step2);
+				z = _mm_add_ps(z, depthStep);
+			}
+		}
+	}
+
+	for (DWORD level = 1; level < OCCLUSION_LEVELS && (OCCLUSION_BAND_ROWS >> level) > 0; level++)
+		reduceRows(level, top >> level, bottom >> level);
+}
+
+/*
+Builds rows of a pyramid level from the level above it: each pixel keeps the
+furthest of the up to four pixels it covers.
+
+@param level - The level to build, at least 1
+@param top - The first row to build
+@param bottom - The row after the last row to build
+*/
+void OcclusionCuller::reduceRows(DWORD level, DWORD top, DWORD bottom) {
+	const float* src = &depth[levelOffset[level - 1]];
+	float* dst = &depth[levelOffset[level]];
+	DWORD srcWidth = levelWidth[level - 1], srcHeight = levelHeight[level - 1];
+
+	for (DWORD y = top; y < bottom; y++) {
+		DWORD y0 = y * 2, y1 = min(y * 2 + 1, srcHeight - 1);
+
+		for (DWORD x = 0; x < levelWidth[level]; x++) {
+			DWORD x0 = x * 2, x1 = min(x * 2 + 1, srcWidth - 1);
+
+			dst[y * levelWidth[level] + x] = max(max(src[y0 * srcWidth + x0], src[y0 * srcWidth + x1]),
+				max(src[y1 * srcWidth + x0], src[y1 * srcWidth + x1]));
+		}
+	}
+}
+
+/*
+Draws the occluders into the depth buffer and builds the depth pyramid. Each
+instance is set up by its own job, then each band of rows is rasterized by its
+own job; the pyramid levels smaller than a band are built last.
+
+@param matViewProj - The camera's view matrix multiplied by its projection matrix
+@param occluders - The occluders to draw, with their world matrices
+@param count - The number of occluders
+*/
+void OcclusionCuller::render(const D3DXMATRIX& matViewProj, const OccluderInstance* occluders, DWORD count) {
+	LARGE_INTEGER start, end, frequency;
+	DWORD numVertices = 0, numTriangles = 0;
+
+	QueryPerformanceCounter(&start);
+	viewProj = matViewProj;
+	instances = occluders;
+
+	// Every instance writes its own range of the vertex and triangle lists
+	vertexStart.resize(count);
+	triangleStart.resize(count);
+	for (DWORD i = 0; i < count; i++) {
+		vertexStart[i] = numVertices;
+		triangleStart[i] = numTriangles;
+		numVertices += (DWORD)meshes[occluders[i].mesh].vertices.size();
+		numTriangles += (DWORD)meshes[occluders[i].mesh].indices.size() / 3;
+	}
+	clipVertices.resize(numVertices);
+	triangles.resize(numTriangles);
+
+	if (jobs) {
+		jobs->parallelFor(count, 1, SetupJob, this);
+		jobs->parallelFor(OCCLUSION_HEIGHT / OCCLUSION_BAND_ROWS, 1, RasterizeJob, this);
+	}
+	else {
+		SetupJob(this, 0, count);
+		RasterizeJob(this, 0, OCCLUSION_HEIGHT / OCCLUSION_BAND_ROWS);
+	}
+
+	for (DWORD level = 1; level < OCCLUSION_LEVELS; level++) {
+		if ((OCCLUSION_BAND_ROWS >> level) == 0)
+			reduceRows(level, 0, levelHeight[level]);
+	}
+
+	stats.occluders = count;
+	stats.triangles = 0;
+	for (DWORD t = 0; t < numTriangles; t++) {
+		if (triangles[t].minX <= triangles[t].maxX && triangles[t].minY <= triangles[t].maxY)
+			stats.triangles++;
+	}
+	instances = 0;
+
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	stats.rasterizeTime = (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart;
+}
+
+/*
+Tests a box against the depth pyramid. The box's corners are projected to find
+the pixels it covers and its nearest depth; the pyramid level where those pixels
+are at most two by two is read, and the box is hidden if it is behind all of
+them.
+
+@param boxMin - The corner of the box with the smallest coordinates
+@param boxMax - The corner of the box with the largest coordinates
+
+@return - Whether the box is hidden. Boxes that reach too close to the eye or are
+		  off the screen are never hidden; the frustum decides those.
+*/
+bool OcclusionCuller::testBox(const D3DXVECTOR3& boxMin, const D3DXVECTOR3& boxMax) {
+	float left = FLT_MAX, right = -FLT_MAX, top = FLT_MAX, bottom = -FLT_MAX, nearest = FLT_MAX;
+	float furthest = 0.0f;
+	int x0, x1, y0, y1;
+	DWORD level = 0;
+
+	for (int c = 0; c < 8; c++) {
+		D3DXVECTOR3 corner(c & 1 ? boxMax.x : boxMin.x, c & 2 ? boxMax.y : boxMin.y, c & 4 ? boxMax.z : boxMin.z);
+		D3DXVECTOR4 clip;
+
+		D3DXVec3Transform(&clip, &corner, &viewProj);
+		if (clip.w < OCCLUSION_NEAR_W)
+			return false;
+
+		float x = (clip.x / clip.w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+		float y = (0.5f - clip.y / clip.w * 0.5f) * OCCLUSION_HEIGHT;
+		left = min(left, x);
+		right = max(right, x);
+		top = min(top, y);
+		bottom = max(bottom, y);
+		nearest = min(nearest, clip.z / clip.w);
+	}
+
+	if (right < 0.0f || bottom < 0.0f || left >= OCCLUSION_WIDTH || top >= OCCLUSION_HEIGHT)
+		return false;
+
+	x0 = max(0, (int)floorf(left));
+	x1 = min(OCCLUSION_WIDTH - 1, (int)floorf(right));
+	y0 = max(0, (int)floorf(top));
+	y1 = min(OCCLUSION_HEIGHT - 1, (int)floorf(bottom));
+
+	while (level + 1 < OCCLUSION_LEVELS && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+		level++;
+
+	const float* pixels = &depth[levelOffset[level]];
+	for (int y = y0 >> level; y <= y1 >> level; y++) {
+		for (int x = x0 >> level; x <= x1 >> level; x++)
+			furthest = max(furthest, pixels[y * levelWidth[level] + x]);
+	}
+	return nearest > furthest;
+}
+
+/*
+Tests boxes against the depth pyramid built by the last render, many at once on
+the job system.
+
+@param boxes - The boxes; each one's occluded is set
+@param count - The number of boxes
+*/
+void OcclusionCuller::cull(OcclusionQuery* boxes, DWORD count) {
+	LARGE_INTEGER start, end, frequency;
+
+	QueryPerformanceCounter(&start);
+	queries = boxes;
+	if (jobs && count > OCCLUSION_TEST_GRAIN)
+		jobs->parallelFor(count, OCCLUSION_TEST_GRAIN, TestJob, this);
+	else
+		TestJob(this, 0, count);
+	queries = 0;
+
+	stats.tested = count;
+	stats.culled = 0;
+	for (DWORD i = 0; i < count; i++) {
+		if (boxes[i].occluded)
+			stats.culled++;
+	}
+
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	stats.testTime = (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart;
+}
+
+const OcclusionStats& OcclusionCuller::getStats() {
+	return stats;
+}
@@ -0,0 +1,113 @@
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include "Headers.h"
+#include <vector>
+#include <xmmintrin.h>
+
+//Width and height of the occlusion depth buffer in pixels; powers of two, the width at least 4 so rows split into groups of four pixels.
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+//Levels of the depth pyramid, from the full buffer down to a single pixel.
+#define OCCLUSION_LEVELS 9
+//Rows of the depth buffer each rasterization job fills; a power of two, so the job can also build its rows of the first few pyramid levels.
+#define OCCLUSION_BAND_ROWS 16
+//Smallest w a projected vertex may have. Triangles that reach closer to the eye are not drawn and boxes that do are never culled; an occluder left out only culls less.
+#define OCCLUSION_NEAR_W 0.01f
+//Boxes each occlusion test job checks.
+#define OCCLUSION_TEST_GRAIN 64
+
+//One occluder mesh drawn into the depth buffer this frame.
+struct OccluderInstance
+{
+	DWORD mesh; // Returned by addOccluder
+	D3DXMATRIX world;
+};
+
+//A world space box to test against the depth buffer, and the answer.
+struct OcclusionQuery
+{
+	D3DXVECTOR3 boxMin, boxMax;
+	bool occluded; // Set by cull
+};
+
+//What the last frame's occlusion culling did.
+struct OcclusionStats
+{
+	DWORD occluders;
+	DWORD triangles; // Occluder triangles rasterized
+	DWORD tested, culled;
+	double rasterizeTime; // Milliseconds transforming, rasterizing and building the pyramid
+	double testTime; // Milliseconds testing boxes
+};
+
+/*
+The OcclusionCuller hides objects that are behind other objects before they are
+queued for drawing. A few occluder meshes, usually the coarsest detail level of
+the big models, are rasterized on the CPU into a small depth buffer, four pixels
+at a time with SSE. A pyramid is then built from it in which every pixel holds
+the furthest depth of the pixels it covers. An object's bounding box is culled
+when its nearest depth is behind the furthest depth of the pyramid pixels its
+projection covers.
+
+The buffer is split into bands of rows, each rasterized by its own job, and the
+boxes are tested in parallel as well. It is all done while the game thread
+simulates, so with the render pipeline it runs alongside the previous frame's
+rendering.
+
+Occluders are drawn where pixel centers fall inside them, so at the buffer's
+resolution an object seen only through a gap narrower than a pixel may be
+culled.
+*/
+class OcclusionCuller {
+private:
+	struct OccluderMesh
+	{
+		std::vector<D3DXVECTOR3> vertices;
+		std::vector<DWORD> indices;
+	};
+
+	//A triangle in pixels, with its depth as a plane across the screen.
+	struct ScreenTriangle
+	{
+		float edgeA[3], edgeB[3], edgeC[3]; // Each edge is >= 0 inside the triangle
+		float depthX, depthY, depthC; // Depth at pixel (x, y) is depthX * x + depthY * y + depthC
+		int minX, maxX, minY, maxY; // Pixels the triangle can cover, empty if it is not drawn
+	};
+
+	std::vector<OccluderMesh> meshes;
+	JobSystem* jobs;
+	D3DXMATRIX viewProj;
+	const OccluderInstance* instances; // Being drawn by render
+	std::vector<DWORD> vertexStart, triangleStart; // First clip vertex and screen triangle of each instance
+	std::vector<__m128> clipVertices;
+	std::vector<ScreenTriangle> triangles;
+	std::vector<float> depth; // Every level of the pyramid, the full buffer first; 1 is the far plane
+	DWORD levelOffset[OCCLUSION_LEVELS];
+	DWORD levelWidth[OCCLUSION_LEVELS], levelHeight[OCCLUSION_LEVELS];
+	OcclusionQuery* queries; // Being tested by cull
+	OcclusionStats stats;
+
+	OcclusionCuller(const OcclusionCuller&);
+	OcclusionCuller& operator=(const OcclusionCuller&);
+
+	static void SetupJob(void* data, unsigned begin, unsigned end);
+	static void RasterizeJob(void* data, unsigned begin, unsigned end);
+	static void TestJob(void* data, unsigned begin, unsigned end);
+	void setupInstance(DWORD instance);
+	void rasterizeBand(int top, int bottom);
+	void reduceRows(DWORD level, DWORD top, DWORD bottom);
+	bool testBox(const D3DXVECTOR3& boxMin, const D3DXVECTOR3& boxMax);
+
+public:
+	OcclusionCuller();
+	void setJobSystem(JobSystem*);
+	DWORD addOccluder(const std::vector<D3DXVECTOR3>& vertices, const std::vector<DWORD>& indices);
+	void replaceOccluder(DWORD id, const std::vector<D3DXVECTOR3>& vertices, const std::vector<DWORD>& indices);
+	void clearOccluders();
+	void render(const D3DXMATRIX& viewProj, const OccluderInstance* instances, DWORD count);
+	void cull(OcclusionQuery* queries, DWORD count);
+	const OcclusionStats& getStats();
+};
+
+#endif // !OCCLUSIONCULLER_H
@@ -1,14 +1,61 @@
-#include "Headers.h"
-
-
-
-
-/*
-Constructor for a Picking.
-
-@param newDevice - The directx device that is being used to calculate the object's projection rays. 
-*/
-Picking::Picking(LPDIRECT3DDEVICE9* pdevice){
-	pDevice = pdevice;
-}
-
\ No newline at end of file
+#include "Picking.h"
+
+/*
+Computes a picking ray in view space through a point on the screen.
+
+@param x, y - The point in pixels from the top left of the viewport
+@param width, height - The size of the viewport in pixels
+@param projection - The projection matrix the scene is drawn with
+
+@return - The ray, starting at the eye
+*/
+Ray ComputePickingRay(int x, int y, int width, int height, const D3DXMATRIX& projection) {
+	Ray ray;
+
+	ray._origin = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+	ray._direction.x = (((2.0f * x) / width) - 1.0f) / projection(0, 0);
+	ray._direction.y = (((-2.0f * y) / height) + 1.0f) / projection(1, 1);
+	ray._direction.z = 1.0f;
+	return ray;
+}
+
+/*
+Transforms a picking ray, usually from view space into world space or an
+object's local space, and normalizes its direction.
+
+@param ray - The ray to transform
+@param T - The transform
+*/
+void TransformPickingRay(Ray* ray, const D3DXMATRIX* T) {
+	// transform the ray's origin, w = 1.  Transforms points.
+	D3DXVec3TransformCoord(&ray->_origin, &ray->_origin, T);
+	// transform the ray's direction, w = 0.  Transforms vectors.
+	D3DXVec3TransformNormal(&ray->_direction, &ray->_direction, T);
+	D3DXVec3Normalize(&ray->_direction, &ray->_direction);
+}
+
+/*
+Tests a ray with a normalized direction against a sphere.
+
+@param ray - The ray
+@param center - The center of the sphere
+@param radius - The radius of the sphere
+
+@return - Whether the ray hits the sphere in front of its origin, or starts inside it
+*/
+bool RayHitsSphere(const Ray* ray, const D3DXVECTOR3& center, float radius) {
+	D3DXVECTOR3 v = ray->_origin - center;
+	float b = 2.0f * D3DXVec3Dot(&ray->_direction, &v);
+	float c = D3DXVec3Dot(&v, &v) - (radius * radius);
+	// find the discriminant
+	float discriminant = (b * b) - (4.0f * c);
+	// test for imaginary number
+	if (discriminant < 0.0f)
+		return false;
+	discriminant = sqrtf(discriminant);
+	float s0 = (-b + discriminant) / 2.0f;
+	float s1 = (-b - discriminant) / 2.0f;
+	// if a solution is >= 0, then we intersected the sphere
+	return s0 >= 0.0f || s1 >= 0.0f;
+}
+
@@ -1,13 +1,10 @@
-#pragma once
-#include "Headers.h"
+#ifndef PICKING_H
+#define PICKING_H
 
-class Picking {
-	
-	private:
-		LPDIRECT3DDEVICE9* pDevice;  //graphics device
+#include "CoreMath.h"
 
-	public:
-		Picking();
-		Picking(LPDIRECT3DDEVICE9*);
+Ray ComputePickingRay(int x, int y, int width, int height, const D3DXMATRIX& projection);
+void TransformPickingRay(Ray* ray, const D3DXMATRIX* T);
+bool RayHitsSphere(const Ray* ray, const D3DXVECTOR3& center, float radius);
 
-};
\ No newline at end of file
+#endif // !PICKING_H
@@ -0,0 +1,114 @@
+#include "Placement.h"
+#include <algorithm>
+
+Placement::Placement() :position(0.0f, 0.0f, 0.0f), scale(1.0f, 1.0f, 1.0f), worldDirty(true) {
+	D3DXQuaternionIdentity(&orientation);
+}
+
+/*
+Moves along the world axes.
+
+@param x, y, z - How far to move
+*/
+void Placement::translate(float x, float y, float z) {
+	position += D3DXVECTOR3(x, y, z);
+	worldDirty = true;
+}
+
+/*
+Turns about the position. The rotation is applied after the orientation, so
+its axis is in world space. The orientation is renormalized, so rounding can
+not build up however many turns are made.
+
+@param rotation - The rotation, which need not be normalized
+*/
+void Placement::rotate(const D3DXQUATERNION& rotation) {
+	D3DXQuaternionMultiply(&orientation, &orientation, &rotation);
+	D3DXQuaternionNormalize(&orientation, &orientation);
+	worldDirty = true;
+}
+
+void Placement::rotateAboutX(float theta) {
+	D3DXQUATERNION rotation(sinf(theta * 0.5f), 0.0f, 0.0f, cosf(theta * 0.5f));
+
+	rotate(rotation);
+}
+
+void Placement::rotateAboutY(float theta) {
+	D3DXQUATERNION rotation(0.0f, sinf(theta * 0.5f), 0.0f, cosf(theta * 0.5f));
+
+	rotate(rotation);
+}
+
+void Placement::rotateAboutZ(float theta) {
+	D3DXQUATERNION rotation(0.0f, 0.0f, sinf(theta * 0.5f), cosf(theta * 0.5f));
+
+	rotate(rotation);
+}
+
+/*
+Gets the world matrix, scaling, then rotating, then translating. It is rebuilt
+only if the Placement moved, turned or was scaled since the last call.
+
+@return - The world matrix, valid until the Placement next changes
+*/
+const D3DXMATRIX& Placement::getWorldMatrix() {
+	if (worldDirty) {
+		D3DXMatrixTransformation(&world, NULL, NULL, &scale, NULL, &orientation, &position);
+		worldDirty = false;
+	}
+	return world;
+}
+
+void Placement::getPosition(D3DXVECTOR3* pos) {
+	*pos = position;
+}
+
+void Placement::setPosition(const D3DXVECTOR3& pos) {
+	position = pos;
+	worldDirty = true;
+}
+
+void Placement::getOrientation(D3DXQUATERNION* rotation) {
+	*rotation = orientation;
+}
+
+void Placement::setOrientation(const D3DXQUATERNION& rotation) {
+	D3DXQuaternionNormalize(&orientation, &rotation);
+	worldDirty = true;
+}
+
+void Placement::getScale(D3DXVECTOR3* size) {
+	*size = scale;
+}
+
+void Placement::setScale(const D3DXVECTOR3& size) {
+	scale = size;
+	worldDirty = true;
+}
+
+/*
+Measures how far the upper 3x3 of a matrix is from a rotation, after dividing
+out the scale of each row.
+
+@param m - The matrix to measure
+
+@return - The largest difference between an entry of R * R^T and the identity
+*/
+float Placement::OrthonormalityError(const D3DXMATRIX& m) {
+	D3DXVECTOR3 rows[3];
+	float error = 0.0f;
+
+	for (int r = 0; r < 3; r++) {
+		rows[r] = D3DXVECTOR3(m(r, 0), m(r, 1), m(r, 2));
+		D3DXVec3Normalize(&rows[r], &rows[r]);
+	}
+
+	for (int r = 0; r < 3; r++) {
+		for (int c = 0; c < 3; c++) {
+			float dot = D3DXVec3Dot(&rows[r], &rows[c]);
+			error = std::max(error, fabsf(dot - (r == c ? 1.0f : 0.0f)));
+		}
+	}
+	return error;
+}
@@ -0,0 +1,39 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+// Only math, so it is part of the core library; Object keeps one for where it is drawn.
+#include "CoreMath.h"
+
+/*
+A Placement is where something is in the world, kept as a position, an
+orientation and a scale. Moving or turning it only updates those; the world
+matrix is rebuilt from them the next time it is asked for. Rotations are
+composed as quaternions and renormalized each time, so however long it is
+turned its world matrix does not drift away from a rotation.
+*/
+class Placement {
+private:
+	D3DXVECTOR3 position; // Where it is in the world
+	D3DXQUATERNION orientation; // Kept normalized, so the world matrix it builds stays orthonormal
+	D3DXVECTOR3 scale;
+	D3DXMATRIX world; // Built from the three above by getWorldMatrix
+	bool worldDirty; // Whether it moved since world was built
+
+public:
+	Placement();
+	void translate(float, float, float);
+	void rotateAboutX(float);
+	void rotateAboutY(float);
+	void rotateAboutZ(float);
+	void rotate(const D3DXQUATERNION& rotation);
+	const D3DXMATRIX& getWorldMatrix();
+	void getPosition(D3DXVECTOR3*);
+	void setPosition(const D3DXVECTOR3&);
+	void getOrientation(D3DXQUATERNION*);
+	void setOrientation(const D3DXQUATERNION&);
+	void getScale(D3DXVECTOR3*);
+	void setScale(const D3DXVECTOR3&);
+	static float OrthonormalityError(const D3DXMATRIX&);
+};
+
+#endif // !PLACEMENT_H
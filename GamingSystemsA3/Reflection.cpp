@@ -1,4 +1,258 @@
 #include "Headers.h"
 
+//Vertex of the mirror quad.
+struct MirrorVertex
+{
+	D3DXVECTOR3 position;
+	D3DXVECTOR3 normal;
+};
 
+#define MIRROR_FVF (D3DFVF_XYZ | D3DFVF_NORMAL)
 
+Reflection::Reflection() :pDevice(0), pQuad(0), enabled(false), mirrorTime(0), drawnObjects(0), culledObjects(0) {
+	ZeroMemory(&material, sizeof(D3DMATERIAL9));
+	passStart.QuadPart = 0;
+}
+
+void Reflection::setDevice(LPDIRECT3DDEVICE9* newDevice) {
+	pDevice = newDevice;
+}
+
+/*
+Creates the mirror as a square lying in a plane.
+
+@param mirrorPlane - The plane of the mirror; its normal faces the side that is reflected
+@param center - The center of the square, on the plane
+@param halfSize - Half the length of the square's sides
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the vertex buffer can not be created or locked.
+*/
+int Reflection::init(const D3DXPLANE& mirrorPlane, const D3DXVECTOR3& center, float halfSize) {
+	MirrorVertex* pVertices = 0;
+	D3DXVECTOR3 normal, tangent, bitangent;
+	D3DXVECTOR3 axis(0.0f, 1.0f, 0.0f);
+
+	D3DXPlaneNormalize(&plane, &mirrorPlane);
+	normal = D3DXVECTOR3(plane.a, plane.b, plane.c);
+
+	// Any direction not parallel to the normal spans the square with it
+	if (fabsf(normal.y) > 0.9f)
+		axis = D3DXVECTOR3(1.0f, 0.0f, 0.0f);
+	D3DXVec3Cross(&tangent, &axis, &normal);
+	D3DXVec3Normalize(&tangent, &tangent);
+	D3DXVec3Cross(&bitangent, &tangent, &normal);
+
+	if (FAILED((*pDevice)->CreateVertexBuffer(4 * sizeof(MirrorVertex), D3DUSAGE_WRITEONLY, MIRROR_FVF, D3DPOOL_MANAGED, &pQuad, NULL))) {
+		SetError(TEXT("Could not create the mirror vertex buffer"));
+		return E_FAIL;
+	}
+
+	if (FAILED(pQuad->Lock(0, 0, (void**)&pVertices, 0))) {
+		SetError(TEXT("Could not lock the mirror vertex buffer"));
+		return E_FAIL;
+	}
+	// Triangle strip, clockwise seen from the reflected side
+	pVertices[0].position = center + (-tangent - bitangent) * halfSize;
+	pVertices[1].position = center + (-tangent + bitangent) * halfSize;
+	pVertices[2].position = center + (tangent - bitangent) * halfSize;
+	pVertices[3].position = center + (tangent + bitangent) * halfSize;
+	for (int i = 0; i < 4; i++)
+		pVertices[i].normal = normal;
+	pQuad->Unlock();
+
+	material.Diffuse = D3DXCOLOR(0.6f, 0.6f, 0.7f, 0.3f);
+	material.Ambient = material.Diffuse;
+	enabled = true;
+
+	return S_OK;
+}
+
+void Reflection::cleanup() {
+	if (pQuad)
+		pQuad->Release();
+	pQuad = 0;
+	enabled = false;
+}
+
+void Reflection::setEnabled(bool on) {
+	enabled = on && pQuad;
+}
+
+bool Reflection::isEnabled() {
+	return enabled;
+}
+
+/*
+Builds the matrix that mirrors points across a plane.
+
+@param pOut - Receives the reflection matrix
+@param mirrorPlane - The plane to reflect across
+
+@return - pOut, so the call can be nested like the D3DX matrix functions
+*/
+D3DXMATRIX* Reflection::D3DMatrixReflect(D3DXMATRIX* pOut, CONST D3DXPLANE& mirrorPlane) {
+	D3DXPLANE normalized;
+
+	D3DXPlaneNormalize(&normalized, &mirrorPlane);
+	return D3DXMatrixReflect(pOut, &normalized);
+}
+
+/*
+Replaces the near plane of a perspective projection with an arbitrary plane, so
+that geometry on the wrong side of the plane is clipped by the hardware without
+a user clip plane. The far plane is tilted to keep the frustum as tight as
+possible, which costs some depth precision.
+
+@param proj - The projection matrix to modify
+@param viewPlane - The new near plane in view space, facing the geometry to keep
+*/
+void Reflection::ObliqueProjection(D3DXMATRIX* proj, const D3DXPLANE& viewPlane) {
+	D3DXMATRIX inverse;
+	D3DXVECTOR4 corner, q;
+	D3DXVECTOR4 plane(viewPlane.a, viewPlane.b, viewPlane.c, viewPlane.d);
+
+	// The far corner of the frustum on the plane's side, in view space
+	D3DXMatrixInverse(&inverse, NULL, proj);
+	corner = D3DXVECTOR4(plane.x > 0.0f ? 1.0f : (plane.x < 0.0f ? -1.0f : 0.0f),
+		plane.y > 0.0f ? 1.0f : (plane.y < 0.0f ? -1.0f : 0.0f), 1.0f, 1.0f);
+	D3DXVec4Transform(&q, &corner, &inverse);
+
+	// Direct3D's near plane is the third column; scale the plane so the far plane,
+	// the fourth column minus the third, still passes through the corner
+	float scale = (q.x * proj->_14 + q.y * proj->_24 + q.z * proj->_34 + q.w * proj->_44) /
+		(plane.x * q.x + plane.y * q.y + plane.z * q.z + plane.w * q.w);
+	proj->_13 = plane.x * scale;
+	proj->_23 = plane.y * scale;
+	proj->_33 = plane.z * scale;
+	proj->_43 = plane.w * scale;
+}
+
+void Reflection::drawQuad() {
+	D3DXMATRIX identity;
+
+	D3DXMatrixIdentity(&identity);
+	(*pDevice)->SetTransform(D3DTS_WORLD, &identity);
+	(*pDevice)->SetMaterial(&material);
+	(*pDevice)->SetTexture(0, NULL);
+	(*pDevice)->SetFVF(MIRROR_FVF);
+	(*pDevice)->SetStreamSource(0, pQuad, 0, sizeof(MirrorVertex));
+	(*pDevice)->DrawPrimitive(D3DPT_TRIANGLESTRIP, 0, 2);
+}
+
+/*
+Starts the mirror pass: marks the mirror in the stencil buffer and sets the
+states that limit drawing to it. The caller then draws every Object inside the
+returned frustum with the returned matrices, sets its own matrices back and calls
+endMirror. The device must hold the camera's view and projection when this is called.
+
+@param view - The camera's view matrix
+@param proj - The camera's projection matrix
+@param mirrorView - Receives the view matrix of the reflected pass
+@param mirrorProj - Receives the oblique projection matrix of the reflected pass
+@param mirrorFrustum - Receives the reflected frustum, to test unreflected world positions against
+
+@return - Returns false if the mirror can not be seen and nothing should be drawn
+*/
+bool Reflection::beginMirror(const D3DXMATRIX& view, const D3DXMATRIX& proj, D3DXMATRIX* mirrorView, D3DXMATRIX* mirrorProj, Frustum* mirrorFrustum) {
+	D3DXMATRIX reflect, inverseView, viewInverseTranspose, mirrorViewProj;
+	D3DXVECTOR3 eye;
+	D3DXPLANE clipPlane, viewClipPlane;
+
+	if (!enabled)
+		return false;
+
+	QueryPerformanceCounter(&passStart);
+
+	// The mirror is one sided; from behind it there is nothing to reflect
+	D3DXMatrixInverse(&inverseView, NULL, &view);
+	eye = D3DXVECTOR3(inverseView._41, inverseView._42, inverseView._43);
+	if (D3DXPlaneDotCoord(&plane, &eye) <= 0.0f) {
+		mirrorTime = 0;
+		drawnObjects = culledObjects = 0;
+		return false;
+	}
+
+	D3DMatrixReflect(&reflect, plane);
+	*mirrorView = reflect * view;
+
+	// Reflected geometry is kept only on the far side of the mirror
+	clipPlane = -plane;
+	D3DXMatrixInverse(&viewInverseTranspose, NULL, &view);
+	D3DXMatrixTranspose(&viewInverseTranspose, &viewInverseTranspose);
+	D3DXPlaneTransform(&viewClipPlane, &clipPlane, &viewInverseTranspose);
+	*mirrorProj = proj;
+	ObliqueProjection(mirrorProj, viewClipPlane);
+
+	mirrorViewProj = *mirrorView * *mirrorProj;
+	BuildFrustum(mirrorViewProj, mirrorFrustum);
+
+	// Write 1 to the stencil where the mirror is visible, leaving colour and depth alone
+	(*pDevice)->SetRenderState(D3DRS_STENCILENABLE, TRUE);
+	(*pDevice)->SetRenderState(D3DRS_STENCILFUNC, D3DCMP_ALWAYS);
+	(*pDevice)->SetRenderState(D3DRS_STENCILREF, 1);
+	(*pDevice)->SetRenderState(D3DRS_STENCILMASK, 0xffffffff);
+	(*pDevice)->SetRenderState(D3DRS_STENCILWRITEMASK, 0xffffffff);
+	(*pDevice)->SetRenderState(D3DRS_STENCILZFAIL, D3DSTENCILOP_KEEP);
+	(*pDevice)->SetRenderState(D3DRS_STENCILFAIL, D3DSTENCILOP_KEEP);
+	(*pDevice)->SetRenderState(D3DRS_STENCILPASS, D3DSTENCILOP_REPLACE);
+	(*pDevice)->SetRenderState(D3DRS_COLORWRITEENABLE, 0);
+	(*pDevice)->SetRenderState(D3DRS_ZWRITEENABLE, FALSE);
+	drawQuad();
+
+	// Draw the reflection only where the stencil was set. Mirroring flips the
+	// winding of every triangle, so the cull mode is flipped too
+	(*pDevice)->SetRenderState(D3DRS_STENCILFUNC, D3DCMP_EQUAL);
+	(*pDevice)->SetRenderState(D3DRS_STENCILPASS, D3DSTENCILOP_KEEP);
+	(*pDevice)->SetRenderState(D3DRS_COLORWRITEENABLE, D3DCOLORWRITEENABLE_RED | D3DCOLORWRITEENABLE_GREEN | D3DCOLORWRITEENABLE_BLUE | D3DCOLORWRITEENABLE_ALPHA);
+	(*pDevice)->SetRenderState(D3DRS_ZWRITEENABLE, TRUE);
+	(*pDevice)->SetRenderState(D3DRS_CULLMODE, D3DCULL_CW);
+
+	return true;
+}
+
+/*
+Finishes the mirror pass: drops the reflection's depth, so the scene drawn
+afterwards is not hidden by it, and blends the mirror surface over the
+reflection. The device must hold the camera's view and projection again.
+
+@param drawn - The number of Objects drawn in the reflection
+@param culled - The number of Objects outside the reflected frustum
+*/
+void Reflection::endMirror(DWORD drawn, DWORD culled) {
+	LARGE_INTEGER end, frequency;
+
+	(*pDevice)->SetRenderState(D3DRS_CULLMODE, D3DCULL_CCW);
+	(*pDevice)->SetRenderState(D3DRS_STENCILENABLE, FALSE);
+	(*pDevice)->Clear(0, NULL, D3DCLEAR_ZBUFFER, 0, 1.0f, 0);
+
+	// The mirror writes its own depth so the scene in front of it still sorts correctly
+	(*pDevice)->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
+	(*pDevice)->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+	(*pDevice)->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+	drawQuad();
+	(*pDevice)->SetRenderState(D3DRS_ALPHABLENDENABLE, FALSE);
+
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	mirrorTime = (end.QuadPart - passStart.QuadPart) * 1000.0 / frequency.QuadPart;
+	drawnObjects = drawn;
+	culledObjects = culled;
+}
+
+/*
+Gets the time spent issuing the last mirror pass.
+
+@return - The time in milliseconds
+*/
+double Reflection::getMirrorTime() {
+	return mirrorTime;
+}
+
+DWORD Reflection::getDrawnObjects() {
+	return drawnObjects;
+}
+
+DWORD Reflection::getCulledObjects() {
+	return culledObjects;
+}
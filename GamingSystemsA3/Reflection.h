@@ -1,13 +1,43 @@
-#pragma once
+#ifndef REFLECTION_H
+#define REFLECTION_H
 
+#include "Headers.h"
+
+/*
+A Reflection renders a planar mirror. The mirror's quad is first drawn into the
+stencil buffer only, then the scene is drawn reflected across the mirror's plane
+where the stencil was set, and finally the quad is blended over the reflection.
+The reflected pass uses an oblique projection whose near plane is the mirror, so
+nothing behind the mirror leaks into the reflection.
+*/
 class Reflection {
 
 	private:
 		LPDIRECT3DDEVICE9* pDevice;
+		LPDIRECT3DVERTEXBUFFER9 pQuad; // Mirror surface, in the managed pool
+		D3DXPLANE plane; // Mirror plane, facing the side it reflects
+		D3DMATERIAL9 material; // Tint of the mirror surface; alpha is its opacity
+		bool enabled;
+		LARGE_INTEGER passStart;
+		double mirrorTime; // Milliseconds spent in the last mirror pass
+		DWORD drawnObjects, culledObjects; // Objects inside and outside the reflected frustum last pass
 
-		D3DMATRIX *D3DMatrixReflect(D3DMATRIX, CONST D3DXPLANE ); 
-		void RenderMirror();
-		void setDevice(LPDIRECT3DDEVICE9*);
+		void drawQuad();
 
+	public:
+		Reflection();
+		void setDevice(LPDIRECT3DDEVICE9*);
+		int init(const D3DXPLANE&, const D3DXVECTOR3& center, float halfSize);
+		void cleanup();
+		void setEnabled(bool);
+		bool isEnabled();
+		static D3DXMATRIX* D3DMatrixReflect(D3DXMATRIX*, CONST D3DXPLANE&);
+		static void ObliqueProjection(D3DXMATRIX* proj, const D3DXPLANE& viewPlane);
+		bool beginMirror(const D3DXMATRIX& view, const D3DXMATRIX& proj, D3DXMATRIX* mirrorView, D3DXMATRIX* mirrorProj, Frustum* mirrorFrustum);
+		void endMirror(DWORD drawn, DWORD culled);
+		double getMirrorTime();
+		DWORD getDrawnObjects();
+		DWORD getCulledObjects();
+};
 
-};
\ No newline at end of file
+#endif // !REFLECTION_H
@@ -0,0 +1,149 @@
+#include "Headers.h"
+#include "RenderPipeline.h"
+
+RenderPipeline::RenderPipeline() :writeIndex(0), readIndex(0), inFlight(0), quitting(false), render(0), context(0), simulateStart(0) {
+	QueryPerformanceFrequency(&frequency);
+	ZeroMemory(&stats, sizeof(RenderPipelineStats));
+}
+
+RenderPipeline::~RenderPipeline() {
+	stop();
+}
+
+double RenderPipeline::toMilliseconds(LONGLONG ticks) {
+	return ticks * 1000.0 / frequency.QuadPart;
+}
+
+/*
+Starts the render thread. From here on the device must only be used from the
+render function until stop is called.
+
+@param renderFunction - Draws a snapshot on the render thread
+@param renderContext - Passed to every call of the render function
+*/
+void RenderPipeline::start(RenderFunction renderFunction, void* renderContext) {
+	stop();
+
+	render = renderFunction;
+	context = renderContext;
+	quitting = false;
+	writeIndex = readIndex = inFlight = 0;
+	thread = std::thread(&RenderPipeline::renderMain, this);
+}
+
+/*
+Stops the render thread once it has finished the frame it is drawing. Frames
+submitted after that one are dropped.
+*/
+void RenderPipeline::stop() {
+	if (!thread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> hold(lock);
+		quitting = true;
+	}
+	changed.notify_all();
+	thread.join();
+}
+
+/*
+Draws submitted snapshots in order until the pipeline stops, timing each one
+and how long after its input was read it reached the screen.
+*/
+void RenderPipeline::renderMain() {
+	for (;;) {
+		FrameSnapshot* snapshot;
+		LARGE_INTEGER start, end;
+		DrawStats drawn;
+
+		{
+			std::unique_lock<std::mutex> hold(lock);
+			changed.wait(hold, [this] { return inFlight > 0 || quitting; });
+			if (quitting)
+				return;
+			snapshot = &snapshots[readIndex];
+		}
+
+		// The snapshot is the render thread's alone until inFlight drops
+		ZeroMemory(&drawn, sizeof(DrawStats));
+		QueryPerformanceCounter(&start);
+		render(context, *snapshot, &drawn);
+		QueryPerformanceCounter(&end);
+
+		{
+			std::lock_guard<std::mutex> hold(lock);
+			double latency = toMilliseconds(end.QuadPart - snapshot->inputTime);
+
+			stats.frames++;
+			stats.renderTime += toMilliseconds(end.QuadPart - start.QuadPart);
+			stats.latencyTotal += latency;
+			stats.latencyMax = max(stats.latencyMax, latency);
+			stats.drawCalls += drawn.drawCalls;
+			stats.triangles += drawn.triangles;
+			stats.stateChanges += drawn.stateChanges;
+			readIndex = (readIndex + 1) % RENDER_PIPELINE_DEPTH;
+			inFlight--;
+		}
+		changed.notify_all();
+	}
+}
+
+/*
+Gets the next snapshot for the game thread to fill, waiting while every
+snapshot is in flight.
+
+@return - The snapshot to fill; the previous contents are left in it so its
+		  buffers are reused
+*/
+FrameSnapshot* RenderPipeline::beginFrame() {
+	LARGE_INTEGER start, end;
+	std::unique_lock<std::mutex> hold(lock);
+
+	QueryPerformanceCounter(&start);
+	changed.wait(hold, [this] { return inFlight < RENDER_PIPELINE_DEPTH; });
+	QueryPerformanceCounter(&end);
+
+	stats.waitTime += toMilliseconds(end.QuadPart - start.QuadPart);
+	simulateStart = end.QuadPart;
+	return &snapshots[writeIndex];
+}
+
+/*
+Hands the snapshot from beginFrame to the render thread.
+*/
+void RenderPipeline::submit() {
+	LARGE_INTEGER now;
+
+	QueryPerformanceCounter(&now);
+	{
+		std::lock_guard<std::mutex> hold(lock);
+
+		stats.simulateTime += toMilliseconds(now.QuadPart - simulateStart);
+		writeIndex = (writeIndex + 1) % RENDER_PIPELINE_DEPTH;
+		inFlight++;
+	}
+	changed.notify_all();
+}
+
+/*
+Waits until every submitted frame has been presented, so the game thread can
+touch state the render thread uses.
+*/
+void RenderPipeline::waitIdle() {
+	std::unique_lock<std::mutex> hold(lock);
+
+	changed.wait(hold, [this] { return inFlight == 0 || !thread.joinable(); });
+}
+
+/*
+Gets the timings gathered since the last call and starts gathering afresh.
+
+@param pStats - Receives the timings
+*/
+void RenderPipeline::takeStats(RenderPipelineStats* pStats) {
+	std::lock_guard<std::mutex> hold(lock);
+
+	*pStats = stats;
+	ZeroMemory(&stats, sizeof(RenderPipelineStats));
+}
@@ -0,0 +1,108 @@
+#ifndef RENDERPIPELINE_H
+#define RENDERPIPELINE_H
+
+#include "Headers.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Frames in flight between the game thread and the render thread: 2 double buffers, 3 triple buffers.
+#define RENDER_PIPELINE_DEPTH 2
+
+//How the models are drawn; cycled with the 0 key.
+enum RenderPath { RENDER_FIXED, RENDER_SPECULAR, RENDER_REFLECT, RENDER_PATH_COUNT };
+
+//What the render thread needs to draw one Object, copied out of the simulation.
+struct DrawItem
+{
+	DWORD object; // Index of the Object in the game's models
+	D3DXMATRIX world;
+	DWORD lod;
+	D3DXVECTOR3 center; // World space bounding sphere
+	float radius;
+	bool visible; // Inside the camera's frustum and not hidden behind an occluder
+	DWORD numLights;
+	D3DLIGHT9 lights[MAX_OBJECT_LIGHTS]; // Brightest first
+};
+
+/*
+Everything a frame is drawn from. The game thread fills a snapshot and submits
+it; after that only the render thread reads it, so drawing never sees state the
+game thread is in the middle of changing.
+*/
+struct FrameSnapshot
+{
+	LONGLONG inputTime; // QueryPerformanceCounter when the frame's input was read
+	D3DXMATRIX view, proj;
+	std::vector<DrawItem> items; // Every Object; the mirror and the probe also draw ones the camera can not see
+	RenderPath renderPath;
+	float reflectivity;
+	bool ambientOn;
+	int fps;
+	unsigned long long sceneSignature; // What the environment map sees besides the Objects
+	bool bakeProbe; // Save the environment map this frame
+	bool secondPassed; // Log render statistics and check the effects for changes
+};
+
+//Work the render thread submitted to the device for one frame.
+struct DrawStats
+{
+	DWORD drawCalls;
+	DWORD triangles;
+	DWORD stateChanges; // Render states, transforms, lights, textures and effect parameters set
+};
+
+//Timings of the frames presented since the statistics were last reset, in milliseconds.
+struct RenderPipelineStats
+{
+	DWORD frames;
+	double simulateTime, renderTime; // Totals on the game and the render thread
+	double waitTime; // Total the game thread waited for a free snapshot
+	double latencyTotal, latencyMax; // From reading input to Present returning
+	unsigned long long drawCalls, triangles, stateChanges; // Totals of every frame's DrawStats
+};
+
+//Draws a snapshot on the render thread, counting what it submits.
+typedef int(*RenderFunction)(void* context, const FrameSnapshot&, DrawStats*);
+
+/*
+The RenderPipeline runs drawing on its own thread, so that while the render
+thread submits frame N the game thread simulates frame N + 1. Snapshots are
+used in turn from a ring of RENDER_PIPELINE_DEPTH; the game thread waits when
+every one is in flight, which caps how far simulation runs ahead of the screen
+and so how old the input of a presented frame can be.
+*/
+class RenderPipeline {
+private:
+	FrameSnapshot snapshots[RENDER_PIPELINE_DEPTH];
+	DWORD writeIndex, readIndex;
+	DWORD inFlight; // Submitted and not yet presented, including the one being drawn
+	bool quitting;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::thread thread;
+	RenderFunction render;
+	void* context;
+	RenderPipelineStats stats;
+	LARGE_INTEGER frequency;
+	LONGLONG simulateStart;
+
+	RenderPipeline(const RenderPipeline&);
+	RenderPipeline& operator=(const RenderPipeline&);
+
+	void renderMain();
+	double toMilliseconds(LONGLONG ticks);
+
+public:
+	RenderPipeline();
+	~RenderPipeline();
+	void start(RenderFunction, void* context);
+	void stop();
+	FrameSnapshot* beginFrame();
+	void submit();
+	void waitIdle();
+	void takeStats(RenderPipelineStats*);
+};
+
+#endif // !RENDERPIPELINE_H
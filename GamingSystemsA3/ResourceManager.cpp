@@ -0,0 +1,160 @@
+#include "Headers.h"
+#include <algorithm>
+
+/*
+Adds a resource's size to the matching pool total of a ResidencyStats.
+
+@param stats - The stats to add to
+@param pool - The pool the resource was created in
+@param bytes - The size of the resource
+*/
+void AddResidency(ResidencyStats* stats, D3DPOOL pool, DWORD bytes) {
+	switch (pool) {
+		case D3DPOOL_MANAGED:
+			stats->managedBytes += bytes;
+			break;
+		case D3DPOOL_DEFAULT:
+			stats->defaultBytes += bytes;
+			break;
+		default:
+			stats->systemBytes += bytes;
+			break;
+	}
+}
+
+ResourceManager::ResourceManager() :pDevice(0) {}
+
+void ResourceManager::setDevice(LPDIRECT3DDEVICE9* newDevice) {
+	pDevice = newDevice;
+}
+
+/*
+Picks the vertex processing flag for device creation. Hardware transform and
+lighting is used when the adapter supports it, so meshes in the managed pool are
+transformed by the GPU instead of being re-read and transformed on the CPU.
+
+@param pD3D - The directX COM object used to query the adapter
+@param deviceType - The type of device that will be created
+
+@return - The D3DCREATE_ vertex processing flags to create the device with
+*/
+DWORD ResourceManager::chooseVertexProcessing(LPDIRECT3D9 pD3D, D3DDEVTYPE deviceType) {
+	D3DCAPS9 caps;
+
+	if (FAILED(pD3D->GetDeviceCaps(D3DADAPTER_DEFAULT, deviceType, &caps)))
+		return D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+
+	if (caps.DevCaps & D3DDEVCAPS_HWTRANSFORMANDLIGHT)
+		return D3DCREATE_HARDWARE_VERTEXPROCESSING;
+
+	return D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+}
+
+/*
+The options meshes are loaded with. Managed meshes keep a system memory copy that
+the runtime uses to restore the video memory copy after a reset, so they do not
+need to be reloaded when the device is lost.
+
+@return - The D3DXMESH_ flags to load meshes with
+*/
+DWORD ResourceManager::meshOptions() {
+	return D3DXMESH_MANAGED;
+}
+
+/*
+Tracks an Object's resources until unregisterObject. The Object is held in
+place, see Object::addHolder.
+
+@param obj - The Object
+*/
+void ResourceManager::registerObject(Object* obj) {
+	if (std::find(objects.begin(), objects.end(), obj) == objects.end()) {
+		objects.push_back(obj);
+		obj->addHolder();
+	}
+}
+
+void ResourceManager::unregisterObject(Object* obj) {
+	std::vector<Object*>::iterator found = std::find(objects.begin(), objects.end(), obj);
+
+	if (found != objects.end()) {
+		objects.erase(found);
+		obj->removeHolder();
+	}
+}
+
+/*
+Releases the default pool resources of every registered Object. Must be called
+before the device is reset.
+*/
+void ResourceManager::onLostDevice() {
+	for (DWORD i = 0; i < objects.size(); i++)
+		objects[i]->onLostDevice();
+}
+
+/*
+Recreates the default pool resources of every registered Object after the
+device has been reset.
+*/
+void ResourceManager::onResetDevice() {
+	for (DWORD i = 0; i < objects.size(); i++)
+		objects[i]->onResetDevice();
+}
+
+/*
+Sums the residency of every registered Object.
+
+@param totals - Receives the summed stats
+*/
+void ResourceManager::getTotals(ResidencyStats* totals) {
+	ResidencyStats stats;
+
+	ZeroMemory(totals, sizeof(ResidencyStats));
+	for (DWORD i = 0; i < objects.size(); i++) {
+		objects[i]->getResidency(&stats);
+		totals->vertexBytes += stats.vertexBytes;
+		totals->indexBytes += stats.indexBytes;
+		totals->textureBytes += stats.textureBytes;
+		totals->managedBytes += stats.managedBytes;
+		totals->defaultBytes += stats.defaultBytes;
+		totals->systemBytes += stats.systemBytes;
+	}
+}
+
+/*
+Writes the memory held by each registered Object and the total to the debug output.
+*/
+void ResourceManager::reportResidency() {
+	ResidencyStats stats;
+
+	for (DWORD i = 0; i < objects.size(); i++) {
+		objects[i]->getResidency(&stats);
+		LogMessage(TEXT("%s: VB %u, IB %u, textures %u bytes (managed %u, default %u, sysmem %u)"),
+			objects[i]->getFile(), stats.vertexBytes, stats.indexBytes, stats.textureBytes,
+			stats.managedBytes, stats.defaultBytes, stats.systemBytes);
+	}
+
+	getTotals(&stats);
+	LogMessage(TEXT("Total resident: %u bytes (managed %u, default %u, sysmem %u), available texture memory %u"),
+		stats.vertexBytes + stats.indexBytes + stats.textureBytes, stats.managedBytes, stats.defaultBytes,
+		stats.systemBytes, pDevice && *pDevice ? (*pDevice)->GetAvailableTextureMem() : 0);
+}
+
+/*
+Computes the size in bytes of all mip levels of a texture.
+
+@param pTexture - The texture to measure
+
+@return - The size of the texture in bytes
+*/
+DWORD TextureBytes(LPDIRECT3DTEXTURE9 pTexture) {
+	D3DSURFACE_DESC desc;
+	DWORD bytes = 0;
+
+	for (DWORD level = 0; level < pTexture->GetLevelCount(); level++) {
+		pTexture->GetLevelDesc(level, &desc);
+		bytes += LevelBytes(desc.Format, desc.Width, desc.Height);
+	}
+
+	return bytes;
+}
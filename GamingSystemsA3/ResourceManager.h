@@ -0,0 +1,47 @@
+#ifndef RESOURCEMANAGER_H
+#define RESOURCEMANAGER_H
+
+#include "Headers.h"
+#include <vector>
+
+class Object;
+
+//Bytes of GPU resources held by an Object, split by the pool they live in.
+struct ResidencyStats
+{
+	DWORD vertexBytes;
+	DWORD indexBytes;
+	DWORD textureBytes;
+	DWORD managedBytes; // Mirrored in system memory, restored by the runtime after a reset
+	DWORD defaultBytes; // Video memory only, must be recreated after a reset
+	DWORD systemBytes;  // System memory only, read by the CPU on every draw
+};
+
+/*
+The ResourceManager keeps track of every Object that owns device resources. It
+picks how the device processes vertices, releases and recreates default pool
+resources around a device reset, and reports how much memory each Object keeps
+resident.
+*/
+class ResourceManager {
+private:
+	LPDIRECT3DDEVICE9* pDevice;
+	std::vector<Object*> objects;
+
+public:
+	ResourceManager();
+	void setDevice(LPDIRECT3DDEVICE9*);
+	static DWORD chooseVertexProcessing(LPDIRECT3D9, D3DDEVTYPE);
+	static DWORD meshOptions();
+	void registerObject(Object*);
+	void unregisterObject(Object*);
+	void onLostDevice();
+	void onResetDevice();
+	void getTotals(ResidencyStats*);
+	void reportResidency();
+};
+
+void AddResidency(ResidencyStats* stats, D3DPOOL pool, DWORD bytes);
+DWORD TextureBytes(LPDIRECT3DTEXTURE9 pTexture);
+
+#endif // !RESOURCEMANAGER_H
@@ -0,0 +1,634 @@
+#include "SpatialGrid.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+//Largest cell coordinate on each axis; keys hold 21 bits of each.
+static const int MAX_CELL = (1 << 20) - 1;
+
+SpatialGrid::SpatialGrid() :cellSize(SPATIAL_DEFAULT_CELL_SIZE), invCellSize(1.0f / SPATIAL_DEFAULT_CELL_SIZE), maxRadius(0.0f), empty(true), stamp(0), count(0) {
+}
+
+/*
+Constructor for a SpatialGrid.
+
+@param size - The width of each cell; about the size of the objects indexed works best
+*/
+SpatialGrid::SpatialGrid(float size) :cellSize(size), invCellSize(1.0f / size), maxRadius(0.0f), empty(true), stamp(0), count(0) {
+}
+
+/*
+Removes every entry and frees the cells.
+*/
+void SpatialGrid::clear() {
+	entries.clear();
+	cells.clear();
+	maxRadius = 0.0f;
+	empty = true;
+	count = 0;
+}
+
+unsigned long long SpatialGrid::CellKey(int x, int y, int z) {
+	return ((unsigned long long)(x & 0x1FFFFF) << 42) | ((unsigned long long)(y & 0x1FFFFF) << 21) | (unsigned long long)(z & 0x1FFFFF);
+}
+
+/*
+Finds the cells the bounding box of a sphere touches.
+
+@param center - The center of the sphere
+@param radius - The radius of the sphere
+@param lo - Receives the lowest cell on each axis
+@param hi - Receives the highest cell on each axis
+*/
+void SpatialGrid::cellRange(const D3DXVECTOR3& center, float radius, int* lo, int* hi) {
+	const float* c = center;
+
+	for (int a = 0; a < 3; a++) {
+		lo[a] = std::max(-MAX_CELL, std::min(MAX_CELL, (int)floorf((c[a] - radius) * invCellSize)));
+		hi[a] = std::max(-MAX_CELL, std::min(MAX_CELL, (int)floorf((c[a] + radius) * invCellSize)));
+	}
+}
+
+/*
+Lists an entry in every cell of its range. Cells are created as needed and
+never freed, so an object moving back and forth does not touch the heap once
+it has visited its cells.
+
+@param id - The entry
+*/
+void SpatialGrid::link(DWORD id) {
+	Entry& entry = entries[id];
+
+	for (int x = entry.lo[0]; x <= entry.hi[0]; x++) {
+		for (int y = entry.lo[1]; y <= entry.hi[1]; y++) {
+			for (int z = entry.lo[2]; z <= entry.hi[2]; z++)
+				cells[CellKey(x, y, z)].push_back(id);
+		}
+	}
+
+	for (int a = 0; a < 3; a++) {
+		boundsLo[a] = empty ? entry.lo[a] : std::min(boundsLo[a], entry.lo[a]);
+		boundsHi[a] = empty ? entry.hi[a] : std::max(boundsHi[a], entry.hi[a]);
+	}
+	maxRadius = std::max(maxRadius, entry.radius);
+	empty = false;
+}
+
+/*
+Takes an entry out of every cell of its range.
+
+@param id - The entry
+*/
+void SpatialGrid::unlink(DWORD id) {
+	Entry& entry = entries[id];
+
+	for (int x = entry.lo[0]; x <= entry.hi[0]; x++) {
+		for (int y = entry.lo[1]; y <= entry.hi[1]; y++) {
+			for (int z = entry.lo[2]; z <= entry.hi[2]; z++) {
+				std::vector<DWORD>& cell = cells[CellKey(x, y, z)];
+
+				for (size_t i = 0; i < cell.size(); i++) {
+					if (cell[i] == id) {
+						cell[i] = cell.back();
+						cell.pop_back();
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+@return - The ids listed in a cell, or null if nothing has ever been in it
+*/
+const std::vector<DWORD>* SpatialGrid::findCell(int x, int y, int z) {
+	std::unordered_map<unsigned long long, std::vector<DWORD> >::const_iterator found = cells.find(CellKey(x, y, z));
+
+	return found == cells.end() ? NULL : &found->second;
+}
+
+/*
+Starts a query. Entries listed in several cells are only tested once per query,
+by marking them with the query's stamp.
+
+@return - The stamp of the new query
+*/
+DWORD SpatialGrid::nextStamp() {
+	if (++stamp == 0) {
+		for (size_t i = 0; i < entries.size(); i++)
+			entries[i].stamp = 0;
+		stamp = 1;
+	}
+	return stamp;
+}
+
+/*
+Adds an entry. Ids need not be added in order, but the grid keeps a slot for
+every id up to the largest, so they should be small.
+
+@param id - The id of the object
+@param center - The center of its bounding sphere
+@param radius - The radius of its bounding sphere
+*/
+void SpatialGrid::insert(DWORD id, const D3DXVECTOR3& center, float radius) {
+	if (id >= entries.size()) {
+		// Value initialized, so every field of the unused entries is zero
+		entries.resize(id + 1, Entry());
+	}
+
+	if (entries[id].used) {
+		update(id, center, radius);
+		return;
+	}
+
+	Entry& entry = entries[id];
+	entry.center = center;
+	entry.radius = radius;
+	entry.used = true;
+	cellRange(center, radius, entry.lo, entry.hi);
+	link(id);
+	count++;
+}
+
+/*
+Moves an entry. If its bounding box still touches the same cells only the
+sphere is written; otherwise it is taken out of its old cells and listed in the
+new ones.
+
+@param id - The id of the object, added if it is not in the grid
+@param center - The new center of its bounding sphere
+@param radius - The new radius of its bounding sphere
+*/
+void SpatialGrid::update(DWORD id, const D3DXVECTOR3& center, float radius) {
+	int lo[3], hi[3];
+
+	if (!contains(id)) {
+		insert(id, center, radius);
+		return;
+	}
+
+	Entry& entry = entries[id];
+	cellRange(center, radius, lo, hi);
+	entry.center = center;
+	entry.radius = radius;
+
+	if (lo[0] == entry.lo[0] && lo[1] == entry.lo[1] && lo[2] == entry.lo[2] &&
+		hi[0] == entry.hi[0] && hi[1] == entry.hi[1] && hi[2] == entry.hi[2])
+		return;
+
+	unlink(id);
+	for (int a = 0; a < 3; a++) {
+		entry.lo[a] = lo[a];
+		entry.hi[a] = hi[a];
+	}
+	link(id);
+}
+
+void SpatialGrid::remove(DWORD id) {
+	if (!contains(id))
+		return;
+
+	unlink(id);
+	entries[id].used = false;
+	count--;
+}
+
+bool SpatialGrid::contains(DWORD id) {
+	return id < entries.size() && entries[id].used;
+}
+
+DWORD SpatialGrid::getCount() {
+	return count;
+}
+
+DWORD SpatialGrid::getNumCells() {
+	return cells.size();
+}
+
+/*
+Tests one block of cells against a frustum, splitting it in two along its
+longest side until it is small enough to test entry by entry. Blocks outside
+the frustum are skipped whole, and blocks inside it are not tested again.
+
+The block is grown by the widest sphere before it is tested, so it holds every
+sphere listed in it; a sphere SphereInFrustum accepts is then never in a block
+that is skipped, and the query finds exactly what testing every sphere would.
+
+@param frustum - The frustum
+@param lo - The lowest cell of the block on each axis
+@param hi - The highest cell of the block on each axis
+@param inside - Whether the block is known to be inside the frustum
+@param results - Receives the ids of the entries whose spheres are in the frustum
+*/
+void SpatialGrid::queryFrustumBlock(const Frustum& frustum, const int* lo, const int* hi, bool inside, std::vector<DWORD>* results) {
+	int longest = 0;
+
+	if (!inside) {
+		float reach = 2.0f * maxRadius;
+		D3DXVECTOR3 boxMin(lo[0] * cellSize - reach, lo[1] * cellSize - reach, lo[2] * cellSize - reach);
+		D3DXVECTOR3 boxMax((hi[0] + 1) * cellSize + reach, (hi[1] + 1) * cellSize + reach, (hi[2] + 1) * cellSize + reach);
+		FrustumOverlap overlap = BoxInFrustum(frustum, boxMin, boxMax);
+
+		if (overlap == FRUSTUM_OUTSIDE)
+			return;
+		inside = overlap == FRUSTUM_INSIDE;
+	}
+
+	for (int a = 1; a < 3; a++) {
+		if (hi[a] - lo[a] > hi[longest] - lo[longest])
+			longest = a;
+	}
+
+	if (hi[longest] - lo[longest] < SPATIAL_FRUSTUM_LEAF_CELLS) {
+		for (int x = lo[0]; x <= hi[0]; x++) {
+			for (int y = lo[1]; y <= hi[1]; y++) {
+				for (int z = lo[2]; z <= hi[2]; z++) {
+					const std::vector<DWORD>* cell = findCell(x, y, z);
+
+					for (size_t i = 0; cell && i < cell->size(); i++) {
+						Entry& entry = entries[(*cell)[i]];
+
+						if (entry.stamp == stamp)
+							continue;
+						entry.stamp = stamp;
+						if (SphereInFrustum(frustum, entry.center, entry.radius))
+							results->push_back((*cell)[i]);
+					}
+				}
+			}
+		}
+		return;
+	}
+
+	int mid = lo[longest] + (hi[longest] - lo[longest]) / 2;
+	int lowerHi[3] = { hi[0], hi[1], hi[2] };
+	int upperLo[3] = { lo[0], lo[1], lo[2] };
+
+	lowerHi[longest] = mid;
+	upperLo[longest] = mid + 1;
+	queryFrustumBlock(frustum, lo, lowerHi, inside, results);
+	queryFrustumBlock(frustum, upperLo, hi, inside, results);
+}
+
+/*
+Finds the entries whose bounding spheres are at least partly inside a frustum.
+
+@param frustum - The frustum
+@param results - Receives the ids, in no particular order
+*/
+void SpatialGrid::queryFrustum(const Frustum& frustum, std::vector<DWORD>* results) {
+	results->clear();
+	if (count == 0)
+		return;
+
+	nextStamp();
+	queryFrustumBlock(frustum, boundsLo, boundsHi, false, results);
+}
+
+/*
+Finds the entries whose bounding spheres overlap a sphere.
+
+@param center - The center of the sphere
+@param radius - The radius of the sphere
+@param results - Receives the ids, in no particular order
+*/
+void SpatialGrid::querySphere(const D3DXVECTOR3& center, float radius, std::vector<DWORD>* results) {
+	int lo[3], hi[3];
+
+	results->clear();
+	if (count == 0)
+		return;
+
+	nextStamp();
+	cellRange(center, radius, lo, hi);
+	for (int a = 0; a < 3; a++) {
+		lo[a] = std::max(lo[a], boundsLo[a]);
+		hi[a] = std::min(hi[a], boundsHi[a]);
+	}
+
+	for (int x = lo[0]; x <= hi[0]; x++) {
+		for (int y = lo[1]; y <= hi[1]; y++) {
+			for (int z = lo[2]; z <= hi[2]; z++) {
+				const std::vector<DWORD>* cell = findCell(x, y, z);
+
+				for (size_t i = 0; cell && i < cell->size(); i++) {
+					Entry& entry = entries[(*cell)[i]];
+					D3DXVECTOR3 offset = entry.center - center;
+					float reach = entry.radius + radius;
+
+					if (entry.stamp == stamp)
+						continue;
+					entry.stamp = stamp;
+					if (D3DXVec3LengthSq(&offset) <= reach * reach)
+						results->push_back((*cell)[i]);
+				}
+			}
+		}
+	}
+}
+
+/*
+Finds the entries whose bounding spheres overlap an axis-aligned box.
+
+@param boxMin - The corner of the box with the smallest coordinates
+@param boxMax - The corner of the box with the largest coordinates
+@param results - Receives the ids, in no particular order
+*/
+void SpatialGrid::queryBox(const D3DXVECTOR3& boxMin, const D3DXVECTOR3& boxMax, std::vector<DWORD>* results) {
+	const float* bMin = boxMin;
+	const float* bMax = boxMax;
+	int lo[3], hi[3];
+
+	results->clear();
+	if (count == 0)
+		return;
+
+	nextStamp();
+	for (int a = 0; a < 3; a++) {
+		lo[a] = std::max(boundsLo[a], (int)floorf(std::max(bMin[a] * invCellSize, (float)-MAX_CELL)));
+		hi[a] = std::min(boundsHi[a], (int)floorf(std::min(bMax[a] * invCellSize, (float)MAX_CELL)));
+	}
+
+	for (int x = lo[0]; x <= hi[0]; x++) {
+		for (int y = lo[1]; y <= hi[1]; y++) {
+			for (int z = lo[2]; z <= hi[2]; z++) {
+				const std::vector<DWORD>* cell = findCell(x, y, z);
+
+				for (size_t i = 0; cell && i < cell->size(); i++) {
+					Entry& entry = entries[(*cell)[i]];
+					const float* c = entry.center;
+					float distanceSq = 0.0f;
+
+					if (entry.stamp == stamp)
+						continue;
+					entry.stamp = stamp;
+
+					// Distance from the sphere's center to the nearest point of the box
+					for (int a = 0; a < 3; a++) {
+						float d = c[a] < bMin[a] ? bMin[a] - c[a] : (c[a] > bMax[a] ? c[a] - bMax[a] : 0.0f);
+						distanceSq += d * d;
+					}
+					if (distanceSq <= entry.radius * entry.radius)
+						results->push_back((*cell)[i]);
+				}
+			}
+		}
+	}
+}
+
+/*
+Finds the nearest entry a ray hits by walking the cells the ray passes through
+in order, stopping once a hit is nearer than the next cell.
+
+@param ray - The ray, with a normalized direction
+@param maxDistance - How far along the ray to look
+@param id - Receives the id of the nearest entry hit
+@param distance - Receives how far along the ray it was hit, 0 if the ray starts inside it
+
+@return - Whether anything was hit
+*/
+bool SpatialGrid::raycast(const Ray& ray, float maxDistance, DWORD* id, float* distance) {
+	const float* origin = ray._origin;
+	const float* direction = ray._direction;
+	float tEnter = 0.0f, tExit = maxDistance;
+	float best = maxDistance;
+	int cell[3], step[3], last[3];
+	float tMax[3], tDelta[3];
+	bool hit = false;
+
+	if (count == 0)
+		return false;
+
+	// Clip the ray to the cells that have held entries
+	for (int a = 0; a < 3; a++) {
+		float boxMin = boundsLo[a] * cellSize;
+		float boxMax = (boundsHi[a] + 1) * cellSize;
+
+		if (direction[a] == 0.0f) {
+			if (origin[a] < boxMin || origin[a] > boxMax)
+				return false;
+			continue;
+		}
+
+		float t0 = (boxMin - origin[a]) / direction[a];
+		float t1 = (boxMax - origin[a]) / direction[a];
+		tEnter = std::max(tEnter, std::min(t0, t1));
+		tExit = std::min(tExit, std::max(t0, t1));
+	}
+	if (tEnter > tExit)
+		return false;
+
+	nextStamp();
+	for (int a = 0; a < 3; a++) {
+		float start = origin[a] + direction[a] * tEnter;
+
+		cell[a] = std::max(boundsLo[a], std::min(boundsHi[a], (int)floorf(start * invCellSize)));
+		if (direction[a] > 0.0f) {
+			step[a] = 1;
+			last[a] = boundsHi[a] + 1;
+			tMax[a] = ((cell[a] + 1) * cellSize - origin[a]) / direction[a];
+			tDelta[a] = cellSize / direction[a];
+		}
+		else if (direction[a] < 0.0f) {
+			step[a] = -1;
+			last[a] = boundsLo[a] - 1;
+			tMax[a] = (cell[a] * cellSize - origin[a]) / direction[a];
+			tDelta[a] = -cellSize / direction[a];
+		}
+		else {
+			step[a] = 0;
+			last[a] = 0;
+			tMax[a] = tDelta[a] = FLT_MAX;
+		}
+	}
+
+	for (;;) {
+		const std::vector<DWORD>* entriesHere = findCell(cell[0], cell[1], cell[2]);
+
+		for (size_t i = 0; entriesHere && i < entriesHere->size(); i++) {
+			Entry& entry = entries[(*entriesHere)[i]];
+			D3DXVECTOR3 offset = ray._origin - entry.center;
+			float b = D3DXVec3Dot(&ray._direction, &offset);
+			float c = D3DXVec3Dot(&offset, &offset) - entry.radius * entry.radius;
+			float discriminant = b * b - c;
+
+			if (entry.stamp == stamp)
+				continue;
+			entry.stamp = stamp;
+
+			// Behind the origin and outside the sphere, or missing it altogether
+			if ((c > 0.0f && b > 0.0f) || discriminant < 0.0f)
+				continue;
+
+			float t = std::max(0.0f, -b - sqrtf(discriminant));
+			if (t <= best) {
+				best = t;
+				*id = (*entriesHere)[i];
+				hit = true;
+			}
+		}
+
+		// A hit before the ray leaves this cell can not be beaten by a later cell
+		int axis = tMax[0] < tMax[1] ? (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+		if ((hit && best <= tMax[axis]) || tMax[axis] > tExit)
+			break;
+
+		cell[axis] += step[axis];
+		if (cell[axis] == last[axis])
+			break;
+		tMax[axis] += tDelta[axis];
+	}
+
+	if (hit)
+		*distance = best;
+	return hit;
+}
+
+/*
+@return - Milliseconds since a time on the steady clock
+*/
+static double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+Times the spatial grid on a scene of randomly placed spheres, four to a cell on
+average, against testing every sphere in turn. The scene and the queries come
+from a fixed seed, so every run times the same work. Each query is made both
+ways and the results compared; result->matched tells whether they agreed.
+
+@param objects - The number of spheres
+@param result - Receives the times
+*/
+void BenchmarkSpatialGrid(DWORD objects, SpatialBenchmarkResult* result) {
+	std::mt19937 random(12345);
+	float side = SPATIAL_DEFAULT_CELL_SIZE * powf(objects / 4.0f, 1.0f / 3.0f);
+	std::uniform_real_distribution<float> position(-side * 0.5f, side * 0.5f);
+	std::uniform_real_distribution<float> size(0.5f, 2.0f);
+	std::uniform_real_distribution<float> nudge(-0.5f, 0.5f);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<D3DXVECTOR3> centers(objects);
+	std::vector<float> radii(objects);
+	std::vector<DWORD> found;
+	SpatialGrid grid;
+	std::chrono::steady_clock::time_point start;
+	D3DXMATRIX proj;
+	DWORD gridCount = 0, linearCount = 0;
+
+	memset(result, 0, sizeof(SpatialBenchmarkResult));
+	result->objects = objects;
+	result->matched = true;
+
+	for (DWORD i = 0; i < objects; i++) {
+		centers[i] = D3DXVECTOR3(position(random), position(random), position(random));
+		radii[i] = size(random);
+	}
+
+	start = std::chrono::steady_clock::now();
+	for (DWORD i = 0; i < objects; i++)
+		grid.insert(i, centers[i], radii[i]);
+	result->build = MillisecondsSince(start);
+
+	for (DWORD i = 0; i < objects; i += 10)
+		centers[i] += D3DXVECTOR3(nudge(random), nudge(random), nudge(random));
+	start = std::chrono::steady_clock::now();
+	for (DWORD i = 0; i < objects; i += 10)
+		grid.update(i, centers[i], radii[i]);
+	result->update = MillisecondsSince(start);
+	result->cells = grid.getNumCells();
+
+	// Frustums look out from random points in random directions
+	D3DXMatrixPerspectiveFovLH(&proj, D3DX_PI / 4, 1.0f, 1.0f, 100.0f);
+	std::vector<Frustum> frustums(SPATIAL_BENCHMARK_QUERIES);
+	std::vector<Ray> rays(SPATIAL_BENCHMARK_QUERIES);
+	for (DWORD q = 0; q < SPATIAL_BENCHMARK_QUERIES; q++) {
+		D3DXVECTOR3 eye(position(random), position(random), position(random));
+		D3DXVECTOR3 look(unit(random), unit(random), unit(random)), up(0.0f, 1.0f, 0.0f);
+		D3DXMATRIX view;
+
+		if (D3DXVec3LengthSq(&look) < 0.01f)
+			look = D3DXVECTOR3(0.0f, 0.0f, 1.0f);
+		D3DXVec3Normalize(&look, &look);
+		D3DXVECTOR3 target = eye + look;
+		if (fabsf(look.y) > 0.99f)
+			up = D3DXVECTOR3(1.0f, 0.0f, 0.0f);
+		D3DXMatrixLookAtLH(&view, &eye, &target, &up);
+		BuildFrustum(view * proj, &frustums[q]);
+
+		rays[q]._origin = eye;
+		rays[q]._direction = look;
+	}
+
+	start = std::chrono::steady_clock::now();
+	for (DWORD q = 0; q < SPATIAL_BENCHMARK_QUERIES; q++) {
+		grid.queryFrustum(frustums[q], &found);
+		gridCount += found.size();
+	}
+	result->frustumGrid = MillisecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	for (DWORD q = 0; q < SPATIAL_BENCHMARK_QUERIES; q++) {
+		for (DWORD i = 0; i < objects; i++) {
+			if (SphereInFrustum(frustums[q], centers[i], radii[i]))
+				linearCount++;
+		}
+	}
+	result->frustumLinear = MillisecondsSince(start);
+	result->matched = result->matched && gridCount == linearCount;
+
+	std::vector<float> gridDistances(SPATIAL_BENCHMARK_QUERIES, -1.0f), linearDistances(SPATIAL_BENCHMARK_QUERIES, -1.0f);
+	start = std::chrono::steady_clock::now();
+	for (DWORD q = 0; q < SPATIAL_BENCHMARK_QUERIES; q++) {
+		DWORD id;
+		float distance;
+
+		if (grid.raycast(rays[q], FLT_MAX, &id, &distance))
+			gridDistances[q] = distance;
+	}
+	result->rayGrid = MillisecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	for (DWORD q = 0; q < SPATIAL_BENCHMARK_QUERIES; q++) {
+		for (DWORD i = 0; i < objects; i++) {
+			D3DXVECTOR3 offset = rays[q]._origin - centers[i];
+			float b = D3DXVec3Dot(&rays[q]._direction, &offset);
+			float c = D3DXVec3Dot(&offset, &offset) - radii[i] * radii[i];
+			float discriminant = b * b - c;
+
+			if ((c > 0.0f && b > 0.0f) || discriminant < 0.0f)
+				continue;
+
+			float t = std::max(0.0f, -b - sqrtf(discriminant));
+			if (linearDistances[q] < 0.0f || t < linearDistances[q])
+				linearDistances[q] = t;
+		}
+	}
+	result->rayLinear = MillisecondsSince(start);
+	for (DWORD q = 0; q < SPATIAL_BENCHMARK_QUERIES; q++)
+		result->matched = result->matched && fabsf(gridDistances[q] - linearDistances[q]) < 0.001f;
+
+	gridCount = linearCount = 0;
+	start = std::chrono::steady_clock::now();
+	for (DWORD q = 0; q < SPATIAL_BENCHMARK_QUERIES; q++) {
+		grid.querySphere(rays[q]._origin, 10.0f, &found);
+		gridCount += found.size();
+	}
+	result->sphereGrid = MillisecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	for (DWORD q = 0; q < SPATIAL_BENCHMARK_QUERIES; q++) {
+		for (DWORD i = 0; i < objects; i++) {
+			D3DXVECTOR3 offset = centers[i] - rays[q]._origin;
+			float reach = radii[i] + 10.0f;
+
+			if (D3DXVec3LengthSq(&offset) <= reach * reach)
+				linearCount++;
+		}
+	}
+	result->sphereLinear = MillisecondsSince(start);
+	result->matched = result->matched && gridCount == linearCount;
+}
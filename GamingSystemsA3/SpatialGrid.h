@@ -0,0 +1,94 @@
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+#include "CoreMath.h"
+#include "Frustum.h"
+#include <unordered_map>
+#include <vector>
+
+//Width of a grid cell when none is given; about the size of a model, so most sit in one to eight cells.
+#define SPATIAL_DEFAULT_CELL_SIZE 8.0f
+//Cells along each side of the smallest block of the grid a frustum query tests entry by entry.
+#define SPATIAL_FRUSTUM_LEAF_CELLS 4
+//Objects in the smaller and larger scenes timed by the spatial grid benchmark.
+#define SPATIAL_BENCHMARK_SMALL 100000
+#define SPATIAL_BENCHMARK_LARGE 1000000
+//Queries of each kind the spatial grid benchmark times.
+#define SPATIAL_BENCHMARK_QUERIES 1000
+
+/*
+A SpatialGrid indexes bounding spheres in a uniform grid of cubic cells so that
+frustum, ray, sphere and box queries only look at objects near the query
+instead of every object in the scene. The grid is hashed, so it has no bounds
+and only occupied cells take memory.
+
+Each object is listed in every cell its bounding box touches. Moving an object
+only touches the grid if its box moved into different cells, so objects that
+move a little each frame cost little more than writing their new sphere.
+Objects are identified by small integer ids chosen by the caller, such as an
+index into the scene's model array.
+
+Queries mark the entries they have seen, so a SpatialGrid must only be used by
+one thread at a time.
+*/
+class SpatialGrid {
+private:
+	struct Entry
+	{
+		D3DXVECTOR3 center;
+		float radius;
+		int lo[3], hi[3]; // Range of cells the entry is listed in
+		DWORD stamp; // The last query that looked at the entry
+		bool used;
+	};
+
+	float cellSize;
+	float invCellSize;
+	std::vector<Entry> entries; // Indexed by id
+	std::unordered_map<unsigned long long, std::vector<DWORD> > cells;
+	int boundsLo[3], boundsHi[3]; // Range of cells that have held an entry
+	float maxRadius; // Largest radius an entry has had; a sphere reaches at most its diameter past a cell it is listed in
+	bool empty; // Whether no entry has been inserted yet
+	DWORD stamp; // Bumped by every query
+	DWORD count; // Entries in use
+
+	static unsigned long long CellKey(int x, int y, int z);
+	void cellRange(const D3DXVECTOR3& center, float radius, int* lo, int* hi);
+	void link(DWORD id);
+	void unlink(DWORD id);
+	const std::vector<DWORD>* findCell(int x, int y, int z);
+	DWORD nextStamp();
+	void queryFrustumBlock(const Frustum&, const int* lo, const int* hi, bool inside, std::vector<DWORD>* results);
+
+public:
+	SpatialGrid();
+	SpatialGrid(float cellSize);
+	void clear();
+	void insert(DWORD id, const D3DXVECTOR3& center, float radius);
+	void update(DWORD id, const D3DXVECTOR3& center, float radius);
+	void remove(DWORD id);
+	bool contains(DWORD id);
+	DWORD getCount();
+	DWORD getNumCells();
+	void queryFrustum(const Frustum&, std::vector<DWORD>* results);
+	void querySphere(const D3DXVECTOR3& center, float radius, std::vector<DWORD>* results);
+	void queryBox(const D3DXVECTOR3& boxMin, const D3DXVECTOR3& boxMax, std::vector<DWORD>* results);
+	bool raycast(const Ray& ray, float maxDistance, DWORD* id, float* distance);
+};
+
+//Times of the spatial grid benchmark on one scene, in milliseconds.
+struct SpatialBenchmarkResult
+{
+	DWORD objects;
+	DWORD cells;
+	double build; // Inserting every object
+	double update; // Moving a tenth of the objects a little
+	double frustumGrid, frustumLinear; // SPATIAL_BENCHMARK_QUERIES frustum queries through the grid and by testing every object
+	double rayGrid, rayLinear;
+	double sphereGrid, sphereLinear;
+	bool matched; // Whether the grid found the same objects as the linear tests
+};
+
+void BenchmarkSpatialGrid(DWORD objects, SpatialBenchmarkResult* result);
+
+#endif // !SPATIALGRID_H
@@ -0,0 +1,572 @@
+#include "Headers.h"
+#include "StreamingManager.h"
+#include <algorithm>
+
+StreamingManager::StreamingManager() :quitting(false), budget(STREAMING_DEFAULT_BUDGET), frame(0) {
+	ZeroMemory(&stats, sizeof(StreamingStats));
+}
+
+StreamingManager::~StreamingManager() {
+	shutdown();
+}
+
+/*
+Starts the threads that read texture files. Every texture should be added
+before, as the list of textures must not grow while they run.
+*/
+void StreamingManager::start() {
+	if (!ioThreads.empty())
+		return;
+
+	quitting = false;
+	for (DWORD t = 0; t < STREAMING_IO_THREADS; t++)
+		ioThreads.push_back(std::thread(&StreamingManager::ioMain, this));
+}
+
+/*
+Stops the reading threads and releases every texture. Called on the thread that
+owns the device once the render thread has stopped.
+*/
+void StreamingManager::shutdown() {
+	{
+		std::lock_guard<std::mutex> hold(lock);
+		quitting = true;
+	}
+	ioWake.notify_all();
+	for (DWORD t = 0; t < ioThreads.size(); t++)
+		ioThreads[t].join();
+	ioThreads.clear();
+
+	ioQueue.clear();
+	textures.clear();
+}
+
+/*
+Sets how many bytes of streamed textures may be on the device at once.
+
+@param bytes - The budget
+*/
+void StreamingManager::setBudget(unsigned long long bytes) {
+	std::lock_guard<std::mutex> hold(lock);
+	budget = bytes;
+}
+
+/*
+Finds a file in the working directory, or failing that in its parent, the same
+way Object looks for its textures.
+
+@param name - The file name
+@param path - Receives the path the file was found at
+@param size - Receives the size of the file in bytes
+
+@return - Whether the file is in either folder
+*/
+bool StreamingManager::FindNearby(LPCWSTR name, std::wstring* path, DWORD* size) {
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+	*path = name;
+	if (!GetFileAttributesEx(path->c_str(), GetFileExInfoStandard, &attributes)) {
+		*path = std::wstring(TEXT("..\\")) + name;
+		if (!GetFileAttributesEx(path->c_str(), GetFileExInfoStandard, &attributes))
+			return false;
+	}
+
+	*size = attributes.nFileSizeLow;
+	return true;
+}
+
+/*
+Switches a texture whose compressed file failed back to its source file. Called
+with the lock held.
+
+@param texture - The texture
+
+@return - Whether the texture had a source file to switch to
+*/
+bool StreamingManager::FallBack(StreamedTexture& texture) {
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+	if (texture.fallback.empty())
+		return false;
+
+	LogMessage(TEXT("Streaming: %s failed, using %s"), texture.path.c_str(), texture.fallback.c_str());
+	texture.path.swap(texture.fallback);
+	texture.fallback.clear();
+	if (GetFileAttributesEx(texture.path.c_str(), GetFileExInfoStandard, &attributes))
+		texture.fileBytes = attributes.nFileSizeLow;
+	texture.state = STREAM_IDLE;
+	return true;
+}
+
+/*
+Adds a texture used by an Object. A texture used by several Objects is streamed
+once, as important as its largest user on screen. The texture is not loaded
+until update finds it wanted. Its compressed version in TEXTURE_CACHE_DIR is
+streamed instead when there is one.
+
+@param name - The file name of the texture
+@param user - The Object drawing with it; must not move while it is registered
+
+@return - The id to draw the texture with, STREAMING_NONE if the file does not exist
+*/
+DWORD StreamingManager::addTexture(LPCWSTR name, Object* user) {
+	std::wstring path, cooked;
+	DWORD size;
+	StreamedTexture texture;
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+	if (!FindNearby(name, &path, &size))
+		return STREAMING_NONE;
+
+	CookedTexturePath(name, &cooked);
+	if (GetFileAttributesEx(cooked.c_str(), GetFileExInfoStandard, &attributes)) {
+		texture.fallback = path;
+		path = cooked;
+		size = attributes.nFileSizeLow;
+	}
+
+	std::lock_guard<std::mutex> hold(lock);
+	for (DWORD i = 0; i < textures.size(); i++) {
+		if (textures[i].path == path) {
+			if (std::find(textures[i].users.begin(), textures[i].users.end(), user) == textures[i].users.end())
+				textures[i].users.push_back(user);
+			return i;
+		}
+	}
+
+	texture.path = path;
+	texture.users.push_back(user);
+	texture.state = STREAM_IDLE;
+	texture.fileBytes = size;
+	texture.width = texture.height = texture.levels = 0;
+	texture.priority = 0.0f;
+	texture.lastWanted = 0;
+	texture.wantedSkip = texture.loadSkip = texture.residentSkip = 0;
+	texture.pendingBytes = texture.bytes = 0;
+	texture.evict = texture.trim = texture.reread = false;
+	textures.push_back(texture);
+	return (DWORD)textures.size() - 1;
+}
+
+/*
+Picks up a texture file that changed on disk. A resident texture is read again
+at the detail it has, and keeps being drawn until the new one is created; one
+that is not resident loads the new file whenever it is next wanted. A file that
+could not be read before is tried again. A changed source of a compressed
+texture makes the compressed file stale, so the source is streamed from then on.
+Called from any thread.
+
+@param name - The file name, without its folder
+
+@return - The number of textures streamed from a file of that name
+*/
+DWORD StreamingManager::reload(LPCWSTR name) {
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	DWORD found = 0;
+
+	std::lock_guard<std::mutex> hold(lock);
+	for (DWORD i = 0; i < textures.size(); i++) {
+		StreamedTexture& texture = textures[i];
+		size_t slash = texture.path.find_last_of(TEXT("\\/"));
+		size_t sourceSlash = texture.fallback.find_last_of(TEXT("\\/"));
+
+		if (!texture.fallback.empty() && _wcsicmp(texture.fallback.c_str() + (sourceSlash == std::wstring::npos ? 0 : sourceSlash + 1), name) == 0) {
+			texture.path.swap(texture.fallback);
+			texture.fallback.clear();
+		}
+		else if (_wcsicmp(texture.path.c_str() + (slash == std::wstring::npos ? 0 : slash + 1), name) != 0)
+			continue;
+
+		found++;
+		if (GetFileAttributesEx(texture.path.c_str(), GetFileExInfoStandard, &attributes))
+			texture.fileBytes = attributes.nFileSizeLow;
+		if (texture.state == STREAM_MISSING)
+			texture.state = STREAM_IDLE;
+		// A read in flight may have caught the old file, so it is read again once it lands
+		texture.reread = texture.bytes > 0 || texture.state != STREAM_IDLE;
+	}
+	return found;
+}
+
+/*
+Stops an Object counting towards the importance of its textures. Textures left
+with no users are unloaded by the next update.
+
+@param user - The Object
+*/
+void StreamingManager::removeUser(Object* user) {
+	std::lock_guard<std::mutex> hold(lock);
+
+	for (DWORD i = 0; i < textures.size(); i++) {
+		std::vector<Object*>& users = textures[i].users;
+		users.erase(std::remove(users.begin(), users.end(), user), users.end());
+	}
+}
+
+/*
+Reads the files update asks for, one at a time, until shutdown. The file and its
+size are read outside the lock, so other threads carry on meanwhile.
+*/
+void StreamingManager::ioMain() {
+	for (;;) {
+		std::wstring path;
+		std::vector<char> data;
+		D3DXIMAGE_INFO info;
+		DWORD id;
+		bool read;
+
+		{
+			std::unique_lock<std::mutex> hold(lock);
+			ioWake.wait(hold, [this] { return quitting || !ioQueue.empty(); });
+			if (quitting)
+				return;
+			id = ioQueue.front();
+			ioQueue.pop_front();
+			path = textures[id].path;
+		}
+
+		read = ReadWholeFile(path.c_str(), &data) && !data.empty() &&
+			SUCCEEDED(D3DXGetImageInfoFromFileInMemory(&data[0], (UINT)data.size(), &info));
+
+		std::lock_guard<std::mutex> hold(lock);
+		StreamedTexture& texture = textures[id];
+		if (!read) {
+			texture.pendingBytes = 0;
+			if (FallBack(texture))
+				continue;
+			LogMessage(TEXT("Streaming: could not read %s"), path.c_str());
+			texture.state = STREAM_MISSING;
+			continue;
+		}
+
+		texture.fileBytes = (DWORD)data.size();
+		texture.data.swap(data);
+		texture.width = info.Width;
+		texture.height = info.Height;
+		texture.levels = info.MipLevels;
+		texture.state = STREAM_READ;
+	}
+}
+
+/*
+Estimates the device memory of a texture from the size of its file; each top
+mip level left out takes three quarters of what is left.
+
+@param texture - The texture
+@param skip - The number of top mip levels left out
+
+@return - The estimated size in bytes
+*/
+DWORD StreamingManager::EstimateBytes(const StreamedTexture& texture, DWORD skip) {
+	return max(1u, texture.fileBytes >> min(2 * skip, 30u));
+}
+
+/*
+@return - The bytes a texture will hold once the work asked of it is done
+*/
+DWORD StreamingManager::projectedBytes(const StreamedTexture& texture) {
+	if (texture.state == STREAM_READING || texture.state == STREAM_READ || texture.state == STREAM_CREATING)
+		return max(texture.pendingBytes, texture.bytes);
+	if (texture.evict)
+		return 0;
+	if (texture.trim)
+		return texture.bytes / 4;
+	return texture.bytes;
+}
+
+/*
+Makes room in the budget for a load by cutting down or unloading less important
+textures, least recently wanted first. A victim still in view loses its top mip
+level; one out of view is unloaded. Only textures less important than the load
+are touched, so two textures never take turns pushing each other out.
+
+@param priority - The priority of the load
+@param needed - The bytes to free
+@param committed - The bytes the budget is holding, reduced by what is freed
+
+@return - Whether enough was freed
+*/
+bool StreamingManager::makeRoom(float priority, unsigned long long needed, unsigned long long* committed) {
+	for (;;) {
+		DWORD victim = STREAMING_NONE;
+		DWORD saved;
+
+		for (DWORD i = 0; i < textures.size(); i++) {
+			const StreamedTexture& texture = textures[i];
+
+			if (texture.bytes == 0 || texture.evict || texture.trim || texture.state != STREAM_IDLE || texture.priority >= priority)
+				continue;
+			if (victim == STREAMING_NONE || texture.lastWanted < textures[victim].lastWanted ||
+				(texture.lastWanted == textures[victim].lastWanted && texture.priority < textures[victim].priority))
+				victim = i;
+		}
+		if (victim == STREAMING_NONE)
+			return false;
+
+		StreamedTexture& texture = textures[victim];
+		if (texture.priority > 0.0f && texture.residentSkip + 1 < texture.levels &&
+			(max(texture.width, texture.height) >> (texture.residentSkip + 1)) >= STREAMING_MIN_MIP_SIZE) {
+			texture.trim = true;
+			saved = texture.bytes - texture.bytes / 4;
+		}
+		else {
+			texture.evict = true;
+			saved = texture.bytes;
+		}
+
+		*committed -= min(*committed, (unsigned long long)saved);
+		if (saved >= needed)
+			return true;
+		needed -= saved;
+	}
+}
+
+/*
+Decides what to load and unload for the camera's new position. Each texture is
+ranked by the screen diameter of its largest user, which also picks how many top
+mip levels it can do without; then the wanted textures that are not resident at
+that detail are queued for reading, most important first, while the budget
+allows. Called on the game thread once a frame.
+
+@param eye - The position of the camera
+@param proj - The projection matrix
+@param viewportHeight - The height of the viewport in pixels
+*/
+void StreamingManager::update(const D3DXVECTOR3& eye, const D3DXMATRIX& proj, float viewportHeight) {
+	unsigned long long committed = 0;
+	bool queued = false;
+
+	std::lock_guard<std::mutex> hold(lock);
+	frame++;
+	candidates.clear();
+
+	for (DWORD i = 0; i < textures.size(); i++) {
+		StreamedTexture& texture = textures[i];
+
+		texture.priority = 0.0f;
+		for (DWORD u = 0; u < texture.users.size(); u++) {
+			D3DXVECTOR3 center, offset;
+			float radius, distance;
+
+			texture.users[u]->getBoundingSphere(&center, &radius);
+			offset = center - eye;
+			distance = D3DXVec3Length(&offset);
+			if (distance - radius > STREAMING_UNLOAD_DISTANCE)
+				continue;
+
+			// A camera inside the sphere sees it fill the screen
+			texture.priority = max(texture.priority, distance > radius ? min(viewportHeight, radius * proj._22 / distance * viewportHeight) : viewportHeight);
+		}
+
+		texture.wantedSkip = 0;
+		if (texture.priority > 0.0f) {
+			DWORD size = max(texture.width, texture.height);
+			float smallest = max(texture.priority, (float)STREAMING_MIN_MIP_SIZE);
+
+			texture.lastWanted = frame;
+			while (texture.wantedSkip + 1 < texture.levels && (size >> (texture.wantedSkip + 1)) >= smallest)
+				texture.wantedSkip++;
+		}
+		else if (texture.bytes > 0) {
+			texture.evict = true;
+		}
+
+		// A changed file is read at the detail already resident, which stays until the new texture replaces it
+		if (texture.reread && texture.state == STREAM_IDLE && !texture.evict && !texture.trim) {
+			texture.reread = false;
+			if (texture.bytes > 0) {
+				texture.state = STREAM_READING;
+				texture.loadSkip = texture.residentSkip;
+				texture.pendingBytes = EstimateBytes(texture, texture.residentSkip);
+				ioQueue.push_back(i);
+				stats.reloads++;
+				queued = true;
+			}
+		}
+
+		committed += projectedBytes(texture);
+		if (texture.priority > 0.0f && texture.state == STREAM_IDLE && !texture.evict && !texture.trim &&
+			(texture.bytes == 0 || texture.residentSkip > texture.wantedSkip))
+			candidates.push_back(i);
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [this](DWORD a, DWORD b) { return textures[a].priority > textures[b].priority; });
+
+	for (DWORD c = 0; c < candidates.size(); c++) {
+		StreamedTexture& texture = textures[candidates[c]];
+		DWORD needed = EstimateBytes(texture, texture.wantedSkip);
+		DWORD growth = needed > texture.bytes ? needed - texture.bytes : 0;
+
+		// Everything after this one is less important, so it waits too
+		if (committed + growth > budget && !makeRoom(texture.priority, committed + growth - budget, &committed))
+			break;
+
+		texture.state = STREAM_READING;
+		texture.loadSkip = texture.wantedSkip;
+		texture.pendingBytes = needed;
+		committed += growth;
+		ioQueue.push_back(candidates[c]);
+		stats.loads++;
+		queued = true;
+	}
+
+	if (queued)
+		ioWake.notify_all();
+}
+
+/*
+Does the device work update asked for: unloads and cuts down textures, and
+creates up to STREAMING_UPLOADS_PER_FRAME textures whose files have been read.
+Files read for textures that are no longer wanted are dropped. Called on the
+render thread at the start of each frame, before anything is drawn.
+
+@param pDevice - The device the textures live on
+*/
+void StreamingManager::service(LPDIRECT3DDEVICE9 pDevice) {
+	DWORD uploads = 0;
+
+	// What to do is decided under the lock; the device work is done on the copy without it
+	{
+		std::lock_guard<std::mutex> hold(lock);
+
+		work.clear();
+		for (DWORD i = 0; i < textures.size(); i++) {
+			StreamedTexture& texture = textures[i];
+
+			if (texture.priority > 0.0f && texture.state != STREAM_MISSING && (texture.bytes == 0 || texture.residentSkip > texture.wantedSkip))
+				stats.stalls++;
+
+			if (texture.state == STREAM_READ && texture.priority == 0.0f) {
+				std::vector<char>().swap(texture.data);
+				texture.state = STREAM_IDLE;
+				texture.pendingBytes = 0;
+			}
+
+			if (texture.state == STREAM_READ && uploads < STREAMING_UPLOADS_PER_FRAME) {
+				texture.state = STREAM_CREATING;
+				uploads++;
+			}
+			if (texture.evict || texture.trim || texture.state == STREAM_CREATING) {
+				work.resize(work.size() + 1);
+				ServiceTask& task = work.back();
+
+				task.id = i;
+				task.evict = texture.evict;
+				task.trim = texture.trim;
+				task.create = texture.state == STREAM_CREATING;
+				task.skip = max(texture.loadSkip, texture.wantedSkip);
+				task.data.clear();
+				if (task.create)
+					task.data.swap(texture.data);
+			}
+		}
+	}
+
+	for (DWORD w = 0; w < work.size(); w++) {
+		ServiceTask& task = work[w];
+		// Only the device texture is touched outside the lock; it belongs to the render thread
+		CComPtr<IDirect3DTexture9>& resident = textures[task.id].texture;
+
+		if (task.evict) {
+			resident.Release();
+
+			std::lock_guard<std::mutex> hold(lock);
+			textures[task.id].bytes = 0;
+			textures[task.id].residentSkip = 0;
+			textures[task.id].evict = false;
+			stats.evictions++;
+		}
+
+		// The top level is dropped by copying the rest into a texture one level shorter
+		if (task.trim) {
+			CComPtr<IDirect3DTexture9> smaller;
+			D3DSURFACE_DESC desc;
+			bool trimmed = false;
+
+			if (resident && resident->GetLevelCount() > 1) {
+				resident->GetLevelDesc(1, &desc);
+				trimmed = SUCCEEDED(pDevice->CreateTexture(desc.Width, desc.Height, resident->GetLevelCount() - 1, 0, desc.Format, D3DPOOL_MANAGED, &smaller, NULL));
+				for (DWORD level = 1; trimmed && level < resident->GetLevelCount(); level++) {
+					CComPtr<IDirect3DSurface9> source, destination;
+
+					trimmed = SUCCEEDED(resident->GetSurfaceLevel(level, &source)) && SUCCEEDED(smaller->GetSurfaceLevel(level - 1, &destination)) &&
+						SUCCEEDED(D3DXLoadSurfaceFromSurface(destination, NULL, NULL, source, NULL, NULL, D3DX_FILTER_NONE, 0));
+				}
+			}
+			if (trimmed)
+				resident = smaller;
+
+			std::lock_guard<std::mutex> hold(lock);
+			if (trimmed) {
+				textures[task.id].bytes = TextureBytes(resident);
+				textures[task.id].residentSkip++;
+				stats.trims++;
+			}
+			textures[task.id].trim = false;
+		}
+
+		if (task.create) {
+			LPDIRECT3DTEXTURE9 pTexture = 0;
+			D3DXIMAGE_INFO info;
+
+			HRESULT r = D3DXCreateTextureFromFileInMemoryEx(pDevice, &task.data[0], (UINT)task.data.size(), D3DX_DEFAULT, D3DX_DEFAULT, D3DX_DEFAULT, 0,
+				D3DFMT_UNKNOWN, D3DPOOL_MANAGED, D3DX_DEFAULT, D3DX_SKIP_DDS_MIP_LEVELS(task.skip, D3DX_DEFAULT), 0, &info, NULL, &pTexture);
+			if (SUCCEEDED(r)) {
+				resident.Release();
+				resident.Attach(pTexture);
+			}
+			std::vector<char>().swap(task.data);
+
+			std::lock_guard<std::mutex> hold(lock);
+			StreamedTexture& texture = textures[task.id];
+			if (SUCCEEDED(r)) {
+				texture.bytes = TextureBytes(pTexture);
+				// Only DDS files can leave their top levels out
+				texture.residentSkip = info.ImageFileFormat == D3DXIFF_DDS ? task.skip : 0;
+				texture.state = STREAM_IDLE;
+			}
+			else if (!FallBack(texture)) {
+				LogMessage(TEXT("Streaming: could not create %s"), texture.path.c_str());
+				texture.state = STREAM_MISSING;
+			}
+			texture.pendingBytes = 0;
+		}
+	}
+}
+
+/*
+Gets a streamed texture to draw with. Called on the render thread.
+
+@param id - The id from addTexture, or STREAMING_NONE
+
+@return - The texture at whatever detail is resident, or null if it is not
+*/
+LPDIRECT3DTEXTURE9 StreamingManager::getTexture(DWORD id) {
+	return id < textures.size() ? (LPDIRECT3DTEXTURE9)textures[id].texture : NULL;
+}
+
+/*
+Gets what the streaming manager holds and the work it has done since it was
+last asked, then starts counting the work again.
+
+@param out - Receives the statistics
+*/
+void StreamingManager::takeStats(StreamingStats* out) {
+	std::lock_guard<std::mutex> hold(lock);
+
+	stats.textures = (DWORD)textures.size();
+	stats.resident = 0;
+	stats.budget = budget;
+	stats.bytesResident = stats.bytesInFlight = stats.bytesOnDisk = 0;
+	for (DWORD i = 0; i < textures.size(); i++) {
+		stats.bytesOnDisk += textures[i].fileBytes;
+		if (textures[i].bytes > 0)
+			stats.resident++;
+		stats.bytesResident += textures[i].bytes;
+		if (textures[i].state == STREAM_READING || textures[i].state == STREAM_READ || textures[i].state == STREAM_CREATING)
+			stats.bytesInFlight += textures[i].pendingBytes;
+	}
+
+	*out = stats;
+	stats.loads = stats.trims = stats.evictions = stats.reloads = stats.stalls = 0;
+}
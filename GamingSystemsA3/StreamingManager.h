@@ -0,0 +1,139 @@
+#ifndef STREAMINGMANAGER_H
+#define STREAMINGMANAGER_H
+
+#include "Headers.h"
+#include <atlbase.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Object;
+
+//Bytes of streamed textures kept on the device when no budget is given.
+#define STREAMING_DEFAULT_BUDGET (64 * 1024 * 1024)
+//Threads reading texture files from disk.
+#define STREAMING_IO_THREADS 2
+//Textures whose every user is further than this from the camera are unloaded.
+#define STREAMING_UNLOAD_DISTANCE 200.0f
+//Most textures created or cut down on the render thread in one frame, so a burst of loads does not hitch a frame.
+#define STREAMING_UPLOADS_PER_FRAME 2
+//Largest share of the budget the models' meshes may take while they are left out of streaming.
+#define STREAMING_MESH_SHARE 0.25
+//Textures are not cut down past this many texels along their longest side.
+#define STREAMING_MIN_MIP_SIZE 32
+//Id of a texture that is not streamed.
+#define STREAMING_NONE 0xFFFFFFFF
+
+//Where a streamed texture's file is on its way to the device.
+enum StreamLoadState { STREAM_IDLE, STREAM_READING, STREAM_READ, STREAM_CREATING, STREAM_MISSING };
+
+//What the streaming manager holds, and what it is doing about it.
+struct StreamingStats
+{
+	DWORD textures; // Registered
+	DWORD resident; // On the device at some detail
+	unsigned long long budget;
+	unsigned long long bytesResident; // Of the textures on the device
+	unsigned long long bytesInFlight; // Of the files being read or waiting to be created on the device
+	unsigned long long bytesOnDisk; // Of every registered texture's file, about its device size at full detail
+	DWORD loads, trims, evictions; // Since the last takeStats
+	DWORD reloads; // Resident textures read again because their file changed, since the last takeStats
+	DWORD stalls; // Frames a wanted texture was missing or coarser than wanted, summed over textures, since the last takeStats
+};
+
+/*
+The StreamingManager loads the textures of Objects as the camera comes near
+them and unloads them as it leaves, within a budget of device memory.
+
+Every frame the game thread ranks each texture by the screen size of the largest
+Object using it, and picks how many of its top mip levels it can do without.
+Textures that are wanted but not resident at that detail are loaded, most
+important first. When a load would go over the budget, room is made from the
+least recently wanted textures: ones still in view lose their top mip level,
+others are unloaded. Textures no Object near the camera uses are unloaded
+whatever the budget.
+
+Files are read on STREAMING_IO_THREADS threads of their own, so a slow disk
+never holds up a frame. Creating, cutting down and releasing textures is device
+work, done by service on the render thread at the start of each frame.
+
+A texture whose file changes is read again the same way, and the old texture is
+drawn until the new one replaces it.
+
+A texture the texture tool has compressed is streamed from TEXTURE_CACHE_DIR,
+and from its source if the compressed file can not be read or created.
+*/
+class StreamingManager {
+private:
+	struct StreamedTexture
+	{
+		std::wstring path;
+		std::wstring fallback; // The source file while path is its compressed version, empty otherwise
+		std::vector<Object*> users;
+		StreamLoadState state;
+		DWORD fileBytes;
+		std::vector<char> data; // The file, from when it is read until it is created on the device
+		DWORD width, height, levels; // Of the file, once it has been read
+		float priority; // Screen diameter in pixels of the largest user; 0 if none is near
+		DWORD lastWanted; // Frame priority was last above 0
+		DWORD wantedSkip; // Top mip levels that can be left out at the current priority
+		DWORD loadSkip; // Of the load in flight; more are left out if wantedSkip has grown by the time it is created
+		DWORD pendingBytes; // Estimated device bytes of the load in flight
+		CComPtr<IDirect3DTexture9> texture; // Render thread only
+		DWORD residentSkip; // Top mip levels left out of texture
+		DWORD bytes; // Of texture, 0 when it is not resident
+		bool evict; // Release texture at the next service
+		bool trim; // Leave out one more top mip level at the next service
+		bool reread; // The file changed since it was read; read it again once the texture is idle
+	};
+
+	//Device work service does for one texture, copied out of it under the lock.
+	struct ServiceTask
+	{
+		DWORD id;
+		bool evict, trim, create;
+		DWORD skip; // Top mip levels to leave out of the texture created
+		std::vector<char> data; // The file to create it from
+	};
+
+	std::vector<StreamedTexture> textures;
+	std::vector<std::thread> ioThreads;
+	std::deque<DWORD> ioQueue; // Textures to read, most important first
+	std::mutex lock;
+	std::condition_variable ioWake;
+	bool quitting;
+	unsigned long long budget;
+	DWORD frame;
+	std::vector<DWORD> candidates; // Reused by update
+	std::vector<ServiceTask> work; // Reused by service
+	StreamingStats stats;
+
+	StreamingManager(const StreamingManager&);
+	StreamingManager& operator=(const StreamingManager&);
+
+	void ioMain();
+	DWORD projectedBytes(const StreamedTexture&);
+	bool makeRoom(float priority, unsigned long long needed, unsigned long long* committed);
+	static DWORD EstimateBytes(const StreamedTexture&, DWORD skip);
+	static bool FallBack(StreamedTexture&);
+	static bool FindNearby(LPCWSTR name, std::wstring* path, DWORD* size);
+
+public:
+	StreamingManager();
+	~StreamingManager();
+	void start();
+	void shutdown();
+	void setBudget(unsigned long long bytes);
+	DWORD addTexture(LPCWSTR name, Object* user);
+	DWORD reload(LPCWSTR name);
+	void removeUser(Object* user);
+	void update(const D3DXVECTOR3& eye, const D3DXMATRIX& proj, float viewportHeight);
+	void service(LPDIRECT3DDEVICE9);
+	LPDIRECT3DTEXTURE9 getTexture(DWORD id);
+	void takeStats(StreamingStats*);
+};
+
+#endif // !STREAMINGMANAGER_H
@@ -0,0 +1,287 @@
+#include "Headers.h"
+#include "TangentFrame.h"
+#include <thread>
+#include <vector>
+
+//A run of faces whose vertices no other run touches, so runs can be processed at the same time.
+struct TangentJob
+{
+	DWORD faceStart, faceCount;
+	DWORD vertexStart, vertexCount;
+};
+
+//What every job reads and writes. Jobs only write the vertices in their own range.
+struct TangentWork
+{
+	BYTE* pVertices;
+	DWORD stride;
+	DWORD normalOffset, uvOffset, tangentOffset;
+	const std::vector<DWORD>* indices;
+	std::vector<D3DXVECTOR3>* tangents; // Accumulated dP/du of the faces around each vertex
+	std::vector<D3DXVECTOR3>* bitangents; // Accumulated dP/dv
+	const std::vector<TangentJob>* jobs;
+};
+
+/*
+Accumulates the texture space directions of a job's faces onto their vertices,
+then orthogonalizes each vertex's tangent against its normal and writes it with
+the handedness of the texture mapping in w.
+
+@param work - The mesh data shared by every job
+@param job - The faces and vertices to process
+*/
+static void ProcessTangentJob(const TangentWork& work, const TangentJob& job) {
+	const std::vector<DWORD>& indices = *work.indices;
+	std::vector<D3DXVECTOR3>& tangents = *work.tangents;
+	std::vector<D3DXVECTOR3>& bitangents = *work.bitangents;
+
+	for (DWORD f = job.faceStart; f < job.faceStart + job.faceCount; f++) {
+		DWORD i0 = indices[f * 3], i1 = indices[f * 3 + 1], i2 = indices[f * 3 + 2];
+		BYTE* v0 = work.pVertices + i0 * work.stride;
+		BYTE* v1 = work.pVertices + i1 * work.stride;
+		BYTE* v2 = work.pVertices + i2 * work.stride;
+		D3DXVECTOR3 e1 = *(D3DXVECTOR3*)v1 - *(D3DXVECTOR3*)v0;
+		D3DXVECTOR3 e2 = *(D3DXVECTOR3*)v2 - *(D3DXVECTOR3*)v0;
+		D3DXVECTOR2 t1 = *(D3DXVECTOR2*)(v1 + work.uvOffset) - *(D3DXVECTOR2*)(v0 + work.uvOffset);
+		D3DXVECTOR2 t2 = *(D3DXVECTOR2*)(v2 + work.uvOffset) - *(D3DXVECTOR2*)(v0 + work.uvOffset);
+		float det = t1.x * t2.y - t2.x * t1.y;
+
+		// Faces with no texture area give no direction
+		if (fabsf(det) < 1e-12f)
+			continue;
+
+		D3DXVECTOR3 tangent = (e1 * t2.y - e2 * t1.y) / det;
+		D3DXVECTOR3 bitangent = (e2 * t1.x - e1 * t2.x) / det;
+
+		tangents[i0] += tangent;
+		tangents[i1] += tangent;
+		tangents[i2] += tangent;
+		bitangents[i0] += bitangent;
+		bitangents[i1] += bitangent;
+		bitangents[i2] += bitangent;
+	}
+
+	for (DWORD v = job.vertexStart; v < job.vertexStart + job.vertexCount; v++) {
+		BYTE* pVertex = work.pVertices + v * work.stride;
+		D3DXVECTOR3 normal, tangent, cross;
+
+		D3DXVec3Normalize(&normal, (D3DXVECTOR3*)(pVertex + work.normalOffset));
+		tangent = tangents[v] - normal * D3DXVec3Dot(&normal, &tangents[v]);
+
+		// Any direction across the normal will do where the mapping gave none
+		if (D3DXVec3LengthSq(&tangent) < 1e-12f) {
+			D3DXVECTOR3 axis = fabsf(normal.x) < 0.9f ? D3DXVECTOR3(1.0f, 0.0f, 0.0f) : D3DXVECTOR3(0.0f, 1.0f, 0.0f);
+			D3DXVec3Cross(&tangent, &normal, &axis);
+		}
+		D3DXVec3Normalize(&tangent, &tangent);
+
+		// Mirrored texture mapping flips the bitangent the shader rebuilds from the normal and tangent
+		D3DXVec3Cross(&cross, &normal, &tangent);
+		*(D3DXVECTOR4*)(pVertex + work.tangentOffset) = D3DXVECTOR4(tangent, D3DXVec3Dot(&cross, &bitangents[v]) < 0.0f ? -1.0f : 1.0f);
+	}
+}
+
+/*
+Runs a range of jobs on one of the job system's threads.
+
+@param data - The TangentWork shared by every job
+@param begin, end - The jobs to run
+*/
+static void RunTangentJobs(void* data, unsigned begin, unsigned end) {
+	const TangentWork& work = *(const TangentWork*)data;
+
+	for (unsigned j = begin; j < end; j++)
+		ProcessTangentJob(work, (*work.jobs)[j]);
+}
+
+/*
+Clones a mesh with a per-vertex tangent frame for normal mapping. The tangent is
+stored as a FLOAT4 TANGENT element: xyz is the tangent orthogonal to the normal
+and w is the sign of the bitangent, so the shader rebuilds the bitangent as
+cross(normal, tangent) * w.
+
+The subsets of a mesh sorted by OptimizeMesh own separate vertex ranges, so each
+subset is processed on its own and the subsets are spread over several threads.
+If any two subsets share vertices the whole mesh is processed on one thread.
+
+@param pMesh - The mesh to add tangents to; it must have float positions, normals and texture coordinates
+@param pDevice - The device the new mesh is created on
+@param threads - The most threads to use; 0 uses one per hardware thread
+@param ppOut - Receives the mesh with tangents
+@param stats - Receives the size of the mesh and the time taken, or NULL
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if:
+			- The mesh has no normals or texture coordinates, or already has tangents
+			- The mesh can not be cloned or its buffers read
+*/
+int ComputeTangentFrames(LPD3DXMESH pMesh, LPDIRECT3DDEVICE9 pDevice, DWORD threads, LPD3DXMESH* ppOut, TangentStats* stats) {
+	D3DVERTEXELEMENT9 decl[MAX_FVF_DECL_SIZE];
+	DWORD normalOffset, uvOffset, tangentOffset, numElements;
+	std::vector<D3DXATTRIBUTERANGE> attributes;
+	std::vector<TangentJob> jobs;
+	std::vector<DWORD> indices;
+	DWORD numAttributes = 0;
+	bool shared = false;
+	DWORD numVertices = pMesh->GetNumVertices();
+	LARGE_INTEGER start, end, frequency;
+
+	QueryPerformanceCounter(&start);
+	*ppOut = 0;
+
+	pMesh->GetDeclaration(decl);
+	if (!FindElement(decl, D3DDECLUSAGE_NORMAL, &normalOffset) || !FindElement(decl, D3DDECLUSAGE_TEXCOORD, &uvOffset) ||
+		FindElement(decl, D3DDECLUSAGE_TANGENT, &tangentOffset)) {
+		SetError(TEXT("Tangent frames need a mesh with normals and texture coordinates and no tangents"));
+		return E_FAIL;
+	}
+
+	// Append the tangent after the existing elements
+	numElements = D3DXGetDeclLength(decl);
+	tangentOffset = D3DXGetDeclVertexSize(decl, 0);
+	decl[numElements + 1] = decl[numElements];
+	decl[numElements].Stream = 0;
+	decl[numElements].Offset = (WORD)tangentOffset;
+	decl[numElements].Type = D3DDECLTYPE_FLOAT4;
+	decl[numElements].Method = D3DDECLMETHOD_DEFAULT;
+	decl[numElements].Usage = D3DDECLUSAGE_TANGENT;
+	decl[numElements].UsageIndex = 0;
+
+	if (FAILED(ReadIndices(pMesh, indices)))
+		return E_FAIL;
+
+	pMesh->GetAttributeTable(NULL, &numAttributes);
+	attributes.resize(numAttributes);
+	if (numAttributes > 0)
+		pMesh->GetAttributeTable(&attributes[0], &numAttributes);
+
+	for (DWORD a = 0; a < numAttributes && !shared; a++) {
+		TangentJob job = { attributes[a].FaceStart, attributes[a].FaceCount, attributes[a].VertexStart, attributes[a].VertexCount };
+
+		for (DWORD j = 0; j < jobs.size(); j++) {
+			if (job.vertexStart < jobs[j].vertexStart + jobs[j].vertexCount && jobs[j].vertexStart < job.vertexStart + job.vertexCount)
+				shared = true;
+		}
+		jobs.push_back(job);
+	}
+	if (shared || jobs.empty()) {
+		TangentJob job = { 0, pMesh->GetNumFaces(), 0, numVertices };
+		jobs.clear();
+		jobs.push_back(job);
+	}
+
+	if (FAILED(pMesh->CloneMesh(pMesh->GetOptions(), decl, pDevice, ppOut))) {
+		SetError(TEXT("Could not clone mesh to add tangents"));
+		return E_FAIL;
+	}
+
+	std::vector<D3DXVECTOR3> tangents(numVertices, D3DXVECTOR3(0.0f, 0.0f, 0.0f));
+	std::vector<D3DXVECTOR3> bitangents(numVertices, D3DXVECTOR3(0.0f, 0.0f, 0.0f));
+	TangentWork work;
+
+	if (FAILED((*ppOut)->LockVertexBuffer(0, (void**)&work.pVertices))) {
+		SetError(TEXT("Could not lock vertex buffer"));
+		(*ppOut)->Release();
+		*ppOut = 0;
+		return E_FAIL;
+	}
+	work.stride = (*ppOut)->GetNumBytesPerVertex();
+	work.normalOffset = normalOffset;
+	work.uvOffset = uvOffset;
+	work.tangentOffset = tangentOffset;
+	work.indices = &indices;
+	work.tangents = &tangents;
+	work.bitangents = &bitangents;
+	work.jobs = &jobs;
+
+	if (threads == 0)
+		threads = max(1u, std::thread::hardware_concurrency());
+	threads = min(threads, (DWORD)jobs.size());
+
+	// One subset per job, so idle threads steal whole subsets
+	JobSystem pool;
+	pool.start(threads);
+	pool.parallelFor(jobs.size(), 1, RunTangentJobs, &work);
+	pool.stop();
+
+	(*ppOut)->UnlockVertexBuffer();
+
+	QueryPerformanceCounter(&end);
+	QueryPerformanceFrequency(&frequency);
+	if (stats) {
+		stats->vertices = numVertices;
+		stats->faces = pMesh->GetNumFaces();
+		stats->subsets = jobs.size();
+		stats->threads = threads;
+		stats->milliseconds = (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart;
+	}
+
+	return S_OK;
+}
+
+/*
+Times tangent frame generation on a mesh without opening a window. The mesh is
+loaded in system memory on a null reference device, then tangents are generated
+TANGENT_BENCHMARK_RUNS times with one thread, and again with every doubling of
+the thread count up to the hardware's. The average time and throughput of each
+thread count are written to the debug output.
+
+@param file - The .x file to load
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the device can not be created, or the mesh loaded or given tangents.
+*/
+int BenchmarkTangentFrames(LPCWSTR file) {
+	LPDIRECT3D9 pD3D = 0;
+	LPDIRECT3DDEVICE9 pDevice = 0;
+	LPD3DXMESH pMesh = 0;
+	DWORD maxThreads = max(1u, std::thread::hardware_concurrency());
+	HRESULT r = S_OK;
+
+	if (FAILED(CreateNullDevice(&pD3D, &pDevice)))
+		return E_FAIL;
+
+	if (FAILED(D3DXLoadMeshFromX(file, D3DXMESH_SYSTEMMEM, pDevice, NULL, NULL, NULL, NULL, &pMesh))) {
+		TCHAR text[MAX_PATH];
+		_stprintf_s(text, MAX_PATH, TEXT("..\\%s"), file);
+		if (FAILED(D3DXLoadMeshFromX(text, D3DXMESH_SYSTEMMEM, pDevice, NULL, NULL, NULL, NULL, &pMesh))) {
+			SetError(TEXT("Could not find mesh %s"), file);
+			r = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(r))
+		r = OptimizeMesh(pMesh, NULL, MESHOPT_VERTEXCACHE | MESHOPT_VERTEXFETCH, file);
+
+	for (DWORD threads = 1; SUCCEEDED(r); threads *= 2) {
+		TangentStats stats;
+		double total = 0.0;
+
+		threads = min(threads, maxThreads);
+		for (int run = 0; run < TANGENT_BENCHMARK_RUNS && SUCCEEDED(r); run++) {
+			LPD3DXMESH pTangentMesh = 0;
+
+			r = ComputeTangentFrames(pMesh, pDevice, threads, &pTangentMesh, &stats);
+			if (SUCCEEDED(r)) {
+				pTangentMesh->Release();
+				total += stats.milliseconds;
+			}
+		}
+		if (FAILED(r))
+			break;
+
+		double average = total / TANGENT_BENCHMARK_RUNS;
+		LogMessage(TEXT("%s: tangent frames, %u vertices in %u subsets, %u threads: %.3f ms, %.2f million vertices/s"),
+			file, stats.vertices, stats.subsets, stats.threads, average, stats.vertices / (average * 1000.0));
+
+		if (threads == maxThreads)
+			break;
+	}
+
+	if (pMesh)
+		pMesh->Release();
+	pDevice->Release();
+	pD3D->Release();
+
+	return r;
+}
@@ -0,0 +1,21 @@
+#ifndef TANGENTFRAME_H
+#define TANGENTFRAME_H
+
+#include "Headers.h"
+
+//Number of times each thread count is timed by BenchmarkTangentFrames.
+#define TANGENT_BENCHMARK_RUNS 20
+
+//How long a tangent frame generation took and how it was split.
+struct TangentStats
+{
+	DWORD vertices, faces;
+	DWORD subsets; // Independent pieces the work was split into
+	DWORD threads; // Threads that ran them
+	double milliseconds;
+};
+
+int ComputeTangentFrames(LPD3DXMESH pMesh, LPDIRECT3DDEVICE9 pDevice, DWORD threads, LPD3DXMESH* ppOut, TangentStats* stats);
+int BenchmarkTangentFrames(LPCWSTR file);
+
+#endif // !TANGENTFRAME_H
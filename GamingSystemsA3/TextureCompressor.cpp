@@ -0,0 +1,818 @@
+#include "Headers.h"
+#include "TextureCompressor.h"
+#include <cfloat>
+#include <cmath>
+#include <xmmintrin.h>
+
+//DDS header flags: caps, height, width, pixel format, mip map count and linear size are set.
+#define DDS_HEADER_FLAGS 0x000A1007
+//DDS pixel format flag of a FourCC format.
+#define DDS_FOURCC 0x00000004
+//DDS caps of a texture with a mip chain.
+#define DDS_CAPS_MIPMAPPED 0x00401008
+
+//The header of a DDS file, after its magic number, laid out as in the DirectX SDK's dds.h.
+struct DdsHeader
+{
+	DWORD size, flags, height, width, linearSize, depth, mipMapCount;
+	DWORD reserved1[11];
+	DWORD formatSize, formatFlags, fourCC, rgbBitCount, rMask, gMask, bMask, aMask;
+	DWORD caps, caps2, caps3, caps4, reserved2;
+};
+
+//One level of a texture's mip chain.
+struct TextureLevel
+{
+	DWORD width, height;
+	std::vector<__m128> linear; // Each texel as linear RGBA, or for a normal map its vector in -1..1 and alpha
+	std::vector<DWORD> texels; // Each texel as stored, A8R8G8B8
+	std::vector<BYTE> blocks; // The level compressed
+};
+
+//Block rows of one level, compressed by one job.
+struct BlockRun
+{
+	DWORD level;
+	DWORD firstRow, endRow;
+};
+
+//Everything the jobs working on one texture share.
+struct TextureWork
+{
+	TextureFormat format;
+	bool normalMap;
+	std::vector<TextureLevel> levels;
+	DWORD level; // Being built by the mip jobs
+	std::vector<BlockRun> runs;
+	float toLinear[256]; // sRGB byte to linear intensity
+	BYTE toSrgb[TEXTURE_GAMMA_STEPS]; // Linear intensity, scaled to the table, to sRGB byte
+};
+
+static float Saturate(float x) {
+	return x < 0.0f ? 0.0f : x > 1.0f ? 1.0f : x;
+}
+
+/*
+Fills the tables that convert between sRGB bytes and linear intensity, so mip
+levels are averaged in linear light and a level does not darken as it shrinks.
+
+@param work - Receives the tables
+*/
+static void BuildGammaTables(TextureWork* work) {
+	for (int i = 0; i < 256; i++) {
+		float c = i / 255.0f;
+
+		work->toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	for (int i = 0; i < TEXTURE_GAMMA_STEPS; i++) {
+		float l = i / (float)(TEXTURE_GAMMA_STEPS - 1);
+		float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+
+		work->toSrgb[i] = (BYTE)(Saturate(c) * 255.0f + 0.5f);
+	}
+}
+
+/*
+@return - A stored texel as four floats: linear RGBA, or for a normal map its vector and alpha
+*/
+static __m128 DecodeTexel(const TextureWork& work, DWORD texel) {
+	BYTE a = (BYTE)(texel >> 24), r = (BYTE)(texel >> 16), g = (BYTE)(texel >> 8), b = (BYTE)texel;
+
+	if (work.normalMap)
+		return _mm_set_ps(a / 255.0f, b / 127.5f - 1.0f, g / 127.5f - 1.0f, r / 127.5f - 1.0f);
+	return _mm_set_ps(a / 255.0f, work.toLinear[b], work.toLinear[g], work.toLinear[r]);
+}
+
+/*
+@return - A texel from DecodeTexel stored back as A8R8G8B8
+*/
+static DWORD EncodeTexel(const TextureWork& work, __m128 value) {
+	float v[4];
+	DWORD channels[3];
+
+	_mm_storeu_ps(v, value);
+	for (int c = 0; c < 3; c++) {
+		if (work.normalMap)
+			channels[c] = (DWORD)(Saturate(v[c] * 0.5f + 0.5f) * 255.0f + 0.5f);
+		else
+			channels[c] = work.toSrgb[(int)(Saturate(v[c]) * (TEXTURE_GAMMA_STEPS - 1) + 0.5f)];
+	}
+
+	return ((DWORD)(Saturate(v[3]) * 255.0f + 0.5f) << 24) | (channels[0] << 16) | (channels[1] << 8) | channels[2];
+}
+
+/*
+@return - A normal map texel with its vector scaled back to unit length, pointing out of the surface if it has none
+*/
+static __m128 NormalizeXyz(__m128 value) {
+	float v[4];
+	float length;
+
+	_mm_storeu_ps(v, value);
+	length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	if (length < 1e-6f)
+		return _mm_set_ps(v[3], 1.0f, 0.0f, 0.0f);
+	return _mm_mul_ps(value, _mm_set_ps(1.0f, 1.0f / length, 1.0f / length, 1.0f / length));
+}
+
+/*
+Builds rows of work->level by averaging each 2x2 square of the level above,
+four channels at once. An odd last row or column is averaged with itself.
+*/
+static void MipJob(void* data, unsigned begin, unsigned end) {
+	TextureWork* work = (TextureWork*)data;
+	const TextureLevel& source = work->levels[work->level - 1];
+	TextureLevel& target = work->levels[work->level];
+	const __m128 quarter = _mm_set1_ps(0.25f);
+
+	for (unsigned y = begin; y < end; y++) {
+		DWORD y0 = min(2 * y, source.height - 1) * source.width;
+		DWORD y1 = min(2 * y + 1, source.height - 1) * source.width;
+
+		for (DWORD x = 0; x < target.width; x++) {
+			DWORD x0 = min(2 * x, source.width - 1), x1 = min(2 * x + 1, source.width - 1);
+			__m128 texel = _mm_mul_ps(_mm_add_ps(_mm_add_ps(source.linear[y0 + x0], source.linear[y0 + x1]),
+				_mm_add_ps(source.linear[y1 + x0], source.linear[y1 + x1])), quarter);
+
+			if (work->normalMap)
+				texel = NormalizeXyz(texel);
+			target.linear[y * target.width + x] = texel;
+			target.texels[y * target.width + x] = EncodeTexel(*work, texel);
+		}
+	}
+}
+
+static WORD Quantize565(const float* color) {
+	return (WORD)(((DWORD)(Saturate(color[0] / 255.0f) * 31.0f + 0.5f) << 11) |
+		((DWORD)(Saturate(color[1] / 255.0f) * 63.0f + 0.5f) << 5) |
+		(DWORD)(Saturate(color[2] / 255.0f) * 31.0f + 0.5f));
+}
+
+static void Expand565(WORD color, int* rgb) {
+	int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+/*
+Picks the closest of the four colours between two endpoints for each texel of a
+block, four texels at a time.
+
+@param r, g, b - The channels of the block, four texels to each vector
+@param c0, c1 - The endpoints
+@param indices - Receives the palette entry of each texel, in the order BC1 stores them
+
+@return - The summed squared error of the block
+*/
+static float FitIndices(const __m128* r, const __m128* g, const __m128* b, WORD c0, WORD c1, BYTE* indices) {
+	int p0[3], p1[3];
+	float palette[4][3];
+	float errors[4], picked[4];
+	__m128 total = _mm_setzero_ps();
+
+	Expand565(c0, p0);
+	Expand565(c1, p1);
+	for (int c = 0; c < 3; c++) {
+		palette[0][c] = (float)p0[c];
+		palette[1][c] = (float)p1[c];
+		palette[2][c] = (float)((2 * p0[c] + p1[c]) / 3);
+		palette[3][c] = (float)((p0[c] + 2 * p1[c]) / 3);
+	}
+
+	for (int q = 0; q < 4; q++) {
+		__m128 best = _mm_set1_ps(FLT_MAX);
+		__m128 bestIndex = _mm_setzero_ps();
+
+		for (int k = 0; k < 4; k++) {
+			__m128 dr = _mm_sub_ps(r[q], _mm_set1_ps(palette[k][0]));
+			__m128 dg = _mm_sub_ps(g[q], _mm_set1_ps(palette[k][1]));
+			__m128 db = _mm_sub_ps(b[q], _mm_set1_ps(palette[k][2]));
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+			__m128 closer = _mm_cmplt_ps(distance, best);
+
+			best = _mm_min_ps(distance, best);
+			bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((float)k)), _mm_andnot_ps(closer, bestIndex));
+		}
+
+		total = _mm_add_ps(total, best);
+		_mm_storeu_ps(picked, bestIndex);
+		for (int i = 0; i < 4; i++)
+			indices[q * 4 + i] = (BYTE)picked[i];
+	}
+
+	_mm_storeu_ps(errors, total);
+	return errors[0] + errors[1] + errors[2] + errors[3];
+}
+
+/*
+Solves for the endpoints that best reproduce a block with the palette entries
+already picked, by least squares.
+
+@param r, g, b - The channels of the block's texels
+@param indices - The palette entry of each texel
+@param c0, c1 - Receive the endpoints
+
+@return - Whether the texels pick enough different entries to solve for two endpoints
+*/
+static bool RefineEndpoints(const float* r, const float* g, const float* b, const BYTE* indices, WORD* c0, WORD* c1) {
+	// Share of the first endpoint in each palette entry
+	static const float shares[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	const float* channels[3] = { r, g, b };
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+	float e0[3], e1[3];
+	float determinant;
+
+	for (int i = 0; i < 16; i++) {
+		float sa = shares[indices[i]], sb = 1.0f - sa;
+
+		aa += sa * sa;
+		ab += sa * sb;
+		bb += sb * sb;
+		for (int c = 0; c < 3; c++) {
+			ax[c] += sa * channels[c][i];
+			bx[c] += sb * channels[c][i];
+		}
+	}
+
+	determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) < 1e-6f)
+		return false;
+
+	for (int c = 0; c < 3; c++) {
+		e0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+		e1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+	}
+	*c0 = Quantize565(e0);
+	*c1 = Quantize565(e1);
+	return true;
+}
+
+/*
+Compresses a 4x4 block of colours to BC1. The endpoints are first put at the
+ends of the block's spread along its principal axis, then refit by least squares
+to the palette entries the texels picked, keeping whichever is closer.
+
+@param block - The block's texels, A8R8G8B8, row by row
+@param out - Receives the 8 bytes of the block
+*/
+static void CompressColorBlock(const DWORD* block, BYTE* out) {
+	float r[16], g[16], b[16];
+	__m128 rs[4], gs[4], bs[4];
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	float lowest[3] = { 255.0f, 255.0f, 255.0f }, highest[3] = { 0.0f, 0.0f, 0.0f };
+	float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	float axis[3], e0[3], e1[3];
+	float lo = FLT_MAX, hi = -FLT_MAX, length, error;
+	BYTE indices[16], refitIndices[16];
+	WORD c0, c1, r0, r1;
+	DWORD bits = 0;
+
+	for (int i = 0; i < 16; i++) {
+		r[i] = (float)((block[i] >> 16) & 0xFF);
+		g[i] = (float)((block[i] >> 8) & 0xFF);
+		b[i] = (float)(block[i] & 0xFF);
+		mean[0] += r[i];
+		mean[1] += g[i];
+		mean[2] += b[i];
+		lowest[0] = min(lowest[0], r[i]);
+		lowest[1] = min(lowest[1], g[i]);
+		lowest[2] = min(lowest[2], b[i]);
+		highest[0] = max(highest[0], r[i]);
+		highest[1] = max(highest[1], g[i]);
+		highest[2] = max(highest[2], b[i]);
+	}
+	for (int c = 0; c < 3; c++) {
+		mean[c] /= 16.0f;
+		axis[c] = highest[c] - lowest[c];
+	}
+
+	for (int i = 0; i < 16; i++) {
+		float dr = r[i] - mean[0], dg = g[i] - mean[1], db = b[i] - mean[2];
+
+		covariance[0] += dr * dr;
+		covariance[1] += dr * dg;
+		covariance[2] += dr * db;
+		covariance[3] += dg * dg;
+		covariance[4] += dg * db;
+		covariance[5] += db * db;
+	}
+
+	// A few steps of power iteration from the bounding box diagonal find the principal axis
+	for (int step = 0; step < 4; step++) {
+		float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+		float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+		float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+		float largest = max(fabsf(x), max(fabsf(y), fabsf(z)));
+
+		if (largest < 1e-6f)
+			break;
+		axis[0] = x / largest;
+		axis[1] = y / largest;
+		axis[2] = z / largest;
+	}
+
+	length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	if (length < 1e-6f) {
+		lo = hi = 0.0f;
+		axis[0] = axis[1] = axis[2] = 0.0f;
+	}
+	else {
+		for (int c = 0; c < 3; c++)
+			axis[c] /= length;
+		for (int i = 0; i < 16; i++) {
+			float t = (r[i] - mean[0]) * axis[0] + (g[i] - mean[1]) * axis[1] + (b[i] - mean[2]) * axis[2];
+
+			lo = min(lo, t);
+			hi = max(hi, t);
+		}
+	}
+
+	for (int c = 0; c < 3; c++) {
+		e0[c] = mean[c] + axis[c] * hi;
+		e1[c] = mean[c] + axis[c] * lo;
+	}
+	c0 = Quantize565(e0);
+	c1 = Quantize565(e1);
+
+	for (int q = 0; q < 4; q++) {
+		rs[q] = _mm_loadu_ps(r + q * 4);
+		gs[q] = _mm_loadu_ps(g + q * 4);
+		bs[q] = _mm_loadu_ps(b + q * 4);
+	}
+
+	error = FitIndices(rs, gs, bs, c0, c1, indices);
+	if (RefineEndpoints(r, g, b, indices, &r0, &r1) && FitIndices(rs, gs, bs, r0, r1, refitIndices) < error) {
+		c0 = r0;
+		c1 = r1;
+		memcpy(indices, refitIndices, sizeof(indices));
+	}
+
+	// Four colour mode needs the first endpoint larger; swapping them swaps entries 0 with 1 and 2 with 3
+	if (c0 < c1) {
+		WORD swap = c0;
+
+		c0 = c1;
+		c1 = swap;
+		for (int i = 0; i < 16; i++)
+			indices[i] ^= 1;
+	}
+	// Equal endpoints would select three colour mode, where entry 3 is transparent black
+	if (c0 == c1)
+		memset(indices, 0, sizeof(indices));
+
+	for (int i = 0; i < 16; i++)
+		bits |= (DWORD)indices[i] << (2 * i);
+
+	out[0] = (BYTE)c0;
+	out[1] = (BYTE)(c0 >> 8);
+	out[2] = (BYTE)c1;
+	out[3] = (BYTE)(c1 >> 8);
+	for (int i = 0; i < 4; i++)
+		out[4 + i] = (BYTE)(bits >> (8 * i));
+}
+
+/*
+Compresses a 4x4 block of one channel, as BC3 stores alpha and BC5 each axis.
+The block's largest and smallest values are the endpoints, with six steps evenly
+between them.
+
+@param values - The block's values, row by row
+@param out - Receives the 8 bytes of the block
+*/
+static void CompressChannelBlock(const BYTE* values, BYTE* out) {
+	BYTE hi = 0, lo = 255;
+	unsigned long long bits = 0;
+
+	for (int i = 0; i < 16; i++) {
+		hi = max(hi, values[i]);
+		lo = min(lo, values[i]);
+	}
+
+	out[0] = hi;
+	out[1] = lo;
+	if (hi > lo) {
+		for (int i = 0; i < 16; i++) {
+			// Steps run from hi to lo, but the endpoints take the first two indices
+			int step = (int)((hi - values[i]) * 7.0f / (hi - lo) + 0.5f);
+			unsigned long long index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+
+			bits |= index << (3 * i);
+		}
+	}
+
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (BYTE)(bits >> (8 * i));
+}
+
+static void DecodeColorBlock(const BYTE* in, DWORD* texels) {
+	WORD c0 = (WORD)(in[0] | (in[1] << 8)), c1 = (WORD)(in[2] | (in[3] << 8));
+	DWORD bits = in[4] | (in[5] << 8) | (in[6] << 16) | ((DWORD)in[7] << 24);
+	int palette[4][3];
+
+	Expand565(c0, palette[0]);
+	Expand565(c1, palette[1]);
+	for (int c = 0; c < 3; c++) {
+		if (c0 > c1) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+
+	for (int i = 0; i < 16; i++) {
+		const int* color = palette[(bits >> (2 * i)) & 3];
+
+		texels[i] = 0xFF000000 | (color[0] << 16) | (color[1] << 8) | color[2];
+	}
+}
+
+static void DecodeChannelBlock(const BYTE* in, BYTE* values) {
+	int palette[8];
+	unsigned long long bits = 0;
+
+	palette[0] = in[0];
+	palette[1] = in[1];
+	if (palette[0] > palette[1]) {
+		for (int k = 1; k < 7; k++)
+			palette[k + 1] = ((7 - k) * palette[0] + k * palette[1]) / 7;
+	}
+	else {
+		for (int k = 1; k < 5; k++)
+			palette[k + 1] = ((5 - k) * palette[0] + k * palette[1]) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	for (int i = 0; i < 6; i++)
+		bits |= (unsigned long long)in[2 + i] << (8 * i);
+	for (int i = 0; i < 16; i++)
+		values[i] = (BYTE)palette[(bits >> (3 * i)) & 7];
+}
+
+/*
+Gets a 4x4 block of a level, repeating the last row and column where the level
+is smaller than the block.
+*/
+static void FetchBlock(const TextureLevel& level, DWORD bx, DWORD by, DWORD* block) {
+	for (DWORD y = 0; y < 4; y++) {
+		const DWORD* row = &level.texels[min(by * 4 + y, level.height - 1) * level.width];
+
+		for (DWORD x = 0; x < 4; x++)
+			block[y * 4 + x] = row[min(bx * 4 + x, level.width - 1)];
+	}
+}
+
+/*
+Compresses one block in a texture's format.
+
+@param format - The format
+@param block - The block's texels, A8R8G8B8, row by row
+@param out - Receives 8 bytes for BC1, 16 for the others
+*/
+static void CompressBlock(TextureFormat format, const DWORD* block, BYTE* out) {
+	BYTE values[16];
+
+	switch (format) {
+	case TEXTURE_BC1:
+		CompressColorBlock(block, out);
+		break;
+	case TEXTURE_BC3:
+		for (int i = 0; i < 16; i++)
+			values[i] = (BYTE)(block[i] >> 24);
+		CompressChannelBlock(values, out);
+		CompressColorBlock(block, out + 8);
+		break;
+	case TEXTURE_BC5:
+		// Red holds x, then green holds y
+		for (int i = 0; i < 16; i++)
+			values[i] = (BYTE)(block[i] >> 16);
+		CompressChannelBlock(values, out);
+		for (int i = 0; i < 16; i++)
+			values[i] = (BYTE)(block[i] >> 8);
+		CompressChannelBlock(values, out + 8);
+		break;
+	}
+}
+
+/*
+Decodes a block compressed by CompressBlock, with the channels the format drops
+left at zero.
+*/
+static void DecodeBlock(TextureFormat format, const BYTE* in, DWORD* texels) {
+	BYTE values[16];
+
+	switch (format) {
+	case TEXTURE_BC1:
+		DecodeColorBlock(in, texels);
+		break;
+	case TEXTURE_BC3:
+		DecodeColorBlock(in + 8, texels);
+		DecodeChannelBlock(in, values);
+		for (int i = 0; i < 16; i++)
+			texels[i] = (texels[i] & 0x00FFFFFF) | ((DWORD)values[i] << 24);
+		break;
+	case TEXTURE_BC5:
+		DecodeChannelBlock(in, values);
+		for (int i = 0; i < 16; i++)
+			texels[i] = (DWORD)values[i] << 16;
+		DecodeChannelBlock(in + 8, values);
+		for (int i = 0; i < 16; i++)
+			texels[i] |= (DWORD)values[i] << 8;
+		break;
+	}
+}
+
+/*
+Compresses runs of block rows. The runs of every level are queued together, so
+the small levels at the end of the chain do not leave threads idle.
+*/
+static void CompressJob(void* data, unsigned begin, unsigned end) {
+	TextureWork* work = (TextureWork*)data;
+	DWORD blockBytes = work->format == TEXTURE_BC1 ? 8 : 16;
+
+	for (unsigned r = begin; r < end; r++) {
+		const BlockRun& run = work->runs[r];
+		TextureLevel& level = work->levels[run.level];
+		DWORD blocksWide = (level.width + 3) / 4;
+
+		for (DWORD by = run.firstRow; by < run.endRow; by++) {
+			for (DWORD bx = 0; bx < blocksWide; bx++) {
+				DWORD block[16];
+
+				FetchBlock(level, bx, by, block);
+				CompressBlock(work->format, block, &level.blocks[(by * blocksWide + bx) * blockBytes]);
+			}
+		}
+	}
+}
+
+/*
+Measures how close a compressed level comes to its texels, over the channels
+the format keeps.
+
+@return - The peak signal to noise ratio in dB, at most TEXTURE_MAX_PSNR
+*/
+static double MeasurePsnr(const TextureWork& work, const TextureLevel& level) {
+	static const int shifts[3][4] = { { 16, 8, 0, -1 }, { 16, 8, 0, 24 }, { 16, 8, -1, -1 } };
+	DWORD blocksWide = (level.width + 3) / 4, blocksHigh = (level.height + 3) / 4;
+	DWORD blockBytes = work.format == TEXTURE_BC1 ? 8 : 16;
+	double squared = 0.0;
+	double samples = 0.0;
+
+	for (DWORD by = 0; by < blocksHigh; by++) {
+		for (DWORD bx = 0; bx < blocksWide; bx++) {
+			DWORD decoded[16];
+
+			DecodeBlock(work.format, &level.blocks[(by * blocksWide + bx) * blockBytes], decoded);
+			for (DWORD y = 0; y < 4 && by * 4 + y < level.height; y++) {
+				for (DWORD x = 0; x < 4 && bx * 4 + x < level.width; x++) {
+					DWORD original = level.texels[(by * 4 + y) * level.width + bx * 4 + x];
+
+					for (int c = 0; c < 4 && shifts[work.format][c] >= 0; c++) {
+						int difference = (int)((original >> shifts[work.format][c]) & 0xFF) - (int)((decoded[y * 4 + x] >> shifts[work.format][c]) & 0xFF);
+
+						squared += difference * difference;
+						samples++;
+					}
+				}
+			}
+		}
+	}
+
+	if (squared == 0.0)
+		return TEXTURE_MAX_PSNR;
+	return min(TEXTURE_MAX_PSNR, 10.0 * log10(255.0 * 255.0 * samples / squared));
+}
+
+/*
+Gets where the texture tool writes the compressed version of a texture, which
+is loaded instead of the source when it exists.
+
+@param name - The file name of the source texture
+@param path - Receives the path of the compressed texture
+*/
+void CookedTexturePath(LPCWSTR name, std::wstring* path) {
+	LPCWSTR extension = _tcsrchr(name, TEXT('.'));
+
+	*path = std::wstring(TEXTURE_CACHE_DIR) + TEXT("\\") + std::wstring(name, extension ? extension - name : lstrlen(name)) + TEXT(".dds");
+}
+
+/*
+Builds a texture's mip chain and compresses every level to a DDS file. Colour
+textures are taken to be sRGB and averaged in linear light; normal maps, named
+with _bumpmap like Object looks for them, are averaged as vectors and
+renormalized. Normal maps become BC5, textures with any transparent texel BC3
+and the rest BC1. Both the mip levels and the blocks of every level are spread
+over the job system.
+
+@param pDevice - A device to load the source with, such as the null reference device
+@param jobs - The job system to run on
+@param source - The texture to compress
+@param destination - The DDS file to write
+@param result - Receives the format, sizes, times and PSNR
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the source can not be loaded or the destination written.
+*/
+int CompressTexture(LPDIRECT3DDEVICE9 pDevice, JobSystem* jobs, LPCWSTR source, LPCWSTR destination, TextureCompressionResult* result) {
+	static const DWORD fourCCs[3] = { D3DFMT_DXT1, D3DFMT_DXT5, TEXTURE_FOURCC_ATI2 };
+	D3DXIMAGE_INFO info;
+	CComPtr<IDirect3DSurface9> surface;
+	D3DLOCKED_RECT locked;
+	TextureWork work;
+	DdsHeader header;
+	DWORD magic = MAKEFOURCC('D', 'D', 'S', ' ');
+	std::vector<BYTE> file;
+	LARGE_INTEGER start, mipped, compressed, frequency;
+	DWORD blockBytes, levels = 1, texels = 0;
+	bool opaque = true;
+
+	ZeroMemory(result, sizeof(TextureCompressionResult));
+	if (FAILED(D3DXGetImageInfoFromFile(source, &info)) ||
+		FAILED(pDevice->CreateOffscreenPlainSurface(info.Width, info.Height, D3DFMT_A8R8G8B8, D3DPOOL_SYSTEMMEM, &surface, NULL)) ||
+		FAILED(D3DXLoadSurfaceFromFile(surface, NULL, NULL, source, NULL, D3DX_FILTER_NONE, 0, NULL))) {
+		SetError(TEXT("Could not load %s"), source);
+		return E_FAIL;
+	}
+
+	while ((max(info.Width, info.Height) >> levels) > 0)
+		levels++;
+
+	work.normalMap = _tcsstr(source, TEXT("_bumpmap")) != NULL;
+	work.levels.resize(levels);
+	work.levels[0].width = info.Width;
+	work.levels[0].height = info.Height;
+	work.levels[0].texels.resize(info.Width * info.Height);
+	if (FAILED(surface->LockRect(&locked, NULL, D3DLOCK_READONLY))) {
+		SetError(TEXT("Could not lock %s"), source);
+		return E_FAIL;
+	}
+	for (DWORD y = 0; y < info.Height; y++)
+		memcpy(&work.levels[0].texels[y * info.Width], (BYTE*)locked.pBits + y * locked.Pitch, info.Width * sizeof(DWORD));
+	surface->UnlockRect();
+
+	for (DWORD i = 0; i < work.levels[0].texels.size(); i++)
+		opaque = opaque && (work.levels[0].texels[i] >> 24) == 0xFF;
+	work.format = work.normalMap ? TEXTURE_BC5 : opaque ? TEXTURE_BC1 : TEXTURE_BC3;
+	blockBytes = work.format == TEXTURE_BC1 ? 8 : 16;
+	BuildGammaTables(&work);
+
+	QueryPerformanceCounter(&start);
+	work.levels[0].linear.resize(work.levels[0].texels.size());
+	for (DWORD i = 0; i < work.levels[0].texels.size(); i++)
+		work.levels[0].linear[i] = DecodeTexel(work, work.levels[0].texels[i]);
+
+	// Each level is built from the one above, so the levels go in turn and their rows in parallel
+	for (DWORD l = 1; l < levels; l++) {
+		TextureLevel& level = work.levels[l];
+
+		level.width = max(1u, work.levels[l - 1].width / 2);
+		level.height = max(1u, work.levels[l - 1].height / 2);
+		level.linear.resize(level.width * level.height);
+		level.texels.resize(level.width * level.height);
+		work.level = l;
+		jobs->parallelFor(level.height, TEXTURE_MIP_JOB_ROWS, MipJob, &work);
+	}
+	QueryPerformanceCounter(&mipped);
+
+	for (DWORD l = 0; l < levels; l++) {
+		TextureLevel& level = work.levels[l];
+		DWORD blocksHigh = (level.height + 3) / 4;
+
+		level.blocks.resize((level.width + 3) / 4 * blocksHigh * blockBytes);
+		for (DWORD row = 0; row < blocksHigh; row += TEXTURE_BLOCK_JOB_ROWS) {
+			BlockRun run = { l, row, min(row + TEXTURE_BLOCK_JOB_ROWS, blocksHigh) };
+			work.runs.push_back(run);
+		}
+		texels += level.width * level.height;
+		result->compressedBytes += (DWORD)level.blocks.size();
+	}
+	jobs->parallelFor((unsigned)work.runs.size(), 1, CompressJob, &work);
+	QueryPerformanceCounter(&compressed);
+	QueryPerformanceFrequency(&frequency);
+
+	ZeroMemory(&header, sizeof(DdsHeader));
+	header.size = sizeof(DdsHeader);
+	header.flags = DDS_HEADER_FLAGS;
+	header.height = info.Height;
+	header.width = info.Width;
+	header.linearSize = (DWORD)work.levels[0].blocks.size();
+	header.mipMapCount = levels;
+	header.formatSize = 32;
+	header.formatFlags = DDS_FOURCC;
+	header.fourCC = fourCCs[work.format];
+	header.caps = DDS_CAPS_MIPMAPPED;
+
+	file.insert(file.end(), (BYTE*)&magic, (BYTE*)&magic + sizeof(magic));
+	file.insert(file.end(), (BYTE*)&header, (BYTE*)&header + sizeof(header));
+	for (DWORD l = 0; l < levels; l++)
+		file.insert(file.end(), work.levels[l].blocks.begin(), work.levels[l].blocks.end());
+	if (!WriteWholeFile(destination, &file[0], (DWORD)file.size())) {
+		SetError(TEXT("Could not write %s"), destination);
+		return E_FAIL;
+	}
+
+	result->format = work.format;
+	result->width = info.Width;
+	result->height = info.Height;
+	result->levels = levels;
+	result->sourceBytes = texels * sizeof(DWORD);
+	result->mipTime = (mipped.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart;
+	result->compressTime = (compressed.QuadPart - mipped.QuadPart) * 1000.0 / frequency.QuadPart;
+	result->megatexelsPerSecond = result->compressTime > 0.0 ? texels / (result->compressTime * 1000.0) : 0.0;
+	result->psnr = MeasurePsnr(work, work.levels[0]);
+	return S_OK;
+}
+
+/*
+Compresses every texture in the working directory that is not block compressed
+yet into TEXTURE_CACHE_DIR, and reports for each its format, size, the time it
+took and its PSNR, both to the log and as a row of TEXTURE_REPORT_FILE. Cube
+maps, such as a baked environment map, are left alone.
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the null device can not be created, any texture could
+		  not be compressed or the report could not be written.
+*/
+int RunTextureTool() {
+	static const LPCWSTR patterns[] = { TEXT("*.bmp"), TEXT("*.dds"), TEXT("*.tga"), TEXT("*.png"), TEXT("*.jpg") };
+	static const LPCWSTR formatNames[3] = { TEXT("BC1"), TEXT("BC3"), TEXT("BC5") };
+	LPDIRECT3D9 pD3D;
+	LPDIRECT3DDEVICE9 pDevice;
+	JobSystem jobs;
+	std::ostringstream csv;
+	DWORD compressedCount = 0;
+	HRESULT r = S_OK;
+
+	if (FAILED(CreateNullDevice(&pD3D, &pDevice)))
+		return E_FAIL;
+
+	CreateDirectory(TEXTURE_CACHE_DIR, NULL);
+	jobs.start(0);
+
+	csv.setf(std::ios::fixed);
+	csv.precision(2);
+	csv << "source,destination,format,width,height,levels,sourceBytes,compressedBytes,mipMs,compressMs,megatexelsPerSecond,psnrDb\n";
+
+	for (DWORD p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+		WIN32_FIND_DATA found;
+		HANDLE find = FindFirstFile(patterns[p], &found);
+
+		if (find == INVALID_HANDLE_VALUE)
+			continue;
+		do {
+			D3DXIMAGE_INFO info;
+			std::wstring destination;
+			TextureCompressionResult result;
+
+			if (FAILED(D3DXGetImageInfoFromFile(found.cFileName, &info)) || info.ResourceType != D3DRTYPE_TEXTURE)
+				continue;
+
+			// Compressing a block compressed texture again would only lose more
+			if (info.Format == D3DFMT_DXT1 || info.Format == D3DFMT_DXT2 || info.Format == D3DFMT_DXT3 ||
+				info.Format == D3DFMT_DXT4 || info.Format == D3DFMT_DXT5 || info.Format == (D3DFORMAT)TEXTURE_FOURCC_ATI2) {
+				LogMessage(TEXT("Textures, %s: already block compressed, skipped"), found.cFileName);
+				continue;
+			}
+
+			CookedTexturePath(found.cFileName, &destination);
+			if (FAILED(CompressTexture(pDevice, &jobs, found.cFileName, destination.c_str(), &result))) {
+				r = E_FAIL;
+				continue;
+			}
+
+			LogMessage(TEXT("Textures, %s -> %s: %s %ux%u, %u levels, %u -> %u bytes, mips %.2f ms, compression %.2f ms (%.1f Mtexels/s), PSNR %.2f dB"),
+				found.cFileName, destination.c_str(), formatNames[result.format], result.width, result.height, result.levels,
+				result.sourceBytes, result.compressedBytes, result.mipTime, result.compressTime, result.megatexelsPerSecond, result.psnr);
+
+			char source[MAX_PATH], cooked[MAX_PATH], format[4];
+			WideCharToMultiByte(CP_UTF8, 0, found.cFileName, -1, source, MAX_PATH, NULL, NULL);
+			WideCharToMultiByte(CP_UTF8, 0, destination.c_str(), -1, cooked, MAX_PATH, NULL, NULL);
+			WideCharToMultiByte(CP_UTF8, 0, formatNames[result.format], -1, format, sizeof(format), NULL, NULL);
+			csv << '"' << source << "\",\"" << cooked << "\"," << format << ',' << result.width << ',' << result.height << ','
+				<< result.levels << ',' << result.sourceBytes << ',' << result.compressedBytes << ',' << result.mipTime << ','
+				<< result.compressTime << ',' << result.megatexelsPerSecond << ',' << result.psnr << '\n';
+			compressedCount++;
+		} while (FindNextFile(find, &found));
+		FindClose(find);
+	}
+
+	std::string report = csv.str();
+	if (!WriteWholeFile(TEXTURE_REPORT_FILE, report.c_str(), report.size())) {
+		SetError(TEXT("Could not write the texture report %s"), TEXTURE_REPORT_FILE);
+		r = E_FAIL;
+	}
+	else
+		LogMessage(TEXT("Textures: %u compressed, report in %s"), compressedCount, TEXTURE_REPORT_FILE);
+
+	pDevice->Release();
+	pD3D->Release();
+	return r;
+}
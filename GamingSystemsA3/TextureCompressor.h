@@ -0,0 +1,46 @@
+#ifndef TEXTURECOMPRESSOR_H
+#define TEXTURECOMPRESSOR_H
+
+#include "Headers.h"
+#include <string>
+#include <vector>
+
+//Folder the texture tool writes compressed textures to, relative to the working directory. A texture found here is loaded instead of its source.
+#define TEXTURE_CACHE_DIR TEXT("TextureCache")
+//File the texture tool writes its report to, one comma separated row per compressed texture.
+#define TEXTURE_REPORT_FILE TEXT("TextureCache\\report.csv")
+//Rows of texels each job filters when building a mip level.
+#define TEXTURE_MIP_JOB_ROWS 16
+//Rows of 4x4 blocks each job compresses; the jobs of every mip level run together.
+#define TEXTURE_BLOCK_JOB_ROWS 4
+//Steps of the table that converts linear intensity back to sRGB; enough that every 8-bit sRGB value has its own step.
+#define TEXTURE_GAMMA_STEPS 4096
+//PSNR reported for a level the compression reproduces exactly, in dB.
+#define TEXTURE_MAX_PSNR 99.0
+
+//The block compressed formats the texture tool writes.
+enum TextureFormat
+{
+	TEXTURE_BC1, // DXT1: colour, no alpha, 8 bytes a block
+	TEXTURE_BC3, // DXT5: colour and alpha, 16 bytes a block
+	TEXTURE_BC5  // ATI2: x and y of a tangent space normal map, 16 bytes a block
+};
+
+//What compressing one texture took and how close it came to its source.
+struct TextureCompressionResult
+{
+	TextureFormat format;
+	DWORD width, height, levels;
+	DWORD sourceBytes; // Of the mip chain at 32 bits a texel
+	DWORD compressedBytes;
+	double mipTime; // Milliseconds building the mip chain
+	double compressTime; // Milliseconds compressing every level
+	double megatexelsPerSecond; // Texels of every level compressed a second, in millions
+	double psnr; // Of the top level against the source, over the channels the format keeps, in dB
+};
+
+void CookedTexturePath(LPCWSTR name, std::wstring* path);
+int CompressTexture(LPDIRECT3DDEVICE9, JobSystem*, LPCWSTR source, LPCWSTR destination, TextureCompressionResult*);
+int RunTextureTool();
+
+#endif // !TEXTURECOMPRESSOR_H
@@ -0,0 +1,38 @@
+#include "TextureSize.h"
+#include <algorithm>
+
+/*
+Computes the size in bytes of one level of a texture. Block compressed formats
+are stored in 4x4 blocks, so a level smaller than a block still takes a whole
+one.
+
+@param format - The format of the level
+@param width, height - The size of the level in texels
+
+@return - The size of the level in bytes
+*/
+DWORD LevelBytes(D3DFORMAT format, DWORD width, DWORD height) {
+	DWORD blocksWide = std::max<DWORD>(1, (width + 3) / 4);
+	DWORD blocksHigh = std::max<DWORD>(1, (height + 3) / 4);
+
+	switch ((DWORD)format) {
+		case D3DFMT_DXT1:
+			return blocksWide * blocksHigh * 8;
+		case D3DFMT_DXT2:
+		case D3DFMT_DXT3:
+		case D3DFMT_DXT4:
+		case D3DFMT_DXT5:
+		case TEXTURE_FOURCC_ATI2:
+			return blocksWide * blocksHigh * 16;
+		case D3DFMT_R5G6B5:
+		case D3DFMT_X1R5G5B5:
+		case D3DFMT_A1R5G5B5:
+		case D3DFMT_A4R4G4B4:
+		case D3DFMT_L16:
+			return width * height * 2;
+		case D3DFMT_A16B16G16R16F:
+			return width * height * 8;
+		default:
+			return width * height * 4;
+	}
+}
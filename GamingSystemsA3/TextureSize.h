@@ -0,0 +1,13 @@
+#ifndef TEXTURESIZE_H
+#define TEXTURESIZE_H
+
+// Only sizes formats by their D3DFORMAT code, so it is part of the core library;
+// ResourceManager and the streaming budget measure textures with it.
+#include "CoreMath.h"
+
+//FourCC of the two channel normal map format, which D3D9 has no name for.
+#define TEXTURE_FOURCC_ATI2 MAKEFOURCC('A', 'T', 'I', '2')
+
+DWORD LevelBytes(D3DFORMAT format, DWORD width, DWORD height);
+
+#endif // !TEXTURESIZE_H
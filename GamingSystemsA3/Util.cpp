@@ -20,3 +20,106 @@ void SetError(TCHAR* szFormat, ...) {
 	OutputDebugString(szBuffer);
 	OutputDebugString(TEXT("\n"));
 }
+
+/*
+Prints a formatted informational message (timings, statistics) to the debug output.
+
+@param szFormat - The message string to be output with standard formatting
+				  characters allowed
+@param ... - The values to replace fields in the szFormat string
+*/
+void LogMessage(TCHAR* szFormat, ...) {
+	TCHAR szBuffer[1024];
+	va_list pArgList;
+
+	va_start(pArgList, szFormat);
+
+	_vsntprintf_s(szBuffer, sizeof(szBuffer) / sizeof(TCHAR), _TRUNCATE, szFormat, pArgList);
+
+	va_end(pArgList);
+
+	OutputDebugString(szBuffer);
+	OutputDebugString(TEXT("\n"));
+}
+
+/*
+Creates a null reference device for tools and benchmarks that run without a
+window. It can create resources and meshes but draws nothing.
+
+@param ppD3D - Receives the IDirect3D9 object
+@param ppDevice - Receives the device
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if either object can not be created; nothing is returned then.
+*/
+int CreateNullDevice(LPDIRECT3D9* ppD3D, LPDIRECT3DDEVICE9* ppDevice) {
+	D3DPRESENT_PARAMETERS d3dpp;
+
+	*ppDevice = 0;
+	*ppD3D = Direct3DCreate9(D3D_SDK_VERSION);
+	if (*ppD3D == NULL) {
+		SetError(TEXT("Could not create IDirect3D9 object"));
+		return E_FAIL;
+	}
+
+	ZeroMemory(&d3dpp, sizeof(d3dpp));
+	d3dpp.Windowed = TRUE;
+	d3dpp.SwapEffect = D3DSWAPEFFECT_DISCARD;
+	d3dpp.BackBufferFormat = D3DFMT_UNKNOWN;
+	d3dpp.BackBufferWidth = 1;
+	d3dpp.BackBufferHeight = 1;
+	if (FAILED((*ppD3D)->CreateDevice(D3DADAPTER_DEFAULT, D3DDEVTYPE_NULLREF, GetDesktopWindow(), D3DCREATE_SOFTWARE_VERTEXPROCESSING, &d3dpp, ppDevice))) {
+		SetError(TEXT("Could not create the null reference device"));
+		(*ppD3D)->Release();
+		*ppD3D = 0;
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+/*
+Reads a whole file into memory.
+
+@param path - The file to read
+@param data - Receives the contents of the file
+
+@return - Returns false if the file could not be opened or read
+*/
+bool ReadWholeFile(LPCWSTR path, std::vector<char>* data) {
+	HANDLE hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	DWORD size, read = 0;
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	size = GetFileSize(hFile, NULL);
+	data->resize(size);
+	if (size > 0 && !ReadFile(hFile, &(*data)[0], size, &read, NULL))
+		read = 0;
+	CloseHandle(hFile);
+
+	return read == size;
+}
+
+/*
+Writes a block of memory to a file, replacing the file if it exists.
+
+@param path - The file to write
+@param data - The bytes to write
+@param size - The number of bytes
+
+@return - Returns false if the file could not be written
+*/
+bool WriteWholeFile(LPCWSTR path, const void* data, DWORD size) {
+	HANDLE hFile = CreateFile(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	DWORD written = 0;
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	WriteFile(hFile, data, size, &written, NULL);
+	CloseHandle(hFile);
+
+	return written == size;
+}
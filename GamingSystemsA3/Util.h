@@ -2,8 +2,14 @@
 #define UTIL_H
 
 #include "Headers.h"
+#include <vector>
 
 void SetError(TCHAR*, ...);
+void LogMessage(TCHAR*, ...);
+
+int CreateNullDevice(LPDIRECT3D9* ppD3D, LPDIRECT3DDEVICE9* ppDevice);
+bool ReadWholeFile(LPCWSTR path, std::vector<char>* data);
+bool WriteWholeFile(LPCWSTR path, const void* data, DWORD size);
 
 
 
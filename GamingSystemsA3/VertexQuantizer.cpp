@@ -0,0 +1,245 @@
+#include "Headers.h"
+
+const D3DVERTEXELEMENT9 COMPACT_VERTEX_DECL[] =
+{
+	{ 0, 0, D3DDECLTYPE_SHORT4N, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0 },
+	{ 0, 8, D3DDECLTYPE_SHORT2N, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_NORMAL, 0 },
+	{ 0, 12, D3DDECLTYPE_FLOAT16_2, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 },
+	D3DDECL_END()
+};
+
+/*
+Converts a float in [-1, 1] to a 16-bit signed normalized integer.
+
+@param value - The value to convert, clamped to [-1, 1]
+
+@return - The quantized value
+*/
+short QuantizeSnorm(float value) {
+	value = max(-1.0f, min(1.0f, value));
+	return (short)floorf(value * 32767.0f + (value >= 0.0f ? 0.5f : -0.5f));
+}
+
+/*
+Converts a 16-bit signed normalized integer back to a float, the same way the
+vertex fetch unit does for D3DDECLTYPE_SHORT2N and D3DDECLTYPE_SHORT4N.
+
+@param value - The quantized value
+
+@return - The value in [-1, 1]
+*/
+float DequantizeSnorm(short value) {
+	return max(-1.0f, value / 32767.0f);
+}
+
+/*
+Encodes a unit vector with the octahedral mapping, which spreads the quantization
+error evenly over the sphere and needs only two components.
+
+@param n - The unit vector to encode
+@param out - Receives the two signed normalized components
+*/
+void OctEncode(const D3DXVECTOR3& n, short out[2]) {
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	float x = l1 > 0.0f ? n.x / l1 : 0.0f;
+	float y = l1 > 0.0f ? n.y / l1 : 0.0f;
+
+	// Fold the lower hemisphere over the diagonals
+	if (n.z < 0.0f) {
+		float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	out[0] = QuantizeSnorm(x);
+	out[1] = QuantizeSnorm(y);
+}
+
+/*
+Decodes an octahedral encoded unit vector. Mirrors DecodeOctahedral in the effect files.
+
+@param in - The two signed normalized components
+
+@return - The decoded unit vector
+*/
+D3DXVECTOR3 OctDecode(const short in[2]) {
+	float x = DequantizeSnorm(in[0]);
+	float y = DequantizeSnorm(in[1]);
+	D3DXVECTOR3 n(x, y, 1.0f - fabsf(x) - fabsf(y));
+
+	if (n.z < 0.0f) {
+		n.x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		n.y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+	}
+
+	D3DXVec3Normalize(&n, &n);
+	return n;
+}
+
+/*
+Decodes a compact vertex on the CPU. This is the software fallback of the vertex
+shader decode and matches it exactly.
+
+@param v - The vertex to decode
+@param info - The scale and bias of the mesh the vertex belongs to
+@param position - Receives the object space position
+@param normal - Receives the unit normal
+@param uv - Receives the texture coordinate
+*/
+void DecodeCompactVertex(const CompactVertex& v, const QuantizationInfo& info, D3DXVECTOR3* position, D3DXVECTOR3* normal, D3DXVECTOR2* uv) {
+	position->x = DequantizeSnorm(v.position[0]) * info.posScale.x + info.posBias.x;
+	position->y = DequantizeSnorm(v.position[1]) * info.posScale.y + info.posBias.y;
+	position->z = DequantizeSnorm(v.position[2]) * info.posScale.z + info.posBias.z;
+	*normal = OctDecode(v.normal);
+	D3DXFloat16To32Array(&uv->x, v.uv, 2);
+}
+
+/*
+Checks whether the device can fetch the compact vertex layout and decode it in a
+vertex shader.
+
+@param pDevice - The device to check
+
+@return - Returns true if compact meshes can be drawn on the device
+*/
+bool SupportsCompactVertices(LPDIRECT3DDEVICE9 pDevice) {
+	D3DCAPS9 caps;
+	DWORD needed = D3DDTCAPS_SHORT2N | D3DDTCAPS_SHORT4N | D3DDTCAPS_FLOAT16_2;
+
+	if (FAILED(pDevice->GetDeviceCaps(&caps)))
+		return false;
+
+	return caps.VertexShaderVersion >= D3DVS_VERSION(2, 0) && (caps.DeclTypes & needed) == needed;
+}
+
+/*
+Finds an element of a vertex declaration.
+
+@param decl - The declaration to search
+@param usage - The usage of the element to find
+@param offset - Receives the offset of the element in the vertex
+
+@return - Returns true if the declaration has an element with the usage
+*/
+bool FindElement(const D3DVERTEXELEMENT9* decl, BYTE usage, DWORD* offset) {
+	for (DWORD i = 0; decl[i].Stream != 0xFF; i++) {
+		if (decl[i].Usage == usage && decl[i].UsageIndex == 0) {
+			*offset = decl[i].Offset;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+Computes the scale and bias that map a mesh's bounding box onto the signed
+normalized range. The box is padded slightly so coarser detail levels, whose
+vertices can move a little outside the original hull, still fit.
+
+@param pMesh - The full detail mesh
+@param info - Receives the scale and bias, with the error and size totals cleared
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the vertex buffer can not be locked.
+*/
+int ComputeQuantization(LPD3DXMESH pMesh, QuantizationInfo* info) {
+	BYTE* pVertices = 0;
+	D3DXVECTOR3 boxMin, boxMax;
+
+	ZeroMemory(info, sizeof(QuantizationInfo));
+
+	if (FAILED(pMesh->LockVertexBuffer(D3DLOCK_READONLY, (void**)&pVertices))) {
+		SetError(TEXT("Could not lock vertex buffer"));
+		return E_FAIL;
+	}
+	D3DXComputeBoundingBox((D3DXVECTOR3*)pVertices, pMesh->GetNumVertices(), pMesh->GetNumBytesPerVertex(), &boxMin, &boxMax);
+	pMesh->UnlockVertexBuffer();
+
+	info->posBias = (boxMin + boxMax) * 0.5f;
+	info->posScale = (boxMax - boxMin) * 0.5f * 1.01f;
+	info->posScale.x = max(info->posScale.x, 1e-6f);
+	info->posScale.y = max(info->posScale.y, 1e-6f);
+	info->posScale.z = max(info->posScale.z, 1e-6f);
+
+	return S_OK;
+}
+
+/*
+Clones a mesh into the compact vertex layout. The encoded vertices are decoded
+again to track the largest position, normal and texture coordinate errors, and
+the vertex sizes before and after are added to the info totals.
+
+@param pSrc - The float mesh to compact
+@param pDevice - The device the compact mesh is created on
+@param info - The scale and bias from ComputeQuantization; receives the errors and sizes
+@param ppOut - Receives the compact mesh
+
+@return - Returns an int to be used as an HRESULT in the FAILED() macro.
+		  Fails if the mesh can not be cloned or its buffers locked.
+*/
+int BuildCompactMesh(LPD3DXMESH pSrc, LPDIRECT3DDEVICE9 pDevice, QuantizationInfo* info, LPD3DXMESH* ppOut) {
+	D3DVERTEXELEMENT9 decl[MAX_FVF_DECL_SIZE];
+	DWORD normalOffset, uvOffset;
+	bool hasNormal, hasUv;
+	BYTE* pSrcVertices = 0;
+	CompactVertex* pDstVertices = 0;
+	DWORD stride = pSrc->GetNumBytesPerVertex();
+	DWORD numVertices = pSrc->GetNumVertices();
+
+	pSrc->GetDeclaration(decl);
+	hasNormal = FindElement(decl, D3DDECLUSAGE_NORMAL, &normalOffset);
+	hasUv = FindElement(decl, D3DDECLUSAGE_TEXCOORD, &uvOffset);
+
+	if (FAILED(pSrc->CloneMesh(pSrc->GetOptions(), COMPACT_VERTEX_DECL, pDevice, ppOut))) {
+		SetError(TEXT("Could not clone mesh to the compact vertex layout"));
+		return E_FAIL;
+	}
+
+	if (FAILED(pSrc->LockVertexBuffer(D3DLOCK_READONLY, (void**)&pSrcVertices))) {
+		SetError(TEXT("Could not lock vertex buffer"));
+		(*ppOut)->Release();
+		*ppOut = 0;
+		return E_FAIL;
+	}
+	if (FAILED((*ppOut)->LockVertexBuffer(0, (void**)&pDstVertices))) {
+		SetError(TEXT("Could not lock vertex buffer"));
+		pSrc->UnlockVertexBuffer();
+		(*ppOut)->Release();
+		*ppOut = 0;
+		return E_FAIL;
+	}
+
+	for (DWORD v = 0; v < numVertices; v++) {
+		BYTE* pSrcVertex = pSrcVertices + v * stride;
+		CompactVertex& dst = pDstVertices[v];
+		D3DXVECTOR3 position = *(D3DXVECTOR3*)pSrcVertex;
+		D3DXVECTOR3 normal = hasNormal ? *(D3DXVECTOR3*)(pSrcVertex + normalOffset) : D3DXVECTOR3(0.0f, 0.0f, 1.0f);
+		D3DXVECTOR2 uv = hasUv ? *(D3DXVECTOR2*)(pSrcVertex + uvOffset) : D3DXVECTOR2(0.0f, 0.0f);
+		D3DXVECTOR3 decodedPosition, decodedNormal;
+		D3DXVECTOR2 decodedUv;
+
+		dst.position[0] = QuantizeSnorm((position.x - info->posBias.x) / info->posScale.x);
+		dst.position[1] = QuantizeSnorm((position.y - info->posBias.y) / info->posScale.y);
+		dst.position[2] = QuantizeSnorm((position.z - info->posBias.z) / info->posScale.z);
+		dst.position[3] = 32767;
+		D3DXVec3Normalize(&normal, &normal);
+		OctEncode(normal, dst.normal);
+		D3DXFloat32To16Array(dst.uv, &uv.x, 2);
+
+		DecodeCompactVertex(dst, *info, &decodedPosition, &decodedNormal, &decodedUv);
+		D3DXVECTOR3 positionError = decodedPosition - position;
+		float cosAngle = max(-1.0f, min(1.0f, D3DXVec3Dot(&decodedNormal, &normal)));
+		info->maxPositionError = max(info->maxPositionError, D3DXVec3Length(&positionError));
+		info->maxNormalError = max(info->maxNormalError, D3DXToDegree(acosf(cosAngle)));
+		info->maxUvError = max(info->maxUvError, max(fabsf(decodedUv.x - uv.x), fabsf(decodedUv.y - uv.y)));
+	}
+
+	(*ppOut)->UnlockVertexBuffer();
+	pSrc->UnlockVertexBuffer();
+
+	info->floatBytes += numVertices * stride;
+	info->compactBytes += numVertices * sizeof(CompactVertex);
+
+	return S_OK;
+}
@@ -0,0 +1,39 @@
+#ifndef VERTEXQUANTIZER_H
+#define VERTEXQUANTIZER_H
+
+#include "Headers.h"
+
+//The compact vertex layout: 16-bit positions relative to the bounding box,
+//octahedral 16-bit normals and half-float texture coordinates.
+struct CompactVertex
+{
+	short position[4];  // SHORT4N, w is unused
+	short normal[2];    // SHORT2N, octahedral encoded
+	D3DXFLOAT16 uv[2];  // FLOAT16_2
+};
+
+//How a compact mesh decodes back to object space, and how much was lost doing so.
+struct QuantizationInfo
+{
+	D3DXVECTOR3 posScale; // Half extent of the bounding box
+	D3DXVECTOR3 posBias;  // Center of the bounding box
+	float maxPositionError; // Largest position error in object space units
+	float maxNormalError;   // Largest normal error in degrees
+	float maxUvError;       // Largest texture coordinate error
+	DWORD floatBytes;   // Vertex bytes before compaction
+	DWORD compactBytes; // Vertex bytes after compaction
+};
+
+extern const D3DVERTEXELEMENT9 COMPACT_VERTEX_DECL[];
+
+short QuantizeSnorm(float);
+float DequantizeSnorm(short);
+void OctEncode(const D3DXVECTOR3&, short[2]);
+D3DXVECTOR3 OctDecode(const short[2]);
+void DecodeCompactVertex(const CompactVertex&, const QuantizationInfo&, D3DXVECTOR3*, D3DXVECTOR3*, D3DXVECTOR2*);
+bool FindElement(const D3DVERTEXELEMENT9* decl, BYTE usage, DWORD* offset);
+bool SupportsCompactVertices(LPDIRECT3DDEVICE9);
+int ComputeQuantization(LPD3DXMESH, QuantizationInfo*);
+int BuildCompactMesh(LPD3DXMESH, LPDIRECT3DDEVICE9, QuantizationInfo*, LPD3DXMESH*);
+
+#endif // !VERTEXQUANTIZER_H
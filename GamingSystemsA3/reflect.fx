@@ -87,6 +87,17 @@ float  Power
 
 > = 8.0f;
 
+// Decode of compact vertices: object space position = position * g_vPosScale + g_vPosBias
+float3 g_vPosScale
+<
+	bool SasUiVisible = false;
+> = {1.0f, 1.0f, 1.0f};
+
+float3 g_vPosBias
+<
+	bool SasUiVisible = false;
+> = {0.0f, 0.0f, 0.0f};
+
 float  Reflectivity
 <
     string SasUiLabel = "Material Reflectivity";
@@ -105,7 +116,7 @@ sampler_state
     Texture = <g_txScene>;
     MinFilter = Linear;
     MagFilter = Linear;
-    MipFilter = None;
+    MipFilter = Linear;
 };
 
 sampler g_samEnv<bool SasUiVisible = false;> =
@@ -118,6 +129,20 @@ sampler_state
 };
 
 
+//-----------------------------------------------------------------------------
+// Name: DecodeOctahedral
+// Type: Function
+// Desc: Decodes an octahedral encoded normal. Mirrors OctDecode in VertexQuantizer.cpp
+//-----------------------------------------------------------------------------
+float3 DecodeOctahedral( float2 e )
+{
+    float3 n = float3( e.xy, 1.0f - abs( e.x ) - abs( e.y ) );
+    if( n.z < 0.0f )
+        n.xy = ( 1.0f - abs( n.yx ) ) * ( step( 0.0f, n.xy ) * 2.0f - 1.0f );
+    return normalize( n );
+}
+
+
 //-----------------------------------------------------------------------------
 // Name: VertScene
 // Type: Vertex shader
@@ -191,6 +216,28 @@ float4 PixScene( float4 MatDiffuse : COLOR0,
 }
 
 
+//-----------------------------------------------------------------------------
+// Name: VertSceneQuantized
+// Type: Vertex shader
+// Desc: Decodes a compact vertex (SHORT4N position, octahedral SHORT2N normal,
+//       FLOAT16_2 texture coordinate) and lights it like VertScene
+//-----------------------------------------------------------------------------
+void VertSceneQuantized( float4 vPos : POSITION,
+                         float2 vNormal : NORMAL,
+                         float2 vTex0 : TEXCOORD0,
+                         out float4 oPos : POSITION,
+                         out float4 oDiffuse : COLOR0,
+                         out float2 oTex0 : TEXCOORD0,
+                         out float3 oViewPos : TEXCOORD1,
+                         out float3 oViewNormal : TEXCOORD2,
+                         out float3 oEnvTex : TEXCOORD3 )
+{
+    float4 vDecodedPos = float4( vPos.xyz * g_vPosScale + g_vPosBias, 1.0f );
+
+    VertScene( vDecodedPos, DecodeOctahedral( vNormal ), vTex0, oPos, oDiffuse, oTex0, oViewPos, oViewNormal, oEnvTex );
+}
+
+
 void VertScene1x( float4 vPos : POSITION,
                   float3 vNormal : NORMAL,
                   float2 vTex0 : TEXCOORD0,
@@ -269,3 +316,15 @@ technique RenderScene1x
         AlphaBlendEnable = false;
     }
 }
+
+
+technique RenderSceneQuantized
+{
+    pass P0
+    {
+        VertexShader = compile vs_2_0 VertSceneQuantized();
+        PixelShader  = compile ps_2_0 PixScene();
+        ZEnable = true;
+        AlphaBlendEnable = false;
+    }
+}
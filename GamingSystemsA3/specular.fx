@@ -73,6 +73,69 @@ float  Power
 
 > = 8.0f;
 
+// Decode of compact vertices: object space position = position * g_vPosScale + g_vPosBias
+float3 g_vPosScale
+<
+	bool SasUiVisible = false;
+> = {1.0f, 1.0f, 1.0f};
+
+float3 g_vPosBias
+<
+	bool SasUiVisible = false;
+> = {0.0f, 0.0f, 0.0f};
+
+// Lights chosen for the current object by the LightManager, already in view space.
+// Attenuation is (constant, linear, quadratic, range). Spot lights also have a
+// direction and a cone of (cos inner half angle, cos outer half angle, falloff);
+// other lights have a cone every direction is inside.
+#define MAX_LIGHTS 8
+
+int g_iNumLights
+<
+	bool SasUiVisible = false;
+> = 0;
+
+float4 g_vLightPositions[MAX_LIGHTS]
+<
+	bool SasUiVisible = false;
+>;
+
+float4 g_vLightColors[MAX_LIGHTS]
+<
+	bool SasUiVisible = false;
+>;
+
+float4 g_vLightAttenuation[MAX_LIGHTS]
+<
+	bool SasUiVisible = false;
+>;
+
+float4 g_vLightDirections[MAX_LIGHTS]
+<
+	bool SasUiVisible = false;
+>;
+
+float4 g_vLightCones[MAX_LIGHTS]
+<
+	bool SasUiVisible = false;
+>;
+
+float4 g_vAmbient
+<
+	bool SasUiVisible = false;
+> = {0.0f, 0.0f, 0.0f, 0.0f}; // Ambient light, added to the lights of the multi-light technique
+
+// Tangent space normal map of the current material, for the normal-mapping technique
+texture g_txNormal
+<
+	bool SasUiVisible = false;
+>;
+
+float g_fBumpiness
+<
+	bool SasUiVisible = false;
+> = 0.0f; // 1 to use g_txNormal, 0 for materials without a normal map
+
 
 //-----------------------------------------------------------------------------
 // Texture samplers
@@ -83,10 +146,33 @@ sampler_state
     Texture = <g_txScene>;
     MinFilter = Linear;
     MagFilter = Linear;
-    MipFilter = None;
+    MipFilter = Linear;
+};
+
+sampler g_samNormal< bool SasUiVisible = false; > =
+sampler_state
+{
+    Texture = <g_txNormal>;
+    MinFilter = Linear;
+    MagFilter = Linear;
+    MipFilter = Linear;
 };
 
 
+//-----------------------------------------------------------------------------
+// Name: DecodeOctahedral
+// Type: Function
+// Desc: Decodes an octahedral encoded normal. Mirrors OctDecode in VertexQuantizer.cpp
+//-----------------------------------------------------------------------------
+float3 DecodeOctahedral( float2 e )
+{
+    float3 n = float3( e.xy, 1.0f - abs( e.x ) - abs( e.y ) );
+    if( n.z < 0.0f )
+        n.xy = ( 1.0f - abs( n.yx ) ) * ( step( 0.0f, n.xy ) * 2.0f - 1.0f );
+    return normalize( n );
+}
+
+
 //-----------------------------------------------------------------------------
 // Name: VertScene
 // Type: Vertex shader
@@ -145,6 +231,125 @@ float4 PixScene( float4 MatDiffuse : COLOR0,
 }
 
 
+//-----------------------------------------------------------------------------
+// Name: VertSceneQuantized
+// Type: Vertex shader
+// Desc: Decodes a compact vertex (SHORT4N position, octahedral SHORT2N normal,
+//       FLOAT16_2 texture coordinate) and lights it like VertScene
+//-----------------------------------------------------------------------------
+void VertSceneQuantized( float4 vPos : POSITION,
+                         float2 vNormal : NORMAL,
+                         float2 vTex0 : TEXCOORD0,
+                         out float4 oPos : POSITION,
+                         out float4 oDiffuse : COLOR0,
+                         out float2 oTex0 : TEXCOORD0,
+                         out float3 oPosForPS : TEXCOORD1,
+                         out float3 oNormal : TEXCOORD2 )
+{
+    float4 vDecodedPos = float4( vPos.xyz * g_vPosScale + g_vPosBias, 1.0f );
+
+    VertScene( vDecodedPos, DecodeOctahedral( vNormal ), vTex0, oPos, oDiffuse, oTex0, oPosForPS, oNormal );
+}
+
+
+//-----------------------------------------------------------------------------
+// Name: ShadeLights
+// Type: Function
+// Desc: Lights a pixel with every light in g_vLightPositions using the same
+//       diffuse and half vector specular model as PixScene. Spot lights fade
+//       from the inner to the outer cone like the fixed-function pipeline
+//-----------------------------------------------------------------------------
+float4 ShadeLights( float2 Tex0, float3 Pos, float3 vNormal )
+{
+    float3 vEye = normalize( -Pos );
+    float4 vAlbedo = tex2D( g_samScene, Tex0 ) * Diffuse;
+    float3 vColor = vAlbedo.rgb * g_vAmbient.rgb;
+
+    for( int i = 0; i < g_iNumLights; i++ )
+    {
+        float3 vToLight = g_vLightPositions[i].xyz - Pos;
+        float fDistance = length( vToLight );
+        float4 vAtten = g_vLightAttenuation[i];
+        float fAtten = fDistance < vAtten.w ? 1.0f / max( dot( vAtten.xyz, float3( 1.0f, fDistance, fDistance * fDistance ) ), 0.001f ) : 0.0f;
+
+        vToLight /= fDistance;
+        float4 vCone = g_vLightCones[i];
+        float fSpot = saturate( ( dot( -vToLight, g_vLightDirections[i].xyz ) - vCone.y ) / max( vCone.x - vCone.y, 0.001f ) );
+        fAtten *= pow( fSpot, vCone.z );
+
+        float3 vHalf = normalize( vEye + vToLight );
+        float fDiffuse = saturate( dot( vNormal, vToLight ) );
+        float fSpecular = pow( saturate( dot( vHalf, vNormal ) ), Power );
+
+        vColor += g_vLightColors[i].rgb * fAtten * ( vAlbedo.rgb * fDiffuse + Specular.rgb * fSpecular );
+    }
+
+    return float4( vColor, 1.0f );
+}
+
+
+//-----------------------------------------------------------------------------
+// Name: PixSceneMultiLight
+// Type: Pixel shader
+// Desc: Lights the pixel with every light chosen by the LightManager
+//-----------------------------------------------------------------------------
+float4 PixSceneMultiLight( float4 MatDiffuse : COLOR0,
+                           float2 Tex0 : TEXCOORD0,
+                           float3 Pos : TEXCOORD1,
+                           float3 Normal : TEXCOORD2 ) : COLOR0
+{
+    return ShadeLights( Tex0, Pos, normalize( Normal ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Name: VertSceneNormalMap
+// Type: Vertex shader
+// Desc: Transforms like VertScene and passes the view-space tangent on. The
+//       tangent's w is the handedness of the texture mapping
+//-----------------------------------------------------------------------------
+void VertSceneNormalMap( float4 vPos : POSITION,
+                         float3 vNormal : NORMAL,
+                         float2 vTex0 : TEXCOORD0,
+                         float4 vTangent : TANGENT,
+                         out float4 oPos : POSITION,
+                         out float4 oDiffuse : COLOR0,
+                         out float2 oTex0 : TEXCOORD0,
+                         out float3 oPosForPS : TEXCOORD1,
+                         out float3 oNormal : TEXCOORD2,
+                         out float4 oTangent : TEXCOORD3 )
+{
+    float4x4 g_mWorldView= mul(g_mWorld, g_mView);
+
+    VertScene( vPos, vNormal, vTex0, oPos, oDiffuse, oTex0, oPosForPS, oNormal );
+    oTangent = float4( normalize( mul( vTangent.xyz, (float3x3)g_mWorldView ) ), vTangent.w );
+}
+
+
+//-----------------------------------------------------------------------------
+// Name: PixSceneNormalMap
+// Type: Pixel shader
+// Desc: Replaces the interpolated normal with the one from g_txNormal, then
+//       lights the pixel like PixSceneMultiLight
+//-----------------------------------------------------------------------------
+float4 PixSceneNormalMap( float4 MatDiffuse : COLOR0,
+                          float2 Tex0 : TEXCOORD0,
+                          float3 Pos : TEXCOORD1,
+                          float3 Normal : TEXCOORD2,
+                          float4 Tangent : TEXCOORD3 ) : COLOR0
+{
+    float3 vNormal = normalize( Normal );
+    float3 vTangent = normalize( Tangent.xyz - vNormal * dot( Tangent.xyz, vNormal ) );
+    float3 vBitangent = cross( vNormal, vTangent ) * Tangent.w;
+    // z is rebuilt from x and y, so two channel (BC5) normal maps work as well as full ones
+    float2 vMapXY = tex2D( g_samNormal, Tex0 ).xy * 2.0f - 1.0f;
+    float3 vMap = float3( vMapXY, sqrt( saturate( 1.0f - dot( vMapXY, vMapXY ) ) ) );
+    float3 vBump = lerp( float3( 0.0f, 0.0f, 1.0f ), vMap, g_fBumpiness );
+
+    return ShadeLights( Tex0, Pos, normalize( vBump.x * vTangent + vBump.y * vBitangent + vBump.z * vNormal ) );
+}
+
+
 void VertScene1x( float4 vPos : POSITION,
                   float3 vNormal : NORMAL,
                   float2 vTex0 : TEXCOORD0,
@@ -218,3 +423,39 @@ technique RenderScene1x
         AlphaBlendEnable = false;
     }
 }
+
+
+technique RenderSceneQuantized
+{
+    pass P0
+    {
+        VertexShader = compile vs_2_0 VertSceneQuantized();
+        PixelShader  = compile ps_2_0 PixScene();
+        ZEnable = true;
+        AlphaBlendEnable = false;
+    }
+}
+
+
+technique RenderSceneMultiLight
+{
+    pass P0
+    {
+        VertexShader = compile vs_3_0 VertScene();
+        PixelShader  = compile ps_3_0 PixSceneMultiLight();
+        ZEnable = true;
+        AlphaBlendEnable = false;
+    }
+}
+
+
+technique RenderSceneNormalMap
+{
+    pass P0
+    {
+        VertexShader = compile vs_3_0 VertSceneNormalMap();
+        PixelShader  = compile ps_3_0 PixSceneNormalMap();
+        ZEnable = true;
+        AlphaBlendEnable = false;
+    }
+}
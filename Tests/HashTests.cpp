@@ -0,0 +1,55 @@
+#include "Hash.h"
+#include "TestCheck.h"
+#include <cstring>
+
+/*
+HashBytes is 64-bit FNV-1a, so it matches the published values, and hashing in
+pieces gives the same hash as hashing all at once.
+*/
+static void MatchesFnv1a() {
+	const char* text = "foobar";
+
+	CHECK(HashBytes(HASH_SEED, "", 0) == 0xcbf29ce484222325ULL);
+	CHECK(HashBytes(HASH_SEED, "a", 1) == 0xaf63dc4c8601ec8cULL);
+	CHECK(HashBytes(HASH_SEED, text, strlen(text)) == 0x85944171f73967e8ULL);
+	CHECK(HashBytes(HashBytes(HASH_SEED, text, 3), text + 3, 3) == HashBytes(HASH_SEED, text, 6));
+}
+
+/*
+The shader cache key changes with the source, each define's name and value,
+the compile flags and the compiler version, and does not change otherwise.
+*/
+static void EffectKeyCoversEveryInput() {
+	const char* text = "float4 main() : COLOR { return 1; }";
+	std::vector<char> source(text, text + strlen(text)), edited(source);
+	std::vector<std::string> names(1, "NUM_LIGHTS"), values(1, "4"), otherValues(1, "8"), otherNames(1, "MAX_LIGHTS");
+	std::vector<std::string> none;
+	unsigned long long key = HashEffectSource(source, names, values, 0x1, 100);
+
+	edited.back() = ' ';
+	CHECK(HashEffectSource(source, names, values, 0x1, 100) == key);
+	CHECK(HashEffectSource(edited, names, values, 0x1, 100) != key);
+	CHECK(HashEffectSource(source, names, otherValues, 0x1, 100) != key);
+	CHECK(HashEffectSource(source, otherNames, values, 0x1, 100) != key);
+	CHECK(HashEffectSource(source, none, none, 0x1, 100) != key);
+	CHECK(HashEffectSource(source, names, values, 0x2, 100) != key);
+	CHECK(HashEffectSource(source, names, values, 0x1, 101) != key);
+}
+
+/*
+A define's name and value are kept apart, so "AB" defined empty and "A" defined
+as "B" compile different effects and get different keys.
+*/
+static void DefinesDoNotRunTogether() {
+	std::vector<char> source(1, ';');
+	std::vector<std::string> joined(1, "AB"), empty(1, ""), split(1, "A"), value(1, "B");
+
+	CHECK(HashEffectSource(source, joined, empty, 0, 0) != HashEffectSource(source, split, value, 0, 0));
+}
+
+int main() {
+	RUN_TEST(MatchesFnv1a);
+	RUN_TEST(EffectKeyCoversEveryInput);
+	RUN_TEST(DefinesDoNotRunTogether);
+	return TEST_RESULT();
+}
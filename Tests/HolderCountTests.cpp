@@ -0,0 +1,63 @@
+#include "HolderCount.h"
+#include "TestCheck.h"
+#include <utility>
+
+/*
+Each add is matched by a remove, and extra removes leave the count at zero.
+*/
+static void AddAndRemove() {
+	HolderCount count;
+
+	CHECK(!count.isHeld() && count.get() == 0);
+	count.add();
+	count.add();
+	CHECK(count.isHeld() && count.get() == 2);
+	count.remove();
+	CHECK(count.isHeld());
+	count.remove();
+	CHECK(!count.isHeld());
+	count.remove();
+	CHECK(!count.isHeld() && count.get() == 0);
+}
+
+/*
+A count made from a held one is not held, as an Object moved out of a manager's
+reach has nothing pointing at it, and the one it came from stays held.
+*/
+static void MoveLeavesHoldersBehind() {
+	HolderCount held;
+
+	held.add();
+	HolderCount moved(std::move(held));
+	CHECK(!moved.isHeld());
+	CHECK(held.isHeld());
+
+	HolderCount copied(held);
+	CHECK(!copied.isHeld());
+}
+
+/*
+Assigning keeps the holders the target already had and takes none from the
+source.
+*/
+static void AssignKeepsOwnHolders() {
+	HolderCount target, source;
+
+	target.add();
+	source.add();
+	source.add();
+	target = std::move(source);
+	CHECK(target.get() == 1);
+	CHECK(source.get() == 2);
+
+	HolderCount empty;
+	empty = target;
+	CHECK(!empty.isHeld());
+}
+
+int main() {
+	RUN_TEST(AddAndRemove);
+	RUN_TEST(MoveLeavesHoldersBehind);
+	RUN_TEST(AssignKeepsOwnHolders);
+	return TEST_RESULT();
+}
@@ -0,0 +1,164 @@
+#include "JobSystem.h"
+#include "TestCheck.h"
+#include <atomic>
+#include <vector>
+
+//Items in the parallel fors the tests run.
+#define TEST_ITEMS 100000
+
+//What a counting job adds to.
+struct CountData
+{
+	std::vector<std::atomic<int> >* visits;
+	std::atomic<long> jobs;
+};
+
+static void CountVisits(void* data, unsigned begin, unsigned end) {
+	CountData* count = (CountData*)data;
+
+	for (unsigned i = begin; i < end; i++)
+		(*count->visits)[i]++;
+	count->jobs++;
+}
+
+/*
+Every item of a parallel for is run exactly once, whatever the grain and the
+number of threads, and the range is split into about count / grain jobs.
+*/
+static void ParallelForVisitsEveryItemOnce() {
+	static const unsigned grains[] = { 1, 7, 64, TEST_ITEMS, TEST_ITEMS * 2 };
+	static const unsigned threads[] = { 1, 2, 4, 0 };
+
+	for (unsigned t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+		JobSystem jobs;
+
+		jobs.start(threads[t]);
+		for (unsigned g = 0; g < sizeof(grains) / sizeof(grains[0]); g++) {
+			std::vector<std::atomic<int> > visits(TEST_ITEMS);
+			CountData data;
+			bool once = true;
+
+			for (unsigned i = 0; i < TEST_ITEMS; i++)
+				visits[i] = 0;
+			data.visits = &visits;
+			data.jobs = 0;
+			jobs.parallelFor(TEST_ITEMS, grains[g], CountVisits, &data);
+
+			for (unsigned i = 0; i < TEST_ITEMS; i++)
+				once = once && visits[i] == 1;
+			CHECK(once);
+			CHECK(data.jobs == (long)((TEST_ITEMS + grains[g] - 1) / grains[g]));
+		}
+	}
+}
+
+/*
+A parallel for of nothing returns at once without running the function.
+*/
+static void ParallelForOfNothing() {
+	JobSystem jobs;
+	std::vector<std::atomic<int> > visits(1);
+	CountData data;
+
+	jobs.start(2);
+	visits[0] = 0;
+	data.visits = &visits;
+	data.jobs = 0;
+	jobs.parallelFor(0, 16, CountVisits, &data);
+	CHECK(data.jobs == 0);
+}
+
+//What a job that pushes jobs of its own works on.
+struct NestedData
+{
+	JobSystem* jobs;
+	std::vector<std::atomic<int> >* visits;
+};
+
+static void RunNested(void* data, unsigned begin, unsigned end) {
+	NestedData* nested = (NestedData*)data;
+
+	for (unsigned i = begin; i < end; i++) {
+		CountData count;
+		std::vector<std::atomic<int> > inner(64);
+
+		for (unsigned j = 0; j < inner.size(); j++)
+			inner[j] = 0;
+		count.visits = &inner;
+		count.jobs = 0;
+		nested->jobs->parallelFor((unsigned)inner.size(), 4, CountVisits, &count);
+
+		bool once = true;
+		for (unsigned j = 0; j < inner.size(); j++)
+			once = once && inner[j] == 1;
+		if (once)
+			(*nested->visits)[i]++;
+	}
+}
+
+/*
+A job may run a parallel for of its own and wait on it without deadlocking, and
+run() with a counter is finished once wait() returns.
+*/
+static void NestedJobsAndCounters() {
+	JobSystem jobs;
+	std::vector<std::atomic<int> > visits(32);
+	NestedData nested;
+	JobCounter counter;
+	Job job;
+	bool once = true;
+
+	jobs.start(4);
+	for (unsigned i = 0; i < visits.size(); i++)
+		visits[i] = 0;
+	nested.jobs = &jobs;
+	nested.visits = &visits;
+
+	for (unsigned i = 0; i < visits.size(); i++) {
+		job.function = RunNested;
+		job.data = &nested;
+		job.begin = i;
+		job.end = i + 1;
+		job.counter = &counter;
+		jobs.run(job);
+	}
+	jobs.wait(&counter);
+
+	CHECK(counter.pending == 0);
+	for (unsigned i = 0; i < visits.size(); i++)
+		once = once && visits[i] == 1;
+	CHECK(once);
+}
+
+/*
+A job system can be stopped and started again, and start(0) takes every hardware thread.
+*/
+static void RestartAndThreadCount() {
+	JobSystem jobs;
+	std::vector<std::atomic<int> > visits(1000);
+	CountData data;
+	bool once = true;
+
+	jobs.start(3);
+	CHECK(jobs.getNumThreads() == 3);
+	jobs.stop();
+	jobs.start(0);
+	CHECK(jobs.getNumThreads() >= 1);
+
+	for (unsigned i = 0; i < visits.size(); i++)
+		visits[i] = 0;
+	data.visits = &visits;
+	data.jobs = 0;
+	jobs.parallelFor((unsigned)visits.size(), 10, CountVisits, &data);
+	for (unsigned i = 0; i < visits.size(); i++)
+		once = once && visits[i] == 1;
+	CHECK(once);
+}
+
+int main() {
+	RUN_TEST(ParallelForVisitsEveryItemOnce);
+	RUN_TEST(ParallelForOfNothing);
+	RUN_TEST(NestedJobsAndCounters);
+	RUN_TEST(RestartAndThreadCount);
+	return TEST_RESULT();
+}
@@ -0,0 +1,243 @@
+#include "MemorySystem.h"
+#include "TestCheck.h"
+#include <cstddef>
+#include <cstring>
+#include <cwchar>
+#include <vector>
+
+//Bytes in each block of the arenas the tests make, small so a few allocations chain blocks.
+#define TEST_ARENA_BLOCK 1024
+
+//A type that needs the strictest alignment the heap guarantees.
+struct alignas(alignof(std::max_align_t)) WideNode
+{
+	char bytes[3 * alignof(std::max_align_t) - 1];
+};
+
+//A scene node shaped like the ones the game pools.
+struct SceneNode
+{
+	double position[3];
+	SceneNode* parent;
+	unsigned id;
+};
+
+/*
+Every allocation is aligned as asked, lies inside the arena's blocks and does
+not overlap any other, including allocations larger than a block.
+*/
+static void ArenaAlignsAndSeparates() {
+	static const size_t alignments[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+	static const size_t sizes[] = { 1, 3, 16, 100, 700, 3000 };
+	LinearArena arena(TEST_ARENA_BLOCK, MEMORY_FRAME);
+	std::vector<unsigned char*> blocks;
+	std::vector<size_t> lengths;
+	size_t requested = 0;
+
+	for (size_t a = 0; a < sizeof(alignments) / sizeof(alignments[0]); a++) {
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			unsigned char* p = (unsigned char*)arena.allocate(sizes[s], alignments[a]);
+
+			CHECK(((size_t)p & (alignments[a] - 1)) == 0);
+			memset(p, (int)blocks.size(), sizes[s]);
+			blocks.push_back(p);
+			lengths.push_back(sizes[s]);
+			requested += sizes[s];
+		}
+	}
+
+	// Each allocation still holds what was written to it, so none overlapped a later one
+	for (size_t i = 0; i < blocks.size(); i++) {
+		bool intact = true;
+
+		for (size_t b = 0; b < lengths[i]; b++)
+			intact = intact && blocks[i][b] == (unsigned char)i;
+		CHECK(intact);
+	}
+
+	CHECK(arena.getUsed() >= requested);
+	CHECK(arena.getPeak() == arena.getUsed());
+
+	// allocArray aligns for the type and at least to ARENA_ALIGNMENT
+	WideNode* wide = arena.allocArray<WideNode>(5);
+	CHECK(((size_t)wide % alignof(WideNode)) == 0);
+	CHECK(((size_t)arena.allocArray<char>(1) % ARENA_ALIGNMENT) == 0);
+}
+
+/*
+Resetting an arena that chained blocks leaves it one block that fits the whole
+cycle, so the same cycle again takes nothing from the heap, and the peak
+survives the reset.
+*/
+static void ArenaResetStopsGrowing() {
+	LinearArena arena(TEST_ARENA_BLOCK, MEMORY_FRAME);
+	MemoryCounters before, after;
+	unsigned long long heapBefore;
+	size_t peak;
+
+	for (int i = 0; i < 40; i++)
+		arena.allocate(100);
+	peak = arena.getPeak();
+	CHECK(peak >= 40 * 100);
+
+	arena.reset();
+	CHECK(arena.getUsed() == 0);
+	CHECK(arena.getPeak() == peak);
+
+	GetMemoryCounters(MEMORY_FRAME, &before);
+	heapBefore = GetThreadHeapAllocations();
+	for (int cycle = 0; cycle < 10; cycle++) {
+		for (int i = 0; i < 40; i++)
+			arena.allocate(100);
+		arena.reset();
+	}
+	GetMemoryCounters(MEMORY_FRAME, &after);
+	CHECK(after.allocations == before.allocations);
+	CHECK(after.frees == before.frees);
+	CHECK(GetThreadHeapAllocations() == heapBefore);
+}
+
+/*
+Releasing or destroying an arena hands back every byte it counted against its
+subsystem.
+*/
+static void ArenaReleaseReturnsEverything() {
+	MemoryCounters before, during, after;
+
+	GetMemoryCounters(MEMORY_ASSET, &before);
+	{
+		LinearArena arena(TEST_ARENA_BLOCK, MEMORY_ASSET);
+
+		for (int i = 0; i < 10; i++)
+			arena.allocate(TEST_ARENA_BLOCK);
+		GetMemoryCounters(MEMORY_ASSET, &during);
+		CHECK(during.allocations - before.allocations >= 10);
+		CHECK(during.bytes - before.bytes >= 10 * TEST_ARENA_BLOCK);
+		CHECK(during.peakBytes >= during.bytes);
+
+		arena.release();
+		CHECK(arena.getUsed() == 0);
+		arena.allocate(16);
+	}
+	GetMemoryCounters(MEMORY_ASSET, &after);
+	CHECK(after.bytes == before.bytes);
+	CHECK(after.allocations - before.allocations == after.frees - before.frees);
+	CHECK(after.peakBytes == during.peakBytes);
+}
+
+/*
+A pool hands out distinct, aligned slots across several chunks, takes them back
+and reuses them without growing, and frees its chunks when it is destroyed.
+*/
+static void PoolReusesSlots() {
+	MemoryCounters before, filled, refilled, after;
+	std::vector<SceneNode*> nodes;
+	std::vector<WideNode*> wide;
+	bool distinct = true, aligned = true;
+
+	GetMemoryCounters(MEMORY_SCENE, &before);
+	{
+		Pool<SceneNode> pool(8, MEMORY_SCENE);
+		Pool<WideNode> widePool(4, MEMORY_SCENE);
+
+		for (unsigned i = 0; i < 50; i++) {
+			SceneNode* node = pool.allocate();
+
+			node->id = i;
+			node->parent = i > 0 ? nodes[i - 1] : 0;
+			nodes.push_back(node);
+			wide.push_back(widePool.allocate());
+			aligned = aligned && ((size_t)node % alignof(SceneNode)) == 0 && ((size_t)wide.back() % alignof(WideNode)) == 0;
+		}
+		for (unsigned i = 0; i < nodes.size(); i++)
+			distinct = distinct && nodes[i]->id == i;
+		CHECK(distinct);
+		CHECK(aligned);
+		CHECK(pool.getLive() == 50);
+		GetMemoryCounters(MEMORY_SCENE, &filled);
+		CHECK(filled.allocations - before.allocations == (50 + 7) / 8 + (50 + 3) / 4);
+
+		for (unsigned i = 0; i < nodes.size(); i++)
+			pool.free(nodes[i]);
+		CHECK(pool.getLive() == 0);
+		for (unsigned i = 0; i < nodes.size(); i++)
+			nodes[i] = pool.allocate();
+		GetMemoryCounters(MEMORY_SCENE, &refilled);
+		CHECK(refilled.allocations == filled.allocations);
+		CHECK(pool.getLive() == 50);
+	}
+	GetMemoryCounters(MEMORY_SCENE, &after);
+	CHECK(after.bytes == before.bytes);
+	CHECK(after.frees - before.frees == after.allocations - before.allocations);
+}
+
+/*
+Heap allocations are counted for the program and for each thread, and each
+subsystem's counters only move with its own allocations.
+*/
+static void CountersTrackTheHeap() {
+	MemoryCounters frameBefore, sceneBefore, frameAfter, sceneAfter;
+	unsigned long long heapBefore = GetHeapAllocations(), threadBefore = GetThreadHeapAllocations();
+	int* p = new int[4];
+	void* block;
+
+	CHECK(GetHeapAllocations() - heapBefore >= 1);
+	CHECK(GetThreadHeapAllocations() - threadBefore == 1);
+	delete[] p;
+
+	GetMemoryCounters(MEMORY_FRAME, &frameBefore);
+	GetMemoryCounters(MEMORY_SCENE, &sceneBefore);
+	block = MemoryAllocate(4096, MEMORY_SCENE);
+	GetMemoryCounters(MEMORY_SCENE, &sceneAfter);
+	CHECK(sceneAfter.bytes - sceneBefore.bytes == 4096);
+	CHECK(sceneAfter.allocations - sceneBefore.allocations == 1);
+	CHECK(sceneAfter.peakBytes >= sceneAfter.bytes);
+	MemoryFree(block, 4096, MEMORY_SCENE);
+	MemoryFree(0, 4096, MEMORY_SCENE);
+	GetMemoryCounters(MEMORY_SCENE, &sceneAfter);
+	GetMemoryCounters(MEMORY_FRAME, &frameAfter);
+	CHECK(sceneAfter.bytes == sceneBefore.bytes);
+	CHECK(sceneAfter.frees - sceneBefore.frees == 1);
+	CHECK(frameAfter.allocations == frameBefore.allocations && frameAfter.bytes == frameBefore.bytes);
+
+	CHECK(wcscmp(GetMemoryTagName(MEMORY_FRAME), L"frame") == 0);
+	CHECK(wcscmp(GetMemoryTagName(MEMORY_SCENE), L"scene") == 0);
+}
+
+/*
+A frame shaped like the game's, with per-frame arrays from the frame arena and
+draw items that come and go through a pool, stops touching the heap once the
+first frame has sized everything.
+*/
+static void SteadyFrameDoesNotAllocate() {
+	LinearArena frameArena(TEST_ARENA_BLOCK, MEMORY_FRAME);
+	Pool<SceneNode> drawItems(32, MEMORY_SCENE);
+	SceneNode* live[20];
+	unsigned long long heapBefore = 0;
+
+	for (int frame = 0; frame < 20; frame++) {
+		// Everything from the second frame on is the steady state
+		if (frame == 1)
+			heapBefore = GetThreadHeapAllocations();
+
+		float* lights = frameArena.allocArray<float>(256 + frame % 3);
+		for (int i = 0; i < 256; i++)
+			lights[i] = (float)i;
+		for (int i = 0; i < 20; i++)
+			live[i] = drawItems.allocate();
+		for (int i = 0; i < 20; i++)
+			drawItems.free(live[i]);
+		frameArena.reset();
+	}
+	CHECK(GetThreadHeapAllocations() == heapBefore);
+}
+
+int main() {
+	RUN_TEST(ArenaAlignsAndSeparates);
+	RUN_TEST(ArenaResetStopsGrowing);
+	RUN_TEST(ArenaReleaseReturnsEverything);
+	RUN_TEST(PoolReusesSlots);
+	RUN_TEST(CountersTrackTheHeap);
+	RUN_TEST(SteadyFrameDoesNotAllocate);
+	return TEST_RESULT();
+}
@@ -0,0 +1,185 @@
+#include "Headers.h"
+#include "TestCheck.h"
+#include <vector>
+
+// How many Objects the vector test loads, enough that the vector reallocates a few times
+#define TEST_OBJECT_COUNT 5
+
+// The null reference device the Objects load onto
+static LPDIRECT3DDEVICE9 pDevice = 0;
+
+/*
+@return - How many references the device has, not counting the one taken to ask
+*/
+static ULONG DeviceReferences() {
+	pDevice->AddRef();
+	return pDevice->Release();
+}
+
+static unsigned long long HeldBytes(MemoryTag tag) {
+	MemoryCounters counters;
+
+	GetMemoryCounters(tag, &counters);
+	return counters.bytes;
+}
+
+static void LoadDwarf(Object* object) {
+	object->setDevice(&pDevice);
+	object->setFile(TEXT("Dwarf.x"));
+	CHECK(SUCCEEDED(object->InitGeometry()));
+}
+
+static DWORD VertexBytes(Object* object) {
+	ResidencyStats stats = {};
+
+	object->getResidency(&stats);
+	return stats.vertexBytes;
+}
+
+// Moving an Object hands its resources over without touching their reference counts
+static void MoveConstruct() {
+	ULONG baseline = DeviceReferences();
+	unsigned long long assetBytes = HeldBytes(MEMORY_ASSET);
+	{
+		Object source;
+		LoadDwarf(&source);
+		DWORD loadedBytes = VertexBytes(&source);
+		ULONG loadedReferences = DeviceReferences();
+
+		CHECK(loadedBytes > 0);
+		Object moved(std::move(source));
+		CHECK(VertexBytes(&moved) == loadedBytes);
+		CHECK(VertexBytes(&source) == 0);
+		CHECK(DeviceReferences() == loadedReferences);
+	}
+	CHECK(DeviceReferences() == baseline);
+	CHECK(HeldBytes(MEMORY_ASSET) == assetBytes);
+}
+
+// Move assignment releases what the target held before taking over the source
+static void MoveAssign() {
+	ULONG baseline = DeviceReferences();
+	unsigned long long assetBytes = HeldBytes(MEMORY_ASSET);
+	{
+		Object first, second;
+		LoadDwarf(&first);
+		ULONG oneLoaded = DeviceReferences();
+		LoadDwarf(&second);
+
+		second = std::move(first);
+		CHECK(DeviceReferences() == oneLoaded);
+		CHECK(VertexBytes(&first) == 0);
+		CHECK(VertexBytes(&second) > 0);
+
+		second = std::move(second);
+		CHECK(VertexBytes(&second) > 0);
+	}
+	CHECK(DeviceReferences() == baseline);
+	CHECK(HeldBytes(MEMORY_ASSET) == assetBytes);
+}
+
+// Objects survive being moved around as a vector grows
+static void VectorGrowth() {
+	ULONG baseline = DeviceReferences();
+	unsigned long long assetBytes = HeldBytes(MEMORY_ASSET);
+	{
+		std::vector<Object> objects;
+		DWORD loadedBytes = 0;
+
+		for (int i = 0; i < TEST_OBJECT_COUNT; i++) {
+			Object object;
+			LoadDwarf(&object);
+			loadedBytes = VertexBytes(&object);
+			objects.push_back(std::move(object));
+		}
+		for (int i = 0; i < TEST_OBJECT_COUNT; i++)
+			CHECK(VertexBytes(&objects[i]) == loadedBytes);
+	}
+	CHECK(DeviceReferences() == baseline);
+	CHECK(HeldBytes(MEMORY_ASSET) == assetBytes);
+}
+
+// Cleaning up twice, then destroying, releases everything exactly once
+static void DoubleCleanup() {
+	ULONG baseline = DeviceReferences();
+	{
+		Object object;
+		LoadDwarf(&object);
+		object.cleanup();
+		CHECK(DeviceReferences() == baseline);
+		object.cleanup();
+		CHECK(DeviceReferences() == baseline);
+	}
+	CHECK(DeviceReferences() == baseline);
+}
+
+// An Object may move again once the ResourceManager has let go of it
+static void RegisteredObject() {
+	ResourceManager resources;
+	Object object;
+
+	resources.setDevice(&pDevice);
+	LoadDwarf(&object);
+	resources.registerObject(&object);
+	resources.registerObject(&object);
+	resources.unregisterObject(&object);
+
+	Object moved(std::move(object));
+	CHECK(VertexBytes(&moved) > 0);
+	resources.unregisterObject(&moved);
+}
+
+// A headless Game starts up and shuts down twice without leaking or releasing anything twice
+static void GameShutdown() {
+	WNDCLASSEX wc = {};
+	unsigned long long assetBytes = HeldBytes(MEMORY_ASSET);
+	unsigned long long sceneBytes = HeldBytes(MEMORY_SCENE);
+
+	wc.cbSize = sizeof(WNDCLASSEX);
+	wc.cbClsExtra = sizeof(Game*);
+	wc.lpfnWndProc = Game::StaticProc;
+	wc.hInstance = GetModuleHandle(NULL);
+	wc.lpszClassName = TEXT("OwnershipTests");
+	RegisterClassEx(&wc);
+
+	HWND hWnd = CreateWindowEx(0, wc.lpszClassName, wc.lpszClassName, WS_OVERLAPPEDWINDOW,
+		CW_USEDEFAULT, CW_USEDEFAULT, 512, 512, NULL, NULL, wc.hInstance, NULL);
+	CHECK(hWnd != NULL);
+	{
+		Game game(hWnd);
+
+		SetClassLongPtr(hWnd, 0, (LONG_PTR)&game);
+		game.setBenchmark(BENCHMARK_DEFAULT_SCENE, true);
+		CHECK(SUCCEEDED(game.GameInit()));
+		CHECK(SUCCEEDED(game.GameShutdown()));
+		CHECK(SUCCEEDED(game.GameShutdown()));
+		SetClassLongPtr(hWnd, 0, 0);
+	}
+	DestroyWindow(hWnd);
+
+	CHECK(HeldBytes(MEMORY_ASSET) == assetBytes);
+	CHECK(HeldBytes(MEMORY_SCENE) == sceneBytes);
+}
+
+int main() {
+	LPDIRECT3D9 pD3D;
+
+	if (FAILED(CreateNullDevice(&pD3D, &pDevice))) {
+		fprintf(stderr, "The null reference device is not available\n");
+		return 1;
+	}
+
+	RUN_TEST(MoveConstruct);
+	RUN_TEST(MoveAssign);
+	RUN_TEST(VectorGrowth);
+	RUN_TEST(DoubleCleanup);
+	RUN_TEST(RegisteredObject);
+
+	// Nothing the tests loaded may still hold the device
+	CHECK(pDevice->Release() == 0);
+	pD3D->Release();
+
+	RUN_TEST(GameShutdown);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,137 @@
+#include "MicroBenchmark.h"
+#include "Placement.h"
+#include "TestCheck.h"
+#include <cmath>
+#include <utility>
+
+static bool MatricesMatch(const D3DXMATRIX& a, const D3DXMATRIX& b, float tolerance) {
+	for (int r = 0; r < 4; r++) {
+		for (int c = 0; c < 4; c++) {
+			if (fabsf(a(r, c) - b(r, c)) > tolerance)
+				return false;
+		}
+	}
+	return true;
+}
+
+/*
+The world matrix scales, then rotates, then translates, with row vectors as
+Direct3D uses them: a point on the X axis of a Placement scaled by 2, turned a
+quarter about Y and moved up 5 lands at (0, 5, -2).
+*/
+static void WorldMatrixScalesRotatesTranslates() {
+	Placement placement;
+	D3DXVECTOR3 point(1.0f, 0.0f, 0.0f), moved;
+	D3DXMATRIX identity;
+
+	D3DXMatrixIdentity(&identity);
+	CHECK(MatricesMatch(placement.getWorldMatrix(), identity, 0.0f));
+
+	placement.setScale(D3DXVECTOR3(2.0f, 2.0f, 2.0f));
+	placement.rotateAboutY(D3DX_PI / 2);
+	placement.translate(0.0f, 5.0f, 0.0f);
+	D3DXVec3TransformCoord(&moved, &point, &placement.getWorldMatrix());
+	CHECK(fabsf(moved.x) < 1e-5f && fabsf(moved.y - 5.0f) < 1e-5f && fabsf(moved.z + 2.0f) < 1e-5f);
+}
+
+/*
+Later turns are about the world axes: turning about X then Y carries the X axis
+to where turning about Y alone does, since the X turn leaves it in place.
+*/
+static void RotationsComposeInWorldSpace() {
+	Placement both, yOnly;
+	D3DXVECTOR3 axis(1.0f, 0.0f, 0.0f), a, b;
+
+	both.rotateAboutX(0.7f);
+	both.rotateAboutY(0.3f);
+	yOnly.rotateAboutY(0.3f);
+	D3DXVec3TransformNormal(&a, &axis, &both.getWorldMatrix());
+	D3DXVec3TransformNormal(&b, &axis, &yOnly.getWorldMatrix());
+	CHECK(fabsf(a.x - b.x) < 1e-5f && fabsf(a.y - b.y) < 1e-5f && fabsf(a.z - b.z) < 1e-5f);
+}
+
+/*
+The world matrix is rebuilt after each change and not before: setting a value
+shows in the next call, and the orientation is kept normalized whatever it is
+set to.
+*/
+static void ChangesRebuildTheWorldMatrix() {
+	Placement placement;
+	D3DXQUATERNION orientation;
+
+	placement.getWorldMatrix();
+	placement.setPosition(D3DXVECTOR3(3.0f, 4.0f, 5.0f));
+	CHECK(placement.getWorldMatrix()._41 == 3.0f && placement.getWorldMatrix()._43 == 5.0f);
+
+	placement.setOrientation(D3DXQUATERNION(0.0f, 0.0f, 2.0f, 0.0f));
+	placement.getOrientation(&orientation);
+	CHECK(fabsf(D3DXQuaternionDot(&orientation, &orientation) - 1.0f) < 1e-6f);
+	CHECK(fabsf(placement.getWorldMatrix()._11 + 1.0f) < 1e-6f);
+}
+
+/*
+A rotation measures as orthonormal whatever its scale, and a sheared matrix
+does not.
+*/
+static void OrthonormalityErrorFindsShear() {
+	Placement placement;
+	D3DXMATRIX sheared;
+
+	placement.rotateAboutZ(1.0f);
+	placement.setScale(D3DXVECTOR3(3.0f, 0.5f, 2.0f));
+	CHECK(Placement::OrthonormalityError(placement.getWorldMatrix()) < 1e-6f);
+
+	D3DXMatrixIdentity(&sheared);
+	sheared._21 = 0.5f;
+	CHECK(Placement::OrthonormalityError(sheared) > 0.4f);
+}
+
+/*
+A million random turns, as a long session of dragging a model around makes,
+leave the world matrix a rotation.
+*/
+static void NoDriftAfterManyRotations() {
+	double nsPerRotation;
+	float error;
+
+	CHECK(CheckRotationDrift(&nsPerRotation, &error));
+	CHECK(error <= MICROBENCH_MAX_DRIFT);
+	printf("%u rotations: %.1f ns each, orthonormality error %g\n", (unsigned)MICROBENCH_DRIFT_ROTATIONS, nsPerRotation, error);
+}
+
+/*
+A moved or copied Placement puts its Object in the same place, with or without
+a world matrix built before the move, and changing the copy leaves the original
+where it was.
+*/
+static void MoveKeepsTransform() {
+	Placement source;
+	D3DXVECTOR3 position;
+
+	source.translate(1.0f, 2.0f, 3.0f);
+	source.rotateAboutY(0.5f);
+	source.setScale(D3DXVECTOR3(2.0f, 2.0f, 2.0f));
+
+	Placement unbuilt(source);
+	D3DXMATRIX world = source.getWorldMatrix();
+	Placement moved(std::move(source));
+	CHECK(MatricesMatch(moved.getWorldMatrix(), world, 0.0f));
+	CHECK(MatricesMatch(unbuilt.getWorldMatrix(), world, 0.0f));
+
+	Placement assigned;
+	assigned = moved;
+	assigned.translate(5.0f, 0.0f, 0.0f);
+	CHECK(MatricesMatch(moved.getWorldMatrix(), world, 0.0f));
+	assigned.getPosition(&position);
+	CHECK(position == D3DXVECTOR3(6.0f, 2.0f, 3.0f));
+}
+
+int main() {
+	RUN_TEST(WorldMatrixScalesRotatesTranslates);
+	RUN_TEST(RotationsComposeInWorldSpace);
+	RUN_TEST(ChangesRebuildTheWorldMatrix);
+	RUN_TEST(OrthonormalityErrorFindsShear);
+	RUN_TEST(NoDriftAfterManyRotations);
+	RUN_TEST(MoveKeepsTransform);
+	return TEST_RESULT();
+}
@@ -0,0 +1,253 @@
+#include "SpatialGrid.h"
+#include "TestCheck.h"
+#include <algorithm>
+#include <cmath>
+
+/*
+Insert, update, remove and the counts keep track of which ids are in the grid.
+*/
+static void InsertUpdateRemove() {
+	SpatialGrid grid(4.0f);
+	std::vector<DWORD> found;
+
+	grid.insert(3, D3DXVECTOR3(0.0f, 0.0f, 0.0f), 1.0f);
+	grid.insert(7, D3DXVECTOR3(20.0f, 0.0f, 0.0f), 1.0f);
+	CHECK(grid.getCount() == 2);
+	CHECK(grid.contains(3) && grid.contains(7) && !grid.contains(5));
+
+	grid.querySphere(D3DXVECTOR3(0.0f, 0.0f, 0.0f), 2.0f, &found);
+	CHECK(found.size() == 1 && found[0] == 3);
+
+	// Moving an entry across cells moves it in every query
+	grid.update(3, D3DXVECTOR3(20.0f, 2.0f, 0.0f), 1.0f);
+	grid.querySphere(D3DXVECTOR3(0.0f, 0.0f, 0.0f), 2.0f, &found);
+	CHECK(found.empty());
+	grid.querySphere(D3DXVECTOR3(20.0f, 1.0f, 0.0f), 2.0f, &found);
+	std::sort(found.begin(), found.end());
+	CHECK(found.size() == 2 && found[0] == 3 && found[1] == 7);
+
+	grid.remove(7);
+	CHECK(grid.getCount() == 1 && !grid.contains(7));
+	grid.queryBox(D3DXVECTOR3(15.0f, -5.0f, -5.0f), D3DXVECTOR3(25.0f, 5.0f, 5.0f), &found);
+	CHECK(found.size() == 1 && found[0] == 3);
+
+	grid.clear();
+	CHECK(grid.getCount() == 0 && !grid.contains(3));
+}
+
+/*
+A ray hits the nearest sphere along it, not one behind it or off to the side,
+and misses past its maximum distance.
+*/
+static void RaycastFindsNearest() {
+	SpatialGrid grid;
+	Ray ray;
+	DWORD id = 0;
+	float distance = 0.0f;
+
+	grid.insert(0, D3DXVECTOR3(0.0f, 0.0f, 30.0f), 1.0f);
+	grid.insert(1, D3DXVECTOR3(0.0f, 0.0f, 10.0f), 1.0f);
+	grid.insert(2, D3DXVECTOR3(0.0f, 0.0f, -10.0f), 1.0f);
+	grid.insert(3, D3DXVECTOR3(5.0f, 0.0f, 5.0f), 1.0f);
+
+	ray._origin = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+	ray._direction = D3DXVECTOR3(0.0f, 0.0f, 1.0f);
+	CHECK(grid.raycast(ray, 100.0f, &id, &distance));
+	CHECK(id == 1);
+	CHECK(fabsf(distance - 9.0f) < 0.001f);
+	CHECK(!grid.raycast(ray, 5.0f, &id, &distance));
+}
+
+/*
+Frustum queries through the grid find exactly the spheres the frustum test
+finds on its own, for a camera inside and one outside the scene.
+*/
+static void FrustumMatchesLinearTest() {
+	SpatialGrid grid(2.0f);
+	std::vector<D3DXVECTOR3> centers;
+	std::vector<DWORD> found, expected;
+	D3DXMATRIX view, proj;
+	D3DXVECTOR3 eyes[2] = { D3DXVECTOR3(0.0f, 0.0f, -5.0f), D3DXVECTOR3(-60.0f, 10.0f, -60.0f) };
+	D3DXVECTOR3 at(0.0f, 0.0f, 0.0f), up(0.0f, 1.0f, 0.0f);
+	Frustum frustum;
+
+	for (int x = -20; x <= 20; x += 2) {
+		for (int z = -20; z <= 20; z += 2)
+			centers.push_back(D3DXVECTOR3((float)x, (float)((x * z) % 5), (float)z));
+	}
+	for (DWORD i = 0; i < centers.size(); i++)
+		grid.insert(i, centers[i], 0.5f + (i % 3) * 0.5f);
+
+	D3DXMatrixPerspectiveFovLH(&proj, D3DX_PI / 4, 1.0f, 1.0f, 100.0f);
+	for (int e = 0; e < 2; e++) {
+		D3DXMatrixLookAtLH(&view, &eyes[e], &at, &up);
+		BuildFrustum(view * proj, &frustum);
+
+		grid.queryFrustum(frustum, &found);
+		expected.clear();
+		for (DWORD i = 0; i < centers.size(); i++) {
+			if (SphereInFrustum(frustum, centers[i], 0.5f + (i % 3) * 0.5f))
+				expected.push_back(i);
+		}
+		std::sort(found.begin(), found.end());
+		CHECK(!expected.empty());
+		CHECK(found == expected);
+	}
+}
+
+//Spheres in the random scene the brute-force test moves around, and the moves made.
+#define TEST_RANDOM_OBJECTS 2000
+#define TEST_RANDOM_STEPS 20
+
+//A sphere of the brute-force reference, or an unused id when radius is negative.
+struct ReferenceSphere
+{
+	D3DXVECTOR3 center;
+	float radius;
+};
+
+static float RandomFloat(unsigned* seed, float lo, float hi) {
+	*seed = *seed * 1664525u + 1013904223u;
+	return lo + (*seed >> 8) / 16777216.0f * (hi - lo);
+}
+
+static D3DXVECTOR3 RandomPoint(unsigned* seed, float extent) {
+	float x = RandomFloat(seed, -extent, extent);
+	float y = RandomFloat(seed, -extent, extent);
+
+	return D3DXVECTOR3(x, y, RandomFloat(seed, -extent, extent));
+}
+
+/*
+Sphere, box and ray queries find what testing every object finds, after rounds
+of small moves, jumps across the scene, growing and shrinking, removals and
+reinsertions in random order, as a running game makes them. A few spheres are
+much larger than a cell.
+*/
+static void QueriesMatchBruteForceAfterUpdates() {
+	SpatialGrid grid(4.0f);
+	std::vector<ReferenceSphere> spheres(TEST_RANDOM_OBJECTS);
+	std::vector<DWORD> found, expected;
+	unsigned seed = 7;
+
+	for (DWORD i = 0; i < TEST_RANDOM_OBJECTS; i++) {
+		spheres[i].center = RandomPoint(&seed, 100.0f);
+		spheres[i].radius = (i % 100 == 0) ? RandomFloat(&seed, 10.0f, 30.0f) : RandomFloat(&seed, 0.1f, 3.0f);
+		grid.insert(i, spheres[i].center, spheres[i].radius);
+	}
+
+	for (int step = 0; step < TEST_RANDOM_STEPS; step++) {
+		for (DWORD n = 0; n < TEST_RANDOM_OBJECTS / 4; n++) {
+			DWORD i = (DWORD)RandomFloat(&seed, 0.0f, (float)TEST_RANDOM_OBJECTS) % TEST_RANDOM_OBJECTS;
+			float choice = RandomFloat(&seed, 0.0f, 1.0f);
+
+			if (spheres[i].radius < 0.0f) {
+				spheres[i].center = RandomPoint(&seed, 100.0f);
+				spheres[i].radius = RandomFloat(&seed, 0.1f, 3.0f);
+				grid.insert(i, spheres[i].center, spheres[i].radius);
+				continue;
+			}
+
+			if (choice < 0.6f) {
+				spheres[i].center += RandomPoint(&seed, 1.0f);
+			}
+			else if (choice < 0.8f) {
+				spheres[i].center = RandomPoint(&seed, 150.0f);
+			}
+			else if (choice < 0.95f) {
+				spheres[i].radius = RandomFloat(&seed, 0.1f, 8.0f);
+			}
+			else {
+				spheres[i].radius = -1.0f;
+				grid.remove(i);
+				continue;
+			}
+			grid.update(i, spheres[i].center, spheres[i].radius);
+		}
+
+		// A sphere query, a box query and a ray from each of a few random points
+		for (int q = 0; q < 8; q++) {
+			D3DXVECTOR3 center = RandomPoint(&seed, 120.0f);
+			D3DXVECTOR3 size = RandomPoint(&seed, 20.0f);
+			D3DXVECTOR3 boxMin = center - D3DXVECTOR3(fabsf(size.x), fabsf(size.y), fabsf(size.z));
+			D3DXVECTOR3 boxMax = center + D3DXVECTOR3(fabsf(size.x), fabsf(size.y), fabsf(size.z));
+			float radius = RandomFloat(&seed, 0.0f, 25.0f);
+			Ray ray;
+			DWORD hitId = 0;
+			float hitDistance = 0.0f, nearest = 500.0f;
+			bool expectHit = false;
+
+			grid.querySphere(center, radius, &found);
+			expected.clear();
+			for (DWORD i = 0; i < TEST_RANDOM_OBJECTS; i++) {
+				D3DXVECTOR3 offset = spheres[i].center - center;
+				float reach = spheres[i].radius + radius;
+
+				if (spheres[i].radius >= 0.0f && D3DXVec3LengthSq(&offset) <= reach * reach)
+					expected.push_back(i);
+			}
+			std::sort(found.begin(), found.end());
+			CHECK(found == expected);
+
+			grid.queryBox(boxMin, boxMax, &found);
+			expected.clear();
+			for (DWORD i = 0; i < TEST_RANDOM_OBJECTS; i++) {
+				const float* c = spheres[i].center;
+				const float* bMin = boxMin;
+				const float* bMax = boxMax;
+				float distanceSq = 0.0f;
+
+				for (int a = 0; a < 3; a++) {
+					float d = c[a] < bMin[a] ? bMin[a] - c[a] : (c[a] > bMax[a] ? c[a] - bMax[a] : 0.0f);
+					distanceSq += d * d;
+				}
+				if (spheres[i].radius >= 0.0f && distanceSq <= spheres[i].radius * spheres[i].radius)
+					expected.push_back(i);
+			}
+			std::sort(found.begin(), found.end());
+			CHECK(found == expected);
+
+			ray._origin = center;
+			ray._direction = RandomPoint(&seed, 1.0f);
+			D3DXVec3Normalize(&ray._direction, &ray._direction);
+			for (DWORD i = 0; i < TEST_RANDOM_OBJECTS; i++) {
+				D3DXVECTOR3 offset = ray._origin - spheres[i].center;
+				float b = D3DXVec3Dot(&ray._direction, &offset);
+				float c = D3DXVec3Dot(&offset, &offset) - spheres[i].radius * spheres[i].radius;
+				float discriminant = b * b - c;
+
+				if (spheres[i].radius < 0.0f || (c > 0.0f && b > 0.0f) || discriminant < 0.0f)
+					continue;
+				float t = std::max(0.0f, -b - sqrtf(discriminant));
+				if (t <= nearest) {
+					nearest = t;
+					expectHit = true;
+				}
+			}
+			CHECK(grid.raycast(ray, 500.0f, &hitId, &hitDistance) == expectHit);
+			if (expectHit)
+				CHECK(fabsf(hitDistance - nearest) < 1e-3f);
+		}
+	}
+}
+
+/*
+The benchmark's own comparison of every query against linear tests agrees on a
+scene small enough for a test run.
+*/
+static void BenchmarkQueriesMatch() {
+	SpatialBenchmarkResult result;
+
+	BenchmarkSpatialGrid(20000, &result);
+	CHECK(result.matched);
+	CHECK(result.objects == 20000 && result.cells > 0);
+}
+
+int main() {
+	RUN_TEST(InsertUpdateRemove);
+	RUN_TEST(RaycastFindsNearest);
+	RUN_TEST(FrustumMatchesLinearTest);
+	RUN_TEST(QueriesMatchBruteForceAfterUpdates);
+	RUN_TEST(BenchmarkQueriesMatch);
+	return TEST_RESULT();
+}
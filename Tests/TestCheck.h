@@ -0,0 +1,19 @@
+#ifndef TESTCHECK_H
+#define TESTCHECK_H
+
+#include <stdio.h>
+
+// Each test program is one translation unit, so its failure count can live here.
+static int testFailures = 0;
+
+//Reports a condition that does not hold and carries on, so one run lists every failure.
+#define CHECK(condition) ((condition) ? (void)0 : \
+	(void)(fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #condition), testFailures++))
+
+//Runs one test function, naming it in the output.
+#define RUN_TEST(test) (printf("%s\n", #test), test())
+
+//What a test program's main returns: 0 when every check held.
+#define TEST_RESULT() (printf(testFailures ? "%d checks failed\n" : "All checks passed\n", testFailures), testFailures ? 1 : 0)
+
+#endif // !TESTCHECK_H
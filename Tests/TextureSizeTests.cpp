@@ -0,0 +1,50 @@
+#include "TextureSize.h"
+#include "TestCheck.h"
+
+/*
+Block compressed levels take 8 or 16 bytes for each 4x4 block, rounding up to
+whole blocks, and the two channel normal map format is sized like BC3.
+*/
+static void BlockFormatsCountBlocks() {
+	CHECK(LevelBytes(D3DFMT_DXT1, 256, 256) == 64 * 64 * 8);
+	CHECK(LevelBytes(D3DFMT_DXT5, 256, 256) == 64 * 64 * 16);
+	CHECK(LevelBytes((D3DFORMAT)TEXTURE_FOURCC_ATI2, 256, 256) == 64 * 64 * 16);
+	CHECK(LevelBytes((D3DFORMAT)TEXTURE_FOURCC_ATI2, 256, 128) == LevelBytes(D3DFMT_DXT5, 256, 128));
+
+	// A level smaller than a block, or not a multiple of one, still takes whole blocks
+	CHECK(LevelBytes(D3DFMT_DXT1, 1, 1) == 8);
+	CHECK(LevelBytes((D3DFORMAT)TEXTURE_FOURCC_ATI2, 2, 2) == 16);
+	CHECK(LevelBytes(D3DFMT_DXT3, 6, 5) == 2 * 2 * 16);
+}
+
+/*
+Uncompressed levels take their texel size for every texel.
+*/
+static void UncompressedFormatsCountTexels() {
+	CHECK(LevelBytes(D3DFMT_A8R8G8B8, 256, 256) == 256 * 256 * 4);
+	CHECK(LevelBytes(D3DFMT_X8R8G8B8, 3, 5) == 3 * 5 * 4);
+	CHECK(LevelBytes(D3DFMT_R5G6B5, 64, 32) == 64 * 32 * 2);
+	CHECK(LevelBytes(D3DFMT_L16, 1, 1) == 2);
+	CHECK(LevelBytes(D3DFMT_A16B16G16R16F, 16, 16) == 16 * 16 * 8);
+}
+
+/*
+A full mip chain of a BC5 normal map is a quarter of the same chain held as
+32-bit texels, down to the levels smaller than a block.
+*/
+static void NormalMapChainIsAQuarter() {
+	DWORD compressed = 0, uncompressed = 0;
+
+	for (DWORD size = 1024; size >= 4; size /= 2) {
+		compressed += LevelBytes((D3DFORMAT)TEXTURE_FOURCC_ATI2, size, size);
+		uncompressed += LevelBytes(D3DFMT_A8R8G8B8, size, size);
+	}
+	CHECK(compressed * 4 == uncompressed);
+}
+
+int main() {
+	RUN_TEST(BlockFormatsCountBlocks);
+	RUN_TEST(UncompressedFormatsCountTexels);
+	RUN_TEST(NormalMapChainIsAQuarter);
+	return TEST_RESULT();
+}